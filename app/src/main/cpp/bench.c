@@ -0,0 +1,318 @@
+/*
+ * Benchmarks of the blockchain code, to compare commits on the same machine.
+ *
+ * usage: btco-bench [-q] [-t threads] [-o file]
+ * - hashing throughput per data size, mining hashrate per difficulty, header version and SHA256 kernel,
+ *   chain build and verify rates
+ * - the header timestamps come from a fixed clock, so every run mines the same nonces: they are
+ *   checked against golden ones, on every kernel, to catch a change that breaks mining while
+ *   making it faster
+ * - the results go out as JSON, on stdout by default
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+
+#include "sha-256.h"
+#include "sha-256-lanes.h"
+#include "blockchain.h"
+#include "chain.h"
+#include "chain-store.h"
+#include "logger.h"
+#include "metrics.h"
+#include "miner.h"
+#include "scheduler.h"
+#include "verify.h"
+
+// the timestamp of every first round, from the fixed clock
+#define BENCH_EPOCH 1231006505u
+
+// blocks mined per difficulty (and per kernel), the golden nonces are of these
+#define MINE_BLOCKS 8
+
+// highest difficulty benchmarked, quick runs stop one lower
+#define MAX_DIFFICULTY 5
+
+// blocks of the chain build and verify benchmarks, at difficulty 1
+#define CHAIN_BLOCKS 2000
+
+// the nonces of the MINE_BLOCKS blocks mined at each difficulty from 1, per header version (SHA256
+// then SHA256d), see mineBlocks
+// NOTE they only change with the header layout, the hash or the difficulty targets: a change that
+//      does not mean to change those must keep them
+static const uint32_t GOLDEN_NONCES[2][MAX_DIFFICULTY][MINE_BLOCKS] = {
+        {
+                { 250, 61, 1127, 62, 664, 44, 27, 671 },
+                { 8244, 5750, 1128, 12311, 7362, 4270, 1053, 4474 },
+                { 29193, 47276, 8288, 10882, 143775, 61921, 181959, 27310 },
+                { 43198, 8638, 33373, 160324, 79002, 279825, 18474, 54065 },
+                { 4612636, 623811, 1427566, 240718, 1517878, 435082, 281484, 2385957 },
+        },
+        {
+                { 472, 90, 95, 393, 158, 16, 249, 303 },
+                { 2029, 1244, 1317, 4064, 1186, 5970, 11066, 3848 },
+                { 23769, 66781, 86796, 69930, 75465, 40246, 16297, 157470 },
+                { 123759, 77676, 39826, 45485, 27846, 57011, 24808, 46599 },
+                { 1951852, 599190, 837457, 744051, 1118525, 1697683, 325317, 375592 },
+        },
+};
+
+/**
+ * Options of a run, set from the command line.
+ */
+typedef struct {
+    int quick;       // fewer and shorter runs, e.g. for a quick check before a commit
+    int threads;     // threads of the pool benchmarks, 0 for one per core
+    int noPin;       // leave the pool threads unpinned, to compare with pinning them
+    const char* out; // where to write the JSON, NULL for stdout
+} BenchOptions;
+
+/**
+ * The JSON results being written.
+ */
+typedef struct {
+    FILE* f;
+    int results;     // results written so far
+    int goldenFails; // mined nonces that were not the golden ones
+} BenchReport;
+
+static uint32_t fixedClock(void* ctx) {
+    (void)ctx;
+    return BENCH_EPOCH;
+}
+
+/**
+ * Write a result.
+ * @param name what was measured
+ * @param param what it was measured with (e.g. the kernel), may be NULL
+ * @param size the size of the work (e.g. bytes of data, difficulty), 0 for none
+ * @param value the measure
+ * @param unit the unit of value
+ */
+static void result(BenchReport* report, const char* name, const char* param, const uint64_t size,
+                   const double value, const char* unit) {
+    fprintf(report->f, "%s\n    {\"name\": \"%s\"", report->results++ ? "," : "", name);
+    if (param)
+        fprintf(report->f, ", \"param\": \"%s\"", param);
+    if (size)
+        fprintf(report->f, ", \"size\": %llu", (unsigned long long)size);
+    fprintf(report->f, ", \"value\": %.6g, \"unit\": \"%s\"}", value, unit);
+}
+
+/**
+ * calc_sha_256 throughput, for a few sizes of data from a header to a big file.
+ */
+static void benchHashing(BenchReport* report, const BenchOptions* opts) {
+    static const size_t SIZES[] = { 64, 1024, 64 << 10, 1 << 20 };
+    const uint64_t total = opts->quick ? (16u << 20) : (256u << 20);
+    uint8_t* data = malloc(1 << 20);
+    if (!data)
+        return;
+    for (size_t i = 0; i < (1 << 20); ++i)
+        data[i] = (uint8_t)(i * 131);
+
+    for (size_t s = 0; s < sizeof(SIZES) / sizeof(SIZES[0]); ++s) {
+        uint8_t hash[SIZE_OF_SHA_256_HASH];
+        const uint64_t calls = total / SIZES[s];
+        const uint64_t start = metricsNowNs();
+        for (uint64_t i = 0; i < calls; ++i)
+            calc_sha_256(hash, data, SIZES[s]);
+        const double seconds = (double)(metricsNowNs() - start) / 1e9;
+        result(report, "sha256", sha_256_backend_name(), SIZES[s],
+               (double)(calls * SIZES[s]) / seconds / 1e6, "MB/s");
+    }
+    free(data);
+}
+
+/**
+ * Mine MINE_BLOCKS blocks in a chain at a difficulty, and check their nonces.
+ * - on one thread the hashes are those up to the nonces found (the kernel hashes its lanes all at
+ *   once), on the pool they are counted, since other threads hash past the winning nonce
+ * @param version the HEADER_VERSION_* of the blocks
+ * @return the hashes per second
+ */
+static double mineBlocks(BenchReport* report, const uint32_t version, const int difficulty,
+                         const int threads, const char* kernel) {
+    Chain chain;
+    chainInit(&chain);
+    setHeaderVersion(version);
+    MetricsSnapshot before, after;
+    metricsSnapshot(&before);
+    const uint64_t lanes = (uint64_t)sha_256_lanes()->lanes;
+    uint64_t attempts = 0;
+    const uint64_t start = metricsNowNs();
+    for (int i = 0; i < MINE_BLOCKS; ++i) {
+        char data[32];
+        const int length = snprintf(data, sizeof(data), "bench block %d", i);
+        const ChainBlock* block = chainMine(&chain, data, (uint64_t)length, difficulty, threads,
+                                            NULL);
+        if (!block) {
+            perror("chainMine");
+            break;
+        }
+        attempts += ((uint64_t)block->header.nonce + lanes) / lanes * lanes;
+        const uint32_t golden = GOLDEN_NONCES[version - 1][difficulty - 1][i];
+        if (block->header.nonce != golden && report->goldenFails++ == 0)
+            fprintf(stderr, "version %u difficulty %d block %d on %s: nonce %u, golden %u\n",
+                    version, difficulty, i, kernel, block->header.nonce, golden);
+    }
+    const double seconds = (double)(metricsNowNs() - start) / 1e9;
+    metricsSnapshot(&after);
+    chainFree(&chain);
+    setHeaderVersion(HEADER_VERSION_SHA256);
+    if (threads != 1)
+        return (double)(after.total.hashes - before.total.hashes) / seconds;
+    // the rounds (timestamps) with no valid nonce were searched in full
+    attempts += (after.total.rollovers - before.total.rollovers) << 32;
+    return (double)attempts / seconds;
+}
+
+/**
+ * Mining hashrate per difficulty and header version on every kernel the CPU supports, then on the
+ * pool.
+ */
+static void benchMining(BenchReport* report, const BenchOptions* opts) {
+    const struct Sha_256_lanes* kernels[8];
+    const int count = sha_256_lanes_available(kernels, 8);
+    const int maxDifficulty = opts->quick ? MAX_DIFFICULTY - 1 : MAX_DIFFICULTY;
+
+    for (int k = 0; k < count; ++k) {
+        sha_256_lanes_use(kernels[k]);
+        for (int d = 1; d <= maxDifficulty; ++d) {
+            result(report, "mine", kernels[k]->name, (uint64_t)d,
+                   mineBlocks(report, HEADER_VERSION_SHA256, d, 1, kernels[k]->name) / 1e6, "MH/s");
+            result(report, "mine-sha256d", kernels[k]->name, (uint64_t)d,
+                   mineBlocks(report, HEADER_VERSION_SHA256D, d, 1, kernels[k]->name) / 1e6,
+                   "MH/s");
+        }
+    }
+    sha_256_lanes_use(NULL);
+
+    // the same nonces again, but found on all the pool threads
+    result(report, "mine-pool", kernels[0]->name, (uint64_t)maxDifficulty,
+           mineBlocks(report, HEADER_VERSION_SHA256, maxDifficulty,
+                      opts->threads == 1 ? 2 : opts->threads, kernels[0]->name) / 1e6, "MH/s");
+}
+
+/**
+ * Chain build rate at difficulty 1 (i.e., mostly everything but mining), then store and verify rates.
+ */
+static void benchChain(BenchReport* report, const BenchOptions* opts) {
+    const int blocks = opts->quick ? CHAIN_BLOCKS / 4 : CHAIN_BLOCKS;
+    Chain chain;
+    chainInit(&chain);
+    uint64_t start = metricsNowNs();
+    for (int i = 0; i < blocks; ++i) {
+        char data[32];
+        const int length = snprintf(data, sizeof(data), "bench block %d", i);
+        if (!chainMine(&chain, data, (uint64_t)length, 1, 1, NULL)) {
+            perror("chainMine");
+            chainFree(&chain);
+            return;
+        }
+    }
+    result(report, "chain-build", NULL, (uint64_t)blocks,
+           blocks / ((double)(metricsNowNs() - start) / 1e9), "blocks/s");
+
+    char path[] = "/tmp/btco-bench-XXXXXX";
+    const int fd = mkstemp(path);
+    if (fd < 0) {
+        perror(path);
+        chainFree(&chain);
+        return;
+    }
+    close(fd);
+
+    start = metricsNowNs();
+    ChainStore* store = chainStoreOpen(path, 0);
+    if (!store || chainExport(&chain, store) != 0 || chainStoreClose(store) != 0) {
+        perror(path);
+    } else {
+        result(report, "chain-store", NULL, (uint64_t)blocks,
+               blocks / ((double)(metricsNowNs() - start) / 1e9), "blocks/s");
+
+        store = chainStoreOpen(path, CHAIN_STORE_READONLY);
+        if (store) {
+            start = metricsNowNs();
+            ChainFault fault;
+            const int64_t invalid = chainVerify(store, 1, CHAIN_VERIFY_PAYLOADS, opts->threads,
+                                                &fault);
+            const double seconds = (double)(metricsNowNs() - start) / 1e9;
+            if (invalid >= 0)
+                fprintf(stderr, "%s: block %lld: %s\n", path, (long long)invalid,
+                        chainFaultName(fault));
+            else
+                result(report, "chain-verify", NULL, (uint64_t)blocks, blocks / seconds,
+                       "blocks/s");
+            chainStoreClose(store);
+        }
+    }
+
+    // the store is 3 files
+    char other[sizeof(path) + 4];
+    unlink(path);
+    snprintf(other, sizeof(other), "%s.dat", path);
+    unlink(other);
+    snprintf(other, sizeof(other), "%s.idx", path);
+    unlink(other);
+    chainFree(&chain);
+}
+
+static void printUsage(FILE* f, const char* prog) {
+    fprintf(f,
+            "usage: %s [-q] [-P] [-t threads] [-o file]\n"
+            "  -q             quick run, fewer and smaller benchmarks\n"
+            "  -P             do not pin the pool threads to CPUs\n"
+            "  -t threads     threads of the pool benchmarks, 0 for one per core (default 0)\n"
+            "  -o file        write the JSON results to a file (default: stdout)\n",
+            prog);
+}
+
+int main(int argc, char* argv[]) {
+    BenchOptions opts = { 0, 0, 0, NULL };
+    int opt;
+    while ((opt = getopt(argc, argv, "qPt:o:h")) != -1) {
+        switch (opt) {
+            case 'q': opts.quick = 1; break;
+            case 'P': opts.noPin = 1; break;
+            case 't': opts.threads = atoi(optarg); break;
+            case 'o': opts.out = optarg; break;
+            case 'h': printUsage(stdout, argv[0]); return EXIT_SUCCESS;
+            default: printUsage(stderr, argv[0]); return EXIT_FAILURE;
+        }
+    }
+
+    BenchReport report = { opts.out ? fopen(opts.out, "w") : stdout, 0, 0 };
+    if (!report.f) {
+        perror(opts.out);
+        return EXIT_FAILURE;
+    }
+    // the mining lines of the log would only slow the benchmarks down
+    setLogSink(NULL);
+    setMiningClock(fixedClock, NULL);
+    schedConfigure(opts.threads);
+    schedConfigurePinning(!opts.noPin);
+
+    fprintf(report.f, "{\n  \"quick\": %s,\n  \"cores\": %d,\n  \"poolThreads\": %d,\n"
+                      "  \"poolCpus\": [", opts.quick ? "true" : "false", minerThreadCount(0),
+            schedThreadCount());
+    // the CPU of each pool thread, -1 for one that is not pinned
+    for (int i = 0; i < schedThreadCount(); ++i)
+        fprintf(report.f, "%s%d", i ? ", " : "", schedWorkerCpu(i));
+    fprintf(report.f, "],\n  \"sha256Backend\": \"%s\",\n  \"miningKernel\": \"%s\",\n"
+                      "  \"results\": [", sha_256_backend_name(), sha_256_lanes()->name);
+    benchHashing(&report, &opts);
+    benchMining(&report, &opts);
+    benchChain(&report, &opts);
+    fprintf(report.f, "\n  ],\n  \"golden\": %s\n}\n", report.goldenFails ? "false" : "true");
+
+    if (report.f != stdout && fclose(report.f) != 0) {
+        perror(opts.out);
+        return EXIT_FAILURE;
+    }
+    return report.goldenFails ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -15,15 +15,25 @@
 #include <time.h>
 #include <memory.h>
 #include <assert.h>
-#include <android/log.h>
+#include <errno.h>
 
 #include "sha-256.h"
+#include "sha-256-lanes.h"
 #include "blockchain.h"
-
-#define LINE_MAX 4096 // max chars for console input
+#include "hex.h"
+#include "miner.h"
+#include "coordinator.h"
+#include "logger.h"
+#include "payload.h"
 
 static const char* TAG = "MIN3NATIV3";
 
+// the version of the headers of new blocks
+static uint32_t headerVersion = HEADER_VERSION_SHA256;
+
+// headers serialized at a time by hashHeaders
+#define HASH_HEADERS_GROUP 64
+
 /**
  * Make a C-style string in the 2-char hex format, from an array of bytes.
  * - Print each byte stored in the bytes array into a hex number
@@ -37,49 +47,28 @@ static const char* TAG = "MIN3NATIV3";
  * @param bytesSize - the length of the bytes array
  */
 void makeCStringFromBytes(const uint8_t* bytes, char* output, const size_t bytesSize) {
+    hexEncode(bytes, bytesSize, output);
     // add C string terminator in the last slot
     output[2*bytesSize] = '\0';
-    for (int i=0; i<bytesSize; i++)
-        // "print" byte hex values into buffer
-        sprintf(output+i*2, "%02x", bytes[i]);
-}
-
-/**
- * Convert a char (in a human-readable string) to a hex char.
- * @param c is the char
- * @return the hex char
- */
-unsigned char hexChar(char c)
-{
-    if ('0' <= c && c <= '9') return (unsigned char)(c - '0');
-    if ('A' <= c && c <= 'F') return (unsigned char)(c - 'A' + 10);
-    if ('a' <= c && c <= 'f') return (unsigned char)(c - 'a' + 10);
-    return 0xFF;
 }
 
 /**
  * Convert a C-style string to a bytes array.
- * [code adapted from
- * https://stackoverflow.com/questions/18267803/how-to-correctly-convert-a-hex-string-to-byte-array-in-c]
+ * - stops at the end of the string, at the end of the bytes array or before the first pair of
+ *   chars that is not hex, whichever comes first; use hexDecode to know which
  * @param cstring - the C-styled string of 2-char hex numbers
  * @param output - C array of 8-bit bytes
  * @param length - length of the bytes array
  */
 void makeBytesFromCString(const char* cstring, uint8_t* output, const size_t length) {
-    int result;
     if (!cstring || !output || length <= 0) return;
 
-    size_t i = length;
-    for (result = 0; *cstring; ++result) {
-        unsigned char msn = hexChar(*cstring++);
-        if (msn == 0xFF) return;
-        unsigned char lsn = hexChar(*cstring++);
-        if (lsn == 0xFF) return;
-        unsigned char bin = (msn << 4) + lsn;
-
-        if (i-- <= 0) return;
-        *output++ = bin;
-    }
+    // a last odd char is not a byte
+    size_t chars = strnlen(cstring, 2 * length);
+    chars -= chars % 2;
+    size_t bad;
+    if (hexDecode(cstring, chars, output, &bad) != 0)
+        hexDecode(cstring, bad - bad % 2, output, NULL);
 }
 
 /**
@@ -89,40 +78,125 @@ void makeBytesFromCString(const char* cstring, uint8_t* output, const size_t len
  * @param hash is the ptr to the hash value in mem
  */
 void fprintHash(FILE* f, const uint8_t* hash) {
-    fprintf(f, "0x");
-    for (int i = 0; i < HASH_LEN; ++i)
-        fprintf(f, "%02x", hash[i]);
+    char hex[2 + HASH_LEN * 2];
+    memcpy(hex, "0x", 2);
+    hexEncode(hash, HASH_LEN, hex + 2);
+    fwrite(hex, 1, sizeof(hex), f);
 }
 
 /**
- * Debug the hash in Android console, prints each hex digit on a newline.
+ * Debug the hash in the log (Android console), as one line of hex.
  * - this is a logging util func mainly for debugging
  * @param hash is the ptr to the hash value in mem
  */
 void logHash(const uint8_t* hash) {
-    for (int i = 0; i < HASH_LEN; ++i)
-        __android_log_print(
-                ANDROID_LOG_INFO, TAG,
-                "logHash %02x",
-                hash[i]
-                );
+    logHashes(LOG_LEVEL_INFO, TAG, "logHash ", &hash, 1);
+}
+
+static void storeLe32(uint8_t* p, uint32_t v) {
+    for (int i = 0; i < 4; ++i)
+        p[i] = (uint8_t)(v >> (8 * i));
+}
+
+static uint32_t loadLe32(const uint8_t* p) {
+    uint32_t v = 0;
+    for (int i = 3; i >= 0; --i)
+        v = v << 8 | p[i];
+    return v;
 }
 
 /**
- * Mine a block to add to the chain. The gist of the algo is:
- * - repeatedly get a SHA256 hash from the header (by changing the nonce and timestamp)
- *   until hash is < targetHash (or more leading zeros than targetHash)
- * - network difficulty is governed by how many possible combinations you allow by specifying a
- *   targetHash as the upper bound
- * NOTE that this is a mining task that may take a long time.
- *      - the higher the difficulty the (exponentially) longer it becomes.
- * @param header the header of the block initialized somewhere else.
+ * Write a header as the bytes that are hashed and stored, the same on every platform.
+ * - version, previousHeaderHash, dataHash, timestamp, bits, dataLength, nonce (see
+ *   HEADER_*_OFFSET): the BTC order, with dataHash as the merkle root, and dataLength on top
+ * - the numbers are little-endian, whatever the endianness of the host
+ * @param header the header
+ * @param bytes the output HEADER_SIZE bytes
+ */
+void serializeHeader(const BlockHeader* header, uint8_t bytes[HEADER_SIZE]) {
+    storeLe32(bytes + HEADER_VERSION_OFFSET, header->version);
+    memcpy(bytes + HEADER_PREV_HASH_OFFSET, header->previousHeaderHash, HASH_LEN);
+    memcpy(bytes + HEADER_DATA_HASH_OFFSET, header->dataHash, HASH_LEN);
+    storeLe32(bytes + HEADER_TIMESTAMP_OFFSET, header->timestamp);
+    storeLe32(bytes + HEADER_BITS_OFFSET, header->bits);
+    storeLe32(bytes + HEADER_DATA_LENGTH_OFFSET, header->dataLength);
+    storeLe32(bytes + HEADER_NONCE_OFFSET, header->nonce);
+}
+
+/**
+ * Read a header written by serializeHeader.
+ * @param bytes the HEADER_SIZE bytes
+ * @param header the output header
+ */
+void deserializeHeader(const uint8_t bytes[HEADER_SIZE], BlockHeader* header) {
+    header->version = loadLe32(bytes + HEADER_VERSION_OFFSET);
+    memcpy(header->previousHeaderHash, bytes + HEADER_PREV_HASH_OFFSET, HASH_LEN);
+    memcpy(header->dataHash, bytes + HEADER_DATA_HASH_OFFSET, HASH_LEN);
+    header->timestamp = loadLe32(bytes + HEADER_TIMESTAMP_OFFSET);
+    header->bits = loadLe32(bytes + HEADER_BITS_OFFSET);
+    header->dataLength = loadLe32(bytes + HEADER_DATA_LENGTH_OFFSET);
+    header->nonce = loadLe32(bytes + HEADER_NONCE_OFFSET);
+}
+
+/**
+ * Get the hash of a header, the way its version says.
+ * @param header the header
+ * @param hash the output hash
+ */
+void hashHeader(const BlockHeader* header, uint8_t hash[HASH_LEN]) {
+    uint8_t bytes[HEADER_SIZE];
+    serializeHeader(header, bytes);
+    calc_sha_256(hash, bytes, sizeof(bytes));
+    if (header->version == HEADER_VERSION_SHA256D) {
+        uint8_t first[HASH_LEN];
+        memcpy(first, hash, HASH_LEN);
+        calc_sha_256(hash, first, HASH_LEN);
+    }
+}
+
+/**
+ * Get the hashes of many headers like hashHeader, several at a time on the multi-lane kernel.
+ * @param headers the headers
+ * @param count number of headers
+ * @param hashes the output hashes, one per header
+ */
+void hashHeaders(const BlockHeader* headers, const size_t count, uint8_t (*hashes)[HASH_LEN]) {
+    uint8_t bytes[HASH_HEADERS_GROUP][HEADER_SIZE];
+    uint8_t second[HASH_HEADERS_GROUP][HASH_LEN];
+    for (size_t first = 0; first < count; first += HASH_HEADERS_GROUP) {
+        const size_t n = count - first < HASH_HEADERS_GROUP ? count - first : HASH_HEADERS_GROUP;
+        int doubles = 0;
+        for (size_t i = 0; i < n; ++i) {
+            serializeHeader(&headers[first + i], bytes[i]);
+            doubles |= headers[first + i].version == HEADER_VERSION_SHA256D;
+        }
+        sha_256_many(hashes[first], bytes[0], HEADER_SIZE, HEADER_SIZE, n);
+        if (!doubles)
+            continue;
+        sha_256_many(second[0], hashes[first], HASH_LEN, HASH_LEN, n);
+        for (size_t i = 0; i < n; ++i)
+            if (headers[first + i].version == HEADER_VERSION_SHA256D)
+                memcpy(hashes[first + i], second[i], HASH_LEN);
+    }
+}
+
+/**
+ * Set the version of the headers of the blocks mined from now on, i.e., how they are hashed.
+ * - each header keeps its own version, so a chain can go on in another one
+ * @param version HEADER_VERSION_SHA256 (the default) or HEADER_VERSION_SHA256D
+ */
+void setHeaderVersion(const uint32_t version) {
+    headerVersion = version;
+}
+
+/**
+ * Make the target hash for a network difficulty.
+ * - the network difficulty is governed by how many leading zeros the targetHash has
  * @param difficulty of the mining task, expressed as a number from 1..10
+ * @param targetHash the output 32-byte target, a header hash must be < this to be valid
  */
-void mine(BlockHeader* header, const int difficulty) {
-    // change the difficulty by manipulating the leading zeros of the targetHash
-    uint8_t targetHash[HASH_LEN]; // create targetHash array of bytes
-    memset(targetHash, 0, sizeof(targetHash)); // init to all 0s
+void makeTargetHash(const int difficulty, uint8_t* targetHash) {
+    memset(targetHash, 0, HASH_LEN); // init to all 0s
     switch (difficulty) {
         case 2:
             targetHash[1] = 0x0F;
@@ -154,32 +228,176 @@ void mine(BlockHeader* header, const int difficulty) {
         default:
             targetHash[1] = 0xFF;
     }
+}
 
-    // Perform mining
-    while (1) {
-        // record the starttime of this mining round that may potentially get the correct hash
-        header->timestamp = (uint64_t)time(NULL);
-
-        // iteratively find the nonce that results in a header hash that is < the targetHash hash
-        uint8_t currHeaderHash[HASH_LEN];
-        for (uint32_t i = 0; i < UINT32_MAX; ++i)
-        {
-            // record the nonce that may potentially get a valid hash
-            header->nonce = i;
-
-            // hash the header that has the new nonce
-            calc_sha_256(currHeaderHash, header, sizeof(BlockHeader));
-
-            // return when the correct hash found
-            if (memcmp(currHeaderHash, targetHash, sizeof(currHeaderHash)) < 0)
-                return;
+/**
+ * Get the compact target bits of a network difficulty, i.e., of makeTargetHash(difficulty).
+ * @param difficulty of the mining task, expressed as a number from 1..10
+ * @return the bits
+ */
+uint32_t difficultyBits(const int difficulty) {
+    uint8_t targetHash[HASH_LEN];
+    makeTargetHash(difficulty, targetHash);
+    return targetToBits(targetHash);
+}
+
+/**
+ * Expand compact target bits (see BlockHeader.bits) into a target hash.
+ * @param bits the compact target
+ * @param targetHash the output 32-byte target, a header hash must be < this to be valid
+ * @return 0 on success, -1 with errno EINVAL if the bits are no target (0, negative, > 256 bits)
+ */
+int bitsToTarget(const uint32_t bits, uint8_t targetHash[HASH_LEN]) {
+    const int size = (int)(bits >> 24);
+    const uint32_t mantissa = bits & 0x7fffff;
+    memset(targetHash, 0, HASH_LEN);
+    if (mantissa == 0 || (bits & 0x800000)) {
+        errno = EINVAL;
+        return -1;
+    }
+    // the 3 bytes of the mantissa, from its top one, at HASH_LEN - size onwards
+    for (int i = 0; i < 3; ++i) {
+        const uint8_t byte = (uint8_t)(mantissa >> (8 * (2 - i)));
+        const int at = HASH_LEN - size + i;
+        if (at >= HASH_LEN)
+            break;
+        if (at < 0) {
+            if (byte) {
+                errno = EINVAL;
+                return -1;
+            }
+            continue;
         }
-        // when all uint32 exhausted without a valid hash, go for the next round with to find the
-        // right time + nonce combo that may result in a valid hash
+        targetHash[at] = byte;
+    }
+    return 0;
+}
+
+/**
+ * Get the compact target bits of a target hash, as BTC does: the target rounded down to its top
+ * 3 bytes (2 when the top one has its top bit set, which is the sign in BTC).
+ * @param targetHash the 32-byte target, not 0
+ * @return the bits
+ */
+uint32_t targetToBits(const uint8_t targetHash[HASH_LEN]) {
+    int first = 0;
+    while (first < HASH_LEN - 1 && targetHash[first] == 0)
+        ++first;
+    uint32_t size = (uint32_t)(HASH_LEN - first);
+    uint32_t mantissa = 0;
+    for (int i = first; i < first + 3; ++i)
+        mantissa = mantissa << 8 | (i < HASH_LEN ? targetHash[i] : 0);
+    if (mantissa & 0x800000) {
+        mantissa >>= 8;
+        ++size;
     }
+    return size << 24 | mantissa;
+}
+
+/**
+ * Get the target of compact bits as a number, e.g. to average or scale targets.
+ * @param bits the compact target
+ * @return the target, as precise as the bits are
+ */
+double bitsToTargetValue(const uint32_t bits) {
+    double target = (double)(bits & 0x7fffff);
+    for (int size = (int)(bits >> 24); size > 3; --size)
+        target *= 256;
+    for (int size = (int)(bits >> 24); size < 3; ++size)
+        target /= 256;
+    return target;
+}
+
+/**
+ * Get the compact bits of a target number, clamped to 1..the target of MAX_TARGET_BITS.
+ * @param target the target
+ * @return the bits, the target rounded down to them
+ */
+uint32_t targetValueToBits(double target) {
+    if (!(target < bitsToTargetValue(MAX_TARGET_BITS)))
+        return MAX_TARGET_BITS;
+    if (target < 1)
+        target = 1;
+    uint32_t size = 3;
+    while (target >= 0x800000) {
+        target /= 256;
+        ++size;
+    }
+    return size << 24 | (uint32_t)target;
+}
+
+/**
+ * Get how much harder than difficulty 1 compact bits are, e.g. to show a retargeted difficulty.
+ * @param bits the compact target
+ * @return the difficulty, as in BTC: the target of difficulty 1 / the target of the bits
+ */
+double bitsDifficulty(const uint32_t bits) {
+    return bitsToTargetValue(difficultyBits(1)) / bitsToTargetValue(bits);
+}
+
+/**
+ * Mine a block to add to the chain. The gist of the algo is:
+ * - repeatedly get a SHA256 hash from the header (by changing the nonce and timestamp)
+ *   until hash is < targetHash (or more leading zeros than targetHash)
+ * - network difficulty is governed by how many possible combinations you allow by specifying a
+ *   targetHash as the upper bound
+ * NOTE that this is a mining task that may take a long time.
+ *      - the higher the difficulty the (exponentially) longer it becomes.
+ * @param header the header of the block initialized somewhere else.
+ * @param difficulty of the mining task, expressed as a number from 1..10
+ */
+void mine(BlockHeader* header, const int difficulty) {
+    mineWithThreads(header, difficulty, 1);
+}
+
+/**
+ * Mine a block like mine(...), with the nonce search split across several threads.
+ * - gives the same nonce as mine(...) for the same timestamp, just sooner on a multi-core device
+ * @param header the header of the block initialized somewhere else.
+ * @param difficulty of the mining task, expressed as a number from 1..10
+ * @param threads number of mining threads, MINER_AUTO_THREADS for one per core
+ */
+void mineWithThreads(BlockHeader* header, const int difficulty, const int threads) {
+    mineWithHash(header, difficulty, threads, NULL, NULL);
+}
+
+/**
+ * Mine a block like mineWithThreads(...), also getting the hash of the mined header.
+ * - the miner computes that hash anyway, keep it rather than hashing the header again later on
+ * @param header the header of the block initialized somewhere else.
+ * @param difficulty of the mining task, expressed as a number from 1..10
+ * @param threads number of mining threads, MINER_AUTO_THREADS for one per core
+ * @param hash the output hash of the mined header, may be NULL
+ * @param control to cancel mining and follow its progress, may be NULL
+ * @return 0 once mined, -1 with errno ECANCELED if cancelled through the control
+ */
+int mineWithHash(BlockHeader* header, const int difficulty, const int threads,
+                 uint8_t hash[HASH_LEN], struct MiningControl* control) {
+    // change the difficulty by manipulating the leading zeros of the targetHash
+    header->bits = difficultyBits(difficulty);
+    return mineHeader(header, threads, hash, control);
+}
 
-    // this code is never reached
-    assert(0);
+/**
+ * Mine a block like mineWithHash(...), to the target of its own bits rather than a difficulty.
+ * @param header the header of the block initialized somewhere else, bits included
+ * @param threads number of mining threads, MINER_AUTO_THREADS for one per core
+ * @param hash the output hash of the mined header, may be NULL
+ * @param control to cancel mining and follow its progress, or mine through a coordinator, may be NULL
+ * @return 0 once mined, -1 with errno ECANCELED if cancelled through the control, EINVAL if the
+ *         bits are no target
+ */
+int mineHeader(BlockHeader* header, const int threads, uint8_t hash[HASH_LEN],
+               struct MiningControl* control) {
+    uint8_t targetHash[HASH_LEN]; // create targetHash array of bytes
+    if (bitsToTarget(header->bits, targetHash) != 0)
+        return -1;
+
+    // Perform mining
+    // NOTE that this may take a LONG TIME
+    if (control && control->coordinator)
+        return coordinatorMine(control->coordinator, header, targetHash, hash, control);
+    return mineParallel(header, targetHash, threads, hash, control);
 }
 
 /**
@@ -196,98 +414,193 @@ BlockHeader addBlockWithPrevPtr(
         const uint64_t length,
         const int difficulty
         ) {
+    return addBlockWithPrevPtrThreads(prevHeader, data, length, difficulty, 1);
+}
+
+/**
+ * Construct a new block like addBlockWithPrevPtr(...), mining it with several threads.
+ * @param prevHeader ptr to the prevHeader header
+ * @param data ptr to the data that this block will be representing (null will mean Genesis)
+ * @param length of the data to read from the ptr
+ * @param difficulty of the mining task, expressed as a number from 1..10
+ * @param threads number of mining threads, MINER_AUTO_THREADS for one per core
+ * @return the constructed header for the new block
+ */
+BlockHeader addBlockWithPrevPtrThreads(
+        const BlockHeader* prevHeader,
+        const char* data,
+        const uint64_t length,
+        const int difficulty,
+        const int threads
+        ) {
+    // obtain the hash of the data and store it in this header
+    uint8_t dataHash[HASH_LEN];
+    calc_sha_256(dataHash, data, length);
+
+    return addBlockWithDataHash(prevHeader, dataHash, length, difficulty, threads);
+}
+
+/**
+ * Construct a new block from the hash of its data, i.e., without needing the data itself.
+ * NOTE that this func includes mining that may take a LONG TIME.
+ * @param prevHeader ptr to the prevHeader header (null will mean Genesis)
+ * @param dataHash the SHA256 hash of the data that this block will be representing
+ * @param length of the data
+ * @param difficulty of the mining task, expressed as a number from 1..10
+ * @param threads number of mining threads, MINER_AUTO_THREADS for one per core
+ * @return the constructed header for the new block
+ */
+BlockHeader addBlockWithDataHash(
+        const BlockHeader* prevHeader,
+        const uint8_t* dataHash,
+        const uint64_t length,
+        const int difficulty,
+        const int threads
+        ) {
+    // obtain the hash of the prevHeader header
+    uint8_t prevHash[HASH_LEN];
+    if (prevHeader)
+        hashHeader(prevHeader, prevHash);
+
     BlockHeader header;
+    addBlockWithPrevHash(prevHeader ? prevHash : NULL, dataHash, length, difficulty, threads,
+                         NULL, &header, NULL);
+    return header;
+}
+
+/**
+ * Construct a new block from the hash of the previous header, e.g. as kept by a Chain.
+ * NOTE that this func includes mining that may take a LONG TIME.
+ * @param prevHash the hash of the previous header (null will mean Genesis)
+ * @param dataHash the SHA256 hash of the data that this block will be representing
+ * @param length of the data
+ * @param difficulty of the mining task, expressed as a number from 1..10
+ * @param threads number of mining threads, MINER_AUTO_THREADS for one per core
+ * @param control to cancel mining and follow its progress, may be NULL
+ * @param headerOut the output header for the new block
+ * @param hash the output hash of the new header, may be NULL
+ * @return 0 on success, -1 with errno ECANCELED if cancelled through the control
+ */
+int addBlockWithPrevHash(
+        const uint8_t* prevHash,
+        const uint8_t* dataHash,
+        const uint64_t length,
+        const int difficulty,
+        const int threads,
+        struct MiningControl* control,
+        BlockHeader* headerOut,
+        uint8_t hash[HASH_LEN]
+        ) {
+    return addBlockWithBits(prevHash, dataHash, length, difficultyBits(difficulty), threads,
+                            control, headerOut, hash);
+}
+
+/**
+ * Construct a new block like addBlockWithPrevHash(...), mined to a target given as compact bits,
+ * e.g. as retargeted from the blocks before it.
+ * NOTE that this func includes mining that may take a LONG TIME.
+ * @param prevHash the hash of the previous header (null will mean Genesis)
+ * @param dataHash the SHA256 hash of the data that this block will be representing
+ * @param length of the data
+ * @param bits the target of the block, see BlockHeader.bits
+ * @param threads number of mining threads, MINER_AUTO_THREADS for one per core
+ * @param control to cancel mining and follow its progress, may be NULL
+ * @param headerOut the output header for the new block
+ * @param hash the output hash of the new header, may be NULL
+ * @return 0 on success, -1 with errno ECANCELED if cancelled through the control, EINVAL if the
+ *         bits are no target
+ */
+int addBlockWithBits(
+        const uint8_t* prevHash,
+        const uint8_t* dataHash,
+        const uint64_t length,
+        const uint32_t bits,
+        const int threads,
+        struct MiningControl* control,
+        BlockHeader* headerOut,
+        uint8_t hash[HASH_LEN]
+        ) {
+    BlockHeader header;
+    header.version = headerVersion;
+    header.bits = bits;
     header.dataLength = length;
-    char logStr[50];
+    memcpy(header.dataHash, dataHash, HASH_LEN);
+    const char* logPrefix;
 
-    // obtain the hash of the prevHeader header and store it in this header
-    if (prevHeader) {
-        calc_sha_256(header.previousHeaderHash, prevHeader, sizeof(BlockHeader));
-        strcpy(logStr, "addBlockWithPrevPtr:BLOCK:%s:%s");
+    // store the hash of the prevHeader header in this header
+    if (prevHash) {
+        memcpy(header.previousHeaderHash, prevHash, HASH_LEN);
+        logPrefix = "addBlockWithPrevPtr:BLOCK:";
     }
 
     // no prevHeader (null) means that this is the Genesis (first) block
     else {
         memset(header.previousHeaderHash, 0, sizeof(header.previousHeaderHash));
-        strcpy(logStr, "addBlockWithPrevPtr:GENESIS:%s:%s");
+        logPrefix = "addBlockWithPrevPtr:GENESIS:";
     }
 
-    // obtain the hash of the data and store it in this header
-    calc_sha_256(header.dataHash, data, length);
-
-    // DEBUG log
-    char dataHashStr[HASH_LEN * 2 + 1];
-    char prevHashStr[HASH_LEN * 2 + 1];
-    makeCStringFromBytes(header.dataHash, dataHashStr, HASH_LEN);
-    makeCStringFromBytes(header.previousHeaderHash, prevHashStr, HASH_LEN);
-    __android_log_print(
-            ANDROID_LOG_INFO, TAG,
-            logStr,
-            dataHashStr,
-            prevHashStr
-    );
+    // DEBUG log, the hashes are turned into hex by the logger's thread
+    const uint8_t* logged[] = { header.dataHash, header.previousHeaderHash };
+    logHashes(LOG_LEVEL_INFO, TAG, logPrefix, logged, 2);
 
     // perform the mining operation
     // NOTE that this may take a LONG TIME
-    mine(&header, difficulty);
+    if (mineHeader(&header, threads, hash, control) != 0)
+        return -1;
 
     // return the constructed header
-    return header;
+    *headerOut = header;
+    return 0;
+}
+
+/**
+ * Construct a new block with the data read from a file descriptor until its end.
+ * - the data is streamed (or memory-mapped) through the hash, it never needs to fit in RAM
+ * NOTE that this func includes mining that may take a LONG TIME.
+ * @param prevHeader ptr to the prevHeader header (null will mean Genesis)
+ * @param fd the file descriptor to read the data from, from its current position
+ * @param difficulty of the mining task, expressed as a number from 1..10
+ * @param threads number of mining threads, MINER_AUTO_THREADS for one per core
+ * @param header the output header for the new block
+ * @return 0 on success, -1 on error with errno set (EFBIG if the data is too long for dataLength)
+ */
+int addBlockWithPrevFd(const BlockHeader* prevHeader, const int fd, const int difficulty,
+                       const int threads, BlockHeader* header) {
+    uint8_t dataHash[HASH_LEN];
+    uint64_t length;
+    if (hashPayloadFd(fd, dataHash, &length) != 0)
+        return -1;
+    if (length > UINT32_MAX) {
+        errno = EFBIG;
+        return -1;
+    }
+
+    *header = addBlockWithDataHash(prevHeader, dataHash, length, difficulty, threads);
+    return 0;
 }
 
 /**
- * This is a function to let you test the functions independently as a compiled C executable.
- * NOTE that this function has not been tested for ages and so use it at your own discretion.
- *      however, there may be hints of C syntax for calling the various functions :)
- * NOTE if you are running this from command line you need to remove the android dependency
- *      `#include <android/log.h>`
- * @param argc - count of command line arguments
- * @param argv - array containing the command line arguments
- * @return standard C program exit code
+ * Construct a new block with the data pulled from a reader until it signals the end.
+ * NOTE that this func includes mining that may take a LONG TIME.
+ * @param prevHeader ptr to the prevHeader header (null will mean Genesis)
+ * @param reader the source of the data
+ * @param ctx passed to every reader call
+ * @param difficulty of the mining task, expressed as a number from 1..10
+ * @param threads number of mining threads, MINER_AUTO_THREADS for one per core
+ * @param header the output header for the new block
+ * @return 0 on success, -1 on error with errno set (EFBIG if the data is too long for dataLength)
  */
-int main(int argc, const char* argv[]) {
-    // set a fixed network difficulty
-    int difficulty = 3;
-
-    // create/open bin file to store the BTC blockchain
-    FILE* outFile = fopen("btchain.bin", "wb");
-
-    // create genesisHdr block
-    char genesisData[] = "The Times 03/Jan/2009 Chancellor on brink of second bailout for banks";
-    BlockHeader genesisHdr = addBlockWithPrevPtr(NULL, genesisData,
-                                                 sizeof(genesisData), difficulty);
-
-    // loop to generate subsequent blocks from text read from the console input
-    int blockNo = 0;
-    BlockHeader prevHdr = genesisHdr;
-    while (!feof(stdin))
-    {
-        // obtain hash of the prevHdr (solved) currHdr
-        uint8_t prevHdrHash[HASH_LEN];
-        calc_sha_256(prevHdrHash, &prevHdr, sizeof(BlockHeader));
-
-        // display the prevHdr nonce and the prev hashed currHdr
-        printf("adding block on the chain with nonce: %i and hash: ", prevHdr.nonce);
-        fprintHash(stdout, prevHdrHash);
-        printf("\n");
-
-        // persist prevHdr (solved) currHdr to blockchain file
-        fwrite(&prevHdr, sizeof(BlockHeader), 1, outFile);
-
-        // read data from the console into a buffer
-        char consoleInput[LINE_MAX];
-        fgets(consoleInput, LINE_MAX, stdin);
-
-        // create the current block with the data from the console
-        printf("creating block %i: ", blockNo);
-        printf("%s\n", consoleInput);
-        uint64_t size = strnlen(consoleInput, LINE_MAX) + 1; // NOTE the +1
-        BlockHeader currHdr = addBlockWithPrevPtr(&prevHdr, consoleInput, size, difficulty);
-
-        prevHdr = currHdr;
-        ++blockNo;
+int addBlockWithPrevReader(const BlockHeader* prevHeader, PayloadReader reader, void* ctx,
+                           const int difficulty, const int threads, BlockHeader* header) {
+    uint8_t dataHash[HASH_LEN];
+    uint64_t length;
+    if (hashPayloadReader(reader, ctx, dataHash, &length) != 0)
+        return -1;
+    if (length > UINT32_MAX) {
+        errno = EFBIG;
+        return -1;
     }
 
-    fclose(outFile);
-    return 1;
-}
\ No newline at end of file
+    *header = addBlockWithDataHash(prevHeader, dataHash, length, difficulty, threads);
+    return 0;
+}
@@ -1,15 +1,54 @@
 #ifndef ICT2105_QUIZ03_2022_SOLUTION_BLOCKCHAIN_H
 #define ICT2105_QUIZ03_2022_SOLUTION_BLOCKCHAIN_H
 
+#include <stdio.h>
+#include <stdint.h>
+
+#include "payload.h"
+
 #define HASH_LEN 32
 
+// bytes of a header as it is hashed and stored, see serializeHeader
+#define HEADER_SIZE 84
+
+// where the fields are in a serialized header, the numbers are little-endian
+// - the same order as a BTC header, so that only the timestamp and the nonce are in the last chunk
+#define HEADER_VERSION_OFFSET 0
+#define HEADER_PREV_HASH_OFFSET 4
+#define HEADER_DATA_HASH_OFFSET 36
+#define HEADER_TIMESTAMP_OFFSET 68
+#define HEADER_BITS_OFFSET 72
+#define HEADER_DATA_LENGTH_OFFSET 76
+#define HEADER_NONCE_OFFSET 80
+
+// versions of the header, i.e., how it is hashed
+#define HEADER_VERSION_SHA256 1  // SHA256 of the serialized header
+#define HEADER_VERSION_SHA256D 2 // SHA256 of the SHA256 of the serialized header, as in BTC
+
+// the easiest target compact bits can give (~2^255), as in the BTC regtest
+#define MAX_TARGET_BITS 0x207fffff
+
+struct MiningControl; // see miner.h
+
 /**
  * The block header.
  */
 typedef struct {
+    // how the header is hashed, a HEADER_VERSION_*
+    // NOTE: useless knowledge below for the quiz but cool nevertheless :)
+    //       - BTC headers start with a version too, it tells which rules the block follows
+    uint32_t version;
+
     // record the starttime when this block was mined
     uint32_t timestamp;
 
+    // the target the hash of this header is below, in the compact form of BTC's nBits:
+    // - the top byte is a number of bytes n, the other 3 the (big-endian) top bytes of the target,
+    //   i.e., target = (bits & 0x7fffff) * 256^(n - 3)
+    // - finer than the 1..10 difficulties (see difficultyBits), so that it can follow a block
+    //   interval (see retarget.h), and part of the header, so that every block has its own
+    uint32_t bits;
+
     // length of the data in the block
     uint32_t dataLength;
 
@@ -19,7 +58,7 @@ typedef struct {
     //   where each element in dataHash will become a 2-char hex digit
     // NOTE: useless knowledge below for the quiz but cool nevertheless :)
     //       - this is super efficient way to detect if contents are tampered with
-    //       - in BTC chain this will be the merkle root
+    //       - in BTC chain this will be the merkle root (see merkle.h for blocks of many transactions)
     uint8_t dataHash[HASH_LEN];
 
     // SHA256 hash of the previous header
@@ -38,9 +77,41 @@ typedef struct {
     uint32_t nonce;
 } BlockHeader;
 
+void serializeHeader(const BlockHeader* header, uint8_t bytes[HEADER_SIZE]);
+void deserializeHeader(const uint8_t bytes[HEADER_SIZE], BlockHeader* header);
+void hashHeader(const BlockHeader* header, uint8_t hash[HASH_LEN]);
+void hashHeaders(const BlockHeader* headers, const size_t count, uint8_t (*hashes)[HASH_LEN]);
+void setHeaderVersion(const uint32_t version);
 BlockHeader addBlockWithPrevPtr(const BlockHeader* prevHeader, const char* data,
                                 const uint64_t length, const int difficulty);
+BlockHeader addBlockWithPrevPtrThreads(const BlockHeader* prevHeader, const char* data,
+                                       const uint64_t length, const int difficulty,
+                                       const int threads);
+BlockHeader addBlockWithDataHash(const BlockHeader* prevHeader, const uint8_t* dataHash,
+                                 const uint64_t length, const int difficulty, const int threads);
+int addBlockWithPrevHash(const uint8_t* prevHash, const uint8_t* dataHash, const uint64_t length,
+                         const int difficulty, const int threads, struct MiningControl* control,
+                         BlockHeader* header, uint8_t hash[HASH_LEN]);
+int addBlockWithPrevFd(const BlockHeader* prevHeader, const int fd, const int difficulty,
+                       const int threads, BlockHeader* header);
+int addBlockWithPrevReader(const BlockHeader* prevHeader, PayloadReader reader, void* ctx,
+                           const int difficulty, const int threads, BlockHeader* header);
+int addBlockWithBits(const uint8_t* prevHash, const uint8_t* dataHash, const uint64_t length,
+                     const uint32_t bits, const int threads, struct MiningControl* control,
+                     BlockHeader* header, uint8_t hash[HASH_LEN]);
+void makeTargetHash(const int difficulty, uint8_t* targetHash);
+uint32_t difficultyBits(const int difficulty);
+int bitsToTarget(const uint32_t bits, uint8_t targetHash[HASH_LEN]);
+uint32_t targetToBits(const uint8_t targetHash[HASH_LEN]);
+double bitsToTargetValue(const uint32_t bits);
+uint32_t targetValueToBits(const double target);
+double bitsDifficulty(const uint32_t bits);
+int mineHeader(BlockHeader* header, const int threads, uint8_t hash[HASH_LEN],
+               struct MiningControl* control);
 void mine(BlockHeader* header, const int difficulty);
+void mineWithThreads(BlockHeader* header, const int difficulty, const int threads);
+int mineWithHash(BlockHeader* header, const int difficulty, const int threads,
+                 uint8_t hash[HASH_LEN], struct MiningControl* control);
 void makeCStringFromBytes(const uint8_t * bytes, char* output, const size_t bytesSize);
 void makeBytesFromCString(const char* cstring, uint8_t* output, const size_t length);
 void fprintHash(FILE* f, const uint8_t* hash);
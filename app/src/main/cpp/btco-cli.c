@@ -0,0 +1,672 @@
+/*
+ * Command line miner, to run (and profile) the blockchain code on a desktop/server.
+ *
+ * usage: btco-cli [-g] [-F] [-V] [-E] [-x format] [--stats] [--sha256d] [--budget seconds] [--serve address] [--work address] [--no-pin] [-b lines] [-d difficulty] [-t threads] [-n blocks] [-m message] [-o file] [-c file] [-i seconds] [-l file] [file ...]
+ * - mines the genesis block, then one block per line of the input files (or stdin)
+ * - or with -F, one block per input file, whatever its size
+ * - or with -b, one block per batch of lines, each line a transaction under the block's Merkle root
+ * - the mined blocks (headers and data) are appended to a chain store, btchain.bin by default,
+ *   continuing the chain already in it if any
+ * - or with -V, verifies the chain in the store instead of mining
+ * - or with -x, dumps the chain in the store to stdout (as hex, json or csv) instead of mining
+ * - or with -E, estimates how long mining the blocks takes (from the hashrate measured for a moment)
+ * - with --budget, refuses to mine blocks that would take longer than that 95% of the time
+ * - with --stats, prints the metrics of the miner (hashrate, latencies, ...) to stderr at the end
+ * - with -i, retargets every block toward a block interval rather than mining them all at -d
+ * - with -c, checkpoints the block being mined, so that after an interrupt (SIGINT/SIGTERM) or a
+ *   crash, running it again goes on from there instead of searching the same nonces again
+ * - with --serve, the blocks are mined by the workers that connect to the address rather than here
+ * - or with --work, mines for the coordinator at the address (another btco-cli --serve) until it is
+ *   done
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <signal.h>
+
+#include "sha-256.h"
+#include "blockchain.h"
+#include "miner.h"
+#include "logger.h"
+#include "metrics.h"
+#include "merkle.h"
+#include "chain-store.h"
+#include "verify.h"
+#include "export.h"
+#include "scheduler.h"
+#include "retarget.h"
+#include "estimate.h"
+#include "coordinator.h"
+#include "worker.h"
+
+#define LINE_MAX 4096 // max chars for console input
+
+// min time between 2 checkpoints with -c
+#define CHECKPOINT_INTERVAL_MS 10000
+
+static const char GENESIS_DATA[] =
+        "The Times 03/Jan/2009 Chancellor on brink of second bailout for banks";
+
+/**
+ * Options of a run, set from the command line.
+ */
+typedef struct {
+    int difficulty;
+    int threads;
+    long blocks;          // stop after this many blocks (genesis included), < 1 for no limit
+    const char* message;  // data of every block after genesis, NULL to read lines from the input
+    const char* outPath;
+    int genesisOnly;
+    int filePerBlock;     // the whole of each input is the data of one block
+    long batch;           // lines (transactions) per block, > 1 to mine Merkle roots
+    int verify;           // verify the stored chain instead of mining
+    int dumpFormat;       // dump the stored chain in this ExportFormat instead of mining, -1 not to
+    int stats;            // print the metrics at the end
+    const char* checkpointPath;
+    MiningControl* control; // to checkpoint the blocks and cancel them, NULL for neither
+    Retarget retarget;    // how the blocks after genesis are retargeted, intervalSec 0 not to
+    int minDifficulty;    // the difficulty every block is verified at, 0 for their own targets
+    uint32_t version;     // the HEADER_VERSION_* of the new blocks
+    int estimate;         // estimate the cost of mining instead of mining
+    double budgetSec;     // the most the blocks to mine may take (95% of the time), 0 for no limit
+    const char* serveAddress; // mine through the workers connecting to this address, NULL not to
+    const char* workAddress;  // mine for the coordinator at this address instead, NULL not to
+    int noPin;            // leave the mining threads unpinned
+} CliOptions;
+
+/**
+ * Lines read but not mined yet, when mining batches of them.
+ */
+typedef struct {
+    const void** lines;
+    size_t* lengths;
+    size_t count;
+} LineBatch;
+
+static void printUsage(FILE* f, const char* prog) {
+    fprintf(f,
+            "usage: %s [-g] [-F] [-V] [-E] [-x format] [--stats] [--sha256d] [--budget seconds] [--serve address] [--work address] [--no-pin] [-b lines] [-d difficulty] [-t threads] [-n blocks] [-m message] [-o file] "
+            "[-c file] [-i seconds] [-l file] [file ...]\n"
+            "  -g             mine the genesis block only\n"
+            "  -F             one block per input file (\"-\" for stdin) instead of per line\n"
+            "  -V             verify the chain in the store (at least at the difficulty of -d,\n"
+            "                 if given) and exit\n"
+            "  -E             estimate how long mining the blocks of -n at -d takes, and exit\n"
+            "  -x format      dump the chain in the store to stdout as hex, json or csv and exit\n"
+            "  --stats        print the metrics of the miner to stderr at the end\n"
+            "  --sha256d      hash the headers of the new blocks twice, as in BTC\n"
+            "  --budget secs  refuse to mine if the blocks would take longer than that 95%% of the time\n"
+            "  --serve addr   mine the blocks (not with -F or -b) by the workers connecting to\n"
+            "                 host:port or unix:path, rather than here\n"
+            "  --work addr    mine for the --serve at host:port or unix:path until it is done, and exit\n"
+            "  --no-pin       let the mining threads run on any CPU rather than one core each\n"
+            "  -b lines       lines per block, as transactions under a Merkle root (default 1)\n"
+            "  -d difficulty  network difficulty 1..10 (default 3)\n"
+            "  -t threads     mining threads, 0 for one per core (default 1)\n"
+            "  -n blocks      stop after this many blocks, genesis included (default: end of input)\n"
+            "  -m message     data of every block after genesis, instead of the input lines\n"
+            "  -o file        chain store to append the mined blocks to (default btchain.bin)\n"
+            "  -c file        checkpoint the mining of each block (not with -F or -b) to a file,\n"
+            "                 going on from it when run again after an interrupt\n"
+            "  -i seconds     retarget each block (not with -F or -b) toward a block every so many\n"
+            "                 seconds, -d is then the difficulty of the genesis block only\n"
+            "  -l file        append the log to a file instead of stderr\n"
+            "  file ...       input files, one block per line (default: stdin)\n",
+            prog);
+}
+
+// the control of the mining, for the signal handler to cancel it
+static MiningControl* interruptible;
+
+static void onInterrupt(int sig) {
+    (void)sig;
+    // NOTE only sets an atomic flag, which is all a signal handler may do
+    miningCancel(interruptible);
+}
+
+/**
+ * Get the target bits of the next block of the store, retargeted if the options say so.
+ */
+static uint32_t nextBits(const CliOptions* opts, const ChainStore* store) {
+    const uint64_t count = chainStoreCount(store);
+    if (!opts->retarget.intervalSec || count == 0)
+        return difficultyBits(opts->difficulty);
+    // the blocks of the window and the one before it, for the time the window took
+    BlockHeader headers[RETARGET_MAX_WINDOW + 1];
+    const uint64_t window = opts->retarget.window < RETARGET_MAX_WINDOW ?
+            opts->retarget.window : RETARGET_MAX_WINDOW;
+    const size_t n = (size_t)(count < window + 1 ? count : window + 1);
+    for (size_t i = 0; i < n; ++i)
+        chainStoreGet(store, count - n + i, &headers[i], NULL);
+    return retargetBits(&opts->retarget, headers, n, sizeof(BlockHeader));
+}
+
+/**
+ * Mine a block of raw data on top of the store, through the control of the options if any.
+ * @param prevHdr the previous header, NULL for the genesis block
+ * @return 0 on success, -1 on error (reported)
+ */
+static int mineRaw(const CliOptions* opts, const ChainStore* store, const BlockHeader* prevHdr,
+                   const void* data, const uint64_t size, BlockHeader* header) {
+    uint8_t dataHash[HASH_LEN];
+    uint8_t prevHash[HASH_LEN];
+    calc_sha_256(dataHash, data, size);
+    if (prevHdr)
+        hashHeader(prevHdr, prevHash);
+    if (addBlockWithBits(prevHdr ? prevHash : NULL, dataHash, size, nextBits(opts, store),
+                         opts->threads, opts->control, header, NULL) != 0) {
+        if (errno == ECANCELED && opts->checkpointPath)
+            fprintf(stderr, "interrupted, checkpoint saved to %s\n", opts->checkpointPath);
+        else if (errno == ECANCELED)
+            fprintf(stderr, "interrupted\n");
+        else
+            perror("mine");
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * Print a block that was mined and stored.
+ */
+static void printBlock(const long blockNo, const BlockHeader* header) {
+    uint8_t hash[HASH_LEN];
+    hashHeader(header, hash);
+
+    printf("block %ld: timestamp=%u bits=%08x nonce=%u hash=", blockNo, header->timestamp,
+           header->bits, header->nonce);
+    fprintHash(stdout, hash);
+    printf("\n");
+    fflush(stdout);
+}
+
+/**
+ * Persist a mined block with its data, and print it.
+ * @return 0 on success, -1 on error (reported)
+ */
+static int emitBlock(ChainStore* store, const long blockNo, const BlockHeader* header,
+                     const void* payload, const uint64_t length, const int payloadKind) {
+    if (chainStoreAppend(store, header, payload, length, payloadKind) != 0) {
+        perror("store");
+        return -1;
+    }
+    printBlock(blockNo, header);
+    return 0;
+}
+
+/**
+ * Frame the transactions of a batch the way the chain store keeps them, see CHAIN_PAYLOAD_MERKLE.
+ * @return the framed transactions to free, NULL if out of memory
+ */
+static uint8_t* frameBatch(const LineBatch* batch, uint64_t* length) {
+    *length = 0;
+    for (size_t i = 0; i < batch->count; ++i)
+        *length += 4 + batch->lengths[i];
+
+    uint8_t* framed = malloc(*length);
+    uint8_t* p = framed;
+    for (size_t i = 0; framed && i < batch->count; ++i) {
+        const uint32_t size = (uint32_t)batch->lengths[i];
+        for (int b = 0; b < 4; ++b)
+            *p++ = (uint8_t)(size >> (8 * b));
+        memcpy(p, batch->lines[i], size);
+        p += size;
+    }
+    return framed;
+}
+
+/**
+ * Mine one block with all the lines of a batch as its transactions, and empty the batch.
+ * @return 0 on success, -1 on error (reported)
+ */
+static int mineBatch(LineBatch* batch, const CliOptions* opts, ChainStore* store,
+                     BlockHeader* prevHdr, long* blockNo) {
+    if (batch->count == 0)
+        return 0;
+
+    MerkleTree tree;
+    BlockHeader currHdr;
+    merkleInit(&tree);
+    int rc = merkleAppendBatch(&tree, batch->lines, batch->lengths, batch->count, opts->threads);
+    if (rc == 0)
+        rc = addBlockWithMerkleTree(prevHdr, &tree, opts->difficulty, opts->threads, &currHdr);
+    merkleFree(&tree);
+
+    uint64_t length;
+    uint8_t* framed = rc == 0 ? frameBatch(batch, &length) : NULL;
+    for (size_t i = 0; i < batch->count; ++i)
+        free((void*)batch->lines[i]);
+    batch->count = 0;
+
+    if (rc != 0 || !framed) {
+        perror("batch");
+        return -1;
+    }
+    *prevHdr = currHdr;
+    rc = emitBlock(store, (*blockNo)++, prevHdr, framed, length, CHAIN_PAYLOAD_MERKLE);
+    free(framed);
+    return rc;
+}
+
+/**
+ * Mine one block per line of an input (or per batch of lines), on top of prevHdr.
+ * @return 0 when the block limit was reached, 1 to go on with the next input, -1 on error
+ */
+static int mineLines(FILE* in, const CliOptions* opts, LineBatch* batch, ChainStore* store,
+                     BlockHeader* prevHdr, long* blockNo) {
+    char consoleInput[LINE_MAX];
+    while (fgets(consoleInput, LINE_MAX, in)) {
+        if (opts->blocks > 0 && *blockNo >= opts->blocks)
+            return 0;
+
+        // the data is the line without its newline, as a C string (NOTE the +1)
+        consoleInput[strcspn(consoleInput, "\r\n")] = '\0';
+        uint64_t size = strnlen(consoleInput, LINE_MAX) + 1;
+
+        if (opts->batch > 1) {
+            batch->lines[batch->count] = strdup(consoleInput);
+            batch->lengths[batch->count] = size;
+            if (!batch->lines[batch->count]) {
+                perror("batch");
+                return -1;
+            }
+            if (++batch->count == (size_t)opts->batch &&
+                mineBatch(batch, opts, store, prevHdr, blockNo) != 0)
+                return -1;
+            continue;
+        }
+
+        if (mineRaw(opts, store, prevHdr, consoleInput, size, prevHdr) != 0)
+            return -1;
+        if (emitBlock(store, (*blockNo)++, prevHdr, consoleInput, size, CHAIN_PAYLOAD_RAW) != 0)
+            return -1;
+    }
+    return opts->blocks < 1 || *blockNo < opts->blocks;
+}
+
+/**
+ * Estimate the cost of mining some blocks at the difficulty of the options, on this machine.
+ */
+static void estimateBlocks(const CliOptions* opts, const uint64_t blocks, MiningEstimate* estimate) {
+    estimateMining(difficultyBits(opts->difficulty), blocks,
+                   calibrateHashrate(opts->version, opts->threads), estimate);
+}
+
+/**
+ * Print the estimated cost of mining the blocks of the options.
+ * @return EXIT_SUCCESS
+ */
+static int printEstimate(const CliOptions* opts) {
+    const uint64_t blocks = opts->blocks > 0 ? (uint64_t)opts->blocks : 1;
+    MiningEstimate estimate;
+    estimateBlocks(opts, blocks, &estimate);
+    printf("difficulty %d: %.3g hashes per block, at %.2f MH/s %llu block%s %.3g s on average, "
+           "95%% within %.3g s\n", opts->difficulty, estimate.attempts / (double)blocks,
+           estimate.hashrate / 1e6, (unsigned long long)blocks, blocks > 1 ? "s take" : " takes",
+           estimate.expectedSec, estimate.p95Sec);
+    return EXIT_SUCCESS;
+}
+
+/**
+ * Verify the whole chain of a store, data included.
+ * @return EXIT_SUCCESS if it is valid, EXIT_FAILURE if not (reported)
+ */
+static int verifyStore(const CliOptions* opts) {
+    ChainStore* store = chainStoreOpen(opts->outPath, CHAIN_STORE_READONLY);
+    if (!store) {
+        perror(opts->outPath);
+        return EXIT_FAILURE;
+    }
+
+    ChainFault fault;
+    const int64_t invalid = chainVerify(store, opts->minDifficulty, CHAIN_VERIFY_PAYLOADS,
+                                        opts->threads, &fault);
+    if (invalid < 0)
+        printf("%s: %llu blocks, valid\n", opts->outPath,
+               (unsigned long long)chainStoreCount(store));
+    else if (fault == CHAIN_IO_ERROR)
+        fprintf(stderr, "%s: block %lld: %s: %s\n", opts->outPath, (long long)invalid,
+                chainFaultName(fault), strerror(errno));
+    else
+        fprintf(stderr, "%s: block %lld: %s\n", opts->outPath, (long long)invalid,
+                chainFaultName(fault));
+    chainStoreClose(store);
+    return invalid < 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+/**
+ * Dump the whole chain of a store to stdout, with the digests of the stored data.
+ * @return EXIT_SUCCESS on success, EXIT_FAILURE on error (reported)
+ */
+static int dumpStore(const CliOptions* opts) {
+    ChainStore* store = chainStoreOpen(opts->outPath, CHAIN_STORE_READONLY);
+    if (!store) {
+        perror(opts->outPath);
+        return EXIT_FAILURE;
+    }
+    const int rc = chainStoreExport(store, STDOUT_FILENO, (ExportFormat)opts->dumpFormat,
+                                    EXPORT_PAYLOAD_DIGESTS);
+    if (rc != 0)
+        perror(opts->outPath);
+    chainStoreClose(store);
+    return rc == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+/**
+ * Copy a pipe (or anything else that can't be read twice) into a temporary file.
+ * @return the temporary file, at its start, NULL on error with errno set
+ */
+static FILE* spool(const int fd) {
+    FILE* tmp = tmpfile();
+    char buf[LINE_MAX];
+    ssize_t n;
+    while (tmp && (n = read(fd, buf, sizeof(buf))) != 0) {
+        if ((n < 0 && errno != EINTR) || (n > 0 && fwrite(buf, 1, (size_t)n, tmp) != (size_t)n)) {
+            fclose(tmp);
+            return NULL;
+        }
+    }
+    if (tmp && (fflush(tmp) != 0 || lseek(fileno(tmp), 0, SEEK_SET) != 0)) {
+        fclose(tmp);
+        return NULL;
+    }
+    return tmp;
+}
+
+/**
+ * Mine one block with the whole of an input file as its data, streamed through the hash.
+ * @return 0 on success, -1 on error (reported)
+ */
+static int mineFile(const char* path, const CliOptions* opts, ChainStore* store,
+                    BlockHeader* prevHdr, long* blockNo) {
+    int fd = strcmp(path, "-") == 0 ? STDIN_FILENO : open(path, O_RDONLY);
+    if (fd < 0) {
+        perror(path);
+        return -1;
+    }
+
+    // the data is read twice, once to hash it and once to store it
+    FILE* tmp = NULL;
+    off_t start = lseek(fd, 0, SEEK_CUR);
+    if (start < 0) {
+        tmp = spool(fd);
+        if (!tmp) {
+            perror(path);
+            if (fd != STDIN_FILENO)
+                close(fd);
+            return -1;
+        }
+        if (fd != STDIN_FILENO)
+            close(fd);
+        fd = fileno(tmp);
+        start = 0;
+    }
+
+    BlockHeader currHdr;
+    int rc = addBlockWithPrevFd(prevHdr, fd, opts->difficulty, opts->threads, &currHdr);
+    if (rc == 0 && (lseek(fd, start, SEEK_SET) != start ||
+                    chainStoreAppendFd(store, &currHdr, fd) != 0))
+        rc = -1;
+    if (rc != 0)
+        perror(path);
+    if (tmp)
+        fclose(tmp);
+    else if (fd != STDIN_FILENO)
+        close(fd);
+    if (rc != 0)
+        return -1;
+
+    *prevHdr = currHdr;
+    printBlock((*blockNo)++, prevHdr);
+    return 0;
+}
+
+/**
+ * Mine for a coordinator until it is done (or interrupted).
+ */
+static int runWorker(const CliOptions* opts, MiningControl* control) {
+    uint64_t solutions;
+    const int rc = workerRun(opts->workAddress, opts->threads, control, &solutions);
+    if (rc != 0)
+        perror(opts->workAddress);
+    fprintf(stderr, "searched %llu nonces, sent %llu solution%s\n",
+            (unsigned long long)atomic_load(&control->noncesTried), (unsigned long long)solutions,
+            solutions == 1 ? "" : "s");
+    return rc == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+int main(int argc, char* argv[]) {
+    CliOptions opts = { 3, 1, 0, NULL, "btchain.bin", 0, 0, 1, 0, -1, 0, NULL, NULL, { 0, 0, 0 }, 0,
+                        HEADER_VERSION_SHA256, 0, 0, NULL, NULL, 0 };
+    retargetInit(&opts.retarget, 0);
+
+    static const struct option longOptions[] = {
+            { "stats", no_argument, NULL, 'S' },
+            { "sha256d", no_argument, NULL, 'D' },
+            { "budget", required_argument, NULL, 'B' },
+            { "serve", required_argument, NULL, 'P' },
+            { "work", required_argument, NULL, 'W' },
+            { "no-pin", no_argument, NULL, 'U' },
+            { NULL, 0, NULL, 0 }
+    };
+    int opt;
+    while ((opt = getopt_long(argc, argv, "gFVEx:b:d:t:n:m:o:c:i:l:h", longOptions, NULL)) != -1) {
+        switch (opt) {
+            case 'S': opts.stats = 1; break;
+            case 'D': opts.version = HEADER_VERSION_SHA256D; break;
+            case 'B': opts.budgetSec = atof(optarg); break;
+            case 'P': opts.serveAddress = optarg; break;
+            case 'W': opts.workAddress = optarg; break;
+            case 'U': opts.noPin = 1; break;
+            case 'E': opts.estimate = 1; break;
+            case 'g': opts.genesisOnly = 1; break;
+            case 'F': opts.filePerBlock = 1; break;
+            case 'V': opts.verify = 1; break;
+            case 'x':
+                opts.dumpFormat = exportFormatByName(optarg);
+                if (opts.dumpFormat < 0) {
+                    fprintf(stderr, "%s: unknown format %s\n", argv[0], optarg);
+                    return EXIT_FAILURE;
+                }
+                break;
+            case 'b': opts.batch = atol(optarg); break;
+            case 'd': opts.difficulty = opts.minDifficulty = atoi(optarg); break;
+            case 't': opts.threads = atoi(optarg); break;
+            case 'n': opts.blocks = atol(optarg); break;
+            case 'm': opts.message = optarg; break;
+            case 'o': opts.outPath = optarg; break;
+            case 'c': opts.checkpointPath = optarg; break;
+            case 'i': opts.retarget.intervalSec = (uint32_t)atol(optarg); break;
+            case 'l':
+                if (setLogFile(optarg) != 0) {
+                    perror(optarg);
+                    return EXIT_FAILURE;
+                }
+                break;
+            case 'h': printUsage(stdout, argv[0]); return EXIT_SUCCESS;
+            default: printUsage(stderr, argv[0]); return EXIT_FAILURE;
+        }
+    }
+    if (opts.difficulty < 1 || opts.difficulty > 10) {
+        fprintf(stderr, "%s: difficulty must be 1..10\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+    if (opts.message && opts.blocks < 1) {
+        fprintf(stderr, "%s: -m needs a block count (-n)\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+    if (opts.serveAddress && (opts.filePerBlock || opts.batch > 1 || opts.checkpointPath)) {
+        fprintf(stderr, "%s: --serve does not go with -F, -b or -c\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+    // NOTE the blocks of files and batches are mined without a control, nothing to checkpoint them
+    //      (or interrupt them) by, and without retargeting
+    if ((opts.filePerBlock || opts.batch > 1) && (opts.checkpointPath || opts.retarget.intervalSec)) {
+        fprintf(stderr, "%s: -c and -i do not go with -F or -b\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    if (opts.verify)
+        return verifyStore(&opts);
+    if (opts.dumpFormat >= 0)
+        return dumpStore(&opts);
+
+    // the mining pool gets the threads asked for, rather than one per core
+    schedConfigure(opts.threads);
+    schedConfigurePinning(!opts.noPin);
+    setHeaderVersion(opts.version);
+    if (opts.estimate)
+        return printEstimate(&opts);
+
+    // an interrupt cancels the block being mined, which saves its checkpoint on the way out
+    MiningControl control;
+    if (opts.checkpointPath || opts.serveAddress || opts.workAddress) {
+        miningControlInit(&control, NULL, NULL, 0);
+        control.checkpointPath = opts.checkpointPath;
+        control.checkpointIntervalMs = CHECKPOINT_INTERVAL_MS;
+        opts.control = &control;
+        interruptible = &control;
+        struct sigaction action;
+        memset(&action, 0, sizeof(action));
+        action.sa_handler = onInterrupt;
+        sigemptyset(&action.sa_mask);
+        sigaction(SIGINT, &action, NULL);
+        sigaction(SIGTERM, &action, NULL);
+    }
+    if (opts.workAddress)
+        return runWorker(&opts, &control);
+    Coordinator* coordinator = NULL;
+    if (opts.serveAddress) {
+        coordinator = coordinatorOpen(opts.serveAddress);
+        if (!coordinator) {
+            perror(opts.serveAddress);
+            return EXIT_FAILURE;
+        }
+        control.coordinator = coordinator;
+        fprintf(stderr, "mining by the workers on %s\n", opts.serveAddress);
+    }
+
+    // create/open the store of the BTC blockchain
+    ChainStore* store = chainStoreOpen(opts.outPath, 0);
+    if (!store) {
+        perror(opts.outPath);
+        coordinatorClose(coordinator);
+        return EXIT_FAILURE;
+    }
+
+    // create the genesis block, or go on from the last block of the store
+    long blockNo = (long)chainStoreCount(store);
+
+    // the blocks left to mine, or each block when there is no telling how many
+    // NOTE the hashrate of the workers is not known, the budget is for mining here
+    if (opts.budgetSec > 0 && !coordinator) {
+        const uint64_t blocks = opts.blocks > blockNo ? (uint64_t)(opts.blocks - blockNo) : 1;
+        MiningEstimate estimate;
+        estimateBlocks(&opts, blocks, &estimate);
+        if (estimate.p95Sec > opts.budgetSec) {
+            fprintf(stderr, "%s: %llu block%s at difficulty %d would take up to %.3g s (95%%), "
+                    "over the budget of %.3g s\n", argv[0], (unsigned long long)blocks,
+                    blocks > 1 ? "s" : "", opts.difficulty, estimate.p95Sec, opts.budgetSec);
+            chainStoreClose(store);
+            coordinatorClose(coordinator);
+            return EXIT_FAILURE;
+        }
+    }
+    BlockHeader prevHdr;
+    int status = EXIT_SUCCESS;
+    if (blockNo > 0) {
+        // the headers are quick to check, and there is no point mining on top of a broken chain
+        ChainFault fault;
+        const int64_t invalid = chainVerify(store, 0, 0, opts.threads, &fault);
+        if (invalid >= 0) {
+            fprintf(stderr, "%s: block %lld: %s\n", opts.outPath, (long long)invalid,
+                    chainFaultName(fault));
+            chainStoreClose(store);
+            coordinatorClose(coordinator);
+            return EXIT_FAILURE;
+        }
+        chainStoreGet(store, (uint64_t)blockNo - 1, &prevHdr, NULL);
+        printf("resuming after block %ld\n", blockNo - 1);
+    } else {
+        if (mineRaw(&opts, store, NULL, GENESIS_DATA, sizeof(GENESIS_DATA), &prevHdr) != 0 ||
+            emitBlock(store, blockNo++, &prevHdr, GENESIS_DATA, sizeof(GENESIS_DATA),
+                      CHAIN_PAYLOAD_RAW) != 0)
+            status = EXIT_FAILURE;
+    }
+
+    if (opts.genesisOnly || status != EXIT_SUCCESS) {
+        // done
+    } else if (opts.message) {
+        // the same message for all the blocks, like the app does
+        const uint64_t size = strlen(opts.message) + 1;
+        while (blockNo < opts.blocks) {
+            if (mineRaw(&opts, store, &prevHdr, opts.message, size, &prevHdr) != 0 ||
+                emitBlock(store, blockNo++, &prevHdr, opts.message, size, CHAIN_PAYLOAD_RAW) != 0) {
+                status = EXIT_FAILURE;
+                break;
+            }
+        }
+    } else if (opts.filePerBlock) {
+        for (int i = optind; i < argc && (opts.blocks < 1 || blockNo < opts.blocks); ++i) {
+            if (mineFile(argv[i], &opts, store, &prevHdr, &blockNo) != 0) {
+                status = EXIT_FAILURE;
+                break;
+            }
+        }
+    } else {
+        LineBatch batch = { NULL, NULL, 0 };
+        if (opts.batch > 1) {
+            batch.lines = calloc((size_t)opts.batch, sizeof(*batch.lines));
+            batch.lengths = calloc((size_t)opts.batch, sizeof(*batch.lengths));
+            if (!batch.lines || !batch.lengths) {
+                perror("batch");
+                chainStoreClose(store);
+                coordinatorClose(coordinator);
+                return EXIT_FAILURE;
+            }
+        }
+
+        // loop to generate subsequent blocks from the lines of every input file (or stdin)
+        int more = 1;
+        for (int i = optind; more > 0 && (i < argc || i == optind); ++i) {
+            FILE* in = i < argc ? fopen(argv[i], "r") : stdin;
+            if (!in) {
+                perror(argv[i]);
+                more = -1;
+                break;
+            }
+            more = mineLines(in, &opts, &batch, store, &prevHdr, &blockNo);
+            if (in != stdin)
+                fclose(in);
+        }
+
+        // the last batch may not be full
+        if (more >= 0 && mineBatch(&batch, &opts, store, &prevHdr, &blockNo) != 0)
+            more = -1;
+        if (more < 0)
+            status = EXIT_FAILURE;
+        free(batch.lines);
+        free(batch.lengths);
+    }
+
+    coordinatorClose(coordinator);
+    if (chainStoreClose(store) != 0) {
+        perror(opts.outPath);
+        status = EXIT_FAILURE;
+    }
+    // the checkpoint is of a block that is in the store by now, unless mining was interrupted
+    if (opts.checkpointPath && status == EXIT_SUCCESS)
+        unlink(opts.checkpointPath);
+    if (opts.stats) {
+        MetricsSnapshot snapshot;
+        metricsSnapshot(&snapshot);
+        metricsPrint(stderr, &snapshot);
+    }
+    return status;
+}
@@ -1,11 +1,118 @@
 #include <jni.h>
-#include <android/log.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
 #include "sha-256.h"
 #include "blockchain.h"
+#include "chain.h"
+#include "chain-store.h"
+#include "checkpoint.h"
+#include "estimate.h"
+#include "metrics.h"
+#include "miner.h"
+#include "scheduler.h"
+#include "logger.h"
 
 static const char* TAG = "BITCONATIVE";
 
+static const char GENESIS_DATA[] =
+        "The Times 03/Jan/2009 Chancellor on brink of second bailout for banks";
+
+// min time between 2 progress callbacks
+#define PROGRESS_INTERVAL_MS 250
+
+// layout of the array returned by estimateNative, mirrored in BTCOActivity
+enum {
+    ESTIMATE_ATTEMPTS,
+    ESTIMATE_HASHRATE,
+    ESTIMATE_EXPECTED_SEC,
+    ESTIMATE_P95_SEC,
+    ESTIMATE_FIELDS
+};
+
+// layout of the array returned by metricsSnapshotNative, mirrored in BTCOActivity
+// - the counters, then the METRICS_BUCKETS buckets of each histogram (see metrics.h), then the
+//   hashes of each thread
+enum {
+    STAT_HASHES,
+    STAT_SHA256_CALLS,
+    STAT_SHA256_BYTES,
+    STAT_BLOCKS,
+    STAT_ROLLOVERS,
+    STAT_SOLVE_NS,
+    STAT_ELAPSED_NS,
+    STAT_THREADS,
+    STAT_MINING_NS,
+    STAT_HISTOGRAMS
+};
+
+/**
+ * A mining job, i.e., the mining of some blocks that Kotlin can cancel and follow.
+ */
+typedef struct {
+    MiningControl control;
+
+    // the listener (a global ref) and the env of the thread mining, the one calling back
+    jobject listener;
+    jmethodID onProgress;
+    JNIEnv* env;
+
+    uint64_t startMs;
+    jint blocksDone;
+
+    // the checkpoint file of the job (owned), NULL if it does not checkpoint
+    char* checkpointPath;
+} MiningJob;
+
+static uint64_t monotonicMs(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + (uint64_t)ts.tv_nsec / 1000000;
+}
+
+/**
+ * Call the listener of a job with the progress of mining, on the thread that mines.
+ */
+static void reportProgress(void* ctx, uint64_t noncesTried) {
+    MiningJob* job = ctx;
+    JNIEnv* env = job->env;
+    const uint64_t elapsedMs = monotonicMs() - job->startMs;
+    const jdouble hashrate = elapsedMs ? (jdouble)noncesTried * 1000 / (jdouble)elapsedMs : 0;
+
+    (*env)->CallVoidMethod(env, job->listener, job->onProgress, (jlong)noncesTried, hashrate,
+                           job->blocksDone);
+    if ((*env)->ExceptionCheck(env)) {
+        // nothing else may be called with an exception pending, and mining can't be told apart
+        // from the listener failing, so give up on the job
+        (*env)->ExceptionClear(env);
+        logPrint(LOG_LEVEL_ERROR, TAG, "mining listener failed, cancelling");
+        miningCancel(&job->control);
+    }
+}
+
+/**
+ * Get the control of a job for the calling thread, NULL for no job.
+ */
+static MiningControl* startJob(JNIEnv* env, jlong job) {
+    MiningJob* j = (MiningJob*)(intptr_t)job;
+    if (!j)
+        return NULL;
+    j->env = env;
+    j->startMs = monotonicMs();
+    j->blocksDone = 0;
+    return &j->control;
+}
+
+static void blockDone(jlong job) {
+    MiningJob* j = (MiningJob*)(intptr_t)job;
+    if (j)
+        j->blocksDone++;
+}
+
 /**
  * @brief Log difficulty and message
  *
@@ -18,30 +125,239 @@ Java_edu_singaporetech_btco_BTCOActivity_logDifficultyMsgNative(JNIEnv *env, job
                                                                 jstring message) {
 
     const char* message_str = (*env)->GetStringUTFChars(env, message, 0);
-    __android_log_print(ANDROID_LOG_INFO, TAG, "Difficulty: %d, Message: %s",
-                        difficulty, message_str);
+    if (!message_str)
+        return;
+    logPrint(LOG_LEVEL_INFO, TAG, "Difficulty: %d, Message: %s",
+             difficulty, message_str);
+    (*env)->ReleaseStringUTFChars(env, message, message_str);
+}
+
+/**
+ * @brief Create an empty native chain, to pass to the other chain functions
+ *
+ * @return handle of the chain, 0 if out of memory
+ */
+JNIEXPORT jlong JNICALL
+Java_edu_singaporetech_btco_BTCOActivity_chainCreateNative(JNIEnv *env, jobject thiz) {
+
+    Chain* chain = malloc(sizeof(Chain));
+    if (chain)
+        chainInit(chain);
+    return (jlong)(intptr_t)chain;
+}
+
+/**
+ * @brief Free a native chain, its handle must not be used after that
+ *
+ * @param chain handle of the chain, may be 0
+ */
+JNIEXPORT void JNICALL
+Java_edu_singaporetech_btco_BTCOActivity_chainDestroyNative(JNIEnv *env, jobject thiz,
+                                                            jlong chain) {
+
+    Chain* c = (Chain*)(intptr_t)chain;
+    if (c) {
+        chainFree(c);
+        free(c);
+    }
+}
+
+/**
+ * @brief Make a native chain retarget its blocks toward a block interval, see retarget.h
+ * - the difficulty given to the mining functions is then the one of the genesis block only
+ *
+ * @param chain handle of the chain
+ * @param intervalSec the time aimed at between 2 blocks, in seconds, 0 to mine every block at the
+ *                    difficulty given (the default)
+ */
+JNIEXPORT void JNICALL
+Java_edu_singaporetech_btco_BTCOActivity_chainRetargetNative(JNIEnv *env, jobject thiz,
+                                                             jlong chain, jint intervalSec) {
+
+    retargetInit(&((Chain*)(intptr_t)chain)->retarget, intervalSec > 0 ? (uint32_t)intervalSec : 0);
+}
+
+/**
+ * @brief Get the number of blocks of a native chain
+ *
+ * @param chain handle of the chain
+ * @return number of blocks, genesis included
+ */
+JNIEXPORT jint JNICALL
+Java_edu_singaporetech_btco_BTCOActivity_chainLengthNative(JNIEnv *env, jobject thiz,
+                                                           jlong chain) {
+
+    return (jint)((Chain*)(intptr_t)chain)->count;
+}
+
+/**
+ * @brief Get the hash of a block of a native chain, as cached when it was mined
+ *
+ * @param chain handle of the chain
+ * @param height of the block, 0 is the genesis block
+ * @return hash of the block header, null if there is no such block
+ */
+JNIEXPORT jstring JNICALL
+Java_edu_singaporetech_btco_BTCOActivity_chainBlockHashNative(JNIEnv *env, jobject thiz,
+                                                              jlong chain, jint height) {
+
+    const ChainBlock* block = height >= 0 ? chainBlock((Chain*)(intptr_t)chain, (size_t)height) : NULL;
+    if (!block)
+        return NULL;
+
+    char hashStr[HASH_LEN * 2 + 1];
+    makeCStringFromBytes(block->hash, hashStr, HASH_LEN);
+    return (*env)->NewStringUTF(env, hashStr);
+}
+
+/**
+ * @brief Save a native chain into a chain store, appending the blocks it does not have yet
+ *
+ * @param chain handle of the chain
+ * @param path of the chain store, created if needed
+ * @return true on success
+ */
+JNIEXPORT jboolean JNICALL
+Java_edu_singaporetech_btco_BTCOActivity_chainExportNative(JNIEnv *env, jobject thiz,
+                                                           jlong chain, jstring path) {
+
+    const char* path_str = (*env)->GetStringUTFChars(env, path, 0);
+    ChainStore* store = chainStoreOpen(path_str, 0);
+    int rc = store ? chainExport((Chain*)(intptr_t)chain, store) : -1;
+    if (store && chainStoreClose(store) != 0)
+        rc = -1;
+    if (rc != 0)
+        logPrint(LOG_LEVEL_ERROR, TAG, "chainExport:%s:%s", path_str, strerror(errno));
+    (*env)->ReleaseStringUTFChars(env, path, path_str);
+    return rc == 0 ? JNI_TRUE : JNI_FALSE;
+}
+
+/**
+ * @brief Create a mining job, to pass to the mining functions to cancel them and follow them
+ *
+ * @param listener called back with the progress (nonces tried, hashrate, blocks done) every
+ *                 PROGRESS_INTERVAL_MS on the thread that mines, may be null
+ * @param priority of the job on the shared mining pool, 0 (low) to 2 (high)
+ * @return handle of the job, 0 if out of memory
+ */
+JNIEXPORT jlong JNICALL
+Java_edu_singaporetech_btco_BTCOActivity_mineJobCreateNative(JNIEnv *env, jobject thiz,
+                                                             jobject listener, jint priority) {
+
+    MiningJob* job = calloc(1, sizeof(MiningJob));
+    if (!job)
+        return 0;
+    if (listener) {
+        jclass listenerClass = (*env)->GetObjectClass(env, listener);
+        job->onProgress = (*env)->GetMethodID(env, listenerClass, "onProgress", "(JDI)V");
+        (*env)->DeleteLocalRef(env, listenerClass);
+        if (!job->onProgress) {
+            // NoSuchMethodError is pending
+            free(job);
+            return 0;
+        }
+        job->listener = (*env)->NewGlobalRef(env, listener);
+    }
+    miningControlInit(&job->control, job->listener ? reportProgress : NULL, job,
+                      PROGRESS_INTERVAL_MS);
+    if (priority >= SCHED_PRIORITY_LOW && priority < SCHED_PRIORITIES)
+        job->control.priority = priority;
+    return (jlong)(intptr_t)job;
+}
+
+/**
+ * @brief Cancel a mining job, from any thread: the mining function using it returns null asap
+ *
+ * @param job handle of the job
+ */
+JNIEXPORT void JNICALL
+Java_edu_singaporetech_btco_BTCOActivity_mineJobCancelNative(JNIEnv *env, jobject thiz,
+                                                             jlong job) {
+
+    miningCancel(&((MiningJob*)(intptr_t)job)->control);
+}
+
+/**
+ * @brief Free a mining job, once no mining function uses it any more
+ *
+ * @param job handle of the job, may be 0
+ */
+JNIEXPORT void JNICALL
+Java_edu_singaporetech_btco_BTCOActivity_mineJobDestroyNative(JNIEnv *env, jobject thiz,
+                                                              jlong job) {
+
+    MiningJob* j = (MiningJob*)(intptr_t)job;
+    if (!j)
+        return;
+    if (j->listener)
+        (*env)->DeleteGlobalRef(env, j->listener);
+    free(j->checkpointPath);
+    free(j);
+}
+
+/**
+ * @brief Make a mining job checkpoint the block it mines, to go on from there if the app is gone
+ * - mineBlocksNative also saves the blocks mined so far next to the checkpoint, in a chain store
+ *   at path + ".chain", and goes on with the job of the checkpoint if there is one, see
+ *   mineBlocksNative
+ *
+ * @param job handle of the job
+ * @param path of the checkpoint file, null not to checkpoint
+ * @param intervalMs min time between 2 checkpoints, 0 (or less) to only write one when the job is
+ *                   cancelled, as one is also written then anyway
+ * @return true on success, false if out of memory
+ */
+JNIEXPORT jboolean JNICALL
+Java_edu_singaporetech_btco_BTCOActivity_mineJobCheckpointNative(JNIEnv *env, jobject thiz,
+                                                                 jlong job, jstring path,
+                                                                 jint intervalMs) {
+
+    MiningJob* j = (MiningJob*)(intptr_t)job;
+    free(j->checkpointPath);
+    j->checkpointPath = NULL;
+    if (path) {
+        const char* path_str = (*env)->GetStringUTFChars(env, path, 0);
+        if (!path_str)
+            return JNI_FALSE;
+        j->checkpointPath = strdup(path_str);
+        (*env)->ReleaseStringUTFChars(env, path, path_str);
+        if (!j->checkpointPath)
+            return JNI_FALSE;
+    }
+    j->control.checkpointPath = j->checkpointPath;
+    j->control.checkpointIntervalMs = intervalMs > 0 ? (uint32_t)intervalMs : 0;
+    return JNI_TRUE;
 }
 
 /**
- * @brief Mine genesis block, log timestamp and return hash
+ * @brief Mine genesis block into a (reset) native chain, log timestamp and return hash
  *
+ * @param chain handle of the chain
+ * @param job handle of the mining job, 0 for none
  * @param difficulty network difficulty
- * @return hash result of mining
+ * @param threads number of mining threads, 0 for one per core
+ * @return hash result of mining, null if cancelled
  */
 JNIEXPORT jstring JNICALL
 Java_edu_singaporetech_btco_BTCOActivity_mineGenesisBlockNative(JNIEnv *env, jobject thiz,
-                                                                jint difficulty) {
+                                                                jlong chain, jlong job,
+                                                                jint difficulty, jint threads) {
 
-    const char data[] = "The Times 03/Jan/2009 Chancellor on brink of second bailout for banks";
-    BlockHeader genesisBlock = addBlockWithPrevPtr(NULL, data, sizeof(data), difficulty);
+    Chain* c = (Chain*)(intptr_t)chain;
+    chainReset(c);
+    const ChainBlock* genesisBlock = chainMine(c, GENESIS_DATA, sizeof(GENESIS_DATA), difficulty,
+                                               threads, startJob(env, job));
+    if (!genesisBlock)
+        return NULL;
+    blockDone(job);
 
-    __android_log_print(ANDROID_LOG_INFO, TAG, "Created block with timestamp=%u nonce=%d",
-                        genesisBlock.timestamp, genesisBlock.nonce);
+    logPrint(LOG_LEVEL_DEBUG, TAG, "Created block with timestamp=%u nonce=%d",
+             genesisBlock->header.timestamp, genesisBlock->header.nonce);
 
     char hashStr[HASH_LEN * 2 + 1];
-    makeCStringFromBytes(genesisBlock.dataHash, hashStr, HASH_LEN);
+    makeCStringFromBytes(genesisBlock->header.dataHash, hashStr, HASH_LEN);
 
-    // [JUST IN CASE] Code to convert string to hash and print to android log
+    // [JUST IN CASE] Code to convert string to hash and print to the log
     // uint8_t bytes[HASH_LEN * 2 + 1];
     // makeBytesFromCString(hashStr, bytes, HASH_LEN * 2 + 1);
     // logHash(bytes);
@@ -51,42 +367,339 @@ Java_edu_singaporetech_btco_BTCOActivity_mineGenesisBlockNative(JNIEnv *env, job
 }
 
 /**
- * @brief Mine blocks, log timestamp and return hash of last block
+ * Mine a block on top of a chain, and log it.
+ * @return the block, NULL if mining failed or was cancelled
+ */
+static const ChainBlock* mineLogged(Chain* c, jlong job, MiningControl* control,
+                                    const void* data, const uint64_t length,
+                                    jint difficulty, jint threads) {
+    const ChainBlock* block = chainMine(c, data, length, difficulty, threads, control);
+    if (!block)
+        return NULL;
+    blockDone(job);
+    logPrint(LOG_LEVEL_DEBUG, TAG, "Created block with timestamp=%u nonce=%d",
+             block->header.timestamp, block->header.nonce);
+    return block;
+}
+
+/**
+ * Mine the genesis block of a chain, unless it has one already.
+ * @return the last block of the chain, NULL if mining failed or was cancelled
+ */
+static const ChainBlock* mineGenesisOnce(Chain* c, jlong job, MiningControl* control,
+                                         jint difficulty, jint threads) {
+    if (c->count > 0)
+        return chainBlock(c, c->count - 1);
+    return mineLogged(c, job, control, GENESIS_DATA, sizeof(GENESIS_DATA), difficulty, threads);
+}
+
+/**
+ * Make the dataHash of a block the string returned to Kotlin.
+ */
+static jstring dataHashString(JNIEnv* env, const ChainBlock* block) {
+    char hashStr[HASH_LEN * 2 + 1];
+    makeCStringFromBytes(block->header.dataHash, hashStr, HASH_LEN);
+    return (*env)->NewStringUTF(env, hashStr);
+}
+
+/**
+ * Get the bytes of a direct ByteBuffer, from its position to its limit, without copying them.
+ * @param length set to the number of bytes
+ * @return the bytes, NULL with an exception pending if the buffer is not a direct one
+ */
+static const uint8_t* directBytes(JNIEnv* env, jobject buffer, uint64_t* length) {
+    // NOTE method ids stay valid as long as the class is loaded, and java.nio.Buffer always is
+    static jmethodID position, limit;
+    if (!position || !limit) {
+        jclass bufferClass = (*env)->FindClass(env, "java/nio/Buffer");
+        if (!bufferClass)
+            return NULL;
+        position = (*env)->GetMethodID(env, bufferClass, "position", "()I");
+        limit = (*env)->GetMethodID(env, bufferClass, "limit", "()I");
+        (*env)->DeleteLocalRef(env, bufferClass);
+        if (!position || !limit)
+            return NULL;
+    }
+
+    const uint8_t* bytes = buffer ? (*env)->GetDirectBufferAddress(env, buffer) : NULL;
+    if (!bytes) {
+        jclass iae = (*env)->FindClass(env, "java/lang/IllegalArgumentException");
+        if (iae)
+            (*env)->ThrowNew(env, iae, "the payload must be a direct ByteBuffer");
+        return NULL;
+    }
+    const jint begin = (*env)->CallIntMethod(env, buffer, position);
+    const jint end = (*env)->CallIntMethod(env, buffer, limit);
+    *length = (uint64_t)(end - begin);
+    return bytes + begin;
+}
+
+/**
+ * Get the path of a file next to a checkpoint, e.g. its chain store.
+ * @return the path (to free), NULL if out of memory
+ */
+static char* checkpointSibling(const char* checkpointPath, const char* suffix) {
+    const size_t pathLen = strlen(checkpointPath);
+    const size_t suffixLen = strlen(suffix);
+    char* path = malloc(pathLen + suffixLen + 1);
+    if (path) {
+        memcpy(path, checkpointPath, pathLen);
+        memcpy(path + pathLen, suffix, suffixLen + 1);
+    }
+    return path;
+}
+
+/**
+ * Delete a checkpoint and the chain store next to it.
+ */
+static void removeCheckpoint(const char* checkpointPath) {
+    static const char* const SUFFIXES[] = {"", ".chain", ".chain.dat", ".chain.idx"};
+    for (size_t i = 0; i < sizeof(SUFFIXES) / sizeof(SUFFIXES[0]); ++i) {
+        char* path = checkpointSibling(checkpointPath, SUFFIXES[i]);
+        if (path)
+            unlink(path);
+        free(path);
+    }
+}
+
+/**
+ * Open the chain store next to a checkpoint, going on with the job of the checkpoint if there is
+ * one, or starting a new one.
+ * - to go on with a job, the chain is loaded with the blocks mined so far and the target is the
+ *   one of the job, else (no job, or not one of this chain) the files are replaced by a store of
+ *   the chain and a checkpoint of no block yet, only holding the target for the job to go on with
+ * @param c the chain
+ * @param checkpointPath the checkpoint of the job
+ * @param target the length the chain is to be mined up to, set to the one of the job gone on with
+ * @return the store, NULL if it can't be opened (mining goes on without it)
+ */
+static ChainStore* openCheckpointStore(Chain* c, const char* checkpointPath, uint64_t* target) {
+    char* storePath = checkpointSibling(checkpointPath, ".chain");
+    if (!storePath)
+        return NULL;
+    MiningCheckpoint checkpoint;
+    ChainStore* store = chainStoreOpen(storePath, 0);
+    if (store && checkpointLoad(checkpointPath, &checkpoint) == 0 &&
+        chainImport(c, store) == 0 && checkpoint.position >= c->count) {
+        logPrint(LOG_LEVEL_INFO, TAG, "going on from the checkpoint at block %zu of %llu",
+                 c->count, (unsigned long long)checkpoint.position);
+        *target = checkpoint.position;
+        free(storePath);
+        return store;
+    }
+
+    chainStoreClose(store);
+    removeCheckpoint(checkpointPath);
+    memset(&checkpoint, 0, sizeof(checkpoint));
+    checkpoint.position = *target;
+    store = chainStoreOpen(storePath, 0);
+    if (!store || chainExport(c, store) != 0 || checkpointSave(checkpointPath, &checkpoint) != 0) {
+        logPrint(LOG_LEVEL_ERROR, TAG, "checkpoint:%s:%s", checkpointPath, strerror(errno));
+        chainStoreClose(store);
+        store = NULL;
+    }
+    free(storePath);
+    return store;
+}
+
+/**
+ * @brief Mine blocks on top of a native chain, log timestamp and return hash of last block
+ * - the genesis block is only mined if the chain does not have one yet
+ * - the data of each block is the message in UTF-8 with its terminating 0, as btco-cli -m does
  *
- * @param blocks number of blocks to mine
+ * @param chain handle of the chain
+ * @param job handle of the mining job, 0 for none
+ * @param blocks number of blocks to mine, genesis included
  * @param difficulty network difficulty
  * @param message transaction message
+ * @param threads number of mining threads, 0 for one per core
  *
- * @return hash result of mining of last block
+ * @return hash result of mining of last block, null if cancelled (the blocks mined until then
+ *         stay in the chain)
+ * NOTE with a job that checkpoints (see mineJobCheckpointNative), a job left unfinished there is
+ *      gone on with instead, up to the number of blocks it was for, if it mined the chain given
  */
 JNIEXPORT jstring JNICALL
-Java_edu_singaporetech_btco_BTCOActivity_mineBlocksNative(JNIEnv *env, jobject thiz, jint blocks,
-                                                          jint difficulty, jstring message) {
+Java_edu_singaporetech_btco_BTCOActivity_mineBlocksNative(JNIEnv *env, jobject thiz, jlong chain,
+                                                          jlong job, jint blocks, jint difficulty,
+                                                          jstring message, jint threads) {
 
-    // Mine genesis block
-    const char genesisData[] = "The Times 03/Jan/2009 Chancellor on brink of second bailout for banks";
+    Chain* c = (Chain*)(intptr_t)chain;
+    MiningControl* control = startJob(env, job);
     const char* message_str = (*env)->GetStringUTFChars(env, message, 0);
-    BlockHeader genesisBlock = addBlockWithPrevPtr(NULL, genesisData, sizeof(genesisData), difficulty);
-
-    // Log timestamp of genesis block
-    __android_log_print(ANDROID_LOG_INFO, TAG, "Created block with timestamp=%u nonce=%d",
-                        genesisBlock.timestamp, genesisBlock.nonce);
-
-    // Do linked list stuff
-    BlockHeader* prevBlock = &genesisBlock;
-    BlockHeader* lastBlock = NULL;
-    for (int i = 1; i < blocks; i++) {
-        BlockHeader newBlock = addBlockWithPrevPtr(prevBlock, message_str, sizeof(genesisData)+1, difficulty);
-        prevBlock = &newBlock;
-        __android_log_print(ANDROID_LOG_INFO, TAG, "Created block with timestamp=%u nonce=%d",
-                            newBlock.timestamp, newBlock.nonce);
-        if (i == blocks - 1) {
-            lastBlock = &newBlock;
-        }
+    if (!message_str)
+        return NULL;
+    const uint64_t length = (uint64_t)(*env)->GetStringUTFLength(env, message) + 1;
+
+    // the length the chain is mined up to: the genesis block, once per chain, then the others
+    uint64_t target = (c->count ? c->count : 1) + (uint64_t)(blocks > 1 ? blocks - 1 : 0);
+    ChainStore* store = control && control->checkpointPath ?
+            openCheckpointStore(c, control->checkpointPath, &target) : NULL;
+    if (control)
+        control->checkpointPosition = target;
+
+    // Mine genesis block, once per chain
+    const ChainBlock* lastBlock = mineGenesisOnce(c, job, control, difficulty, threads);
+
+    // the chain keeps the blocks (and the hash of the last one to mine the next one on top)
+    while (lastBlock && c->count < target) {
+        if (store && chainExport(c, store) != 0)
+            logPrint(LOG_LEVEL_ERROR, TAG, "chainExport:%s", strerror(errno));
+        lastBlock = mineLogged(c, job, control, message_str, length, difficulty, threads);
+    }
+    (*env)->ReleaseStringUTFChars(env, message, message_str);
+
+    // once done, the job is gone with its checkpoint, else it is there to go on with
+    if (store) {
+        if (lastBlock && chainExport(c, store) != 0)
+            logPrint(LOG_LEVEL_ERROR, TAG, "chainExport:%s", strerror(errno));
+        chainStoreClose(store);
+        if (lastBlock)
+            removeCheckpoint(control->checkpointPath);
     }
 
     // Convert hash to string
-    char hashStr[HASH_LEN * 2 + 1];
-    makeCStringFromBytes(lastBlock->dataHash, hashStr, HASH_LEN);
-    return (*env)->NewStringUTF(env, hashStr);
-}
\ No newline at end of file
+    return lastBlock ? dataHashString(env, lastBlock) : NULL;
+}
+
+/**
+ * @brief Mine a block of binary data on top of a native chain, hashed straight from the buffer
+ * - the genesis block is mined first if the chain does not have one yet
+ *
+ * @param chain handle of the chain
+ * @param job handle of the mining job, 0 for none
+ * @param payload a direct ByteBuffer, the data of the block is from its position to its limit
+ * @param difficulty network difficulty
+ * @param threads number of mining threads, 0 for one per core
+ *
+ * @return dataHash of the block, null if cancelled; throws IllegalArgumentException if the
+ *         buffer is not direct
+ */
+JNIEXPORT jstring JNICALL
+Java_edu_singaporetech_btco_BTCOActivity_mineBufferNative(JNIEnv *env, jobject thiz, jlong chain,
+                                                          jlong job, jobject payload,
+                                                          jint difficulty, jint threads) {
+
+    Chain* c = (Chain*)(intptr_t)chain;
+    MiningControl* control = startJob(env, job);
+    uint64_t length;
+    const uint8_t* bytes = directBytes(env, payload, &length);
+    if (!bytes || !mineGenesisOnce(c, job, control, difficulty, threads))
+        return NULL;
+    const ChainBlock* block = mineLogged(c, job, control, bytes, length, difficulty, threads);
+    return block ? dataHashString(env, block) : NULL;
+}
+
+/**
+ * @brief Mine a block per direct ByteBuffer on top of a native chain, in order
+ * - the genesis block is mined first if the chain does not have one yet
+ *
+ * @param chain handle of the chain
+ * @param job handle of the mining job, 0 for none
+ * @param payloads direct ByteBuffers, the data of each block is from its position to its limit
+ * @param difficulty network difficulty
+ * @param threads number of mining threads, 0 for one per core
+ *
+ * @return dataHash of the last block, null if cancelled or there are no payloads (the blocks
+ *         mined until then stay in the chain); throws IllegalArgumentException at the first
+ *         buffer that is not direct
+ */
+JNIEXPORT jstring JNICALL
+Java_edu_singaporetech_btco_BTCOActivity_mineBuffersNative(JNIEnv *env, jobject thiz, jlong chain,
+                                                           jlong job, jobjectArray payloads,
+                                                           jint difficulty, jint threads) {
+
+    Chain* c = (Chain*)(intptr_t)chain;
+    MiningControl* control = startJob(env, job);
+    const jsize count = (*env)->GetArrayLength(env, payloads);
+    if (count == 0 || !mineGenesisOnce(c, job, control, difficulty, threads))
+        return NULL;
+    const ChainBlock* lastBlock = NULL;
+    for (jsize i = 0; i < count; i++) {
+        // NOTE a thread only has room for so many local refs, so each goes as soon as it is used
+        jobject payload = (*env)->GetObjectArrayElement(env, payloads, i);
+        uint64_t length;
+        const uint8_t* bytes = directBytes(env, payload, &length);
+        lastBlock = bytes ? mineLogged(c, job, control, bytes, length, difficulty, threads) : NULL;
+        (*env)->DeleteLocalRef(env, payload);
+        if (!lastBlock)
+            return NULL;
+    }
+    return lastBlock ? dataHashString(env, lastBlock) : NULL;
+}
+
+/**
+ * @brief Get a snapshot of the mining metrics, counted since the app started
+ *
+ * @return the counters, histograms and per-thread hashes, laid out as STAT_* says, null if out of
+ *         memory
+ */
+JNIEXPORT jlongArray JNICALL
+Java_edu_singaporetech_btco_BTCOActivity_metricsSnapshotNative(JNIEnv *env, jobject thiz) {
+
+    MetricsSnapshot snapshot;
+    metricsSnapshot(&snapshot);
+
+    jlong stats[STAT_HISTOGRAMS + METRICS_HISTOGRAMS * METRICS_BUCKETS + METRICS_MAX_THREADS];
+    stats[STAT_HASHES] = (jlong)snapshot.total.hashes;
+    stats[STAT_SHA256_CALLS] = (jlong)snapshot.total.sha256Calls;
+    stats[STAT_SHA256_BYTES] = (jlong)snapshot.total.sha256Bytes;
+    stats[STAT_BLOCKS] = (jlong)snapshot.total.blocks;
+    stats[STAT_ROLLOVERS] = (jlong)snapshot.total.rollovers;
+    stats[STAT_SOLVE_NS] = (jlong)snapshot.total.solveNs;
+    stats[STAT_ELAPSED_NS] = (jlong)snapshot.elapsedNs;
+    stats[STAT_THREADS] = snapshot.threads;
+    stats[STAT_MINING_NS] = (jlong)snapshot.total.miningNs;
+    jsize n = STAT_HISTOGRAMS;
+    for (int h = 0; h < METRICS_HISTOGRAMS; ++h)
+        for (int b = 0; b < METRICS_BUCKETS; ++b)
+            stats[n++] = (jlong)snapshot.histograms[h][b];
+    for (int i = 0; i < snapshot.threads; ++i)
+        stats[n++] = (jlong)snapshot.perThread[i].hashes;
+
+    jlongArray array = (*env)->NewLongArray(env, n);
+    if (array)
+        (*env)->SetLongArrayRegion(env, array, 0, n, stats);
+    return array;
+}
+
+/**
+ * @brief Measure the hashrate of mining with a thread count, once: it is cached after that
+ * - takes CALIBRATION_MS the first time, call it at startup rather than before mining
+ *
+ * @param threads number of mining threads, 0 for one per core
+ * @return hashes per second
+ */
+JNIEXPORT jdouble JNICALL
+Java_edu_singaporetech_btco_BTCOActivity_calibrateNative(JNIEnv *env, jobject thiz, jint threads) {
+
+    return calibrateHashrate(HEADER_VERSION_SHA256, threads);
+}
+
+/**
+ * @brief Estimate how long mining some blocks takes, e.g. to turn down jobs that take too long
+ *
+ * @param difficulty network difficulty
+ * @param blocks number of blocks
+ * @param threads number of mining threads, 0 for one per core
+ * @return expected hashes, hashrate, expected and 95% time in seconds, laid out as ESTIMATE_*
+ *         says, null if out of memory
+ */
+JNIEXPORT jdoubleArray JNICALL
+Java_edu_singaporetech_btco_BTCOActivity_estimateNative(JNIEnv *env, jobject thiz, jint difficulty,
+                                                        jint blocks, jint threads) {
+
+    MiningEstimate estimate;
+    estimateMining(difficultyBits(difficulty), blocks > 0 ? (uint64_t)blocks : 1,
+                   calibrateHashrate(HEADER_VERSION_SHA256, threads), &estimate);
+
+    jdouble fields[ESTIMATE_FIELDS];
+    fields[ESTIMATE_ATTEMPTS] = estimate.attempts;
+    fields[ESTIMATE_HASHRATE] = estimate.hashrate;
+    fields[ESTIMATE_EXPECTED_SEC] = estimate.expectedSec;
+    fields[ESTIMATE_P95_SEC] = estimate.p95Sec;
+    jdoubleArray array = (*env)->NewDoubleArray(env, ESTIMATE_FIELDS);
+    if (array)
+        (*env)->SetDoubleArrayRegion(env, array, 0, ESTIMATE_FIELDS, fields);
+    return array;
+}
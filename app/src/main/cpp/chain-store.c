@@ -0,0 +1,576 @@
+/*
+ * Append-only, indexed, memory-mapped storage of a whole chain (see chain-store.h).
+ */
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "sha-256.h"
+#include "blockchain.h"
+#include "chain-store.h"
+
+#define CHAIN_MAGIC "BTCOCHN3"
+#define INDEX_MAGIC "BTCOIDX2"
+#define MAGIC_LEN 8
+
+// bytes of the file header of both the main file and the index
+#define FILE_HEADER_LEN 64
+
+// a record: serialized header, hash, payload offset (u64), payload length (u32), payload kind (u32),
+// crc32, all the numbers little-endian
+#define RECORD_LEN 136
+#define RECORD_HASH 84
+#define RECORD_OFFSET 116
+#define RECORD_LENGTH 124
+#define RECORD_KIND 128
+#define RECORD_CRC 132
+
+// the index header: magic, capacity (u64), count (u64), clean (u32), then capacity u64 slots
+#define INDEX_CAPACITY 8
+#define INDEX_COUNT 16
+#define INDEX_CLEAN 24
+#define INDEX_MIN_CAPACITY 1024
+
+// records the main file is mapped for at first, the mapping then doubles as needed
+#define MIN_MAPPED_RECORDS 1024
+
+// bytes copied at a time by chainStoreAppendFd
+#define COPY_BUFFER (1 << 20)
+
+_Static_assert(HEADER_SIZE == RECORD_HASH, "the hash must follow the serialized header");
+
+struct ChainStore {
+    int flags;
+    int fd;          // main file: file header, then records
+    int dataFd;      // payloads
+    int indexFd;     // hash -> height, -1 if the index only lives in memory (read-only store)
+    uint8_t* map;    // main file, mapped past its end so that appends rarely need a new mapping
+    size_t mapSize;
+    uint64_t count;  // records
+    uint64_t dataEnd;
+    uint8_t* index;  // index file header then slots
+    size_t indexSize;
+};
+
+static const uint32_t CRC_NIBBLES[16] = {
+        0x00000000, 0x1db71064, 0x3b6e20c8, 0x26d930ac, 0x76dc4190, 0x6b6b51f4, 0x4db26158, 0x5005713c,
+        0xedb88320, 0xf00f9344, 0xd6d6a3e8, 0xcb61b38c, 0x9b64c2b0, 0x86d3d2d4, 0xa00ae278, 0xbdbdf21c
+};
+
+/**
+ * CRC32 (the zlib/PNG one), a nibble at a time, records are too small to need more.
+ */
+static uint32_t crc32(const uint8_t* p, size_t size) {
+    uint32_t crc = 0xffffffff;
+    while (size--) {
+        crc ^= *p++;
+        crc = (crc >> 4) ^ CRC_NIBBLES[crc & 15];
+        crc = (crc >> 4) ^ CRC_NIBBLES[crc & 15];
+    }
+    return ~crc;
+}
+
+static void storeLe32(uint8_t* p, uint32_t v) {
+    for (int i = 0; i < 4; ++i)
+        p[i] = (uint8_t)(v >> (8 * i));
+}
+
+static void storeLe64(uint8_t* p, uint64_t v) {
+    for (int i = 0; i < 8; ++i)
+        p[i] = (uint8_t)(v >> (8 * i));
+}
+
+static uint32_t loadLe32(const uint8_t* p) {
+    uint32_t v = 0;
+    for (int i = 3; i >= 0; --i)
+        v = v << 8 | p[i];
+    return v;
+}
+
+static uint64_t loadLe64(const uint8_t* p) {
+    uint64_t v = 0;
+    for (int i = 7; i >= 0; --i)
+        v = v << 8 | p[i];
+    return v;
+}
+
+static const uint8_t* recordAt(const ChainStore* store, const uint64_t height) {
+    return store->map + FILE_HEADER_LEN + height * RECORD_LEN;
+}
+
+static uint64_t payloadEnd(const uint8_t* record) {
+    return loadLe64(record + RECORD_OFFSET) + loadLe32(record + RECORD_LENGTH);
+}
+
+static int pwriteAll(const int fd, const void* buf, size_t size, uint64_t offset) {
+    const uint8_t* p = buf;
+    while (size > 0) {
+        ssize_t n = pwrite(fd, p, size, (off_t)offset);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            return -1;
+        }
+        p += n;
+        size -= (size_t)n;
+        offset += (uint64_t)n;
+    }
+    return 0;
+}
+
+/**
+ * Map the main file for at least records records.
+ * @return 0 on success, -1 on error with errno set (the old mapping is kept)
+ */
+static int mapRecords(ChainStore* store, const uint64_t records) {
+    const size_t needed = FILE_HEADER_LEN + (size_t)records * RECORD_LEN;
+    if (needed <= store->mapSize)
+        return 0;
+
+    size_t size = store->mapSize ? store->mapSize : FILE_HEADER_LEN + MIN_MAPPED_RECORDS * RECORD_LEN;
+    while (size < needed)
+        size *= 2;
+    // NOTE only the part up to the end of the file is ever read, the rest is room to grow into,
+    //      records are written with pwrite which the shared mapping sees
+    uint8_t* map = mmap(NULL, size, PROT_READ, MAP_SHARED, store->fd, 0);
+    if (map == MAP_FAILED)
+        return -1;
+    if (store->map)
+        munmap(store->map, store->mapSize);
+    store->map = map;
+    store->mapSize = size;
+    return 0;
+}
+
+static uint64_t* indexSlots(const ChainStore* store) {
+    return (uint64_t*)(store->index + FILE_HEADER_LEN);
+}
+
+static uint64_t indexCapacity(const ChainStore* store) {
+    return loadLe64(store->index + INDEX_CAPACITY);
+}
+
+/**
+ * Get the key of a block hash in the index.
+ * - from the last 8 bytes of the hash: the proof of work makes the first ones 0, which would put
+ *   every block in the same few slots; mixed (the splitmix64 finalizer) to be safe either way
+ */
+static uint64_t indexKey(const uint8_t hash[HASH_LEN]) {
+    uint64_t key = loadLe64(hash + HASH_LEN - 8);
+    key = (key ^ (key >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    key = (key ^ (key >> 27)) * 0x94d049bb133111ebULL;
+    return key ^ (key >> 31);
+}
+
+/**
+ * Put a block in the index, unless it is there already.
+ */
+static void indexInsert(ChainStore* store, const uint64_t height) {
+    const uint64_t mask = indexCapacity(store) - 1;
+    uint64_t* slots = indexSlots(store);
+    const uint64_t key = indexKey(recordAt(store, height) + RECORD_HASH);
+
+    // linear probing, the slots hold height + 1 so that 0 is an empty slot
+    for (uint64_t i = key & mask; ; i = (i + 1) & mask) {
+        if (slots[i] == 0) {
+            slots[i] = height + 1;
+            break;
+        }
+        if (slots[i] == height + 1)
+            break;
+    }
+    if (loadLe64(store->index + INDEX_COUNT) < height + 1)
+        storeLe64(store->index + INDEX_COUNT, height + 1);
+}
+
+/**
+ * Make a new, empty index with room for capacity blocks (a power of 2), then index every block.
+ * @return 0 on success, -1 on error with errno set
+ */
+static int indexRebuild(ChainStore* store, const uint64_t capacity) {
+    const size_t size = FILE_HEADER_LEN + (size_t)capacity * sizeof(uint64_t);
+    uint8_t* index;
+    if (store->indexFd >= 0) {
+        // truncate first so that all the slots read back as 0
+        if (ftruncate(store->indexFd, 0) != 0 || ftruncate(store->indexFd, (off_t)size) != 0)
+            return -1;
+        index = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, store->indexFd, 0);
+    } else {
+        index = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    }
+    if (index == MAP_FAILED)
+        return -1;
+
+    if (store->index)
+        munmap(store->index, store->indexSize);
+    store->index = index;
+    store->indexSize = size;
+    memcpy(index, INDEX_MAGIC, MAGIC_LEN);
+    storeLe64(index + INDEX_CAPACITY, capacity);
+    storeLe64(index + INDEX_COUNT, 0);
+    storeLe32(index + INDEX_CLEAN, 0);
+    for (uint64_t height = 0; height < store->count; ++height)
+        indexInsert(store, height);
+    return 0;
+}
+
+/**
+ * Make sure the index has room for records blocks, at most half full.
+ * @return 0 on success, -1 on error with errno set
+ */
+static int indexReserve(ChainStore* store, const uint64_t records) {
+    uint64_t capacity = store->index ? indexCapacity(store) : INDEX_MIN_CAPACITY;
+    if (store->index && records * 2 <= capacity)
+        return 0;
+    while (records * 2 > capacity)
+        capacity *= 2;
+    return indexRebuild(store, capacity);
+}
+
+/**
+ * Open (or make) the index of a store, whose records are already loaded.
+ * - a cleanly closed index is used as is, but for the blocks it is missing (if any)
+ * - any other index is rebuilt from the records
+ * @return 0 on success, -1 on error with errno set
+ */
+static int indexOpen(ChainStore* store, const char* path) {
+    const int readOnly = store->flags & CHAIN_STORE_READONLY;
+    store->indexFd = open(path, (readOnly ? O_RDONLY : O_RDWR | O_CREAT) | O_CLOEXEC, 0644);
+    if (store->indexFd < 0 && !(readOnly && errno == ENOENT))
+        return -1;
+
+    struct stat st;
+    if (store->indexFd >= 0 && fstat(store->indexFd, &st) == 0 && st.st_size >= FILE_HEADER_LEN) {
+        const size_t size = (size_t)st.st_size;
+        uint8_t* index = mmap(NULL, size, readOnly ? PROT_READ : PROT_READ | PROT_WRITE,
+                              MAP_SHARED, store->indexFd, 0);
+        if (index != MAP_FAILED) {
+            const uint64_t capacity = loadLe64(index + INDEX_CAPACITY);
+            const uint64_t count = loadLe64(index + INDEX_COUNT);
+            const int usable = memcmp(index, INDEX_MAGIC, MAGIC_LEN) == 0 &&
+                    capacity >= INDEX_MIN_CAPACITY && (capacity & (capacity - 1)) == 0 &&
+                    size == FILE_HEADER_LEN + capacity * sizeof(uint64_t) &&
+                    loadLe32(index + INDEX_CLEAN) == 1 && count <= store->count &&
+                    (readOnly ? count == store->count : store->count * 2 <= capacity);
+            if (usable) {
+                store->index = index;
+                store->indexSize = size;
+                for (uint64_t height = count; height < store->count; ++height)
+                    indexInsert(store, height);
+                return 0;
+            }
+            munmap(index, size);
+        }
+    }
+
+    // a read-only store can't fix its index file, so it indexes its blocks in memory instead
+    if (readOnly && store->indexFd >= 0) {
+        close(store->indexFd);
+        store->indexFd = -1;
+    }
+    return indexReserve(store, store->count);
+}
+
+/**
+ * Cut off what a crash may have left half-written at the end of the store.
+ * - the last records are dropped until one has a good checksum and all of its payload
+ * - the payloads past the last record are dropped
+ * @return 0 on success, -1 on error with errno set
+ */
+static int recover(ChainStore* store, uint64_t records, const uint64_t dataSize) {
+    while (records > 0) {
+        const uint8_t* record = recordAt(store, records - 1);
+        if (crc32(record, RECORD_CRC) == loadLe32(record + RECORD_CRC) &&
+            payloadEnd(record) <= dataSize)
+            break;
+        --records;
+    }
+    store->count = records;
+    store->dataEnd = records ? payloadEnd(recordAt(store, records - 1)) : 0;
+
+    if (store->flags & CHAIN_STORE_READONLY)
+        return 0;
+    if (ftruncate(store->fd, (off_t)(FILE_HEADER_LEN + records * RECORD_LEN)) != 0)
+        return -1;
+    return ftruncate(store->dataFd, (off_t)store->dataEnd);
+}
+
+/**
+ * Open the file path + suffix.
+ */
+static int openWithSuffix(const char* path, const char* suffix, const int flags) {
+    char* name = malloc(strlen(path) + strlen(suffix) + 1);
+    if (!name) {
+        errno = ENOMEM;
+        return -1;
+    }
+    strcpy(name, path);
+    strcat(name, suffix);
+    const int fd = open(name, flags, 0644);
+    free(name);
+    return fd;
+}
+
+ChainStore* chainStoreOpen(const char* path, const int flags) {
+    ChainStore* store = calloc(1, sizeof(ChainStore));
+    if (!store) {
+        errno = ENOMEM;
+        return NULL;
+    }
+    store->flags = flags;
+    store->fd = store->dataFd = store->indexFd = -1;
+    int err;
+
+    const int openFlags = (flags & CHAIN_STORE_READONLY ? O_RDONLY : O_RDWR | O_CREAT) | O_CLOEXEC;
+    struct stat st, dataSt;
+    store->fd = open(path, openFlags, 0644);
+    if (store->fd < 0)
+        goto fail;
+    // one writer at a time, and no readers meanwhile: 2 writers would append at the same height
+    // NOTE released by closing the file
+    if (flock(store->fd, (flags & CHAIN_STORE_READONLY ? LOCK_SH : LOCK_EX) | LOCK_NB) != 0 ||
+        fstat(store->fd, &st) != 0)
+        goto fail;
+    store->dataFd = openWithSuffix(path, ".dat", openFlags);
+    if (store->dataFd < 0 || fstat(store->dataFd, &dataSt) != 0)
+        goto fail;
+
+    // a new store
+    if (st.st_size == 0 && !(flags & CHAIN_STORE_READONLY)) {
+        uint8_t fileHeader[FILE_HEADER_LEN] = { 0 };
+        memcpy(fileHeader, CHAIN_MAGIC, MAGIC_LEN);
+        storeLe32(fileHeader + MAGIC_LEN, RECORD_LEN);
+        if (pwriteAll(store->fd, fileHeader, sizeof(fileHeader), 0) != 0)
+            goto fail;
+        st.st_size = FILE_HEADER_LEN;
+    }
+
+    const uint64_t records = st.st_size >= FILE_HEADER_LEN ?
+            (uint64_t)(st.st_size - FILE_HEADER_LEN) / RECORD_LEN : 0;
+    if (mapRecords(store, records) != 0)
+        goto fail;
+    if (st.st_size < FILE_HEADER_LEN || memcmp(store->map, CHAIN_MAGIC, MAGIC_LEN) != 0 ||
+        loadLe32(store->map + MAGIC_LEN) != RECORD_LEN) {
+        errno = EINVAL;
+        goto fail;
+    }
+    if (recover(store, records, (uint64_t)dataSt.st_size) != 0)
+        goto fail;
+
+    char* indexPath = malloc(strlen(path) + sizeof(".idx"));
+    if (!indexPath) {
+        errno = ENOMEM;
+        goto fail;
+    }
+    strcpy(indexPath, path);
+    strcat(indexPath, ".idx");
+    const int rc = indexOpen(store, indexPath);
+    free(indexPath);
+    if (rc != 0)
+        goto fail;
+
+    // until it is closed, the index is only as good as the last crash left it
+    if (!(flags & CHAIN_STORE_READONLY))
+        storeLe32(store->index + INDEX_CLEAN, 0);
+    return store;
+
+fail:
+    err = errno;
+    // close without touching the files, whatever is in them
+    store->flags |= CHAIN_STORE_READONLY;
+    chainStoreClose(store);
+    errno = err;
+    return NULL;
+}
+
+int chainStoreClose(ChainStore* store) {
+    if (!store)
+        return 0;
+
+    int rc = 0;
+    if (!(store->flags & CHAIN_STORE_READONLY) && store->index) {
+        // the index is up to date as it is only written by the one open store
+        storeLe32(store->index + INDEX_CLEAN, 1);
+        if (msync(store->index, store->indexSize, MS_SYNC) != 0)
+            rc = -1;
+    }
+    if (!(store->flags & CHAIN_STORE_READONLY)) {
+        // drop whatever a failed append left past the last payload
+        if (ftruncate(store->dataFd, (off_t)store->dataEnd) != 0)
+            rc = -1;
+        if (store->flags & CHAIN_STORE_SYNC && (fsync(store->dataFd) != 0 || fsync(store->fd) != 0))
+            rc = -1;
+    }
+
+    const int err = errno;
+    if (store->index)
+        munmap(store->index, store->indexSize);
+    if (store->map)
+        munmap(store->map, store->mapSize);
+    if (store->indexFd >= 0)
+        close(store->indexFd);
+    if (store->dataFd >= 0)
+        close(store->dataFd);
+    if (store->fd >= 0)
+        close(store->fd);
+    free(store);
+    errno = err;
+    return rc;
+}
+
+uint64_t chainStoreCount(const ChainStore* store) {
+    return store->count;
+}
+
+/**
+ * Check that a block can go on top of the store, and make room for it.
+ * @return 0 if it can, -1 if not with errno set
+ */
+static int prepareAppend(ChainStore* store, const BlockHeader* header, const int payloadKind) {
+    if (store->flags & CHAIN_STORE_READONLY) {
+        errno = EBADF;
+        return -1;
+    }
+    if (payloadKind != CHAIN_PAYLOAD_RAW && payloadKind != CHAIN_PAYLOAD_MERKLE) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    static const uint8_t NO_HASH[HASH_LEN];
+    const uint8_t* tipHash = store->count ? recordAt(store, store->count - 1) + RECORD_HASH : NO_HASH;
+    if (memcmp(header->previousHeaderHash, tipHash, HASH_LEN) != 0) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    // so that nothing can fail once the block is written
+    if (mapRecords(store, store->count + 1) != 0 || indexReserve(store, store->count + 1) != 0)
+        return -1;
+    return 0;
+}
+
+/**
+ * Write the record of a block whose payload was written at the end of the payloads.
+ * @return 0 on success, -1 on error with errno set
+ */
+static int commitAppend(ChainStore* store, const BlockHeader* header, const uint64_t length,
+                        const int payloadKind) {
+    if (length > UINT32_MAX) {
+        errno = EFBIG;
+        return -1;
+    }
+    // NOTE the payload written past dataEnd is just written over by the next block
+    if (payloadKind == CHAIN_PAYLOAD_RAW && length != header->dataLength) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    uint8_t record[RECORD_LEN];
+    serializeHeader(header, record);
+    hashHeader(header, record + RECORD_HASH);
+    storeLe64(record + RECORD_OFFSET, store->dataEnd);
+    storeLe32(record + RECORD_LENGTH, (uint32_t)length);
+    storeLe32(record + RECORD_KIND, (uint32_t)payloadKind);
+    storeLe32(record + RECORD_CRC, crc32(record, RECORD_CRC));
+
+    // the payload must be on disk before the record that says it is there
+    if (store->flags & CHAIN_STORE_SYNC && fdatasync(store->dataFd) != 0)
+        return -1;
+    if (pwriteAll(store->fd, record, sizeof(record), FILE_HEADER_LEN + store->count * RECORD_LEN) != 0)
+        return -1;
+    if (store->flags & CHAIN_STORE_SYNC && fdatasync(store->fd) != 0)
+        return -1;
+
+    store->dataEnd += length;
+    indexInsert(store, store->count++);
+    return 0;
+}
+
+int chainStoreAppend(ChainStore* store, const BlockHeader* header, const void* payload,
+                     const uint64_t length, const int payloadKind) {
+    if (prepareAppend(store, header, payloadKind) != 0)
+        return -1;
+    if (length > UINT32_MAX) {
+        errno = EFBIG;
+        return -1;
+    }
+    if (length > 0 && pwriteAll(store->dataFd, payload, (size_t)length, store->dataEnd) != 0)
+        return -1;
+    return commitAppend(store, header, length, payloadKind);
+}
+
+int chainStoreAppendFd(ChainStore* store, const BlockHeader* header, const int fd) {
+    if (prepareAppend(store, header, CHAIN_PAYLOAD_RAW) != 0)
+        return -1;
+
+    uint8_t* buf = malloc(COPY_BUFFER);
+    if (!buf) {
+        errno = ENOMEM;
+        return -1;
+    }
+    uint64_t length = 0;
+    while (1) {
+        ssize_t n = read(fd, buf, COPY_BUFFER);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n < 0 || (n > 0 && pwriteAll(store->dataFd, buf, (size_t)n, store->dataEnd + length) != 0)) {
+            free(buf);
+            return -1;
+        }
+        if (n == 0)
+            break;
+        length += (uint64_t)n;
+    }
+    free(buf);
+    return commitAppend(store, header, length, CHAIN_PAYLOAD_RAW);
+}
+
+int chainStoreGet(const ChainStore* store, const uint64_t height, BlockHeader* header,
+                  uint8_t hash[HASH_LEN]) {
+    if (height >= store->count) {
+        errno = ERANGE;
+        return -1;
+    }
+    const uint8_t* record = recordAt(store, height);
+    if (header)
+        deserializeHeader(record, header);
+    if (hash)
+        memcpy(hash, record + RECORD_HASH, HASH_LEN);
+    return 0;
+}
+
+int64_t chainStoreFind(const ChainStore* store, const uint8_t hash[HASH_LEN]) {
+    const uint64_t mask = indexCapacity(store) - 1;
+    const uint64_t* slots = indexSlots(store);
+    const uint64_t key = indexKey(hash);
+
+    for (uint64_t i = key & mask; slots[i] != 0; i = (i + 1) & mask) {
+        // NOTE a slot may be left over from blocks cut off by a crash, hence the height check
+        const uint64_t height = slots[i] - 1;
+        if (height < store->count && memcmp(recordAt(store, height) + RECORD_HASH, hash, HASH_LEN) == 0)
+            return (int64_t)height;
+    }
+    return -1;
+}
+
+int chainStorePayload(const ChainStore* store, const uint64_t height, int* fd, uint64_t* offset,
+                      uint64_t* length, int* payloadKind) {
+    if (height >= store->count) {
+        errno = ERANGE;
+        return -1;
+    }
+    const uint8_t* record = recordAt(store, height);
+    *fd = store->dataFd;
+    *offset = loadLe64(record + RECORD_OFFSET);
+    *length = loadLe32(record + RECORD_LENGTH);
+    if (payloadKind)
+        *payloadKind = (int)loadLe32(record + RECORD_KIND);
+    return 0;
+}
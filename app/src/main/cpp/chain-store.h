@@ -0,0 +1,106 @@
+#ifndef BTCO_CHAIN_STORE_H
+#define BTCO_CHAIN_STORE_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "blockchain.h"
+
+// flags of chainStoreOpen
+#define CHAIN_STORE_READONLY 1 // open an existing store for reading only
+#define CHAIN_STORE_SYNC 2     // fsync every append before it returns (slower, survives power loss)
+
+// what the payload of a block is, see chainStoreAppend
+#define CHAIN_PAYLOAD_RAW 0    // the data hashed into dataHash as is
+#define CHAIN_PAYLOAD_MERKLE 1 // transactions, each as a 32-bit little-endian length then its bytes
+
+/**
+ * An append-only store of a whole chain, made of 3 files:
+ * - <path>: a small file header then one fixed-size record per block: the header, its (cached)
+ *   hash, where its payload is and a checksum; memory-mapped, so a block is found by height in O(1)
+ * - <path>.dat: the payloads of all the blocks, one after the other
+ * - <path>.idx: an open-addressing hash table from block hash to height, memory-mapped, so a block
+ *   is found by hash in O(1) too
+ * Appends write the payload, then the record, then the index. On open, a torn last record (or
+ * payload) from a crash is cut off using the record checksums, and the index is only rebuilt when
+ * the store was not closed cleanly; a clean reopen reads nothing but the file headers.
+ * NOTE a store is not thread-safe, use it from one thread at a time.
+ */
+typedef struct ChainStore ChainStore;
+
+/**
+ * Open a store, creating it if it does not exist (unless CHAIN_STORE_READONLY).
+ * @param path the path of the main file, the other two are next to it
+ * - the store is locked (see flock) until closed: shared by readers, exclusive to a writer
+ * @param flags CHAIN_STORE_* flags, or 0
+ * @return the store, NULL on error with errno set (EWOULDBLOCK if locked the other way, e.g. by
+ *         another process writing it)
+ */
+ChainStore* chainStoreOpen(const char* path, const int flags);
+
+/**
+ * Flush and close a store.
+ * @param store the store, may be NULL
+ * @return 0 on success, -1 if something could not be flushed (errno set), the store is closed anyway
+ */
+int chainStoreClose(ChainStore* store);
+
+/**
+ * Get the number of blocks in a store.
+ */
+uint64_t chainStoreCount(const ChainStore* store);
+
+/**
+ * Append a block on top of the last one.
+ * - the block must link to the last block (previousHeaderHash), or be a genesis block (all 0s
+ *   previousHeaderHash) for an empty store
+ * @param store the store
+ * @param header the header of the new block
+ * @param payload ptr to the data of the block, may be NULL if length is 0
+ * @param length number of bytes of payload
+ * @param payloadKind CHAIN_PAYLOAD_RAW or CHAIN_PAYLOAD_MERKLE
+ * @return 0 on success, -1 on error with errno set (EINVAL if the block does not link, or a raw
+ *         payload is not of the length of the header's dataLength)
+ */
+int chainStoreAppend(ChainStore* store, const BlockHeader* header, const void* payload,
+                     const uint64_t length, const int payloadKind);
+
+/**
+ * Append a block with a raw payload read from a file descriptor until its end.
+ * - like chainStoreAppend, for payloads too big to be in memory
+ * - EINVAL if what is read is not of the header's dataLength, e.g. the file changed since it was
+ *   hashed
+ */
+int chainStoreAppendFd(ChainStore* store, const BlockHeader* header, const int fd);
+
+/**
+ * Get a block by height.
+ * @param store the store
+ * @param height of the block, 0 is the genesis block
+ * @param header the output header, may be NULL
+ * @param hash the output (cached) hash of the header, may be NULL
+ * @return 0 on success, -1 with errno ERANGE if there is no such block
+ */
+int chainStoreGet(const ChainStore* store, const uint64_t height, BlockHeader* header,
+                  uint8_t hash[HASH_LEN]);
+
+/**
+ * Find a block by the hash of its header.
+ * @return the height of the block, -1 if it is not in the store
+ */
+int64_t chainStoreFind(const ChainStore* store, const uint8_t hash[HASH_LEN]);
+
+/**
+ * Get where the payload of a block is, e.g. to hash or read it.
+ * @param store the store
+ * @param height of the block
+ * @param fd set to the file descriptor of the payload file (owned by the store)
+ * @param offset set to the position of the payload in that file
+ * @param length set to the number of bytes of the payload
+ * @param payloadKind set to CHAIN_PAYLOAD_RAW or CHAIN_PAYLOAD_MERKLE, may be NULL
+ * @return 0 on success, -1 with errno ERANGE if there is no such block
+ */
+int chainStorePayload(const ChainStore* store, const uint64_t height, int* fd, uint64_t* offset,
+                      uint64_t* length, int* payloadKind);
+
+#endif //BTCO_CHAIN_STORE_H
@@ -0,0 +1,185 @@
+/*
+ * A whole chain in memory (see chain.h).
+ */
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+
+#include "sha-256.h"
+#include "blockchain.h"
+#include "chain-store.h"
+#include "chain.h"
+#include "miner.h"
+#include "retarget.h"
+
+void chainInit(Chain* chain) {
+    memset(chain, 0, sizeof(Chain));
+}
+
+void chainFree(Chain* chain) {
+    free(chain->blocks);
+    free(chain->data);
+    chainInit(chain);
+}
+
+void chainReset(Chain* chain) {
+    chain->count = 0;
+    chain->dataSize = 0;
+}
+
+/**
+ * Grow an array to hold at least count items, doubling its capacity.
+ * @return 0 on success, -1 if out of memory (the array is left as it was)
+ */
+static int reserve(void** items, size_t* capacity, const size_t count, const size_t itemSize,
+                   const size_t minCapacity) {
+    if (count <= *capacity)
+        return 0;
+
+    size_t grown = *capacity ? *capacity : minCapacity;
+    while (grown < count)
+        grown *= 2;
+    void* p = realloc(*items, grown * itemSize);
+    if (!p)
+        return -1;
+    *items = p;
+    *capacity = grown;
+    return 0;
+}
+
+/**
+ * Get the target bits of the next block of a chain.
+ */
+static uint32_t chainNextBits(const Chain* chain, const int difficulty) {
+    if (!chain->retarget.intervalSec || chain->count == 0)
+        return difficultyBits(difficulty);
+    // the blocks of the window and the one before it, for the time the window took
+    const size_t window = chain->retarget.window < RETARGET_MAX_WINDOW ?
+            chain->retarget.window : RETARGET_MAX_WINDOW;
+    const size_t n = chain->count < window + 1 ? chain->count : window + 1;
+    return retargetBits(&chain->retarget, &chain->blocks[chain->count - n].header, n,
+                        sizeof(ChainBlock));
+}
+
+const ChainBlock* chainMine(Chain* chain, const void* data, const uint64_t length,
+                            const int difficulty, const int threads, MiningControl* control) {
+    if (length > UINT32_MAX) {
+        errno = EFBIG;
+        return NULL;
+    }
+    // make room first, so that running out of memory does not throw away a mined block
+    if (reserve((void**)&chain->blocks, &chain->capacity, chain->count + 1, sizeof(ChainBlock), 64) != 0 ||
+        reserve((void**)&chain->data, &chain->dataCapacity, chain->dataSize + (size_t)length, 1, 4096) != 0) {
+        errno = ENOMEM;
+        return NULL;
+    }
+
+    ChainBlock* block = &chain->blocks[chain->count];
+    const uint8_t* prevHash = chain->count ? chain->blocks[chain->count - 1].hash : NULL;
+    uint8_t dataHash[HASH_LEN];
+    calc_sha_256(dataHash, data, length);
+    if (addBlockWithBits(prevHash, dataHash, length, chainNextBits(chain, difficulty), threads,
+                         control, &block->header, block->hash) != 0)
+        return NULL;
+
+    block->dataOffset = chain->dataSize;
+    if (length > 0)
+        memcpy(chain->data + chain->dataSize, data, (size_t)length);
+    chain->dataSize += (size_t)length;
+    chain->count++;
+    return block;
+}
+
+const ChainBlock* chainBlock(const Chain* chain, const size_t height) {
+    return height < chain->count ? &chain->blocks[height] : NULL;
+}
+
+const uint8_t* chainBlockData(const Chain* chain, const ChainBlock* block) {
+    return chain->data + block->dataOffset;
+}
+
+int chainExport(const Chain* chain, ChainStore* store) {
+    const uint64_t stored = chainStoreCount(store);
+    uint8_t storedHash[HASH_LEN];
+    if (stored > chain->count ||
+        (stored > 0 && (chainStoreGet(store, stored - 1, NULL, storedHash) != 0 ||
+                        memcmp(storedHash, chain->blocks[stored - 1].hash, HASH_LEN) != 0))) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    for (size_t height = (size_t)stored; height < chain->count; ++height) {
+        const ChainBlock* block = &chain->blocks[height];
+        if (chainStoreAppend(store, &block->header, chainBlockData(chain, block),
+                             block->header.dataLength, CHAIN_PAYLOAD_RAW) != 0)
+            return -1;
+    }
+    return 0;
+}
+
+/**
+ * Read exactly size bytes at an offset of a file.
+ * @return 0 on success, -1 on error with errno set (EIO if the file is shorter)
+ */
+static int readFully(const int fd, uint8_t* p, size_t size, uint64_t offset) {
+    while (size > 0) {
+        const ssize_t n = pread(fd, p, size, (off_t)offset);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0) {
+            if (n == 0)
+                errno = EIO;
+            return -1;
+        }
+        p += n;
+        size -= (size_t)n;
+        offset += (uint64_t)n;
+    }
+    return 0;
+}
+
+int chainImport(Chain* chain, const ChainStore* store) {
+    const uint64_t stored = chainStoreCount(store);
+    uint8_t storedHash[HASH_LEN];
+    if (stored < chain->count ||
+        (chain->count > 0 && (chainStoreGet(store, chain->count - 1, NULL, storedHash) != 0 ||
+                              memcmp(storedHash, chain->blocks[chain->count - 1].hash, HASH_LEN) != 0))) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    const size_t count = chain->count;
+    const size_t dataSize = chain->dataSize;
+    for (uint64_t height = count; height < stored; ++height) {
+        int fd;
+        uint64_t offset, length;
+        int payloadKind;
+        if (chainStorePayload(store, height, &fd, &offset, &length, &payloadKind) != 0)
+            goto fail;
+        if (payloadKind != CHAIN_PAYLOAD_RAW) {
+            errno = EINVAL;
+            goto fail;
+        }
+        if (reserve((void**)&chain->blocks, &chain->capacity, chain->count + 1, sizeof(ChainBlock), 64) != 0 ||
+            reserve((void**)&chain->data, &chain->dataCapacity, chain->dataSize + (size_t)length, 1, 4096) != 0) {
+            errno = ENOMEM;
+            goto fail;
+        }
+        ChainBlock* block = &chain->blocks[chain->count];
+        if (chainStoreGet(store, height, &block->header, block->hash) != 0 ||
+            readFully(fd, chain->data + chain->dataSize, (size_t)length, offset) != 0)
+            goto fail;
+        block->dataOffset = chain->dataSize;
+        chain->dataSize += (size_t)length;
+        chain->count++;
+    }
+    return 0;
+
+fail:
+    chain->count = count;
+    chain->dataSize = dataSize;
+    return -1;
+}
@@ -0,0 +1,110 @@
+#ifndef BTCO_CHAIN_H
+#define BTCO_CHAIN_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "blockchain.h"
+#include "chain-store.h"
+#include "miner.h"
+#include "retarget.h"
+
+/**
+ * A block of a Chain.
+ */
+typedef struct {
+    BlockHeader header;
+
+    // hash of the header, as found by the miner, so that it is never computed again
+    uint8_t hash[HASH_LEN];
+
+    // where the data of the block is in the data arena of the chain (dataLength bytes)
+    size_t dataOffset;
+} ChainBlock;
+
+/**
+ * A whole chain in memory, e.g. for the app to keep between mining requests.
+ * - the blocks are one contiguous (growing) array, and their data another one, so that a chain of
+ *   any length is 2 allocations, walks in order and hands out blocks by height in O(1)
+ * - the tip hash is cached, so adding a block does not rehash the previous header
+ * NOTE a chain is not thread-safe, use it from one thread at a time.
+ */
+typedef struct {
+    ChainBlock* blocks;
+    size_t count;
+    size_t capacity;
+
+    uint8_t* data;
+    size_t dataSize;
+    size_t dataCapacity;
+
+    // how the blocks after the genesis one are retargeted, off (intervalSec 0) by default, see
+    // retargetInit
+    Retarget retarget;
+} Chain;
+
+/**
+ * Start an empty chain.
+ * @param chain the chain to initialize
+ */
+void chainInit(Chain* chain);
+
+/**
+ * Release everything a chain holds, it can be initialized again after that.
+ * @param chain the chain to free
+ */
+void chainFree(Chain* chain);
+
+/**
+ * Drop all the blocks of a chain, keeping its memory for the next ones.
+ * @param chain the chain to empty
+ */
+void chainReset(Chain* chain);
+
+/**
+ * Mine a new block on top of a chain, the genesis block if it is empty.
+ * NOTE that this func includes mining that may take a LONG TIME.
+ * @param chain the chain to add to
+ * @param data ptr to the data of the block, copied into the chain
+ * @param length number of bytes of data
+ * @param difficulty of the mining task, expressed as a number from 1..10, only that of the genesis
+ *                   block if the chain retargets (the others get the bits of retargetBits)
+ * @param threads number of mining threads, MINER_AUTO_THREADS for one per core
+ * @param control to cancel mining and follow its progress, may be NULL
+ * @return the new block, NULL on error with errno set (ENOMEM, EFBIG if the data is too long
+ *         for dataLength, ECANCELED if cancelled), the chain is left as it was
+ */
+const ChainBlock* chainMine(Chain* chain, const void* data, const uint64_t length,
+                            const int difficulty, const int threads, MiningControl* control);
+
+/**
+ * Get a block of a chain by height.
+ * @return the block, valid until the chain changes, NULL if there is no such block
+ */
+const ChainBlock* chainBlock(const Chain* chain, const size_t height);
+
+/**
+ * Get the data of a block of a chain.
+ * @return ptr to the header.dataLength bytes of data of the block, valid until the chain changes
+ */
+const uint8_t* chainBlockData(const Chain* chain, const ChainBlock* block);
+
+/**
+ * Save a chain into a store, i.e., append the blocks the store does not have yet.
+ * @param chain the chain
+ * @param store the store, empty or holding the first blocks of this very chain
+ * @return 0 on success, -1 on error with errno set (EINVAL if the store holds another chain)
+ */
+int chainExport(const Chain* chain, ChainStore* store);
+
+/**
+ * Load the blocks of a store a chain does not have yet, e.g. to go on with a chain saved by
+ * chainExport before the process was gone.
+ * @param chain the chain, empty or holding the first blocks of the chain in the store
+ * @param store the store, of blocks with raw payloads
+ * @return 0 on success, -1 on error with errno set (EINVAL if the store holds another chain or
+ *         Merkle payloads, ENOMEM), the chain is left as it was
+ */
+int chainImport(Chain* chain, const ChainStore* store);
+
+#endif //BTCO_CHAIN_H
@@ -0,0 +1,149 @@
+/*
+ * Mining checkpoints in small files (see checkpoint.h).
+ */
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "blockchain.h"
+#include "checkpoint.h"
+
+#define CHECKPOINT_MAGIC "BTCOCKP2"
+#define MAGIC_LEN 8
+
+// the file: magic, position (u64), header, target, segments, crc32 of all that, little-endian
+#define FILE_POSITION 8
+#define FILE_HEADER 16
+#define FILE_TARGET (FILE_HEADER + HEADER_SIZE)
+#define FILE_SEGMENTS (FILE_TARGET + HASH_LEN)
+#define FILE_CRC (FILE_SEGMENTS + CHECKPOINT_SEGMENTS / 8)
+#define FILE_LEN (FILE_CRC + 4)
+
+static const uint32_t CRC_NIBBLES[16] = {
+        0x00000000, 0x1db71064, 0x3b6e20c8, 0x26d930ac, 0x76dc4190, 0x6b6b51f4, 0x4db26158, 0x5005713c,
+        0xedb88320, 0xf00f9344, 0xd6d6a3e8, 0xcb61b38c, 0x9b64c2b0, 0x86d3d2d4, 0xa00ae278, 0xbdbdf21c
+};
+
+/**
+ * CRC32 (the zlib/PNG one), a nibble at a time, checkpoints are too small to need more.
+ */
+static uint32_t crc32(const uint8_t* p, size_t size) {
+    uint32_t crc = 0xffffffff;
+    while (size--) {
+        crc ^= *p++;
+        crc = (crc >> 4) ^ CRC_NIBBLES[crc & 15];
+        crc = (crc >> 4) ^ CRC_NIBBLES[crc & 15];
+    }
+    return ~crc;
+}
+
+static void storeLe32(uint8_t* p, uint32_t v) {
+    for (int i = 0; i < 4; ++i)
+        p[i] = (uint8_t)(v >> (8 * i));
+}
+
+static void storeLe64(uint8_t* p, uint64_t v) {
+    for (int i = 0; i < 8; ++i)
+        p[i] = (uint8_t)(v >> (8 * i));
+}
+
+static uint32_t loadLe32(const uint8_t* p) {
+    uint32_t v = 0;
+    for (int i = 3; i >= 0; --i)
+        v = v << 8 | p[i];
+    return v;
+}
+
+static uint64_t loadLe64(const uint8_t* p) {
+    uint64_t v = 0;
+    for (int i = 7; i >= 0; --i)
+        v = v << 8 | p[i];
+    return v;
+}
+
+int checkpointSave(const char* path, const MiningCheckpoint* checkpoint) {
+    uint8_t file[FILE_LEN];
+    memcpy(file, CHECKPOINT_MAGIC, MAGIC_LEN);
+    storeLe64(file + FILE_POSITION, checkpoint->position);
+    memcpy(file + FILE_HEADER, checkpoint->header, HEADER_SIZE);
+    memcpy(file + FILE_TARGET, checkpoint->targetHash, HASH_LEN);
+    memcpy(file + FILE_SEGMENTS, checkpoint->segments, sizeof(checkpoint->segments));
+    storeLe32(file + FILE_CRC, crc32(file, FILE_CRC));
+
+    // written next to it then renamed over it, so the previous checkpoint is there until this one is
+    const size_t pathLen = strlen(path);
+    char* tmp = malloc(pathLen + 5);
+    if (!tmp) {
+        errno = ENOMEM;
+        return -1;
+    }
+    memcpy(tmp, path, pathLen);
+    memcpy(tmp + pathLen, ".tmp", 5);
+
+    int rc = -1;
+    const int fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd >= 0) {
+        ssize_t n;
+        do {
+            n = write(fd, file, sizeof(file));
+        } while (n < 0 && errno == EINTR);
+        if (n == (ssize_t)sizeof(file) && fdatasync(fd) == 0)
+            rc = 0;
+        else if (n >= 0 && n < (ssize_t)sizeof(file))
+            errno = ENOSPC;
+        if (close(fd) != 0)
+            rc = -1;
+        if (rc == 0)
+            rc = rename(tmp, path);
+        if (rc != 0) {
+            const int error = errno;
+            unlink(tmp);
+            errno = error;
+        }
+    }
+    free(tmp);
+    return rc;
+}
+
+int checkpointLoad(const char* path, MiningCheckpoint* checkpoint) {
+    const int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        return -1;
+    // one more byte than a checkpoint, to tell a longer file apart
+    uint8_t file[FILE_LEN + 1];
+    ssize_t n;
+    do {
+        n = read(fd, file, sizeof(file));
+    } while (n < 0 && errno == EINTR);
+    const int error = errno;
+    close(fd);
+    if (n < 0) {
+        errno = error;
+        return -1;
+    }
+    if (n != FILE_LEN || memcmp(file, CHECKPOINT_MAGIC, MAGIC_LEN) != 0 ||
+        crc32(file, FILE_CRC) != loadLe32(file + FILE_CRC)) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    checkpoint->position = loadLe64(file + FILE_POSITION);
+    memcpy(checkpoint->header, file + FILE_HEADER, HEADER_SIZE);
+    memcpy(checkpoint->targetHash, file + FILE_TARGET, HASH_LEN);
+    memcpy(checkpoint->segments, file + FILE_SEGMENTS, sizeof(checkpoint->segments));
+    return 0;
+}
+
+int checkpointMatches(const MiningCheckpoint* checkpoint, const BlockHeader* header,
+                      const uint8_t targetHash[HASH_LEN]) {
+    BlockHeader other;
+    deserializeHeader(checkpoint->header, &other);
+    return other.version == header->version && other.dataLength == header->dataLength &&
+           memcmp(other.dataHash, header->dataHash, HASH_LEN) == 0 &&
+           memcmp(other.previousHeaderHash, header->previousHeaderHash, HASH_LEN) == 0 &&
+           memcmp(checkpoint->targetHash, targetHash, HASH_LEN) == 0;
+}
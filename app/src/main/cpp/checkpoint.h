@@ -0,0 +1,55 @@
+#ifndef BTCO_CHECKPOINT_H
+#define BTCO_CHECKPOINT_H
+
+#include <stdint.h>
+
+#include "blockchain.h"
+
+// the nonces of a round are checkpointed by segments of 2^CHECKPOINT_SEGMENT_BITS
+#define CHECKPOINT_SEGMENT_BITS 20
+#define CHECKPOINT_SEGMENTS (1u << (32 - CHECKPOINT_SEGMENT_BITS))
+
+/**
+ * Where the mining of a block is at, to go on from there after the process is gone.
+ * - the nonces are searched out of order (by many threads, and stolen among them), so rather than
+ *   a range per thread, what is kept is which segments of the round have been searched in full
+ * - a segment is only marked once searched without finding a valid nonce, so resuming can skip it
+ *   and still find the lowest valid nonce of the round
+ */
+typedef struct {
+    // set by whoever mines, e.g. the length of chain a job of many blocks is going for
+    uint64_t position;
+
+    // the header being mined, serialized, with the timestamp of the round being searched
+    uint8_t header[HEADER_SIZE];
+    uint8_t targetHash[HASH_LEN];
+
+    // a bit per segment of nonces searched, the lowest bit of the first byte for nonces 0..2^20-1
+    uint8_t segments[CHECKPOINT_SEGMENTS / 8];
+} MiningCheckpoint;
+
+/**
+ * Write a checkpoint to a file, replacing the previous one at once (a crash leaves either).
+ * @param path the file
+ * @param checkpoint the checkpoint
+ * @return 0 on success, -1 on error with errno set
+ */
+int checkpointSave(const char* path, const MiningCheckpoint* checkpoint);
+
+/**
+ * Read a checkpoint written by checkpointSave.
+ * @param path the file
+ * @param checkpoint set to the checkpoint
+ * @return 0 on success, -1 on error with errno set (ENOENT if there is none, EINVAL if the file is
+ *         not a whole checkpoint)
+ */
+int checkpointLoad(const char* path, MiningCheckpoint* checkpoint);
+
+/**
+ * Check whether a checkpoint is of the mining of a header, whatever its timestamp and nonce.
+ * @return 1 if it is, 0 if not
+ */
+int checkpointMatches(const MiningCheckpoint* checkpoint, const BlockHeader* header,
+                      const uint8_t targetHash[HASH_LEN]);
+
+#endif //BTCO_CHECKPOINT_H
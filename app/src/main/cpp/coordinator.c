@@ -0,0 +1,392 @@
+/*
+ * Mining blocks by workers in other processes (see coordinator.h).
+ */
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/socket.h>
+
+#include "blockchain.h"
+#include "coordinator.h"
+#include "metrics.h"
+#include "miner.h"
+#include "work-protocol.h"
+
+// the nonces of a round are [0, ROUND_NONCES), as in mineParallel
+#define ROUND_NONCES ((uint64_t)UINT32_MAX)
+
+/**
+ * A range of the nonces of a round.
+ */
+typedef struct {
+    uint32_t timestamp;
+    uint32_t begin;
+    uint32_t count;
+} WorkUnit;
+
+/**
+ * A connected worker.
+ */
+typedef struct {
+    int fd; // -1 once dropped
+
+    // whether it has a unit, of the job jobId, it is not done with (i.e., not asked for another),
+    // or it just connected and has not asked for one yet
+    int busy;
+    uint32_t jobId;
+    WorkUnit unit;
+
+    // the message being received, the socket is read as it comes so that no worker holds up others
+    uint8_t in[WORK_MESSAGE_SIZE];
+    size_t inLen;
+} Worker;
+
+struct Coordinator {
+    int listenFd;
+    char* unixPath; // the file of a Unix socket, removed at the end, NULL for TCP
+
+    Worker workers[COORDINATOR_MAX_WORKERS];
+    int workerCount;
+
+    // the block being mined, if mining
+    int mining;
+    uint32_t jobId;
+    BlockHeader job;
+    uint8_t targetHash[HASH_LEN];
+
+    // where the next unit starts
+    uint32_t roundTimestamp;
+    uint64_t nextNonce;
+
+    // units handed out again before any new ones, those of the workers gone
+    WorkUnit orphans[COORDINATOR_MAX_WORKERS];
+    int orphanCount;
+};
+
+static uint64_t monotonicMs(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + (uint64_t)ts.tv_nsec / 1000000;
+}
+
+Coordinator* coordinatorOpen(const char* address) {
+    Coordinator* coordinator = calloc(1, sizeof(*coordinator));
+    if (!coordinator)
+        return NULL;
+    coordinator->listenFd = workOpenSocket(address, WORK_LISTEN);
+    if (coordinator->listenFd < 0) {
+        free(coordinator);
+        return NULL;
+    }
+    if (strncmp(address, "unix:", 5) == 0)
+        coordinator->unixPath = strdup(address + 5);
+    return coordinator;
+}
+
+/**
+ * Hand the next unit of the job out, those of workers gone first.
+ */
+static void nextUnit(Coordinator* coordinator, WorkUnit* unit) {
+    if (coordinator->orphanCount > 0) {
+        *unit = coordinator->orphans[--coordinator->orphanCount];
+        return;
+    }
+    // a new round once all the nonces of this one are handed out
+    if (coordinator->nextNonce >= ROUND_NONCES) {
+        coordinator->roundTimestamp = nextRoundTimestamp(NULL, (uint32_t)time(NULL),
+                                                         coordinator->roundTimestamp, 0);
+        coordinator->nextNonce = 0;
+        metricsCountRollover();
+    }
+    const uint64_t left = ROUND_NONCES - coordinator->nextNonce;
+    unit->timestamp = coordinator->roundTimestamp;
+    unit->begin = (uint32_t)coordinator->nextNonce;
+    unit->count = left < COORDINATOR_UNIT_NONCES ? (uint32_t)left : COORDINATOR_UNIT_NONCES;
+    coordinator->nextNonce += unit->count;
+}
+
+/**
+ * Close the connection of a worker, its unit is handed out again.
+ * NOTE the worker is only removed from the list by compactWorkers
+ */
+static void dropWorker(Coordinator* coordinator, Worker* worker) {
+    if (worker->busy && coordinator->mining && worker->jobId == coordinator->jobId)
+        coordinator->orphans[coordinator->orphanCount++] = worker->unit;
+    close(worker->fd);
+    worker->fd = -1;
+    worker->busy = 0;
+}
+
+static void compactWorkers(Coordinator* coordinator) {
+    int count = 0;
+    for (int i = 0; i < coordinator->workerCount; ++i)
+        if (coordinator->workers[i].fd >= 0)
+            coordinator->workers[count++] = coordinator->workers[i];
+    coordinator->workerCount = count;
+}
+
+/**
+ * Give a worker that is done with its unit the next one, if there is a block being mined.
+ */
+static void assignWork(Coordinator* coordinator, Worker* worker) {
+    if (!coordinator->mining || worker->busy || worker->fd < 0)
+        return;
+    WorkMessage message;
+    memset(&message, 0, sizeof(message));
+    message.type = WORK_MSG_WORK;
+    message.jobId = coordinator->jobId;
+    nextUnit(coordinator, &worker->unit);
+    message.header = coordinator->job;
+    message.header.timestamp = worker->unit.timestamp;
+    message.begin = worker->unit.begin;
+    message.count = worker->unit.count;
+    worker->busy = 1;
+    worker->jobId = coordinator->jobId;
+    if (workSend(worker->fd, &message) != 0)
+        dropWorker(coordinator, worker);
+}
+
+/**
+ * Tell every worker still on the job to drop it, now that it is over.
+ */
+static void endJob(Coordinator* coordinator) {
+    coordinator->mining = 0;
+    coordinator->orphanCount = 0;
+    WorkMessage message;
+    memset(&message, 0, sizeof(message));
+    message.type = WORK_MSG_STALE;
+    message.jobId = coordinator->jobId;
+    for (int i = 0; i < coordinator->workerCount; ++i) {
+        Worker* worker = &coordinator->workers[i];
+        // NOTE it stays busy until it asks for more, so it gets nothing of the next job before
+        if (worker->fd >= 0 && worker->busy && worker->jobId == coordinator->jobId &&
+            workSend(worker->fd, &message) != 0)
+            dropWorker(coordinator, worker);
+    }
+}
+
+/**
+ * Check that a header from a worker is a valid one of the unit it was given.
+ */
+static int isSolution(const Coordinator* coordinator, const Worker* worker,
+                      const BlockHeader* header, uint8_t hash[HASH_LEN]) {
+    const BlockHeader* job = &coordinator->job;
+    const WorkUnit* unit = &worker->unit;
+    if (header->version != job->version || header->bits != job->bits ||
+        header->dataLength != job->dataLength ||
+        memcmp(header->dataHash, job->dataHash, HASH_LEN) != 0 ||
+        memcmp(header->previousHeaderHash, job->previousHeaderHash, HASH_LEN) != 0 ||
+        header->timestamp != unit->timestamp || header->nonce < unit->begin ||
+        (uint64_t)header->nonce >= (uint64_t)unit->begin + unit->count)
+        return 0;
+    hashHeader(header, hash);
+    return memcmp(hash, coordinator->targetHash, HASH_LEN) < 0;
+}
+
+/**
+ * Act on a message of a worker.
+ * @return 1 if it is the block, 0 if not
+ */
+static int handleMessage(Coordinator* coordinator, Worker* worker, const WorkMessage* message,
+                         BlockHeader* header, uint8_t hash[HASH_LEN], MiningControl* control) {
+    if (message->type != WORK_MSG_REQUEST && message->type != WORK_MSG_SOLUTION) {
+        dropWorker(coordinator, worker);
+        return 0;
+    }
+    const int current = worker->busy && coordinator->mining && worker->jobId == coordinator->jobId &&
+            message->jobId == coordinator->jobId;
+    if (control && current)
+        atomic_fetch_add_explicit(&control->noncesTried, message->count, memory_order_relaxed);
+
+    if (message->type == WORK_MSG_SOLUTION && current) {
+        uint8_t solutionHash[HASH_LEN];
+        if (!isSolution(coordinator, worker, &message->header, solutionHash)) {
+            // a worker that gets blocks wrong would only waste the work handed out to it
+            dropWorker(coordinator, worker);
+            return 0;
+        }
+        worker->busy = 0;
+        *header = message->header;
+        if (hash)
+            memcpy(hash, solutionHash, HASH_LEN);
+        endJob(coordinator);
+        return 1;
+    }
+    // done with its unit, the solution of a job over already is no use either
+    worker->busy = 0;
+    assignWork(coordinator, worker);
+    return 0;
+}
+
+/**
+ * Read what a worker sent, and act on it once a whole message is in.
+ * @return 1 if it is the block, 0 if not
+ */
+static int readWorker(Coordinator* coordinator, Worker* worker, BlockHeader* header,
+                      uint8_t hash[HASH_LEN], MiningControl* control) {
+    const ssize_t n = recv(worker->fd, worker->in + worker->inLen, WORK_MESSAGE_SIZE - worker->inLen,
+                           MSG_DONTWAIT);
+    if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR))
+        return 0;
+    if (n <= 0) {
+        dropWorker(coordinator, worker);
+        return 0;
+    }
+    worker->inLen += (size_t)n;
+    if (worker->inLen < WORK_MESSAGE_SIZE)
+        return 0;
+    worker->inLen = 0;
+    WorkMessage message;
+    if (workDecode(worker->in, &message) != 0) {
+        dropWorker(coordinator, worker);
+        return 0;
+    }
+    return handleMessage(coordinator, worker, &message, header, hash, control);
+}
+
+/**
+ * Take a worker waiting to connect, it asks for work first thing.
+ */
+static void acceptWorker(Coordinator* coordinator) {
+    const int fd = accept(coordinator->listenFd, NULL, NULL);
+    if (fd < 0)
+        return;
+    if (coordinator->workerCount == COORDINATOR_MAX_WORKERS) {
+        close(fd);
+        return;
+    }
+    Worker* worker = &coordinator->workers[coordinator->workerCount++];
+    memset(worker, 0, sizeof(*worker));
+    worker->fd = fd;
+    worker->busy = 1; // until it asks, with a job id 0 that is never the current one
+}
+
+int coordinatorMine(Coordinator* coordinator, BlockHeader* header,
+                    const uint8_t targetHash[HASH_LEN], uint8_t hash[HASH_LEN],
+                    MiningControl* control) {
+    const uint64_t startNs = metricsNowNs();
+    coordinator->job = *header;
+    memcpy(coordinator->targetHash, targetHash, HASH_LEN);
+    coordinator->roundTimestamp = nextRoundTimestamp(NULL, (uint32_t)time(NULL), 0, 1);
+    coordinator->nextNonce = 0;
+    coordinator->orphanCount = 0;
+    ++coordinator->jobId;
+    coordinator->mining = 1;
+    for (int i = 0; i < coordinator->workerCount; ++i)
+        assignWork(coordinator, &coordinator->workers[i]);
+
+    struct pollfd fds[1 + COORDINATOR_MAX_WORKERS];
+    int found = 0;
+    while (!found) {
+        if (control && atomic_load(&control->cancelled)) {
+            endJob(coordinator);
+            compactWorkers(coordinator);
+            errno = ECANCELED;
+            return -1;
+        }
+        if (control && control->onProgress && monotonicMs() >= control->nextProgressMs) {
+            control->nextProgressMs = monotonicMs() + control->progressIntervalMs;
+            control->onProgress(control->progressCtx, atomic_load(&control->noncesTried));
+        }
+
+        compactWorkers(coordinator);
+        const int workerCount = coordinator->workerCount;
+        fds[0].fd = coordinator->listenFd;
+        fds[0].events = POLLIN;
+        for (int i = 0; i < workerCount; ++i) {
+            fds[1 + i].fd = coordinator->workers[i].fd;
+            fds[1 + i].events = POLLIN;
+        }
+        int timeoutMs = COORDINATOR_POLL_MS;
+        if (control && control->onProgress && control->progressIntervalMs < (uint32_t)timeoutMs)
+            timeoutMs = (int)control->progressIntervalMs;
+        const int ready = poll(fds, (nfds_t)(1 + workerCount), timeoutMs);
+        if (ready < 0 && errno == EINTR)
+            continue;
+        if (ready < 0) {
+            endJob(coordinator);
+            return -1;
+        }
+
+        for (int i = 0; i < workerCount && !found; ++i)
+            if (fds[1 + i].revents && coordinator->workers[i].fd >= 0)
+                found = readWorker(coordinator, &coordinator->workers[i], header, hash, control);
+        // the newcomers ask for work first, they get it on the next turn
+        if (!found && fds[0].revents & POLLIN)
+            acceptWorker(coordinator);
+    }
+    compactWorkers(coordinator);
+    metricsCountBlock(metricsNowNs() - startNs);
+    return 0;
+}
+
+int coordinatorWorkerCount(const Coordinator* coordinator) {
+    return coordinator->workerCount;
+}
+
+/**
+ * Wait for the workers told to drop their unit to say they did, and for those that just connected
+ * to ask for work, or for a while at most.
+ */
+static void drainWorkers(Coordinator* coordinator) {
+    compactWorkers(coordinator);
+    struct pollfd pending = { coordinator->listenFd, POLLIN, 0 };
+    while (coordinator->workerCount < COORDINATOR_MAX_WORKERS && poll(&pending, 1, 0) > 0) {
+        const int count = coordinator->workerCount;
+        acceptWorker(coordinator);
+        if (coordinator->workerCount == count)
+            break;
+    }
+
+    struct pollfd fds[COORDINATOR_MAX_WORKERS];
+    Worker* busy[COORDINATOR_MAX_WORKERS];
+    BlockHeader header; // of no use, no job is being mined
+    const uint64_t endMs = monotonicMs() + COORDINATOR_CLOSE_MS;
+    for (;;) {
+        int count = 0;
+        for (int i = 0; i < coordinator->workerCount; ++i) {
+            Worker* worker = &coordinator->workers[i];
+            if (worker->fd < 0 || !worker->busy)
+                continue;
+            fds[count].fd = worker->fd;
+            fds[count].events = POLLIN;
+            busy[count++] = worker;
+        }
+        const uint64_t nowMs = monotonicMs();
+        if (count == 0 || nowMs >= endMs)
+            return;
+        const int ready = poll(fds, (nfds_t)count, (int)(endMs - nowMs));
+        if (ready < 0 && errno != EINTR)
+            return;
+        // NOTE no job is being mined, so a worker done with its unit gets no other one
+        for (int i = 0; i < count && ready > 0; ++i)
+            if (fds[i].revents)
+                readWorker(coordinator, busy[i], &header, NULL, NULL);
+    }
+}
+
+void coordinatorClose(Coordinator* coordinator) {
+    if (!coordinator)
+        return;
+    // no more workers can connect to a Unix socket once it is gone, so none is left out
+    if (coordinator->unixPath)
+        unlink(coordinator->unixPath);
+    drainWorkers(coordinator);
+    WorkMessage message;
+    memset(&message, 0, sizeof(message));
+    message.type = WORK_MSG_BYE;
+    for (int i = 0; i < coordinator->workerCount; ++i) {
+        if (coordinator->workers[i].fd < 0)
+            continue;
+        workSend(coordinator->workers[i].fd, &message);
+        close(coordinator->workers[i].fd);
+    }
+    close(coordinator->listenFd);
+    free(coordinator->unixPath);
+    free(coordinator);
+}
@@ -0,0 +1,76 @@
+#ifndef BTCO_COORDINATOR_H
+#define BTCO_COORDINATOR_H
+
+#include <stdint.h>
+
+#include "blockchain.h"
+#include "miner.h"
+
+// the most workers connected at a time, more are turned away
+#define COORDINATOR_MAX_WORKERS 64
+
+// the nonces of a unit of work, a couple of seconds of a phone, a fraction of one of a desktop
+#define COORDINATOR_UNIT_NONCES (1u << 26)
+
+// how often the coordinator looks at its control while waiting for the workers
+#define COORDINATOR_POLL_MS 100
+
+// how long the coordinator waits, when closing, for the workers to stop the units of the last job
+#define COORDINATOR_CLOSE_MS 2000
+
+/**
+ * Mines blocks by handing their nonces out to workers, other processes on this machine or others
+ * (see worker.h), over TCP or a Unix socket (see work-protocol.h).
+ * - the work of a block is cut into units: its header at a timestamp and a range of the nonces of
+ *   that timestamp; the units are handed out in order, a round (timestamp) at a time as in
+ *   mineParallel, so no 2 workers ever hash the same header
+ * - a worker gets a unit when it connects and every time it is done with one, so faster workers
+ *   get more of them; the unit of a worker that disconnects is handed out again
+ * - the first valid header a worker sends is the block (checked before it is), every other worker
+ *   is told to drop its unit at once, and the messages about it that are still on the way are told
+ *   apart by the id of its job
+ * - the block is whichever valid header comes first, NOT the lowest nonce of its round as when
+ *   mining in one process, so it depends on the workers and their timing
+ * NOTE a coordinator is not thread-safe, use it from one thread at a time.
+ */
+typedef struct Coordinator Coordinator;
+
+/**
+ * Start a coordinator, listening for workers.
+ * - the workers may connect at any time, they wait while no block is being mined
+ * @param address "unix:<path>" or "<host>:<port>", see workOpenSocket
+ * @return the coordinator, NULL on error with errno set
+ */
+Coordinator* coordinatorOpen(const char* address);
+
+/**
+ * Tell the workers there is no more work, and stop the coordinator.
+ * - the workers still on a unit of the last job are waited for (up to COORDINATOR_CLOSE_MS) to say
+ *   they stopped it, and those waiting to connect are taken, so that none is left talking to a
+ *   coordinator gone
+ * @param coordinator the coordinator, may be NULL
+ */
+void coordinatorClose(Coordinator* coordinator);
+
+/**
+ * Mine a header by the workers, waiting for them to find it.
+ * - NOT to be called from many threads at once
+ * @param coordinator the coordinator
+ * @param header the header of the block initialized somewhere else, timestamp and nonce are set
+ * @param targetHash the (big-endian) hash that the header hash must be below
+ * @param hash set to the hash of the mined header, may be NULL
+ * @param control to cancel mining and follow its progress (the nonces searched by the workers),
+ *                may be NULL
+ * @return 0 once mined, -1 with errno ECANCELED if cancelled (the header is not valid then), or
+ *         another error of the listening socket
+ */
+int coordinatorMine(Coordinator* coordinator, BlockHeader* header,
+                    const uint8_t targetHash[HASH_LEN], uint8_t hash[HASH_LEN],
+                    MiningControl* control);
+
+/**
+ * Get the number of workers connected.
+ */
+int coordinatorWorkerCount(const Coordinator* coordinator);
+
+#endif //BTCO_COORDINATOR_H
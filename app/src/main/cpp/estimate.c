@@ -0,0 +1,144 @@
+/*
+ * Hashrate calibration and mining cost estimates (see estimate.h).
+ */
+
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <pthread.h>
+#include <stdatomic.h>
+
+#include "blockchain.h"
+#include "estimate.h"
+#include "miner.h"
+#include "scheduler.h"
+#include "sha-256-lanes.h"
+
+// setups whose hashrate is cached, a process hardly ever sees more than a couple
+#define MAX_CALIBRATIONS 8
+
+// the quantile of the standard normal distribution at 95%
+#define Z_95 1.6448536269514722
+
+/**
+ * The hashrate of a setup of the miner, see calibrateHashrate.
+ */
+typedef struct {
+    const struct Sha_256_lanes* kernel;
+    uint32_t version;
+    int poolThreads; // 0 for the calling thread
+    double hashrate;
+} Calibration;
+
+static Calibration calibrations[MAX_CALIBRATIONS];
+static int calibrationCount;
+static pthread_mutex_t calibrationLock = PTHREAD_MUTEX_INITIALIZER;
+
+/**
+ * The state of a calibration run, given to the progress callback.
+ */
+typedef struct {
+    MiningControl control;
+    struct timespec start;
+} CalibrationRun;
+
+static double elapsedSec(const struct timespec* start) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (double)(now.tv_sec - start->tv_sec) + (double)(now.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+/**
+ * Stop calibrating once it has mined for long enough.
+ */
+static void onCalibrationProgress(void* ctx, uint64_t noncesTried) {
+    (void)noncesTried;
+    CalibrationRun* run = ctx;
+    if (elapsedSec(&run->start) * 1000 >= CALIBRATION_MS)
+        miningCancel(&run->control);
+}
+
+/**
+ * Mine a header that can't be mined (a target of 0) for CALIBRATION_MS.
+ * @return the hashes per second
+ */
+static double measureHashrate(const uint32_t version, const int threads) {
+    CalibrationRun run;
+    miningControlInit(&run.control, onCalibrationProgress, &run, CALIBRATION_MS / 10);
+    run.control.noMetrics = 1; // nothing mined, it would only skew the hashrate of the metrics
+    BlockHeader header;
+    memset(&header, 0, sizeof(header));
+    header.version = version;
+    static const uint8_t NO_TARGET[HASH_LEN];
+
+    clock_gettime(CLOCK_MONOTONIC, &run.start);
+    mineParallel(&header, NO_TARGET, threads, NULL, &run.control);
+    const double seconds = elapsedSec(&run.start);
+    return seconds > 0 ? (double)atomic_load(&run.control.noncesTried) / seconds : 0;
+}
+
+double calibrateHashrate(const uint32_t version, const int threads) {
+    const struct Sha_256_lanes* kernel = sha_256_lanes();
+    const int poolThreads = minerThreadCount(threads) > 1 ? schedThreadCount() : 0;
+
+    // NOTE the lock is held while measuring, so that 2 threads don't measure each other
+    pthread_mutex_lock(&calibrationLock);
+    for (int i = 0; i < calibrationCount; ++i) {
+        const Calibration* c = &calibrations[i];
+        if (c->kernel == kernel && c->version == version && c->poolThreads == poolThreads) {
+            const double hashrate = c->hashrate;
+            pthread_mutex_unlock(&calibrationLock);
+            return hashrate;
+        }
+    }
+
+    const double hashrate = measureHashrate(version, threads);
+    // the oldest setup makes room if need be
+    if (calibrationCount == MAX_CALIBRATIONS) {
+        memmove(calibrations, calibrations + 1, sizeof(Calibration) * (MAX_CALIBRATIONS - 1));
+        --calibrationCount;
+    }
+    calibrations[calibrationCount++] = (Calibration){ kernel, version, poolThreads, hashrate };
+    pthread_mutex_unlock(&calibrationLock);
+    return hashrate;
+}
+
+double expectedAttempts(const uint32_t bits) {
+    uint8_t targetHash[HASH_LEN];
+    if (bitsToTarget(bits, targetHash) != 0)
+        return INFINITY;
+    // 2^256 / target
+    return ldexp(1, 256) / bitsToTargetValue(bits);
+}
+
+/**
+ * Get the 95% quantile of the sum of independent exponential times of mean 1.
+ * - exact for 1, from the Wilson-Hilferty approximation of the chi-square distribution (within
+ *   1% from 2 on, and closer the more there are) for more
+ * @param count number of times, > 0
+ */
+static double gammaP95(const uint64_t count) {
+    if (count == 1)
+        return log(20);
+    // the sum of count exponentials of mean 1 is half a chi-square of 2 * count degrees of freedom
+    const double dof = 2 * (double)count;
+    const double a = 2 / (9 * dof);
+    const double root = 1 - a + Z_95 * sqrt(a);
+    return dof * root * root * root / 2;
+}
+
+void estimateMining(const uint32_t bits, const uint64_t blocks, const double hashrate,
+                    MiningEstimate* estimate) {
+    const double perBlock = expectedAttempts(bits);
+    estimate->attempts = perBlock * (double)blocks;
+    estimate->hashrate = hashrate;
+    if (!(hashrate > 0)) {
+        estimate->expectedSec = INFINITY;
+        estimate->p95Sec = INFINITY;
+        return;
+    }
+    const double secPerBlock = perBlock / hashrate;
+    estimate->expectedSec = secPerBlock * (double)blocks;
+    estimate->p95Sec = secPerBlock * gammaP95(blocks);
+}
@@ -0,0 +1,55 @@
+#ifndef BTCO_ESTIMATE_H
+#define BTCO_ESTIMATE_H
+
+#include <stdint.h>
+
+// how long calibrateHashrate mines for
+#define CALIBRATION_MS 250
+
+/**
+ * What mining some blocks is expected to cost, before mining them.
+ * - each hash is below the target with probability target / 2^256, so the hashes a block takes
+ *   are geometric and the time a run of blocks takes is (very nearly) gamma-distributed
+ */
+typedef struct {
+    // hashes the blocks take on average
+    double attempts;
+
+    // the hashrate the times are for, hashes per second
+    double hashrate;
+
+    // the time the blocks take on average, and the time they take at most 95% of the time, in
+    // seconds, infinite if the hashrate is 0
+    double expectedSec;
+    double p95Sec;
+} MiningEstimate;
+
+/**
+ * Get the hashrate of the miner as it is set up now: the SHA256 kernel, the header version and
+ * mining on the calling thread or on the pool (and its size).
+ * - measured by mining a header for CALIBRATION_MS the first time, then cached for that setup
+ * - NOT to be called while mining, the measure would be of a share of the CPU
+ * @param version the HEADER_VERSION_* of the blocks, SHA256d hashes at about half the rate
+ * @param threads as given to the miner, 1 for the calling thread, anything else for the pool
+ * @return the hashes per second, 0 if it can't be measured
+ */
+double calibrateHashrate(const uint32_t version, const int threads);
+
+/**
+ * Get the hashes a block takes on average at a target.
+ * @param bits the target as compact bits, see BlockHeader.bits
+ * @return the hashes, 2^256 / target, infinite if the bits are no target
+ */
+double expectedAttempts(const uint32_t bits);
+
+/**
+ * Estimate what mining some blocks at a target costs.
+ * @param bits the target of the blocks as compact bits, e.g. difficultyBits(difficulty)
+ * @param blocks number of blocks, > 0
+ * @param hashrate hashes per second, e.g. from calibrateHashrate
+ * @param estimate the output estimate
+ */
+void estimateMining(const uint32_t bits, const uint64_t blocks, const double hashrate,
+                    MiningEstimate* estimate);
+
+#endif //BTCO_ESTIMATE_H
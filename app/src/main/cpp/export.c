@@ -0,0 +1,264 @@
+/*
+ * Dumps of whole stored chains in text formats (see export.h).
+ */
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+
+#include "blockchain.h"
+#include "chain-store.h"
+#include "hex.h"
+#include "payload.h"
+#include "export.h"
+
+// bytes written at a time
+#define EXPORT_BUFFER (64 << 10)
+
+// room for the longest block in any format, so that a block is checked for room once
+#define BLOCK_MAX 1024
+_Static_assert(BLOCK_MAX < EXPORT_BUFFER, "a block must fit in the buffer");
+
+/**
+ * A buffer in front of a file descriptor.
+ * - a failed write is remembered rather than returned, and ends the dump at the next block
+ */
+typedef struct {
+    int fd;
+    int error; // errno of the first failed write, 0 if none
+    size_t used;
+    char buf[EXPORT_BUFFER];
+} ExportWriter;
+
+static void flush(ExportWriter* w) {
+    const char* p = w->buf;
+    while (!w->error && w->used > 0) {
+        const ssize_t n = write(w->fd, p, w->used);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n < 0) {
+            w->error = errno;
+            break;
+        }
+        p += n;
+        w->used -= (size_t)n;
+    }
+    w->used = 0;
+}
+
+/**
+ * Make sure there is room for the next block.
+ */
+static void reserve(ExportWriter* w) {
+    if (EXPORT_BUFFER - w->used < BLOCK_MAX)
+        flush(w);
+}
+
+static void put(ExportWriter* w, const char* s) {
+    const size_t length = strlen(s);
+    memcpy(w->buf + w->used, s, length);
+    w->used += length;
+}
+
+static void putChar(ExportWriter* w, const char c) {
+    w->buf[w->used++] = c;
+}
+
+static void putHex(ExportWriter* w, const uint8_t* bytes, const size_t size) {
+    hexEncode(bytes, size, w->buf + w->used);
+    w->used += 2 * size;
+}
+
+static void putU64(ExportWriter* w, uint64_t n) {
+    // the digits come out last first
+    char digits[20];
+    int i = sizeof(digits);
+    do {
+        digits[--i] = (char)('0' + n % 10);
+        n /= 10;
+    } while (n > 0);
+    memcpy(w->buf + w->used, digits + i, sizeof(digits) - (size_t)i);
+    w->used += sizeof(digits) - (size_t)i;
+}
+
+/**
+ * Everything dumped of a block.
+ */
+typedef struct {
+    uint64_t height;
+    BlockHeader header;
+    uint8_t hash[HASH_LEN];
+    int payloadKind;
+    uint64_t payloadLength;
+    int hasDigest;
+    uint8_t payloadDigest[HASH_LEN];
+} ExportBlock;
+
+static void putHexBlock(ExportWriter* w, const ExportBlock* b) {
+    uint8_t bytes[HEADER_SIZE];
+    serializeHeader(&b->header, bytes);
+    putHex(w, bytes, sizeof(bytes));
+    putChar(w, ' ');
+    putHex(w, b->hash, HASH_LEN);
+    if (b->hasDigest) {
+        putChar(w, ' ');
+        putHex(w, b->payloadDigest, HASH_LEN);
+    }
+    putChar(w, '\n');
+}
+
+static void putJsonField(ExportWriter* w, const char* name) {
+    putChar(w, '"');
+    put(w, name);
+    put(w, "\":");
+}
+
+static void putJsonHash(ExportWriter* w, const char* name, const uint8_t* hash) {
+    putChar(w, ',');
+    putJsonField(w, name);
+    putChar(w, '"');
+    putHex(w, hash, HASH_LEN);
+    putChar(w, '"');
+}
+
+/**
+ * Write compact target bits as 8 hex digits, the way BTC shows them.
+ */
+static void putBits(ExportWriter* w, const uint32_t bits) {
+    const uint8_t bytes[4] = {
+            (uint8_t)(bits >> 24), (uint8_t)(bits >> 16), (uint8_t)(bits >> 8), (uint8_t)bits
+    };
+    putHex(w, bytes, sizeof(bytes));
+}
+
+static void putJsonBlock(ExportWriter* w, const ExportBlock* b) {
+    put(w, b->height > 0 ? ",\n{" : "{");
+    putJsonField(w, "height");
+    putU64(w, b->height);
+    putChar(w, ',');
+    putJsonField(w, "version");
+    putU64(w, b->header.version);
+    putChar(w, ',');
+    putJsonField(w, "timestamp");
+    putU64(w, b->header.timestamp);
+    putChar(w, ',');
+    putJsonField(w, "bits");
+    putChar(w, '"');
+    putBits(w, b->header.bits);
+    putChar(w, '"');
+    putChar(w, ',');
+    putJsonField(w, "nonce");
+    putU64(w, b->header.nonce);
+    putChar(w, ',');
+    putJsonField(w, "dataLength");
+    putU64(w, b->header.dataLength);
+    putJsonHash(w, "dataHash", b->header.dataHash);
+    putJsonHash(w, "previousHeaderHash", b->header.previousHeaderHash);
+    putJsonHash(w, "hash", b->hash);
+    putChar(w, ',');
+    putJsonField(w, "payloadKind");
+    put(w, b->payloadKind == CHAIN_PAYLOAD_MERKLE ? "\"merkle\"" : "\"raw\"");
+    putChar(w, ',');
+    putJsonField(w, "payloadLength");
+    putU64(w, b->payloadLength);
+    if (b->hasDigest)
+        putJsonHash(w, "payloadDigest", b->payloadDigest);
+    putChar(w, '}');
+}
+
+static void putCsvBlock(ExportWriter* w, const ExportBlock* b) {
+    putU64(w, b->height);
+    putChar(w, ',');
+    putU64(w, b->header.version);
+    putChar(w, ',');
+    putU64(w, b->header.timestamp);
+    putChar(w, ',');
+    putBits(w, b->header.bits);
+    putChar(w, ',');
+    putU64(w, b->header.nonce);
+    putChar(w, ',');
+    putU64(w, b->header.dataLength);
+    putChar(w, ',');
+    putHex(w, b->header.dataHash, HASH_LEN);
+    putChar(w, ',');
+    putHex(w, b->header.previousHeaderHash, HASH_LEN);
+    putChar(w, ',');
+    putHex(w, b->hash, HASH_LEN);
+    putChar(w, ',');
+    put(w, b->payloadKind == CHAIN_PAYLOAD_MERKLE ? "merkle" : "raw");
+    putChar(w, ',');
+    putU64(w, b->payloadLength);
+    putChar(w, ',');
+    if (b->hasDigest)
+        putHex(w, b->payloadDigest, HASH_LEN);
+    putChar(w, '\n');
+}
+
+int chainStoreExport(const ChainStore* store, const int fd, const ExportFormat format,
+                     const int flags) {
+    // too big for the stack of a JNI thread
+    ExportWriter* w = malloc(sizeof(ExportWriter));
+    if (!w) {
+        errno = ENOMEM;
+        return -1;
+    }
+    w->fd = fd;
+    w->error = 0;
+    w->used = 0;
+
+    if (format == EXPORT_JSON)
+        put(w, "[\n");
+    else if (format == EXPORT_CSV)
+        put(w, "height,version,timestamp,bits,nonce,dataLength,dataHash,previousHeaderHash,hash,payloadKind,"
+                "payloadLength,payloadDigest\n");
+
+    const uint64_t count = chainStoreCount(store);
+    ExportBlock b;
+    for (b.height = 0; b.height < count && !w->error; ++b.height) {
+        int payloadFd;
+        uint64_t offset;
+        if (chainStoreGet(store, b.height, &b.header, b.hash) != 0 ||
+            chainStorePayload(store, b.height, &payloadFd, &offset, &b.payloadLength,
+                              &b.payloadKind) != 0)
+            break;
+        b.hasDigest = (flags & EXPORT_PAYLOAD_DIGESTS) != 0;
+        if (b.hasDigest && hashPayloadRange(payloadFd, offset, b.payloadLength, b.payloadDigest) != 0)
+            break;
+
+        reserve(w);
+        switch (format) {
+            case EXPORT_HEX: putHexBlock(w, &b); break;
+            case EXPORT_JSON: putJsonBlock(w, &b); break;
+            case EXPORT_CSV: putCsvBlock(w, &b); break;
+        }
+    }
+
+    if (b.height < count && !w->error) {
+        // the store failed rather than the writes
+        const int error = errno;
+        free(w);
+        errno = error;
+        return -1;
+    }
+    if (format == EXPORT_JSON) {
+        reserve(w);
+        put(w, "\n]\n");
+    }
+    flush(w);
+    const int error = w->error;
+    free(w);
+    if (error) {
+        errno = error;
+        return -1;
+    }
+    return 0;
+}
+
+int exportFormatByName(const char* name) {
+    if (strcmp(name, "hex") == 0) return EXPORT_HEX;
+    if (strcmp(name, "json") == 0) return EXPORT_JSON;
+    if (strcmp(name, "csv") == 0) return EXPORT_CSV;
+    return -1;
+}
@@ -0,0 +1,35 @@
+#ifndef BTCO_EXPORT_H
+#define BTCO_EXPORT_H
+
+#include "chain-store.h"
+
+/**
+ * Formats of a chain dump, one block after the other in height order.
+ */
+typedef enum {
+    EXPORT_HEX,  // a line per block: the serialized header as hex, its hash, then the payload digest if any
+    EXPORT_JSON, // an array of an object per block
+    EXPORT_CSV   // a line of column names, then a line per block
+} ExportFormat;
+
+// flags of chainStoreExport
+#define EXPORT_PAYLOAD_DIGESTS 1 // also hash the stored payload of every block (reads all the data)
+
+/**
+ * Dump a whole stored chain for auditing: the headers, hashes and (optionally) payload digests.
+ * - written as it is read, through a buffer, so the size of the chain does not matter
+ * @param store the store
+ * @param fd where to write, e.g. STDOUT_FILENO
+ * @param format the format of the dump
+ * @param flags EXPORT_* flags, or 0
+ * @return 0 on success, -1 on error with errno set
+ */
+int chainStoreExport(const ChainStore* store, int fd, ExportFormat format, int flags);
+
+/**
+ * Get a format by its name: "hex", "json" or "csv".
+ * @return the format, -1 if there is no such format
+ */
+int exportFormatByName(const char* name);
+
+#endif //BTCO_EXPORT_H
@@ -0,0 +1,143 @@
+/*
+ * Hex encoding and decoding of hashes and other bytes (see hex.h), 16 bytes at a time where there
+ * are 128-bit vectors.
+ */
+
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+
+#include "hex.h"
+
+#if defined(__has_builtin)
+#if __has_builtin(__builtin_shufflevector) && \
+        (defined(__SSE2__) || defined(__ARM_NEON) || defined(__aarch64__))
+#define HAVE_HEX_VECTORS 1
+#endif
+#endif
+
+// the 2 chars of each byte value
+static const char PAIRS[256][2] = {
+#define P(n) { "0123456789abcdef"[(n) >> 4], "0123456789abcdef"[(n) & 0xf] }
+#define P4(n) P(n), P((n) + 1), P((n) + 2), P((n) + 3)
+#define P16(n) P4(n), P4((n) + 4), P4((n) + 8), P4((n) + 12)
+#define P64(n) P16(n), P16((n) + 16), P16((n) + 32), P16((n) + 48)
+        P64(0), P64(64), P64(128), P64(192)
+#undef P64
+#undef P16
+#undef P4
+#undef P
+};
+
+// 0x10 | the value of each hex char, 0 for anything else (so most of the table is implicit)
+static const uint8_t VALUES[256] = {
+        ['0'] = 0x10, ['1'] = 0x11, ['2'] = 0x12, ['3'] = 0x13, ['4'] = 0x14,
+        ['5'] = 0x15, ['6'] = 0x16, ['7'] = 0x17, ['8'] = 0x18, ['9'] = 0x19,
+        ['a'] = 0x1a, ['b'] = 0x1b, ['c'] = 0x1c, ['d'] = 0x1d, ['e'] = 0x1e, ['f'] = 0x1f,
+        ['A'] = 0x1a, ['B'] = 0x1b, ['C'] = 0x1c, ['D'] = 0x1d, ['E'] = 0x1e, ['F'] = 0x1f,
+};
+
+#ifdef HAVE_HEX_VECTORS
+typedef uint8_t v16u8 __attribute__((vector_size(16)));
+typedef uint64_t v2u64 __attribute__((vector_size(16)));
+
+/**
+ * Turn 16 nibbles into hex chars.
+ */
+static inline v16u8 nibbleChars(const v16u8 n) {
+    // '0'..'9', then 'a'..'f' is 39 further
+    return n + '0' + ((v16u8)(n > 9) & 39);
+}
+
+/**
+ * Turn 16 hex chars into their values.
+ * @param valid set to all 1s in the lanes that are hex, 0 in the others
+ */
+static inline v16u8 charValues(const v16u8 c, v16u8* valid) {
+    const v16u8 digit = c - '0';
+    const v16u8 letter = (c | 0x20) - 'a';
+    const v16u8 isDigit = (v16u8)(digit <= 9);
+    const v16u8 isLetter = (v16u8)(letter <= 5);
+    *valid = isDigit | isLetter;
+    return (digit & isDigit) | ((letter + 10) & isLetter);
+}
+#endif
+
+void hexEncode(const uint8_t* bytes, size_t size, char* out) {
+#ifdef HAVE_HEX_VECTORS
+    for (; size >= 16; size -= 16, bytes += 16, out += 32) {
+        v16u8 v;
+        memcpy(&v, bytes, sizeof(v));
+        const v16u8 high = nibbleChars(v >> 4);
+        const v16u8 low = nibbleChars(v & 0xf);
+        // interleave, the high nibble of each byte first
+        const v16u8 first = __builtin_shufflevector(high, low, 0, 16, 1, 17, 2, 18, 3, 19,
+                                                    4, 20, 5, 21, 6, 22, 7, 23);
+        const v16u8 second = __builtin_shufflevector(high, low, 8, 24, 9, 25, 10, 26, 11, 27,
+                                                     12, 28, 13, 29, 14, 30, 15, 31);
+        memcpy(out, &first, sizeof(first));
+        memcpy(out + 16, &second, sizeof(second));
+    }
+#endif
+    for (size_t i = 0; i < size; ++i)
+        memcpy(out + 2 * i, PAIRS[bytes[i]], 2);
+}
+
+/**
+ * Find the first char that is not hex.
+ */
+static size_t firstBad(const char* hex, const size_t length) {
+    size_t i = 0;
+    while (i < length && VALUES[(uint8_t)hex[i]])
+        ++i;
+    return i;
+}
+
+int hexDecode(const char* hex, size_t length, uint8_t* out, size_t* bad) {
+    if (length % 2) {
+        if (bad)
+            *bad = length;
+        errno = EINVAL;
+        return -1;
+    }
+
+    const char* start = hex;
+    const size_t total = length;
+#ifdef HAVE_HEX_VECTORS
+    for (; length >= 32; length -= 32, hex += 32, out += 16) {
+        v16u8 a, b, validHigh, validLow;
+        memcpy(&a, hex, sizeof(a));
+        memcpy(&b, hex + 16, sizeof(b));
+        // the even chars are the high nibbles, the odd ones the low ones
+        const v16u8 high = charValues(__builtin_shufflevector(a, b, 0, 2, 4, 6, 8, 10, 12, 14,
+                                                              16, 18, 20, 22, 24, 26, 28, 30),
+                                      &validHigh);
+        const v16u8 low = charValues(__builtin_shufflevector(a, b, 1, 3, 5, 7, 9, 11, 13, 15,
+                                                             17, 19, 21, 23, 25, 27, 29, 31),
+                                     &validLow);
+        const v2u64 valid = (v2u64)(validHigh & validLow);
+        if ((valid[0] & valid[1]) != UINT64_MAX)
+            goto fail;
+        const v16u8 v = high << 4 | low;
+        memcpy(out, &v, sizeof(v));
+    }
+#endif
+    // NOTE no branch per char, the bad chars are looked for once at the end
+    uint8_t all = 0x10;
+    for (size_t i = 0; i < length; i += 2) {
+        const uint8_t high = VALUES[(uint8_t)hex[i]];
+        const uint8_t low = VALUES[(uint8_t)hex[i + 1]];
+        all &= high & low;
+        *out++ = (uint8_t)(high << 4 | (low & 0xf));
+    }
+    if (all)
+        return 0;
+
+#ifdef HAVE_HEX_VECTORS
+fail:
+#endif
+    if (bad)
+        *bad = firstBad(start, total);
+    errno = EINVAL;
+    return -1;
+}
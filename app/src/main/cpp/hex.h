@@ -0,0 +1,27 @@
+#ifndef BTCO_HEX_H
+#define BTCO_HEX_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+/**
+ * Write bytes as lowercase hex, 2 chars per byte.
+ * - 16 bytes at a time with SSE2/NEON, through a table of the 256 char pairs otherwise
+ * @param bytes the bytes
+ * @param size number of bytes
+ * @param out where to write the 2 * size chars, NOT followed by a '\0'
+ */
+void hexEncode(const uint8_t* bytes, size_t size, char* out);
+
+/**
+ * Read hex (upper or lower case) into bytes.
+ * @param hex the chars, need not be '\0' terminated
+ * @param length number of chars, must be even
+ * @param out where to write the length / 2 bytes
+ * @param bad set to the index of the first char that is not hex (or to length if length is odd)
+ *            on error, may be NULL
+ * @return 0 on success, -1 with errno EINVAL if the chars are not all hex (out is then undefined)
+ */
+int hexDecode(const char* hex, size_t length, uint8_t* out, size_t* bad);
+
+#endif //BTCO_HEX_H
@@ -0,0 +1,295 @@
+/*
+ * Platform-neutral logging, so that the blockchain code runs on Android and on build servers alike.
+ * - the lines go through a lock-free queue to a background thread, the only one calling the sink,
+ *   so logging costs the callers a slot claim and a copy rather than a write to logcat/stderr
+ */
+
+#include <stdio.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#ifdef __ANDROID__
+#include <android/log.h>
+#endif
+
+#include "hex.h"
+#include "logger.h"
+
+// max chars of a formatted log line, longer lines are truncated
+#define LOG_LINE_MAX 512
+
+// lines queued at most, a power of 2
+#define LOG_QUEUE_SIZE 256
+_Static_assert((LOG_QUEUE_SIZE & (LOG_QUEUE_SIZE - 1)) == 0, "the queue size must be a power of 2");
+
+#define HASH_BYTES 32
+_Static_assert(LOG_MAX_HASHES * HASH_BYTES < LOG_LINE_MAX, "the hashes must fit in a slot");
+
+typedef enum {
+    LOG_TEXT,  // data is the line
+    LOG_HASHES // data is the hashes, then the prefix of the line
+} LogKind;
+
+/**
+ * A queued line.
+ * - seq is the position in the queue the slot is ready to be written for, or that + 1 once it is
+ *   written and ready to be read (see the bounded MPMC queue by D. Vyukov, here with one reader)
+ */
+typedef struct {
+    _Atomic size_t seq;
+    LogLevel level;
+    LogKind kind;
+    const char* tag;
+    int count;
+    char data[LOG_LINE_MAX];
+} LogSlot;
+
+static struct {
+    _Atomic(LogSink) sink;
+    FILE* _Atomic file;
+
+    LogSlot slots[LOG_QUEUE_SIZE];
+    _Atomic size_t head;    // next position to write
+    _Atomic size_t drained; // next position to read, i.e., lines handed to the sink so far
+    _Atomic size_t dropped; // lines dropped for lack of room
+
+    // the writer thread, and whether it sleeps for lack of lines
+    pthread_once_t once;
+    int async;
+    _Atomic int sleeping;
+    pthread_mutex_t idleLock;
+    pthread_cond_t idleCond;
+} logger = {
+#ifdef __ANDROID__
+        .sink = logToAndroid,
+#else
+        .sink = logToStderr,
+#endif
+        .once = PTHREAD_ONCE_INIT,
+        .idleLock = PTHREAD_MUTEX_INITIALIZER,
+        .idleCond = PTHREAD_COND_INITIALIZER
+};
+
+void setLogSink(LogSink sink) {
+    atomic_store(&logger.sink, sink);
+}
+
+int setLogFile(const char* path) {
+    FILE* f = fopen(path, "a");
+    if (!f)
+        return -1;
+    // NOTE lines still queued for the previous file go to the new one, the flush is for the line
+    //      the writer may be writing to the old one
+    FILE* old = atomic_exchange(&logger.file, f);
+    setLogSink(logToFile);
+    logFlush();
+    if (old)
+        fclose(old);
+    return 0;
+}
+
+/**
+ * Hand a queued line to the sink, formatting it first if it is not yet.
+ */
+static void writeSlot(const LogSlot* slot) {
+    const LogSink sink = atomic_load(&logger.sink);
+    if (!sink)
+        return;
+    if (slot->kind == LOG_TEXT) {
+        sink(slot->level, slot->tag, slot->data);
+        return;
+    }
+
+    char line[LOG_LINE_MAX + LOG_MAX_HASHES * (2 * HASH_BYTES + 1)];
+    const char* prefix = slot->data + slot->count * HASH_BYTES;
+    const size_t prefixLength = strlen(prefix);
+    memcpy(line, prefix, prefixLength);
+    char* end = line + prefixLength;
+    for (int i = 0; i < slot->count; ++i) {
+        if (i > 0)
+            *end++ = ':';
+        hexEncode((const uint8_t*)slot->data + i * HASH_BYTES, HASH_BYTES, end);
+        end += 2 * HASH_BYTES;
+    }
+    *end = '\0';
+    sink(slot->level, slot->tag, line);
+}
+
+/**
+ * The writer thread: hand the lines to the sink in order, sleep when there are none.
+ */
+static void* drain(void* arg) {
+    (void)arg;
+    size_t pos = atomic_load(&logger.drained);
+    while (1) {
+        LogSlot* slot = &logger.slots[pos & (LOG_QUEUE_SIZE - 1)];
+        if (atomic_load(&slot->seq) == pos + 1) {
+            writeSlot(slot);
+            atomic_store(&slot->seq, pos + LOG_QUEUE_SIZE);
+            atomic_store(&logger.drained, ++pos);
+            continue;
+        }
+
+        const size_t dropped = atomic_exchange(&logger.dropped, 0);
+        if (dropped > 0) {
+            char line[64];
+            snprintf(line, sizeof(line), "%zu log lines dropped, the log queue was full", dropped);
+            const LogSink sink = atomic_load(&logger.sink);
+            if (sink)
+                sink(LOG_LEVEL_WARN, "logger", line);
+        }
+
+        // sleep until the slot is written, see publish for the other side of this
+        pthread_mutex_lock(&logger.idleLock);
+        atomic_store(&logger.sleeping, 1);
+        while (atomic_load(&slot->seq) != pos + 1)
+            pthread_cond_wait(&logger.idleCond, &logger.idleLock);
+        atomic_store(&logger.sleeping, 0);
+        pthread_mutex_unlock(&logger.idleLock);
+    }
+    return NULL;
+}
+
+static void startDrain(void) {
+    for (size_t i = 0; i < LOG_QUEUE_SIZE; ++i)
+        atomic_init(&logger.slots[i].seq, i);
+
+    pthread_t tid;
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    // without the thread, lines are written by the threads logging them
+    logger.async = pthread_create(&tid, &attr, drain, NULL) == 0;
+    pthread_attr_destroy(&attr);
+    if (logger.async)
+        atexit(logFlush);
+}
+
+/**
+ * Claim the slot of the next line.
+ * @return the slot, NULL if the queue is full or there is no writer thread
+ */
+static LogSlot* claim(size_t* pos) {
+    pthread_once(&logger.once, startDrain);
+    if (!logger.async)
+        return NULL;
+
+    size_t p = atomic_load_explicit(&logger.head, memory_order_relaxed);
+    while (1) {
+        LogSlot* slot = &logger.slots[p & (LOG_QUEUE_SIZE - 1)];
+        const size_t seq = atomic_load_explicit(&slot->seq, memory_order_acquire);
+        if (seq == p) {
+            if (atomic_compare_exchange_weak_explicit(&logger.head, &p, p + 1,
+                                                      memory_order_relaxed, memory_order_relaxed)) {
+                *pos = p;
+                return slot;
+            }
+        } else if (seq < p) {
+            // the writer is a whole queue behind
+            atomic_fetch_add_explicit(&logger.dropped, 1, memory_order_relaxed);
+            return NULL;
+        } else {
+            p = atomic_load_explicit(&logger.head, memory_order_relaxed);
+        }
+    }
+}
+
+/**
+ * Hand a claimed slot over to the writer thread, waking it up if it sleeps.
+ */
+static void publish(LogSlot* slot, const size_t pos) {
+    // NOTE the writer flags itself sleeping before checking the slot, and the slot is written
+    //      before the flag is checked here, so either the writer sees the line or it is woken up
+    atomic_store(&slot->seq, pos + 1);
+    if (atomic_load(&logger.sleeping)) {
+        pthread_mutex_lock(&logger.idleLock);
+        pthread_cond_signal(&logger.idleCond);
+        pthread_mutex_unlock(&logger.idleLock);
+    }
+}
+
+void logWrite(LogLevel level, const char* tag, const char* format, ...) {
+    size_t pos;
+    LogSlot* slot = claim(&pos);
+    LogSlot local;
+    if (!slot && logger.async)
+        return;
+
+    LogSlot* s = slot ? slot : &local;
+    s->level = level;
+    s->kind = LOG_TEXT;
+    s->tag = tag;
+    va_list args;
+    va_start(args, format);
+    vsnprintf(s->data, sizeof(s->data), format, args);
+    va_end(args);
+
+    if (slot)
+        publish(slot, pos);
+    else
+        writeSlot(&local);
+}
+
+void logWriteHashes(LogLevel level, const char* tag, const char* prefix,
+                    const uint8_t* const* hashes, int count) {
+    size_t pos;
+    LogSlot* slot = claim(&pos);
+    LogSlot local;
+    if (!slot && logger.async)
+        return;
+
+    LogSlot* s = slot ? slot : &local;
+    if (count > LOG_MAX_HASHES)
+        count = LOG_MAX_HASHES;
+    s->level = level;
+    s->kind = LOG_HASHES;
+    s->tag = tag;
+    s->count = count;
+    for (int i = 0; i < count; ++i)
+        memcpy(s->data + i * HASH_BYTES, hashes[i], HASH_BYTES);
+    const size_t room = sizeof(s->data) - (size_t)count * HASH_BYTES;
+    strncpy(s->data + count * HASH_BYTES, prefix, room - 1);
+    s->data[sizeof(s->data) - 1] = '\0';
+
+    if (slot)
+        publish(slot, pos);
+    else
+        writeSlot(&local);
+}
+
+void logFlush(void) {
+    if (!logger.async)
+        return;
+    const size_t head = atomic_load(&logger.head);
+    while (atomic_load(&logger.drained) < head) {
+        const struct timespec pause = { 0, 1000000 };
+        nanosleep(&pause, NULL);
+    }
+}
+
+void logToStderr(LogLevel level, const char* tag, const char* message) {
+    static const char levels[] = { 'D', 'I', 'W', 'E' };
+    fprintf(stderr, "%c/%s: %s\n", levels[level], tag, message);
+}
+
+void logToFile(LogLevel level, const char* tag, const char* message) {
+    static const char levels[] = { 'D', 'I', 'W', 'E' };
+    FILE* f = atomic_load(&logger.file);
+    if (f) {
+        fprintf(f, "%c/%s: %s\n", levels[level], tag, message);
+        fflush(f);
+    }
+}
+
+#ifdef __ANDROID__
+void logToAndroid(LogLevel level, const char* tag, const char* message) {
+    static const int priorities[] = {
+            ANDROID_LOG_DEBUG, ANDROID_LOG_INFO, ANDROID_LOG_WARN, ANDROID_LOG_ERROR
+    };
+    __android_log_write(priorities[level], tag, message);
+}
+#endif
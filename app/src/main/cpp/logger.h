@@ -0,0 +1,104 @@
+#ifndef BTCO_LOGGER_H
+#define BTCO_LOGGER_H
+
+#include <stdint.h>
+
+/**
+ * Log priorities, from the most to the least verbose.
+ */
+typedef enum {
+    LOG_LEVEL_DEBUG,
+    LOG_LEVEL_INFO,
+    LOG_LEVEL_WARN,
+    LOG_LEVEL_ERROR
+} LogLevel;
+
+/**
+ * The least priority logged, anything below is compiled out.
+ * - e.g. -DLOG_MIN_LEVEL=2 for warnings and errors only
+ */
+#ifndef LOG_MIN_LEVEL
+#define LOG_MIN_LEVEL LOG_LEVEL_DEBUG
+#endif
+
+/**
+ * Where log lines end up, e.g. the Android log or stderr.
+ * - sinks are only ever called from the thread writing the log out, one line at a time
+ * @param level priority of the line
+ * @param tag the module the line comes from
+ * @param message the formatted line, without a trailing newline
+ */
+typedef void (*LogSink)(LogLevel level, const char* tag, const char* message);
+
+/**
+ * Send all log lines to another sink.
+ * - by default lines go to the Android log on Android, and to stderr everywhere else
+ * @param sink the new sink, NULL to drop all log lines
+ */
+void setLogSink(LogSink sink);
+
+/**
+ * Log a line, formatted printf-style.
+ * - the line is queued and handed to the sink by a background thread, so logging never waits on
+ *   the sink; if the queue is full the line is dropped (and the drops are logged later on)
+ * - the tag must be a string that is never freed, e.g. a literal
+ * @param level priority of the line
+ * @param tag the module the line comes from
+ * @param format the printf-style format of the line
+ */
+#define logPrint(level, tag, ...) \
+    do { if ((level) >= LOG_MIN_LEVEL) logWrite(level, tag, __VA_ARGS__); } while (0)
+
+/**
+ * Log a line made of a prefix and hashes in hex, separated by ':'.
+ * - only the bytes are copied, the hex is written by the background thread, so this is the cheap
+ *   way to log hashes on hot paths
+ * @param level priority of the line
+ * @param tag the module the line comes from, a string that is never freed
+ * @param prefix the start of the line
+ * @param hashes the 32-byte hashes
+ * @param count number of hashes, at most LOG_MAX_HASHES
+ */
+#define logHashes(level, tag, prefix, hashes, count) \
+    do { if ((level) >= LOG_MIN_LEVEL) logWriteHashes(level, tag, prefix, hashes, count); } while (0)
+
+// max hashes of a logHashes line
+#define LOG_MAX_HASHES 4
+
+/**
+ * Wait until all the lines logged so far are handed to the sink.
+ * - also done at exit
+ */
+void logFlush(void);
+
+/**
+ * Send all log lines to a file, appending to it.
+ * @param path of the file
+ * @return 0 on success, -1 if the file can't be opened (with errno set)
+ */
+int setLogFile(const char* path);
+
+/**
+ * Sink writing "tag: message" lines to stderr.
+ */
+void logToStderr(LogLevel level, const char* tag, const char* message);
+
+/**
+ * Sink writing "tag: message" lines to the file opened by setLogFile.
+ */
+void logToFile(LogLevel level, const char* tag, const char* message);
+
+#ifdef __ANDROID__
+/**
+ * Sink writing to the Android log (logcat).
+ */
+void logToAndroid(LogLevel level, const char* tag, const char* message);
+#endif
+
+// the functions behind logPrint and logHashes, which are to be called instead
+void logWrite(LogLevel level, const char* tag, const char* format, ...)
+        __attribute__((format(printf, 3, 4)));
+void logWriteHashes(LogLevel level, const char* tag, const char* prefix,
+                    const uint8_t* const* hashes, int count);
+
+#endif //BTCO_LOGGER_H
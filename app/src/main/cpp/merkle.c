@@ -0,0 +1,158 @@
+/*
+ * Merkle trees, to commit to many transactions with the one dataHash of a block.
+ */
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include "sha-256.h"
+#include "sha-256-lanes.h"
+#include "blockchain.h"
+#include "merkle.h"
+#include "parallel.h"
+
+// min number of hashes worth a thread of their own
+#define HASHES_PER_THREAD 1024
+
+typedef struct {
+    const void* const* data;
+    const size_t* lengths;
+    uint8_t (*leaves)[HASH_LEN];
+} LeafTask;
+
+typedef struct {
+    const uint8_t (*children)[HASH_LEN];
+    uint8_t (*parents)[HASH_LEN];
+    size_t firstParent;
+} NodeTask;
+
+static void hashLeaves(void* ctx, size_t begin, size_t end) {
+    const LeafTask* task = ctx;
+    for (size_t i = begin; i < end; ++i)
+        calc_sha_256(task->leaves[i], task->data[i], task->lengths[i]);
+}
+
+static void hashNodes(void* ctx, size_t begin, size_t end) {
+    const NodeTask* task = ctx;
+    begin += task->firstParent;
+    end += task->firstParent;
+    // the 2 children of a parent are next to each other, i.e., they are the 64 bytes to hash
+    sha_256_many(task->parents[begin], task->children[2 * begin], 2 * HASH_LEN, 2 * HASH_LEN,
+                 end - begin);
+}
+
+/**
+ * Make room for count nodes in a level.
+ * @return 0 on success, -1 if out of memory
+ */
+static int reserveLevel(MerkleTree* tree, const int level, const size_t count) {
+    if (count <= tree->capacities[level])
+        return 0;
+
+    size_t capacity = tree->capacities[level] ? tree->capacities[level] : 16;
+    while (capacity < count)
+        capacity *= 2;
+    void* nodes = realloc(tree->levels[level], capacity * HASH_LEN);
+    if (!nodes)
+        return -1;
+    tree->levels[level] = nodes;
+    tree->capacities[level] = capacity;
+    return 0;
+}
+
+/**
+ * Rehash every parent from the one above dirtyFrom (the first changed leaf) up to the root.
+ */
+static void rehashFrom(MerkleTree* tree, size_t dirtyFrom, const int threads) {
+    int level = 0;
+    while (tree->counts[level] > 1) {
+        const size_t count = tree->counts[level];
+        const size_t parents = (count + 1) / 2;
+        const size_t pairs = count / 2;
+        const size_t firstParent = dirtyFrom / 2;
+
+        // all the parents with 2 children in one go, then the odd last one that pairs with itself
+        if (firstParent < pairs) {
+            NodeTask task = { (const uint8_t (*)[HASH_LEN])tree->levels[level],
+                              tree->levels[level + 1], firstParent };
+            parallelFor(pairs - firstParent, HASHES_PER_THREAD, threads, hashNodes, &task);
+        }
+        if (count % 2) {
+            uint8_t pair[2 * HASH_LEN];
+            memcpy(pair, tree->levels[level][count - 1], HASH_LEN);
+            memcpy(pair + HASH_LEN, tree->levels[level][count - 1], HASH_LEN);
+            calc_sha_256(tree->levels[level + 1][parents - 1], pair, sizeof(pair));
+        }
+
+        tree->counts[level + 1] = parents;
+        dirtyFrom = firstParent;
+        ++level;
+    }
+    tree->height = level + 1;
+}
+
+void merkleInit(MerkleTree* tree) {
+    memset(tree, 0, sizeof(MerkleTree));
+}
+
+void merkleFree(MerkleTree* tree) {
+    for (int i = 0; i < MERKLE_MAX_LEVELS; ++i)
+        free(tree->levels[i]);
+    merkleInit(tree);
+}
+
+int merkleAppend(MerkleTree* tree, const void* data, const size_t length) {
+    return merkleAppendBatch(tree, &data, &length, 1, 1);
+}
+
+int merkleAppendBatch(MerkleTree* tree, const void* const* data, const size_t* lengths,
+                      const size_t count, const int threads) {
+    if (count == 0)
+        return 0;
+
+    // reserve every level first, so that running out of memory leaves the tree untouched
+    size_t nodes = tree->counts[0] + count;
+    for (int level = 0; ; ++level) {
+        if (level == MERKLE_MAX_LEVELS || reserveLevel(tree, level, nodes) != 0) {
+            errno = ENOMEM;
+            return -1;
+        }
+        if (nodes == 1)
+            break;
+        nodes = (nodes + 1) / 2;
+    }
+
+    // hash the new leaves
+    const size_t first = tree->counts[0];
+    LeafTask task = { data, lengths, tree->levels[0] + first };
+    parallelFor(count, HASHES_PER_THREAD, threads, hashLeaves, &task);
+    tree->counts[0] += count;
+    for (size_t i = 0; i < count; ++i)
+        tree->dataLength += lengths[i];
+
+    // and everything above them
+    rehashFrom(tree, first, threads);
+    return 0;
+}
+
+void merkleRoot(const MerkleTree* tree, uint8_t root[HASH_LEN]) {
+    if (tree->counts[0] == 0)
+        calc_sha_256(root, "", 0);
+    else
+        memcpy(root, tree->levels[tree->height - 1][0], HASH_LEN);
+}
+
+int addBlockWithMerkleTree(const BlockHeader* prevHeader, const MerkleTree* tree,
+                           const int difficulty, const int threads, BlockHeader* header) {
+    if (tree->dataLength > UINT32_MAX) {
+        errno = EFBIG;
+        return -1;
+    }
+
+    uint8_t root[HASH_LEN];
+    merkleRoot(tree, root);
+    *header = addBlockWithDataHash(prevHeader, root, tree->dataLength, difficulty, threads);
+    return 0;
+}
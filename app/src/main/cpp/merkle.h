@@ -0,0 +1,84 @@
+#ifndef BTCO_MERKLE_H
+#define BTCO_MERKLE_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "blockchain.h"
+
+// levels of a tree, enough for any number of leaves that fits in memory
+#define MERKLE_MAX_LEVELS 64
+
+/**
+ * A Merkle tree over the transactions of a block, like the one behind the merkle root of BTC.
+ * - leaves are the SHA256 hashes of the transactions, a parent is the SHA256 of its 2 children
+ *   (left hash then right hash), and a level with an odd count pairs its last node with itself
+ * - all the levels are kept, so appending transactions only rehashes the nodes that changed (the
+ *   new ones and the right edge above them), not the whole tree
+ */
+typedef struct {
+    // levels[0] are the leaves, levels[height - 1] is the root (when there is at least 1 leaf)
+    uint8_t (*levels[MERKLE_MAX_LEVELS])[HASH_LEN];
+    size_t counts[MERKLE_MAX_LEVELS];
+    size_t capacities[MERKLE_MAX_LEVELS];
+    int height;
+
+    // total bytes of all the transactions
+    uint64_t dataLength;
+} MerkleTree;
+
+/**
+ * Start an empty tree.
+ * @param tree the tree to initialize
+ */
+void merkleInit(MerkleTree* tree);
+
+/**
+ * Release everything a tree holds, it can be initialized again after that.
+ * @param tree the tree to free
+ */
+void merkleFree(MerkleTree* tree);
+
+/**
+ * Append one transaction to a tree.
+ * @param tree the tree to append to
+ * @param data ptr to the transaction
+ * @param length number of bytes of the transaction
+ * @return 0 on success, -1 if out of memory
+ */
+int merkleAppend(MerkleTree* tree, const void* data, const size_t length);
+
+/**
+ * Append a batch of transactions to a tree, hashing the leaves and the nodes of every level that
+ * changed in parallel.
+ * @param tree the tree to append to
+ * @param data ptrs to the transactions
+ * @param lengths number of bytes of every transaction
+ * @param count number of transactions
+ * @param threads number of threads, MINER_AUTO_THREADS for one per core
+ * @return 0 on success, -1 if out of memory (the tree is left as it was)
+ */
+int merkleAppendBatch(MerkleTree* tree, const void* const* data, const size_t* lengths,
+                      const size_t count, const int threads);
+
+/**
+ * Get the root of a tree, i.e., the hash that commits to all its transactions.
+ * @param tree the tree
+ * @param root the output root, the SHA256 of nothing for an empty tree
+ */
+void merkleRoot(const MerkleTree* tree, uint8_t root[HASH_LEN]);
+
+/**
+ * Construct a new block whose dataHash is the root of a tree of transactions.
+ * NOTE that this func includes mining that may take a LONG TIME.
+ * @param prevHeader ptr to the prevHeader header (null will mean Genesis)
+ * @param tree the transactions of the block
+ * @param difficulty of the mining task, expressed as a number from 1..10
+ * @param threads number of mining threads, MINER_AUTO_THREADS for one per core
+ * @param header the output header for the new block
+ * @return 0 on success, -1 with errno EFBIG if the transactions are too long for dataLength
+ */
+int addBlockWithMerkleTree(const BlockHeader* prevHeader, const MerkleTree* tree,
+                           const int difficulty, const int threads, BlockHeader* header);
+
+#endif //BTCO_MERKLE_H
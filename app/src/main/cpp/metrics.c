@@ -0,0 +1,217 @@
+/*
+ * Per-thread counters and latency histograms of the hot paths (see metrics.h).
+ */
+
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <stdatomic.h>
+#include <pthread.h>
+
+#include "metrics.h"
+
+/**
+ * The counters of a thread, alone on their cache line(s) so that threads never write the same one.
+ */
+typedef struct {
+    _Alignas(64) _Atomic uint64_t hashes;
+    _Atomic uint64_t sha256Calls;
+    _Atomic uint64_t sha256Bytes;
+    _Atomic uint64_t blocks;
+    _Atomic uint64_t rollovers;
+    _Atomic uint64_t solveNs;
+    _Atomic uint64_t miningNs;
+} MetricsSlot;
+_Static_assert(sizeof(MetricsSlot) % 64 == 0, "slots must not share cache lines");
+
+static struct {
+    MetricsSlot slots[METRICS_MAX_THREADS];
+    _Atomic int usedSlots; // one past the highest slot ever taken
+    _Atomic uint8_t taken[METRICS_MAX_THREADS]; // 1 while a thread has the slot
+    _Atomic uint64_t startNs;
+
+    // NOTE histograms are only updated once per block or task (i.e., per many thousand hashes),
+    //      so they are shared
+    _Atomic uint64_t histograms[METRICS_HISTOGRAMS][METRICS_BUCKETS];
+} metrics;
+
+// the slot of this thread, NULL until it counts something
+static _Thread_local MetricsSlot* threadSlot;
+
+// to give a slot back when its thread ends
+static pthread_key_t slotKey;
+static pthread_once_t slotKeyOnce = PTHREAD_ONCE_INIT;
+
+uint64_t metricsNowNs(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000 + (uint64_t)now.tv_nsec;
+}
+
+#if BTCO_METRICS
+/**
+ * Give the slot of a thread that ended to the next thread, its counts stay in it.
+ */
+static void releaseSlot(void* s) {
+    atomic_store(&metrics.taken[(MetricsSlot*)s - metrics.slots], 0);
+}
+
+static void createSlotKey(void) {
+    pthread_key_create(&slotKey, releaseSlot);
+}
+
+static MetricsSlot* slot(void) {
+    MetricsSlot* s = threadSlot;
+    if (s)
+        return s;
+
+    // the first thread counting anything starts the clock, unless metricsReset did already
+    uint64_t unset = 0;
+    atomic_compare_exchange_strong(&metrics.startNs, &unset, metricsNowNs());
+
+    // the lowest free slot, so that threads coming and going (e.g. of parallelFor, or calling in
+    // through JNI) don't use them all up
+    pthread_once(&slotKeyOnce, createSlotKey);
+    for (int i = 0; i < METRICS_MAX_THREADS; ++i) {
+        uint8_t free = 0;
+        if (!atomic_compare_exchange_strong(&metrics.taken[i], &free, 1))
+            continue;
+        int used = atomic_load(&metrics.usedSlots);
+        while (used <= i && !atomic_compare_exchange_weak(&metrics.usedSlots, &used, i + 1)) {}
+        s = &metrics.slots[i];
+        pthread_setspecific(slotKey, s);
+        threadSlot = s;
+        return s;
+    }
+    atomic_store(&metrics.usedSlots, METRICS_MAX_THREADS);
+    s = &metrics.slots[METRICS_MAX_THREADS - 1];
+    threadSlot = s;
+    return s;
+}
+
+static void add(_Atomic uint64_t* counter, const uint64_t n) {
+    atomic_fetch_add_explicit(counter, n, memory_order_relaxed);
+}
+
+void metricsCountHashes(const uint64_t hashes) {
+    add(&slot()->hashes, hashes);
+}
+
+void metricsCountSha256(const uint64_t bytes) {
+    MetricsSlot* s = slot();
+    add(&s->sha256Calls, 1);
+    add(&s->sha256Bytes, bytes);
+}
+
+void metricsCountRollover(void) {
+    add(&slot()->rollovers, 1);
+}
+
+void metricsCountBlock(const uint64_t solveNs) {
+    MetricsSlot* s = slot();
+    add(&s->blocks, 1);
+    add(&s->solveNs, solveNs);
+    metricsRecord(METRICS_SOLVE_TIME, solveNs);
+}
+
+void metricsCountMining(const uint64_t ns) {
+    add(&slot()->miningNs, ns);
+}
+
+void metricsRecord(const MetricsHistogram histogram, const uint64_t ns) {
+    // the bucket is the position of the highest bit of the microseconds
+    uint64_t us = ns / 1000;
+    int bucket = 0;
+    while (us > 1 && bucket < METRICS_BUCKETS - 1) {
+        us >>= 1;
+        ++bucket;
+    }
+    add(&metrics.histograms[histogram][bucket], 1);
+}
+#endif
+
+static void readSlot(MetricsSlot* s, MetricsCounters* counters) {
+    counters->hashes = atomic_load_explicit(&s->hashes, memory_order_relaxed);
+    counters->sha256Calls = atomic_load_explicit(&s->sha256Calls, memory_order_relaxed);
+    counters->sha256Bytes = atomic_load_explicit(&s->sha256Bytes, memory_order_relaxed);
+    counters->blocks = atomic_load_explicit(&s->blocks, memory_order_relaxed);
+    counters->rollovers = atomic_load_explicit(&s->rollovers, memory_order_relaxed);
+    counters->solveNs = atomic_load_explicit(&s->solveNs, memory_order_relaxed);
+    counters->miningNs = atomic_load_explicit(&s->miningNs, memory_order_relaxed);
+}
+
+void metricsSnapshot(MetricsSnapshot* snapshot) {
+    memset(snapshot, 0, sizeof(*snapshot));
+    snapshot->threads = atomic_load(&metrics.usedSlots);
+
+    MetricsCounters* total = &snapshot->total;
+    for (int i = 0; i < snapshot->threads; ++i) {
+        MetricsCounters* c = &snapshot->perThread[i];
+        readSlot(&metrics.slots[i], c);
+        total->hashes += c->hashes;
+        total->sha256Calls += c->sha256Calls;
+        total->sha256Bytes += c->sha256Bytes;
+        total->blocks += c->blocks;
+        total->rollovers += c->rollovers;
+        total->solveNs += c->solveNs;
+        total->miningNs += c->miningNs;
+    }
+    for (int h = 0; h < METRICS_HISTOGRAMS; ++h)
+        for (int b = 0; b < METRICS_BUCKETS; ++b)
+            snapshot->histograms[h][b] = atomic_load_explicit(&metrics.histograms[h][b],
+                                                              memory_order_relaxed);
+
+    const uint64_t start = atomic_load(&metrics.startNs);
+    snapshot->elapsedNs = start ? metricsNowNs() - start : 0;
+}
+
+void metricsReset(void) {
+    // NOTE the slots stay with their threads, only their counts go
+    for (int i = 0; i < METRICS_MAX_THREADS; ++i) {
+        MetricsSlot* s = &metrics.slots[i];
+        atomic_store_explicit(&s->hashes, 0, memory_order_relaxed);
+        atomic_store_explicit(&s->sha256Calls, 0, memory_order_relaxed);
+        atomic_store_explicit(&s->sha256Bytes, 0, memory_order_relaxed);
+        atomic_store_explicit(&s->blocks, 0, memory_order_relaxed);
+        atomic_store_explicit(&s->rollovers, 0, memory_order_relaxed);
+        atomic_store_explicit(&s->solveNs, 0, memory_order_relaxed);
+        atomic_store_explicit(&s->miningNs, 0, memory_order_relaxed);
+    }
+    for (int h = 0; h < METRICS_HISTOGRAMS; ++h)
+        for (int b = 0; b < METRICS_BUCKETS; ++b)
+            atomic_store_explicit(&metrics.histograms[h][b], 0, memory_order_relaxed);
+    atomic_store(&metrics.startNs, metricsNowNs());
+}
+
+double metricsHashrate(const MetricsCounters* counters) {
+    return counters->miningNs ? (double)counters->hashes * 1e9 / (double)counters->miningNs : 0;
+}
+
+/**
+ * Print the non-empty buckets of a histogram on one line.
+ */
+static void printHistogram(FILE* f, const char* name, const uint64_t* buckets) {
+    fprintf(f, "%-14s", name);
+    for (int b = 0; b < METRICS_BUCKETS; ++b)
+        if (buckets[b])
+            fprintf(f, " <%lluus:%llu", 2ull << b, (unsigned long long)buckets[b]);
+    fputc('\n', f);
+}
+
+void metricsPrint(FILE* f, const MetricsSnapshot* snapshot) {
+    const MetricsCounters* total = &snapshot->total;
+    fprintf(f, "elapsed        %.3f s\n", (double)snapshot->elapsedNs / 1e9);
+    fprintf(f, "hashes         %llu\n", (unsigned long long)total->hashes);
+    fprintf(f, "hashrate       %.2f MH/s\n", metricsHashrate(total) / 1e6);
+    fprintf(f, "blocks         %llu\n", (unsigned long long)total->blocks);
+    fprintf(f, "rollovers      %llu\n", (unsigned long long)total->rollovers);
+    fprintf(f, "solve time     %.3f s\n", (double)total->solveNs / 1e9);
+    fprintf(f, "mining time    %.3f s\n", (double)total->miningNs / 1e9);
+    fprintf(f, "sha256 calls   %llu (%llu bytes)\n", (unsigned long long)total->sha256Calls,
+            (unsigned long long)total->sha256Bytes);
+    for (int i = 0; i < snapshot->threads; ++i)
+        fprintf(f, "thread %-7d %llu hashes\n", i,
+                (unsigned long long)snapshot->perThread[i].hashes);
+    printHistogram(f, "solve time", snapshot->histograms[METRICS_SOLVE_TIME]);
+    printHistogram(f, "task time", snapshot->histograms[METRICS_TASK_TIME]);
+}
@@ -0,0 +1,108 @@
+#ifndef BTCO_METRICS_H
+#define BTCO_METRICS_H
+
+#include <stdio.h>
+#include <stdint.h>
+
+/**
+ * Counters and latency histograms of the hot paths (mining and hashing), cheap enough to always
+ * be on.
+ * - every thread counts into a slot of its own, on its own cache line, so counting is an
+ *   uncontended relaxed add; a snapshot sums the slots up
+ * - a thread gives its slot back when it ends, to the next thread to count anything, so that
+ *   short-lived threads don't use them up
+ * - build with -DBTCO_METRICS=0 to compile all the counting out
+ */
+#ifndef BTCO_METRICS
+#define BTCO_METRICS 1
+#endif
+
+// threads at once with a slot of their own, any more share the last slot
+#define METRICS_MAX_THREADS 64
+
+// buckets of a latency histogram, bucket i counts latencies of [2^i, 2^(i+1)) microseconds
+// (bucket 0 also counts anything under a microsecond, the last one anything longer)
+#define METRICS_BUCKETS 32
+
+/**
+ * The latency histograms.
+ */
+typedef enum {
+    METRICS_SOLVE_TIME, // time to mine a block, from its first round to its nonce
+    METRICS_TASK_TIME,  // time a pool worker spends on a mining task
+    METRICS_HISTOGRAMS
+} MetricsHistogram;
+
+/**
+ * Counters of one thread, or of all of them (see metricsSnapshot).
+ */
+typedef struct {
+    uint64_t hashes;      // nonces tried by the miner
+    uint64_t sha256Calls; // calc_sha_256 calls, i.e., hashes of data rather than of headers
+    uint64_t sha256Bytes; // bytes hashed by those calls
+    uint64_t blocks;      // blocks mined
+    uint64_t rollovers;   // rounds (timestamps) with no valid nonce at all
+    uint64_t solveNs;     // total time to mine the blocks
+    uint64_t miningNs;    // total time in the miner, blocks mined or not (e.g. cancelled), as
+                          // timed by the threads that called it
+} MetricsCounters;
+
+/**
+ * All the metrics at one point in time.
+ */
+typedef struct {
+    MetricsCounters total;
+    uint64_t elapsedNs; // time since the metrics were started/reset
+    int threads;        // slots ever taken, i.e., the most threads at once that counted anything
+    MetricsCounters perThread[METRICS_MAX_THREADS];
+    uint64_t histograms[METRICS_HISTOGRAMS][METRICS_BUCKETS];
+} MetricsSnapshot;
+
+/**
+ * @return a monotonic time in nanoseconds, for measuring latencies
+ */
+uint64_t metricsNowNs(void);
+
+#if BTCO_METRICS
+void metricsCountHashes(uint64_t hashes);
+void metricsCountSha256(uint64_t bytes);
+void metricsCountRollover(void);
+void metricsCountBlock(uint64_t solveNs);
+void metricsCountMining(uint64_t ns);
+void metricsRecord(MetricsHistogram histogram, uint64_t ns);
+#else
+static inline void metricsCountHashes(uint64_t hashes) { (void)hashes; }
+static inline void metricsCountSha256(uint64_t bytes) { (void)bytes; }
+static inline void metricsCountRollover(void) {}
+static inline void metricsCountBlock(uint64_t solveNs) { (void)solveNs; }
+static inline void metricsCountMining(uint64_t ns) { (void)ns; }
+static inline void metricsRecord(MetricsHistogram histogram, uint64_t ns) { (void)histogram; (void)ns; }
+#endif
+
+/**
+ * Read all the metrics.
+ * - counting goes on meanwhile, so the counters are each exact but not all from the same instant
+ * @param snapshot where to put them
+ */
+void metricsSnapshot(MetricsSnapshot* snapshot);
+
+/**
+ * Zero all the metrics and restart the clock of elapsedNs.
+ * - e.g. between benchmark runs; anything counted while resetting may or may not be kept
+ */
+void metricsReset(void);
+
+/**
+ * @return the hashes per second over the time spent mining, whether blocks came of it or not,
+ *         0 if there was none
+ */
+double metricsHashrate(const MetricsCounters* counters);
+
+/**
+ * Print a snapshot, one counter per line.
+ * @param f where to print
+ * @param snapshot what to print
+ */
+void metricsPrint(FILE* f, const MetricsSnapshot* snapshot);
+
+#endif //BTCO_METRICS_H
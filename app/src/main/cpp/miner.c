@@ -0,0 +1,621 @@
+/*
+ * The mining engine behind mine(): the per-nonce hot loop and the threads running it.
+ */
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <stdatomic.h>
+
+#include "sha-256.h"
+#include "sha-256-lanes.h"
+#include "blockchain.h"
+#include "checkpoint.h"
+#include "logger.h"
+#include "metrics.h"
+#include "miner.h"
+#include "scheduler.h"
+#include "topology.h"
+
+// the serialized header is hashed as 2 SHA256 chunks, the timestamp and the nonce are in the 2nd
+// (tail) one, so the 1st one is compressed once per block
+#define HEADER_TAIL_LEN (HEADER_SIZE - SIZE_OF_SHA_256_CHUNK)
+_Static_assert(HEADER_TIMESTAMP_OFFSET >= SIZE_OF_SHA_256_CHUNK,
+               "the timestamp must be in the tail chunk");
+_Static_assert(HEADER_TAIL_LEN + 1 + 8 <= SIZE_OF_SHA_256_CHUNK,
+               "the header tail and its padding must fit in a single chunk");
+
+// nonces handed to a worker at a time, also how often a worker checks whether it can stop
+// NOTE: a multiple of SHA_256_MAX_LANES so that the kernel lanes never straddle two batches
+#define NONCE_BATCH 4096u
+_Static_assert(NONCE_BATCH % SHA_256_MAX_LANES == 0, "batches must be made of whole lane groups");
+
+// the words of the tail chunk (as 16 big-endian words) that hold the timestamp and the nonce
+#define HEADER_TIMESTAMP_WORD ((HEADER_TIMESTAMP_OFFSET - SIZE_OF_SHA_256_CHUNK) / 4)
+#define HEADER_NONCE_WORD ((HEADER_NONCE_OFFSET - SIZE_OF_SHA_256_CHUNK) / 4)
+_Static_assert(HEADER_TIMESTAMP_OFFSET % 4 == 0 && HEADER_NONCE_OFFSET % 4 == 0,
+               "the timestamp and the nonce must be word aligned in the chunk");
+
+// the nonces tried per round are [0, NONCE_END), i.e., all uint32 but UINT32_MAX
+#define NONCE_END ((uint64_t)UINT32_MAX)
+
+// no valid nonce found (yet) in this round
+#define NONCE_NONE UINT64_MAX
+
+static const char* TAG = "MIN3NATIV3";
+
+// the clock of the header timestamps, time(NULL) if NULL
+static MiningClock miningClock;
+static void* miningClockCtx;
+
+// batches between 2 looks at the clock for progress reports, i.e., ~64k nonces
+#define PROGRESS_BATCHES 16
+
+// min nonces of a pool task, bigger ranges split in 2 (leaving a half to steal) before running
+#define RANGE_GRAIN (16 * (uint64_t)NONCE_BATCH)
+
+// the shortest pool task whose hashrate is taken for a sample of its worker's (see schedRecordRate)
+#define RATE_MIN_NS 1000000
+
+// batches of a checkpoint segment
+#define SEGMENT_BATCHES ((1u << CHECKPOINT_SEGMENT_BITS) / NONCE_BATCH)
+_Static_assert((1u << CHECKPOINT_SEGMENT_BITS) % NONCE_BATCH == 0,
+               "checkpoint segments must be made of whole batches");
+
+/**
+ * Everything the pool tasks share for one timestamp round.
+ */
+typedef struct {
+    uint32_t midstate[8];
+    // the tail chunk as SHA256 message words, the kernel fills in the nonce word per lane
+    uint32_t tailWords[16];
+    // the target hash as big-endian words, i.e., comparable with the hash state words as they are
+    uint32_t targetWords[8];
+    const struct Sha_256_lanes* kernel;
+    BlockHeader* header;
+    const uint8_t* targetHash;
+    // the kernel's compress, or compress_double for SHA256d headers
+    uint32_t (*compress)(uint32_t out[8][SHA_256_MAX_LANES], const uint32_t state[8],
+                         const uint32_t w[16], int var_word, const uint32_t* var, uint32_t max_h0);
+    MiningControl* control;
+    uint64_t startNs; // when the mining began, for the time spent at it (see metricsCountMining)
+
+    // batches searched without a valid nonce per checkpoint segment, NULL when not checkpointing
+    // - a segment is searched once all its batches are, those of a resumed one are all to begin with
+    _Atomic uint16_t* segmentBatches;
+
+    // the lowest valid nonce found so far, NONCE_NONE if none
+    _Atomic uint64_t bestNonce;
+
+    // nonces neither searched nor skipped yet, the round is over at 0
+    _Atomic uint64_t remaining;
+    int done;
+    pthread_mutex_t doneLock;
+    pthread_cond_t doneCond;
+} MiningRound;
+
+/**
+ * Make the last (2nd) padded SHA256 chunk of a serialized header, i.e., the bytes after the first
+ * chunk followed by the SHA256 padding for a message of HEADER_SIZE bytes.
+ * - only the timestamp (per round) and the nonce (per hash) change in this chunk while mining
+ * @param bytes the serialized header
+ * @param chunk the output 64-byte chunk
+ */
+static void makeHeaderTailChunk(const uint8_t bytes[HEADER_SIZE], uint8_t chunk[SIZE_OF_SHA_256_CHUNK]) {
+    const uint64_t bitLen = (uint64_t)HEADER_SIZE * 8;
+    memset(chunk, 0, SIZE_OF_SHA_256_CHUNK);
+    memcpy(chunk, bytes + SIZE_OF_SHA_256_CHUNK, HEADER_TAIL_LEN);
+    chunk[HEADER_TAIL_LEN] = 0x80;
+    for (int i = 0; i < 8; ++i)
+        chunk[SIZE_OF_SHA_256_CHUNK - 1 - i] = (uint8_t)(bitLen >> (8 * i));
+}
+
+/**
+ * Compute the SHA256 midstate of a serialized header, i.e., the hash state after its first 64 bytes.
+ * @param bytes the serialized header
+ * @param midstate the output hash state
+ */
+static void makeHeaderMidstate(const uint8_t bytes[HEADER_SIZE], uint32_t midstate[8]) {
+    struct Sha_256 sha;
+    sha_256_init(&sha);
+    sha_256_write(&sha, bytes, SIZE_OF_SHA_256_CHUNK);
+    memcpy(midstate, sha.h, sizeof(sha.h));
+}
+
+/**
+ * Get the message word of a little-endian number of the header, i.e., its bytes read big-endian.
+ */
+static inline uint32_t leWord(const uint32_t n) {
+    return (n & 0xff) << 24 | (n & 0xff00) << 8 | (n >> 8 & 0xff00) | n >> 24;
+}
+
+/**
+ * Read 4 bytes as a big-endian 32-bit word, i.e., how SHA256 sees them.
+ */
+static uint32_t loadBigEndian(const uint8_t* p) {
+    return (uint32_t)p[0] << 24 | (uint32_t)p[1] << 16 | (uint32_t)p[2] << 8 | (uint32_t)p[3];
+}
+
+/**
+ * Check a lane of hash states against the target, word by word.
+ * - the hash bytes are the big-endian state words, so comparing words in order is comparing bytes
+ * @return 1 if the hash of the lane is < the target, 0 if not
+ */
+static int isBelowTarget(const uint32_t states[8][SHA_256_MAX_LANES], const int lane,
+                         const uint32_t targetWords[8]) {
+    for (int i = 0; i < 8; ++i)
+        if (states[i][lane] != targetWords[i])
+            return states[i][lane] < targetWords[i];
+    return 0;
+}
+
+/**
+ * Lower the round's best nonce to the given one, unless a lower one is already known.
+ */
+static void offerNonce(MiningRound* round, uint64_t nonce) {
+    uint64_t best = atomic_load(&round->bestNonce);
+    while (nonce < best && !atomic_compare_exchange_weak(&round->bestNonce, &best, nonce))
+        ;
+}
+
+static uint64_t monotonicMs(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + (uint64_t)ts.tv_nsec / 1000000;
+}
+
+/**
+ * Write the checkpoint of a round, i.e., its header and the segments of nonces searched in full.
+ */
+static void saveCheckpoint(const MiningRound* round) {
+    MiningControl* control = round->control;
+    MiningCheckpoint checkpoint;
+    checkpoint.position = control->checkpointPosition;
+    serializeHeader(round->header, checkpoint.header);
+    memcpy(checkpoint.targetHash, round->targetHash, HASH_LEN);
+    memset(checkpoint.segments, 0, sizeof(checkpoint.segments));
+    for (uint32_t i = 0; i < CHECKPOINT_SEGMENTS; ++i)
+        if (atomic_load_explicit(&round->segmentBatches[i], memory_order_relaxed) == SEGMENT_BATCHES)
+            checkpoint.segments[i / 8] |= (uint8_t)(1u << (i % 8));
+    // NOTE mining goes on if it fails, the next one may make it, so a run of failures is told once
+    if (checkpointSave(control->checkpointPath, &checkpoint) != 0) {
+        if (!control->checkpointFailing)
+            logPrint(LOG_LEVEL_ERROR, TAG, "checkpoint:%s:%s", control->checkpointPath,
+                     strerror(errno));
+        control->checkpointFailing = 1;
+    } else {
+        control->checkpointFailing = 0;
+    }
+}
+
+/**
+ * @return 1 if the rounds are checkpointed every checkpointIntervalMs, 0 if not (at most when
+ *         cancelled)
+ */
+static int checkpointsOnTime(const MiningRound* round) {
+    return round->segmentBatches && round->control->checkpointIntervalMs;
+}
+
+/**
+ * Report the progress of mining, and checkpoint it, if it is time to.
+ * NOTE only ever called on the thread that called the miner, callbacks may need to be on it (JNI)
+ */
+static void reportProgress(const MiningRound* round) {
+    MiningControl* control = round->control;
+    const uint64_t now = monotonicMs();
+    if (control->onProgress && now >= control->nextProgressMs) {
+        control->nextProgressMs = now + control->progressIntervalMs;
+        control->onProgress(control->progressCtx,
+                            atomic_load_explicit(&control->noncesTried, memory_order_relaxed));
+    }
+    if (checkpointsOnTime(round) && now >= control->nextCheckpointMs) {
+        control->nextCheckpointMs = now + control->checkpointIntervalMs;
+        saveCheckpoint(round);
+    }
+}
+
+/**
+ * Check for a cancel before a batch of nonces, and report the progress if mining on the calling
+ * thread.
+ * @return 1 if mining was cancelled, 0 if not
+ */
+static int checkControl(const MiningRound* round, const int report, const uint64_t batches) {
+    MiningControl* control = round->control;
+    if (atomic_load_explicit(&control->cancelled, memory_order_relaxed))
+        return 1;
+    if (report && batches % PROGRESS_BATCHES == 0)
+        reportProgress(round);
+    return 0;
+}
+
+/**
+ * @return 1 if the mining of a round goes into the metrics, 0 if not
+ */
+static int isMetered(const MiningRound* round) {
+    return !round->control || !round->control->noMetrics;
+}
+
+/**
+ * Account for nonces hashed, once they are.
+ */
+static void countHashed(const MiningRound* round, const uint64_t nonces) {
+    if (isMetered(round))
+        metricsCountHashes(nonces);
+    if (round->control)
+        atomic_fetch_add_explicit(&round->control->noncesTried, nonces, memory_order_relaxed);
+}
+
+void miningControlInit(MiningControl* control, MiningProgress onProgress, void* progressCtx,
+                       const uint32_t progressIntervalMs) {
+    atomic_init(&control->cancelled, 0);
+    atomic_init(&control->noncesTried, 0);
+    control->onProgress = onProgress;
+    control->progressCtx = progressCtx;
+    control->progressIntervalMs = progressIntervalMs;
+    control->nextProgressMs = 0;
+    control->priority = SCHED_PRIORITY_NORMAL;
+    control->noMetrics = 0;
+    control->space.stride = 1;
+    control->space.offset = 0;
+    control->checkpointPath = NULL;
+    control->checkpointIntervalMs = 0;
+    control->nextCheckpointMs = 0;
+    control->checkpointFailing = 0;
+    control->checkpointPosition = 0;
+    control->coordinator = NULL;
+}
+
+void miningCancel(MiningControl* control) {
+    atomic_store(&control->cancelled, 1);
+}
+
+/**
+ * Search a range of nonces in order, a batch at a time, until the first valid one.
+ * @param round the round
+ * @param begin first nonce, a multiple of NONCE_BATCH
+ * @param end one past the last nonce
+ * @param report 1 if on the thread that called the miner, to report progress
+ * @param hashed set to the nonces hashed
+ * @return 1 if searched to the end, 0 if stopped before (a valid nonce, or mining cancelled)
+ */
+static int searchRange(MiningRound* round, const uint64_t begin, const uint64_t end,
+                       const int report, uint64_t* hashed) {
+    const struct Sha_256_lanes* kernel = round->kernel;
+    uint64_t batches = 0;
+    *hashed = 0;
+    for (uint64_t start = begin; start < end; start += NONCE_BATCH) {
+        // nothing left to win once a lower valid nonce is known
+        if (start > atomic_load_explicit(&round->bestNonce, memory_order_relaxed))
+            return 0;
+        // searched before the checkpoint this round was resumed from
+        _Atomic uint16_t* segment = round->segmentBatches ?
+                &round->segmentBatches[start >> CHECKPOINT_SEGMENT_BITS] : NULL;
+        if (segment && atomic_load_explicit(segment, memory_order_relaxed) == SEGMENT_BATCHES)
+            continue;
+        if (round->control && checkControl(round, report, batches++))
+            return 0;
+
+        const uint64_t batchEnd = start + NONCE_BATCH < end ? start + NONCE_BATCH : end;
+        for (uint64_t n = start; n < batchEnd; n += kernel->lanes) {
+            // the nonce word of each lane, i.e., the nonce bytes as they sit in the header
+            uint32_t nonceWords[SHA_256_MAX_LANES];
+            for (int lane = 0; lane < kernel->lanes; ++lane)
+                nonceWords[lane] = leWord((uint32_t)(n + lane));
+
+            // hash the headers of all the lanes, starting from the midstate
+            // NOTE: the kernel already rejects every lane whose leading word is above the target's,
+            //       which at any difficulty is all of them but once in a (very long) while
+            uint32_t states[8][SHA_256_MAX_LANES];
+            uint32_t candidates = round->compress(states, round->midstate, round->tailWords,
+                                                  HEADER_NONCE_WORD, nonceWords,
+                                                  round->targetWords[0]);
+
+            // the nonces left in this range are all higher, so the first hit is its best
+            for (int lane = 0; candidates && lane < kernel->lanes && n + lane < batchEnd; ++lane) {
+                if ((candidates >> lane & 1) && isBelowTarget(states, lane, round->targetWords)) {
+                    // the lanes past the valid nonce were hashed too, and none after them
+                    const uint64_t last = n + kernel->lanes < batchEnd ? n + kernel->lanes : batchEnd;
+                    countHashed(round, last - start);
+                    *hashed += last - start;
+                    offerNonce(round, n + lane);
+                    return 0;
+                }
+            }
+        }
+        countHashed(round, batchEnd - start);
+        *hashed += batchEnd - start;
+        if (segment)
+            atomic_fetch_add_explicit(segment, 1, memory_order_relaxed);
+    }
+    return 1;
+}
+
+/**
+ * Account for nonces searched or skipped, and end the round once they all are.
+ * NOTE the round may be gone as soon as this returns.
+ */
+static void finishRange(MiningRound* round, const uint64_t nonces) {
+    if (atomic_fetch_sub(&round->remaining, nonces) != nonces)
+        return;
+    pthread_mutex_lock(&round->doneLock);
+    round->done = 1;
+    pthread_cond_signal(&round->doneCond);
+    pthread_mutex_unlock(&round->doneLock);
+}
+
+/**
+ * A pool task: search a range of nonces of a round, leaving most of it for other workers to steal.
+ * - the upper half of the range is split off again and again, so the worker goes on with the
+ *   low end (where the winning nonce must be for the round to stop early) while idle workers steal
+ *   the biggest pieces from the top of its deque
+ */
+static void mineRange(const SchedTask* task) {
+    MiningRound* round = task->ctx;
+    const uint64_t begin = task->begin;
+    uint64_t end = task->end;
+    const uint64_t startNs = metricsNowNs();
+
+    const int skip = begin > atomic_load_explicit(&round->bestNonce, memory_order_relaxed) ||
+            (round->control && atomic_load_explicit(&round->control->cancelled, memory_order_relaxed));
+    while (!skip && end - begin > RANGE_GRAIN) {
+        const uint64_t mid = begin + (end - begin) / 2 / NONCE_BATCH * NONCE_BATCH;
+        const SchedTask upper = { mineRange, round, mid, end, task->priority };
+        if (schedSubmit(&upper) != 0)
+            break;
+        end = mid;
+    }
+    if (!skip) {
+        uint64_t hashed;
+        const int complete = searchRange(round, begin, end, 0, &hashed);
+        const uint64_t ns = metricsNowNs() - startNs;
+        if (isMetered(round))
+            metricsRecord(METRICS_TASK_TIME, ns);
+        // a range cut short, or too short a time, says little of the hashrate
+        if (complete && ns >= RATE_MIN_NS)
+            schedRecordRate(hashed, ns);
+    }
+    finishRange(round, end - begin);
+}
+
+/**
+ * Search the nonces of a round from begin to end on the shared pool, and wait for it to be done.
+ */
+static void mineRound(MiningRound* round, const uint64_t begin, const uint64_t end) {
+    const int threads = schedThreadCount();
+    atomic_init(&round->remaining, end - begin);
+    round->done = 0;
+
+    // a range per pool thread to start with, as big as the thread is fast (so that on big.LITTLE
+    // the LITTLE cores don't hold the round up), the rest is balanced by stealing
+    const SchedPriority priority = round->control ? round->control->priority : SCHED_PRIORITY_NORMAL;
+    uint64_t from = begin;
+    for (int worker = 0; worker < threads && from < end; ++worker) {
+        const uint64_t share = (uint64_t)(schedWorkerShare(worker) * (double)(end - begin));
+        const uint64_t shareBatches = (share + NONCE_BATCH - 1) / NONCE_BATCH * NONCE_BATCH;
+        const uint64_t to = worker == threads - 1 || from + shareBatches > end ? end :
+                from + shareBatches;
+        if (to == from)
+            continue;
+        const SchedTask task = { mineRange, round, from, to, priority };
+        if (schedSubmitTo(worker, &task) != 0)
+            mineRange(&task);
+        from = to;
+    }
+
+    // how often to wake up to report the progress and checkpoint, on this thread, 0 not to
+    uint32_t wakeMs = 0;
+    if (round->control && round->control->onProgress)
+        wakeMs = round->control->progressIntervalMs;
+    if (checkpointsOnTime(round) && (!wakeMs || round->control->checkpointIntervalMs < wakeMs))
+        wakeMs = round->control->checkpointIntervalMs;
+
+    pthread_mutex_lock(&round->doneLock);
+    while (!round->done) {
+        if (!wakeMs) {
+            pthread_cond_wait(&round->doneCond, &round->doneLock);
+            continue;
+        }
+        struct timespec deadline;
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        const uint64_t ns = (uint64_t)deadline.tv_nsec + (uint64_t)wakeMs * 1000000;
+        deadline.tv_sec += (time_t)(ns / 1000000000);
+        deadline.tv_nsec = (long)(ns % 1000000000);
+        pthread_cond_timedwait(&round->doneCond, &round->doneLock, &deadline);
+        if (!round->done) {
+            pthread_mutex_unlock(&round->doneLock);
+            reportProgress(round);
+            pthread_mutex_lock(&round->doneLock);
+        }
+    }
+    pthread_mutex_unlock(&round->doneLock);
+}
+
+void setMiningClock(MiningClock clock, void* ctx) {
+    miningClock = clock;
+    miningClockCtx = ctx;
+}
+
+uint32_t nextRoundTimestamp(const NonceSpace* space, const uint32_t now, const uint32_t last,
+                            const int first) {
+    const uint32_t stride = space && space->stride > 1 ? space->stride : 1;
+    const uint32_t offset = stride > 1 ? space->offset % stride : 0;
+    uint32_t timestamp = !first && now <= last ? last + 1 : now;
+    // up to the next timestamp of the share
+    timestamp += (offset + stride - timestamp % stride) % stride;
+    return timestamp;
+}
+
+int minerThreadCount(const int threads) {
+    if (threads >= 1)
+        return threads;
+    // SMT siblings share the SIMD units of their core, a 2nd thread on them adds little to hashing
+    const CpuTopology* topology = cpuTopology();
+    if (topology)
+        return topology->coreCount;
+    long cores = sysconf(_SC_NPROCESSORS_ONLN);
+    return cores >= 1 ? (int)cores : 1;
+}
+
+/**
+ * Set up the rounds of mining a header, whatever its timestamp.
+ * - to be ended with endRounds
+ */
+static void beginRounds(MiningRound* round, BlockHeader* header, const uint8_t targetHash[HASH_LEN],
+                        MiningControl* control) {
+    round->control = control;
+    round->startNs = metricsNowNs();
+    round->kernel = sha_256_lanes();
+    round->compress = header->version == HEADER_VERSION_SHA256D ? round->kernel->compress_double :
+            round->kernel->compress;
+    for (int i = 0; i < 8; ++i)
+        round->targetWords[i] = loadBigEndian(targetHash + 4 * i);
+    pthread_mutex_init(&round->doneLock, NULL);
+    pthread_cond_init(&round->doneCond, NULL);
+
+    // the header is hashed as two chunks: the first one (version .. most of dataHash) never
+    // changes while mining, the second (tail) one holds the timestamp and the nonce
+    // NOTE: this is the same hash as hashHeader(header, hash), just without recomputing the first
+    //       chunk for every nonce
+    uint8_t bytes[HEADER_SIZE];
+    uint8_t tailChunk[SIZE_OF_SHA_256_CHUNK];
+    serializeHeader(header, bytes);
+    makeHeaderMidstate(bytes, round->midstate);
+    makeHeaderTailChunk(bytes, tailChunk);
+    for (int i = 0; i < 16; ++i)
+        round->tailWords[i] = loadBigEndian(tailChunk + 4 * i);
+
+    round->header = header;
+    round->targetHash = targetHash;
+    round->segmentBatches = NULL;
+}
+
+static void endRounds(MiningRound* round) {
+    if (isMetered(round))
+        metricsCountMining(metricsNowNs() - round->startNs);
+    free(round->segmentBatches);
+    pthread_mutex_destroy(&round->doneLock);
+    pthread_cond_destroy(&round->doneCond);
+}
+
+/**
+ * Search the nonces of a round from begin to end, at the timestamp of the header.
+ * @param onPool 1 to search on the shared pool, 0 on the calling thread
+ */
+static void searchRound(MiningRound* round, const int onPool, const uint64_t begin,
+                        const uint64_t end) {
+    round->tailWords[HEADER_TIMESTAMP_WORD] = leWord(round->header->timestamp);
+    atomic_init(&round->bestNonce, NONCE_NONE);
+    uint64_t hashed;
+    if (onPool)
+        mineRound(round, begin, end);
+    else
+        searchRange(round, begin, end, 1, &hashed);
+}
+
+/**
+ * One thread means this very thread, e.g. for a deterministic reference run, anything else means
+ * the shared pool, which also runs the rounds of every other block mined at the time.
+ */
+static int minesOnPool(const int threads) {
+    return minerThreadCount(threads) > 1 && schedThreadCount() > 0;
+}
+
+int mineParallel(BlockHeader* header, const uint8_t targetHash[HASH_LEN], const int threads,
+                 uint8_t hash[HASH_LEN], MiningControl* control) {
+    MiningRound round;
+    beginRounds(&round, header, targetHash, control);
+    const int onPool = minesOnPool(threads);
+    int resumed = 0;
+    if (control && control->checkpointPath) {
+        // NOTE without the memory for it, this just mines without checkpointing
+        round.segmentBatches = calloc(CHECKPOINT_SEGMENTS, sizeof(*round.segmentBatches));
+        if (round.segmentBatches && !control->nextCheckpointMs)
+            control->nextCheckpointMs = monotonicMs() + control->checkpointIntervalMs;
+        // go on from the round of the checkpoint, if it is this block's: its segments are done
+        MiningCheckpoint checkpoint;
+        if (round.segmentBatches && checkpointLoad(control->checkpointPath, &checkpoint) == 0 &&
+            checkpointMatches(&checkpoint, header, targetHash)) {
+            BlockHeader saved;
+            deserializeHeader(checkpoint.header, &saved);
+            header->timestamp = saved.timestamp;
+            for (uint32_t i = 0; i < CHECKPOINT_SEGMENTS; ++i)
+                if (checkpoint.segments[i / 8] & (1u << (i % 8)))
+                    atomic_init(&round.segmentBatches[i], SEGMENT_BATCHES);
+            resumed = 1;
+        }
+    }
+
+    const uint64_t startNs = metricsNowNs();
+    const NonceSpace* space = control ? &control->space : NULL;
+    int rc = 0;
+    for (int first = 1; ; first = 0) {
+        // a resumed round keeps the timestamp and the segments of its checkpoint
+        if (!first || !resumed) {
+            // record the starttime of this mining round that may potentially get the correct hash
+            // NOTE when all the nonces of the last round were tried within the same second, this
+            //      is a second later than now: hashing the same headers again would be no use
+            const uint32_t now = miningClock ? miningClock(miningClockCtx) : (uint32_t)time(NULL);
+            header->timestamp = nextRoundTimestamp(space, now, first ? 0 : header->timestamp, first);
+            if (round.segmentBatches)
+                for (uint32_t i = 0; i < CHECKPOINT_SEGMENTS; ++i)
+                    atomic_init(&round.segmentBatches[i], 0);
+        }
+        searchRound(&round, onPool, 0, NONCE_END);
+
+        // NOTE a nonce found while cancelling may not be the lowest, so it does not count either
+        if (control && atomic_load(&control->cancelled)) {
+            // the workers are done with the round, so the checkpoint has all they searched
+            if (round.segmentBatches)
+                saveCheckpoint(&round);
+            errno = ECANCELED;
+            rc = -1;
+            break;
+        }
+        uint64_t best = atomic_load(&round.bestNonce);
+        if (best != NONCE_NONE) {
+            // record the nonce that got the valid hash
+            header->nonce = (uint32_t)best;
+            // the hash was found in some lane of some thread, hashing the header again is as cheap
+            // as getting it back from there
+            if (hash)
+                hashHeader(header, hash);
+            if (isMetered(&round))
+                metricsCountBlock(metricsNowNs() - startNs);
+            break;
+        }
+        // when all uint32 exhausted without a valid hash, go for the next round with to find the
+        // right time + nonce combo that may result in a valid hash
+        if (isMetered(&round))
+            metricsCountRollover();
+    }
+    endRounds(&round);
+    return rc;
+}
+
+int mineNonceRange(BlockHeader* header, const uint8_t targetHash[HASH_LEN], const uint32_t begin,
+                   const uint64_t end, const int threads, uint8_t hash[HASH_LEN],
+                   MiningControl* control) {
+    MiningRound round;
+    beginRounds(&round, header, targetHash, control);
+    searchRound(&round, minesOnPool(threads), begin, end < NONCE_END ? end : NONCE_END);
+    const uint64_t best = atomic_load(&round.bestNonce);
+    endRounds(&round);
+
+    if (control && atomic_load(&control->cancelled)) {
+        errno = ECANCELED;
+        return -1;
+    }
+    if (best == NONCE_NONE) {
+        errno = ENOENT;
+        return -1;
+    }
+    header->nonce = (uint32_t)best;
+    if (hash)
+        hashHeader(header, hash);
+    return 0;
+}
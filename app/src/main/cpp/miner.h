@@ -0,0 +1,174 @@
+#ifndef BTCO_MINER_H
+#define BTCO_MINER_H
+
+#include <stdint.h>
+#include <stdatomic.h>
+
+#include "blockchain.h"
+
+struct Coordinator; // see coordinator.h
+
+// pass as the thread count to use one mining thread per physical core (see topology.h)
+#define MINER_AUTO_THREADS 0
+
+/**
+ * Called with the progress of mining, on the thread that called the miner.
+ * @param ctx the progressCtx of the MiningControl
+ * @param noncesTried total nonces tried by all the threads since the control was initialized
+ */
+typedef void (*MiningProgress)(void* ctx, uint64_t noncesTried);
+
+/**
+ * The share of the search space of a miner, when several (e.g. processes) mine the same block.
+ * - the header has no room for an extranonce, so the timestamp is used as one: a miner only uses
+ *   the timestamps that are offset modulo stride, and never the same one twice for a block, so no
+ *   (timestamp, nonce) pair is ever hashed twice by it or by the others
+ * - the nonces of a round are split into disjoint ranges among the threads of a miner
+ */
+typedef struct {
+    uint32_t stride; // number of miners sharing the block, 1 if alone
+    uint32_t offset; // the share of this miner, 0..stride-1
+} NonceSpace;
+
+/**
+ * A handle on a mining task, to cancel it and follow its progress from other threads.
+ * - the workers only touch it once per batch of nonces, so it costs nothing in the hot loop
+ * - one control can be used for many blocks in a row, e.g. a whole mining job
+ */
+typedef struct MiningControl {
+    // set (see miningCancel) to stop mining as soon as possible
+    _Atomic int cancelled;
+
+    // nonces tried so far, counted a batch at a time
+    _Atomic uint64_t noncesTried;
+
+    // called at most every progressIntervalMs on the thread that called the miner, may be NULL
+    MiningProgress onProgress;
+    void* progressCtx;
+    uint32_t progressIntervalMs;
+    uint64_t nextProgressMs;
+
+    // a SchedPriority, for the tasks of this mining on the shared pool (NORMAL by default)
+    int priority;
+
+    // 1 to keep this mining out of the metrics (see metrics.h), e.g. a calibration, 0 by default
+    int noMetrics;
+
+    // the timestamps this mining may use, all of them by default
+    NonceSpace space;
+
+    // where to checkpoint the search of each block (see checkpoint.h), NULL not to (the default)
+    // - written at most every checkpointIntervalMs (0: never on a timer), and when cancelled, by
+    //   the thread that called the miner: the workers only count the batches they are done with
+    // - a block whose checkpoint is there already goes on from it, i.e., from its round and
+    //   without the nonces searched in it
+    // - the checkpoint is left there once the block is mined, for the caller to remove
+    const char* checkpointPath;
+    uint32_t checkpointIntervalMs;
+    uint64_t nextCheckpointMs;
+
+    // whether the last checkpoint could not be written, the failures are logged once in a row
+    int checkpointFailing;
+
+    // written into the checkpoints as their position, e.g. the length of chain being mined for
+    uint64_t checkpointPosition;
+
+    // the coordinator to mine through (see coordinator.h), i.e., by the workers connected to it
+    // rather than by this process, NULL not to (the default)
+    // - the blocks are not checkpointed then, and the thread count is up to each worker
+    struct Coordinator* coordinator;
+} MiningControl;
+
+/**
+ * Initialize a mining control.
+ * @param control the control
+ * @param onProgress called with the progress of mining, may be NULL
+ * @param progressCtx passed to onProgress
+ * @param progressIntervalMs min time between 2 calls of onProgress
+ */
+void miningControlInit(MiningControl* control, MiningProgress onProgress, void* progressCtx,
+                       const uint32_t progressIntervalMs);
+
+/**
+ * Ask the mining under a control to stop, from any thread.
+ * - the miner returns within a batch of nonces per thread
+ * @param control the control
+ */
+void miningCancel(MiningControl* control);
+
+/**
+ * Where the miner gets the current time (in seconds since the epoch) for the header timestamps.
+ * @param ctx the ctx given to setMiningClock
+ */
+typedef uint32_t (*MiningClock)(void* ctx);
+
+/**
+ * Make the miner read the time from another clock, e.g. a fixed one for reproducible benchmarks.
+ * - NOT to be called while mining
+ * @param clock the clock, NULL for the real time (time(NULL))
+ * @param ctx passed to the clock
+ */
+void setMiningClock(MiningClock clock, void* ctx);
+
+/**
+ * Pick the timestamp of the next round of mining a block.
+ * @param space the share of the miner, NULL for all the timestamps
+ * @param now the current time
+ * @param last the timestamp of the previous round of the block
+ * @param first 1 for the first round of the block, when there is no previous one
+ * @return the first timestamp of the share that is at least now, and after last unless first
+ */
+uint32_t nextRoundTimestamp(const NonceSpace* space, const uint32_t now, const uint32_t last,
+                            const int first);
+
+/**
+ * Resolve a requested mining thread count into the number of worker threads actually used.
+ * @param threads the requested count, MINER_AUTO_THREADS (or any value < 1) for one per physical
+ *                core of the CPUs this process may run on, SMT siblings left out
+ * @return the number of worker threads, at least 1
+ */
+int minerThreadCount(const int threads);
+
+/**
+ * Mine a header by splitting the nonce space of every timestamp round across the shared pool.
+ * - the nonce space is cut into ranges that the pool workers split further and steal from each
+ *   other (see scheduler.h), along with the ranges of every other header being mined at the time
+ * - a range is skipped or stopped as soon as a nonce lower than anything it has left is known to
+ *   be valid
+ * - the winner is always the LOWEST valid nonce of the round, so the result for a given timestamp
+ *   does not depend on the thread count or on scheduling, and is the same as mining on one thread
+ * - each round has a new timestamp (see nextRoundTimestamp), even when the nonces of a round run
+ *   out within a second, so no header is hashed twice
+ * NOTE do not call this from a pool task, it waits for other pool tasks.
+ * @param header the header of the block initialized somewhere else, timestamp and nonce are set
+ * @param targetHash the (big-endian) hash that the header hash must be below
+ * @param threads 1 to mine on the calling thread only, anything else to mine on the shared pool
+ *                (whose size is set by schedConfigure, one thread per core by default)
+ * @param hash set to the hash of the mined header, may be NULL
+ * @param control to cancel mining and follow its progress, may be NULL
+ * @return 0 once mined, -1 with errno ECANCELED if cancelled (the header is not valid then)
+ */
+int mineParallel(BlockHeader* header, const uint8_t targetHash[HASH_LEN], const int threads,
+                 uint8_t hash[HASH_LEN], MiningControl* control);
+
+/**
+ * Search a range of the nonces of a header at its timestamp only, e.g. a unit of work handed out by
+ * a coordinator (see worker.h).
+ * - on the calling thread or the shared pool as mineParallel, and the winner is the LOWEST valid
+ *   nonce of the range likewise
+ * - ranges made of whole batches of 4096 nonces split the best
+ * @param header the header of the block, timestamp included, the nonce is set
+ * @param targetHash the (big-endian) hash that the header hash must be below
+ * @param begin the first nonce
+ * @param end one past the last nonce, the nonces of a round end before UINT32_MAX
+ * @param threads as for mineParallel
+ * @param hash set to the hash of the mined header, may be NULL
+ * @param control to cancel mining and follow its progress, may be NULL
+ * @return 0 once mined, -1 with errno ENOENT if no nonce of the range is valid, ECANCELED if
+ *         cancelled
+ */
+int mineNonceRange(BlockHeader* header, const uint8_t targetHash[HASH_LEN], const uint32_t begin,
+                   const uint64_t end, const int threads, uint8_t hash[HASH_LEN],
+                   MiningControl* control);
+
+#endif //BTCO_MINER_H
@@ -0,0 +1,56 @@
+/*
+ * A minimal fork-join helper for the hashing that is not mining (Merkle trees, verification, ...).
+ */
+
+#include <stddef.h>
+#include <pthread.h>
+
+#include "miner.h"
+#include "parallel.h"
+
+typedef struct {
+    ParallelTask task;
+    void* ctx;
+    size_t begin;
+    size_t end;
+} ParallelShare;
+
+static void* runShare(void* arg) {
+    const ParallelShare* share = arg;
+    share->task(share->ctx, share->begin, share->end);
+    return NULL;
+}
+
+void parallelFor(size_t count, size_t minPerThread, int threads, ParallelTask task, void* ctx) {
+    if (count == 0)
+        return;
+
+    size_t shares = (size_t)minerThreadCount(threads);
+    if (minPerThread < 1)
+        minPerThread = 1;
+    if (shares > count / minPerThread)
+        shares = count / minPerThread;
+    if (shares <= 1) {
+        task(ctx, 0, count);
+        return;
+    }
+
+    ParallelShare share[shares];
+    pthread_t tids[shares];
+    int started[shares];
+    for (size_t i = 0; i < shares; ++i) {
+        share[i].task = task;
+        share[i].ctx = ctx;
+        share[i].begin = count * i / shares;
+        share[i].end = count * (i + 1) / shares;
+        started[i] = i > 0 && pthread_create(&tids[i], NULL, runShare, &share[i]) == 0;
+    }
+
+    // the first share, and those of threads that failed to start, run on the calling thread
+    for (size_t i = 0; i < shares; ++i)
+        if (!started[i])
+            runShare(&share[i]);
+    for (size_t i = 1; i < shares; ++i)
+        if (started[i])
+            pthread_join(tids[i], NULL);
+}
@@ -0,0 +1,26 @@
+#ifndef BTCO_PARALLEL_H
+#define BTCO_PARALLEL_H
+
+#include <stddef.h>
+
+/**
+ * A share of a parallel loop: process the items [begin, end).
+ * @param ctx whatever the task needs, shared by all the threads
+ * @param begin first item of this share
+ * @param end one past the last item of this share
+ */
+typedef void (*ParallelTask)(void* ctx, size_t begin, size_t end);
+
+/**
+ * Run a loop over count items on several threads, each getting one contiguous share.
+ * - the calling thread takes the first share itself, and returns once all the shares are done
+ * - small loops are not worth a thread: every thread gets at least minPerThread items
+ * @param count number of items
+ * @param minPerThread min number of items that is worth a thread of its own
+ * @param threads max number of threads, MINER_AUTO_THREADS for one per core
+ * @param task what to do with a share
+ * @param ctx passed to every task call
+ */
+void parallelFor(size_t count, size_t minPerThread, int threads, ParallelTask task, void* ctx);
+
+#endif //BTCO_PARALLEL_H
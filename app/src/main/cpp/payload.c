@@ -0,0 +1,172 @@
+/*
+ * Hashing of block data that is too big to (or simply is not) sit in one buffer in RAM.
+ */
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "sha-256.h"
+#include "payload.h"
+
+// bytes of a file mapped at a time, small enough for a 32-bit address space
+#define MAP_WINDOW ((uint64_t)64 << 20)
+
+// bytes read at a time when the data can't be mapped, a whole number of SHA256 chunks
+#define READ_BUFFER (1 << 20)
+
+/**
+ * Hash a regular file from offset to size by mapping it a window at a time.
+ * @param partial set to 1 once something was hashed, after which a failure can't fall back to
+ *                reading the file instead
+ * @return 0 on success, -1 if a window could not be mapped (with errno set)
+ */
+static int hashMapped(int fd, off_t offset, uint64_t size, struct Sha_256* sha, int* partial) {
+    const uint64_t pageSize = (uint64_t)sysconf(_SC_PAGESIZE);
+
+    // mappings start at a page boundary, so hash from the start of the page the data starts in
+    uint64_t pos = (uint64_t)offset - (uint64_t)offset % pageSize;
+    uint64_t skip = (uint64_t)offset - pos;
+    *partial = 0;
+
+    while (pos < size) {
+        const size_t window = (size_t)(size - pos < MAP_WINDOW ? size - pos : MAP_WINDOW);
+        uint8_t* p = mmap(NULL, window, PROT_READ, MAP_PRIVATE, fd, (off_t)pos);
+        if (p == MAP_FAILED)
+            return -1;
+        madvise(p, window, MADV_SEQUENTIAL);
+        sha_256_write(sha, p + skip, window - skip);
+        munmap(p, window);
+
+        *partial = 1;
+        pos += window;
+        skip = 0;
+    }
+    return 0;
+}
+
+/**
+ * Reader over a file descriptor, for whatever can't be mapped.
+ */
+static int64_t readFd(void* ctx, uint8_t* buf, size_t size) {
+    const int fd = *(const int*)ctx;
+    ssize_t n;
+    do {
+        n = read(fd, buf, size);
+    } while (n < 0 && errno == EINTR);
+    return n;
+}
+
+int hashPayloadFd(int fd, uint8_t hash[SIZE_OF_SHA_256_HASH], uint64_t* length) {
+    struct stat st;
+    if (fstat(fd, &st) != 0)
+        return -1;
+
+    off_t offset = S_ISREG(st.st_mode) ? lseek(fd, 0, SEEK_CUR) : -1;
+    if (offset >= 0 && offset <= st.st_size) {
+        struct Sha_256 sha;
+        int partial;
+        sha_256_init(&sha);
+        if (hashMapped(fd, offset, (uint64_t)st.st_size, &sha, &partial) == 0) {
+            sha_256_close(&sha, hash);
+            if (length)
+                *length = (uint64_t)(st.st_size - offset);
+            // leave the fd at the end of the data, as reading it would have
+            lseek(fd, st.st_size, SEEK_SET);
+            return 0;
+        }
+        if (partial)
+            return -1;
+        // could not map this file at all (e.g. on some special filesystems), read it instead
+    }
+    return hashPayloadReader(readFd, &fd, hash, length);
+}
+
+/**
+ * Reader over a range of a file descriptor, with pread.
+ */
+typedef struct {
+    int fd;
+    uint64_t pos;
+    uint64_t end;
+} RangeReader;
+
+static int64_t readRange(void* ctx, uint8_t* buf, size_t size) {
+    RangeReader* range = ctx;
+    if (size > range->end - range->pos)
+        size = (size_t)(range->end - range->pos);
+    if (size == 0)
+        return 0;
+
+    ssize_t n;
+    do {
+        n = pread(range->fd, buf, size, (off_t)range->pos);
+    } while (n < 0 && errno == EINTR);
+    if (n == 0) {
+        // the file is shorter than the range
+        errno = EIO;
+        return -1;
+    }
+    if (n > 0)
+        range->pos += (uint64_t)n;
+    return n;
+}
+
+int hashPayloadRange(int fd, uint64_t offset, uint64_t length, uint8_t hash[SIZE_OF_SHA_256_HASH]) {
+    struct stat st;
+    if (fstat(fd, &st) != 0)
+        return -1;
+    if (S_ISREG(st.st_mode) && offset + length > (uint64_t)st.st_size) {
+        // mapping past the end of the file would crash (SIGBUS) rather than fail
+        errno = EIO;
+        return -1;
+    }
+
+    if (S_ISREG(st.st_mode)) {
+        struct Sha_256 sha;
+        int partial;
+        sha_256_init(&sha);
+        if (hashMapped(fd, (off_t)offset, offset + length, &sha, &partial) == 0) {
+            sha_256_close(&sha, hash);
+            return 0;
+        }
+        if (partial)
+            return -1;
+    }
+    RangeReader range = { fd, offset, offset + length };
+    return hashPayloadReader(readRange, &range, hash, NULL);
+}
+
+int hashPayloadReader(PayloadReader reader, void* ctx, uint8_t hash[SIZE_OF_SHA_256_HASH],
+                      uint64_t* length) {
+    // aligned so that the chunks are hashed straight out of the buffer on any backend
+    uint8_t* buf;
+    if (posix_memalign((void**)&buf, SIZE_OF_SHA_256_CHUNK, READ_BUFFER) != 0) {
+        errno = ENOMEM;
+        return -1;
+    }
+
+    struct Sha_256 sha;
+    uint64_t total = 0;
+    sha_256_init(&sha);
+    while (1) {
+        int64_t n = reader(ctx, buf, READ_BUFFER);
+        if (n < 0) {
+            free(buf);
+            return -1;
+        }
+        if (n == 0)
+            break;
+        sha_256_write(&sha, buf, (size_t)n);
+        total += (uint64_t)n;
+    }
+    free(buf);
+
+    sha_256_close(&sha, hash);
+    if (length)
+        *length = total;
+    return 0;
+}
@@ -0,0 +1,52 @@
+#ifndef BTCO_PAYLOAD_H
+#define BTCO_PAYLOAD_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "sha-256.h"
+
+/**
+ * Pull-style source of block data, for payloads that are not (all) in memory.
+ * @param ctx whatever the reader needs, passed through untouched
+ * @param buf where to put the next bytes
+ * @param size max number of bytes to put in buf
+ * @return number of bytes put in buf, 0 at the end of the data, < 0 on error (with errno set)
+ */
+typedef int64_t (*PayloadReader)(void* ctx, uint8_t* buf, size_t size);
+
+/**
+ * Hash everything from the current position of a file descriptor to its end.
+ * - regular files are memory-mapped a window at a time and hashed in place, without copying
+ * - anything else (pipes, sockets, ...) is read through one big aligned buffer
+ * @param fd the file descriptor to read, e.g. from open(...)
+ * @param hash the output SHA256 hash of the data
+ * @param length set to the number of bytes hashed, may be NULL
+ * @return 0 on success, -1 on error with errno set
+ */
+int hashPayloadFd(int fd, uint8_t hash[SIZE_OF_SHA_256_HASH], uint64_t* length);
+
+/**
+ * Hash a range of a file, e.g. the data of a block in a chain store.
+ * - memory-mapped a window at a time like hashPayloadFd, or read with pread if it can't be
+ * - the position of the file descriptor is not used nor changed, so threads may share it
+ * @param fd the file descriptor to read
+ * @param offset where the data starts in the file
+ * @param length number of bytes of data
+ * @param hash the output SHA256 hash of the data
+ * @return 0 on success, -1 on error with errno set (EIO if the file ends before the data does)
+ */
+int hashPayloadRange(int fd, uint64_t offset, uint64_t length, uint8_t hash[SIZE_OF_SHA_256_HASH]);
+
+/**
+ * Hash everything a reader gives until it signals the end of the data.
+ * @param reader the data source
+ * @param ctx passed to every reader call
+ * @param hash the output SHA256 hash of the data
+ * @param length set to the number of bytes hashed, may be NULL
+ * @return 0 on success, -1 on error with errno set (by the reader)
+ */
+int hashPayloadReader(PayloadReader reader, void* ctx, uint8_t hash[SIZE_OF_SHA_256_HASH],
+                      uint64_t* length);
+
+#endif //BTCO_PAYLOAD_H
@@ -0,0 +1,49 @@
+/*
+ * Retargeting of the blocks of a chain toward a block interval (see retarget.h).
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "blockchain.h"
+#include "retarget.h"
+
+void retargetInit(Retarget* retarget, const uint32_t intervalSec) {
+    retarget->intervalSec = intervalSec;
+    retarget->window = RETARGET_WINDOW;
+    retarget->maxAdjust = RETARGET_MAX_ADJUST;
+}
+
+/**
+ * Get the header at an index of headers of any stride.
+ */
+static const BlockHeader* headerAt(const BlockHeader* headers, const size_t stride, const size_t i) {
+    return (const BlockHeader*)((const uint8_t*)headers + i * stride);
+}
+
+uint32_t retargetBits(const Retarget* retarget, const BlockHeader* headers, const size_t count,
+                      const size_t stride) {
+    const BlockHeader* last = headerAt(headers, stride, count - 1);
+    size_t window = retarget->window < RETARGET_MAX_WINDOW ? retarget->window : RETARGET_MAX_WINDOW;
+    if (window > count - 1)
+        window = count - 1;
+    if (!retarget->intervalSec || window == 0)
+        return last->bits;
+
+    // the average target of the window, then scaled by the time it took over the time aimed at
+    double target = 0;
+    for (size_t i = count - window; i < count; ++i)
+        target += bitsToTargetValue(headerAt(headers, stride, i)->bits);
+    target /= (double)window;
+
+    // NOTE the timestamps may go back (e.g. a clock set back), that is just a fast window
+    const double expected = (double)window * retarget->intervalSec;
+    double actual = (double)last->timestamp -
+            (double)headerAt(headers, stride, count - 1 - window)->timestamp;
+    const double maxAdjust = retarget->maxAdjust > 1 ? retarget->maxAdjust : 1;
+    if (actual < expected / maxAdjust)
+        actual = expected / maxAdjust;
+    if (actual > expected * maxAdjust)
+        actual = expected * maxAdjust;
+    return targetValueToBits(target * actual / expected);
+}
@@ -0,0 +1,58 @@
+#ifndef BTCO_RETARGET_H
+#define BTCO_RETARGET_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "blockchain.h"
+
+// defaults of retargetInit
+#define RETARGET_WINDOW 16
+#define RETARGET_MAX_ADJUST 4
+
+// the most blocks a retarget looks back at
+#define RETARGET_MAX_WINDOW 256
+
+/**
+ * How the target of a chain follows the time its blocks take, to mine a block every so often
+ * whatever the load of the device (rather than a fixed difficulty, whose time per block swings with
+ * it, and by 16x from one difficulty to the next).
+ * - every block gets the average target of the last window blocks, scaled by how long they took
+ *   over how long they should have, as in Dash's Dark Gravity Wave: averaging keeps a slow or lucky
+ *   block from swinging the next ones
+ * - the scaling is clamped to 1/maxAdjust..maxAdjust, so that one odd timestamp can't either
+ * NOTE the timestamps are the start of the mining round that found each block, in seconds, so the
+ *      interval had better be a few seconds at least
+ */
+typedef struct {
+    // the time aimed at between 2 blocks, in seconds, 0 not to retarget
+    uint32_t intervalSec;
+
+    // the blocks looked back at, 1..RETARGET_MAX_WINDOW
+    uint32_t window;
+
+    // the most the target moves by at once, up or down, >= 1
+    uint32_t maxAdjust;
+} Retarget;
+
+/**
+ * Set a retarget up with the default window and max adjustment.
+ * @param retarget the retarget
+ * @param intervalSec the time aimed at between 2 blocks, in seconds, 0 not to retarget
+ */
+void retargetInit(Retarget* retarget, const uint32_t intervalSec);
+
+/**
+ * Get the target bits of the block after some blocks.
+ * @param retarget the retarget
+ * @param headers the last blocks, oldest first (e.g. the last window + 1 of the chain), may be
+ *                headers inside bigger structs
+ * @param count number of blocks, > 0
+ * @param stride number of bytes from one header to the next, sizeof(BlockHeader) for an array
+ * @return the bits of the next block, those of the last block if it can't be retargeted yet (it is
+ *         the genesis block) or retarget is off
+ */
+uint32_t retargetBits(const Retarget* retarget, const BlockHeader* headers, const size_t count,
+                      const size_t stride);
+
+#endif //BTCO_RETARGET_H
@@ -0,0 +1,316 @@
+/*
+ * The shared worker pool, with one work-stealing deque per worker (see scheduler.h).
+ */
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include <stdatomic.h>
+
+#include "miner.h"
+#include "scheduler.h"
+#include "topology.h"
+
+// tasks a deque holds at first, per priority, it then doubles as needed
+#define DEQUE_MIN_CAPACITY 64
+
+// the weight of a new rate in the average rate of a worker, 1 / 2^RATE_SMOOTHING
+#define RATE_SMOOTHING 3
+
+// no CPU to pin a worker to
+#define NO_CPU (-1)
+
+/**
+ * The tasks of one worker, one ring buffer per priority.
+ * - the worker pushes and pops at the bottom (newest first, i.e., the small pieces it just split
+ *   off, close to what it is working on), thieves take from the top (oldest, i.e., biggest pieces)
+ * - tasks are coarse (thousands of hashes), so a lock per deque is cheap enough
+ */
+typedef struct {
+    pthread_mutex_t lock;
+    SchedTask* tasks[SCHED_PRIORITIES];
+    size_t capacity[SCHED_PRIORITIES];
+    size_t top[SCHED_PRIORITIES];
+    size_t bottom[SCHED_PRIORITIES];
+} SchedDeque;
+
+/**
+ * Where a worker runs, and how fast.
+ */
+typedef struct {
+    int cpu; // the CPU it is pinned to, NO_CPU if none
+
+    // the share of a core it has, TOPOLOGY_FULL_CAPACITY for a whole core of the fastest kind
+    uint32_t capacity;
+
+    // the units of tasks (e.g. nonces) it does per second, on average, 0 until measured
+    // NOTE only ever written by the worker itself
+    _Atomic uint64_t rate;
+} SchedWorker;
+
+static struct {
+    pthread_once_t once;
+    pthread_mutex_t configLock;
+    int requestedThreads;
+    int pinning;
+    int threads;
+    SchedDeque* deques;
+    SchedWorker* workers;
+
+    // tasks in all the deques, and the workers sleeping for lack of them
+    _Atomic size_t queued;
+    _Atomic int sleeping;
+    pthread_mutex_t idleLock;
+    pthread_cond_t idleCond;
+
+    // the deque of the next task submitted from outside the pool
+    _Atomic unsigned next;
+} sched = {
+        PTHREAD_ONCE_INIT, PTHREAD_MUTEX_INITIALIZER, 0, 1, 0, NULL, NULL,
+        0, 0, PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER, 0
+};
+
+// index of the worker running on this thread, -1 if it is not a worker
+static _Thread_local int workerIndex = -1;
+
+/**
+ * Push a task at the bottom of a deque.
+ * @return 0 on success, -1 if out of memory
+ */
+static int pushBottom(SchedDeque* deque, const SchedTask* task) {
+    const int p = task->priority;
+    pthread_mutex_lock(&deque->lock);
+    if (deque->bottom[p] - deque->top[p] == deque->capacity[p]) {
+        // unroll the ring into a bigger one
+        const size_t capacity = deque->capacity[p] ? 2 * deque->capacity[p] : DEQUE_MIN_CAPACITY;
+        SchedTask* tasks = malloc(capacity * sizeof(SchedTask));
+        if (!tasks) {
+            pthread_mutex_unlock(&deque->lock);
+            return -1;
+        }
+        for (size_t i = deque->top[p]; i < deque->bottom[p]; ++i)
+            tasks[i - deque->top[p]] = deque->tasks[p][i % deque->capacity[p]];
+        free(deque->tasks[p]);
+        deque->tasks[p] = tasks;
+        deque->bottom[p] -= deque->top[p];
+        deque->top[p] = 0;
+        deque->capacity[p] = capacity;
+    }
+    deque->tasks[p][deque->bottom[p]++ % deque->capacity[p]] = *task;
+    pthread_mutex_unlock(&deque->lock);
+    return 0;
+}
+
+/**
+ * Take a task of a priority from a deque, from the bottom (own deque) or the top (stealing).
+ * @return 1 if a task was taken, 0 if there was none
+ */
+static int take(SchedDeque* deque, const int p, const int steal, SchedTask* task) {
+    pthread_mutex_lock(&deque->lock);
+    const int found = deque->bottom[p] != deque->top[p];
+    if (found) {
+        const size_t i = steal ? deque->top[p]++ : --deque->bottom[p];
+        *task = deque->tasks[p][i % deque->capacity[p]];
+    }
+    pthread_mutex_unlock(&deque->lock);
+    return found;
+}
+
+/**
+ * Find the next task of a worker: the highest priority one, from its own deque first.
+ * @return 1 if a task was found, 0 if all the deques are empty
+ */
+static int findTask(const int self, SchedTask* task) {
+    for (int p = SCHED_PRIORITIES - 1; p >= 0; --p) {
+        if (take(&sched.deques[self], p, 0, task))
+            return 1;
+        for (int i = 1; i < sched.threads; ++i)
+            if (take(&sched.deques[(self + i) % sched.threads], p, 1, task))
+                return 1;
+    }
+    return 0;
+}
+
+static void* runWorker(void* arg) {
+    workerIndex = (int)(intptr_t)arg;
+    // NOTE a worker that can't be pinned just runs wherever the kernel puts it
+    if (sched.workers[workerIndex].cpu != NO_CPU)
+        topologyPinThread(sched.workers[workerIndex].cpu);
+    SchedTask task;
+    while (1) {
+        if (atomic_load(&sched.queued) > 0 && findTask(workerIndex, &task)) {
+            atomic_fetch_sub(&sched.queued, 1);
+            task.run(&task);
+            continue;
+        }
+
+        // sleep until something is queued, see schedSubmit for the other side of this
+        pthread_mutex_lock(&sched.idleLock);
+        atomic_fetch_add(&sched.sleeping, 1);
+        while (atomic_load(&sched.queued) == 0)
+            pthread_cond_wait(&sched.idleCond, &sched.idleLock);
+        atomic_fetch_sub(&sched.sleeping, 1);
+        pthread_mutex_unlock(&sched.idleLock);
+    }
+    return NULL;
+}
+
+/**
+ * Put the workers on the CPUs of the topology in its order, i.e., one per core, fastest first, and
+ * SMT siblings last: worker i on the CPU i of the topology, if there are enough CPUs to go round.
+ */
+static void placeWorkers(const int threads) {
+    const CpuTopology* topology = cpuTopology();
+    const int pin = sched.pinning && topology && threads <= topology->cpuCount;
+    int perCore[TOPOLOGY_MAX_CPUS] = { 0 };
+    for (int i = 0; pin && i < threads; ++i)
+        ++perCore[topology->cpus[i].core];
+    for (int i = 0; i < threads; ++i) {
+        SchedWorker* worker = &sched.workers[i];
+        worker->cpu = pin ? topology->cpus[i].cpu : NO_CPU;
+        // SMT siblings share their core
+        worker->capacity = pin ? topology->cpus[i].capacity / (uint32_t)perCore[topology->cpus[i].core] :
+                TOPOLOGY_FULL_CAPACITY;
+        atomic_init(&worker->rate, 0);
+    }
+}
+
+static void startPool(void) {
+    pthread_mutex_lock(&sched.configLock);
+    const int threads = minerThreadCount(sched.requestedThreads);
+    sched.deques = calloc((size_t)threads, sizeof(SchedDeque));
+    sched.workers = calloc((size_t)threads, sizeof(SchedWorker));
+    if (!sched.workers) {
+        free(sched.deques);
+        sched.deques = NULL;
+    } else {
+        placeWorkers(threads);
+    }
+    int started = 0;
+    for (int i = 0; sched.deques && i < threads; ++i) {
+        pthread_mutex_init(&sched.deques[i].lock, NULL);
+        pthread_t tid;
+        pthread_attr_t attr;
+        pthread_attr_init(&attr);
+        pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+        // NOTE the workers only look at the deques below sched.threads, so one failing to start
+        //      just makes the pool smaller
+        if (pthread_create(&tid, &attr, runWorker, (void*)(intptr_t)started) == 0)
+            ++started;
+        pthread_attr_destroy(&attr);
+    }
+    sched.threads = started;
+    pthread_mutex_unlock(&sched.configLock);
+}
+
+int schedConfigure(const int threads) {
+    pthread_mutex_lock(&sched.configLock);
+    const int running = sched.deques != NULL;
+    if (!running)
+        sched.requestedThreads = threads;
+    pthread_mutex_unlock(&sched.configLock);
+    if (running) {
+        errno = EBUSY;
+        return -1;
+    }
+    return 0;
+}
+
+int schedConfigurePinning(const int pin) {
+    pthread_mutex_lock(&sched.configLock);
+    const int running = sched.deques != NULL;
+    if (!running)
+        sched.pinning = pin;
+    pthread_mutex_unlock(&sched.configLock);
+    if (running) {
+        errno = EBUSY;
+        return -1;
+    }
+    return 0;
+}
+
+int schedThreadCount(void) {
+    pthread_once(&sched.once, startPool);
+    return sched.threads;
+}
+
+/**
+ * Queue a task on the deque of a worker, and wake a worker up for it if need be.
+ */
+static int submitTo(const int worker, const SchedTask* task) {
+    if (pushBottom(&sched.deques[worker], task) != 0) {
+        errno = ENOMEM;
+        return -1;
+    }
+
+    // NOTE the sleepers count goes up before a worker checks the queue, and the queue count goes up
+    //      before it is checked here, so either the worker sees the task or it is woken up
+    atomic_fetch_add(&sched.queued, 1);
+    if (atomic_load(&sched.sleeping) > 0) {
+        pthread_mutex_lock(&sched.idleLock);
+        pthread_cond_signal(&sched.idleCond);
+        pthread_mutex_unlock(&sched.idleLock);
+    }
+    return 0;
+}
+
+int schedSubmit(const SchedTask* task) {
+    const int threads = schedThreadCount();
+    if (threads == 0) {
+        errno = EAGAIN;
+        return -1;
+    }
+    return submitTo(workerIndex >= 0 ? workerIndex :
+                    (int)(atomic_fetch_add(&sched.next, 1) % (unsigned)threads), task);
+}
+
+int schedSubmitTo(const int worker, const SchedTask* task) {
+    const int threads = schedThreadCount();
+    if (threads == 0) {
+        errno = EAGAIN;
+        return -1;
+    }
+    return submitTo(worker >= 0 && worker < threads ? worker : 0, task);
+}
+
+void schedRecordRate(const uint64_t units, const uint64_t ns) {
+    if (workerIndex < 0 || ns == 0)
+        return;
+    _Atomic uint64_t* rate = &sched.workers[workerIndex].rate;
+    const uint64_t sample = (uint64_t)((double)units * 1e9 / (double)ns);
+    // NOTE a rate of 0 is one not measured yet
+    if (sample == 0)
+        return;
+    const uint64_t average = atomic_load_explicit(rate, memory_order_relaxed);
+    atomic_store_explicit(rate, average ? average - (average >> RATE_SMOOTHING) +
+                          (sample >> RATE_SMOOTHING) : sample, memory_order_relaxed);
+}
+
+double schedWorkerShare(const int worker) {
+    const int threads = schedThreadCount();
+    if (worker < 0 || worker >= threads)
+        return 0;
+    // the measured rates once every worker has one, they are comparable then
+    int measured = 1;
+    for (int i = 0; i < threads && measured; ++i)
+        measured = atomic_load_explicit(&sched.workers[i].rate, memory_order_relaxed) != 0;
+    double total = 0;
+    double own = 0;
+    for (int i = 0; i < threads; ++i) {
+        const double weight = measured ?
+                (double)atomic_load_explicit(&sched.workers[i].rate, memory_order_relaxed) :
+                (double)sched.workers[i].capacity;
+        total += weight;
+        if (i == worker)
+            own = weight;
+    }
+    return total > 0 ? own / total : 1.0 / threads;
+}
+
+int schedWorkerCpu(const int worker) {
+    if (worker < 0 || worker >= schedThreadCount())
+        return -1;
+    return sched.workers[worker].cpu;
+}
@@ -0,0 +1,96 @@
+#ifndef BTCO_SCHEDULER_H
+#define BTCO_SCHEDULER_H
+
+#include <stdint.h>
+
+/**
+ * Priorities of tasks: a worker always runs the highest priority task it can find (its own or
+ * stolen), so a high priority job gets all the cores it can use before a low priority one gets any.
+ */
+typedef enum {
+    SCHED_PRIORITY_LOW = 0,
+    SCHED_PRIORITY_NORMAL,
+    SCHED_PRIORITY_HIGH,
+    SCHED_PRIORITIES
+} SchedPriority;
+
+/**
+ * A task of the shared worker pool: a range [begin, end) of something (e.g. nonces) to process.
+ * - a task may split itself by submitting part of its range as a new task, which lands in the
+ *   deque of the worker running it, where idle workers steal it from
+ */
+typedef struct SchedTask {
+    void (*run)(const struct SchedTask* task);
+    void* ctx;
+    uint64_t begin;
+    uint64_t end;
+    SchedPriority priority;
+} SchedTask;
+
+/**
+ * Set the number of threads of the shared pool, before it is first used.
+ * @param threads number of threads, MINER_AUTO_THREADS for one per core
+ * @return 0 on success, -1 with errno EBUSY if the pool is already running
+ */
+int schedConfigure(const int threads);
+
+/**
+ * Set whether the threads of the shared pool are pinned to CPUs, before it is first used.
+ * - pinned (the default), worker i stays on CPU i of the topology (see topology.h), so the workers
+ *   each get a core of their own, the fastest ones first, before any 2 of them share the SIMD units
+ *   of a core through SMT; there is no pinning when there are more workers than CPUs
+ * @param pin 1 to pin them, 0 to let the kernel move them around
+ * @return 0 on success, -1 with errno EBUSY if the pool is already running
+ */
+int schedConfigurePinning(const int pin);
+
+/**
+ * Get the number of threads of the shared pool, starting it if needed.
+ * @return the number of threads, 0 if none could be started
+ */
+int schedThreadCount(void);
+
+/**
+ * Queue a task on the shared pool, starting it if needed.
+ * - from a worker thread (i.e., a task splitting itself) the task goes to the bottom of the deque
+ *   of that worker, from any other thread to the deques of the workers in turn
+ * NOTE never wait from a task for other tasks to finish, the pool does not grow to make up for it.
+ * @param task the task, copied
+ * @return 0 on success, -1 with errno EAGAIN if the pool has no threads
+ */
+int schedSubmit(const SchedTask* task);
+
+/**
+ * Queue a task on the deque of a given worker, e.g. a share of a job sized for that worker (see
+ * schedWorkerShare); other workers may still steal it.
+ * @param worker the worker, 0..schedThreadCount()-1
+ * @param task the task, copied
+ * @return 0 on success, -1 with errno EAGAIN if the pool has no threads
+ */
+int schedSubmitTo(const int worker, const SchedTask* task);
+
+/**
+ * Record how fast the calling worker got through some units of a task, e.g. nonces.
+ * - nothing if not called from a worker, or if no units were done
+ * @param units the units done
+ * @param ns the time they took, in nanoseconds
+ */
+void schedRecordRate(const uint64_t units, const uint64_t ns);
+
+/**
+ * Get the share of a job to hand to a worker, so that all the workers get done at about the same
+ * time: from the rates recorded by schedRecordRate once every worker has one, or else from the
+ * capacity of its core (e.g. the big and LITTLE cores of ARM).
+ * @param worker the worker, 0..schedThreadCount()-1
+ * @return the share, 0..1, those of all the workers add up to 1
+ */
+double schedWorkerShare(const int worker);
+
+/**
+ * Get the CPU a worker of the shared pool is pinned to.
+ * @param worker the worker, 0..schedThreadCount()-1
+ * @return the CPU, -1 if it is not pinned
+ */
+int schedWorkerCpu(const int worker);
+
+#endif //BTCO_SCHEDULER_H
@@ -0,0 +1,176 @@
+#include <stdint.h>
+#include <stddef.h>
+
+#include "sha-256-hw.h"
+#include "sha-256-lanes.h"
+
+/*
+ * The SHA256 instructions work on 4 message words (4 rounds) at a time, the round constants are
+ * added to the message words before the rounds, and the message schedule is extended 4 words at a
+ * time from W[t-16..t-13], W[t-12..t-9], W[t-8..t-5] and W[t-4..t-1].
+ * Both backends are adapted from the public domain https://github.com/noloader/SHA-Intrinsics
+ */
+
+#if defined(__x86_64__) || defined(__i386__)
+
+#include <cpuid.h>
+#include <immintrin.h>
+
+#define SHANI_TARGET __attribute__((target("sha,sse4.1")))
+
+/* 4 rounds with the message words m */
+#define SHANI_ROUNDS(m, i) \
+    msg = _mm_add_epi32(m, _mm_loadu_si128((const __m128i *) &sha_256_k[4 * (i)])); \
+    state1 = _mm_sha256rnds2_epu32(state1, state0, msg); \
+    msg = _mm_shuffle_epi32(msg, 0x0E); \
+    state0 = _mm_sha256rnds2_epu32(state0, state1, msg)
+
+/* Replace m0 (W[t-16..t-13]) by the next 4 message words W[t..t+3]. */
+#define SHANI_SCHEDULE(m0, m1, m2, m3) \
+    m0 = _mm_sha256msg2_epu32(_mm_add_epi32(_mm_sha256msg1_epu32(m0, m1), \
+                                            _mm_alignr_epi8(m3, m2, 4)), m3)
+
+SHANI_TARGET
+static void compress_shani(uint32_t h[8], const uint8_t *data, size_t chunks)
+{
+    const __m128i byte_swap = _mm_set_epi64x(0x0c0d0e0f08090a0bULL, 0x0405060700010203ULL);
+    __m128i state0, state1, abef_save, cdgh_save, msg, tmp;
+    __m128i m0, m1, m2, m3;
+    int i;
+
+    /* The instructions want the state as ABEF and CDGH. */
+    tmp = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i *) &h[0]), 0xB1);    /* CDAB */
+    state1 = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i *) &h[4]), 0x1B); /* EFGH */
+    state0 = _mm_alignr_epi8(tmp, state1, 8);                                   /* ABEF */
+    state1 = _mm_blend_epi16(state1, tmp, 0xF0);                                /* CDGH */
+
+    for (; chunks > 0; chunks--, data += 64) {
+        abef_save = state0;
+        cdgh_save = state1;
+
+        m0 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *) (data + 0)), byte_swap);
+        SHANI_ROUNDS(m0, 0);
+        m1 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *) (data + 16)), byte_swap);
+        SHANI_ROUNDS(m1, 1);
+        m2 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *) (data + 32)), byte_swap);
+        SHANI_ROUNDS(m2, 2);
+        m3 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *) (data + 48)), byte_swap);
+        SHANI_ROUNDS(m3, 3);
+
+        for (i = 4; i < 16; i += 4) {
+            SHANI_SCHEDULE(m0, m1, m2, m3);
+            SHANI_ROUNDS(m0, i);
+            SHANI_SCHEDULE(m1, m2, m3, m0);
+            SHANI_ROUNDS(m1, i + 1);
+            SHANI_SCHEDULE(m2, m3, m0, m1);
+            SHANI_ROUNDS(m2, i + 2);
+            SHANI_SCHEDULE(m3, m0, m1, m2);
+            SHANI_ROUNDS(m3, i + 3);
+        }
+
+        state0 = _mm_add_epi32(state0, abef_save);
+        state1 = _mm_add_epi32(state1, cdgh_save);
+    }
+
+    /* Back to ABCD and EFGH. */
+    tmp = _mm_shuffle_epi32(state0, 0x1B);                  /* FEBA */
+    state1 = _mm_shuffle_epi32(state1, 0xB1);               /* DCHG */
+    _mm_storeu_si128((__m128i *) &h[0], _mm_blend_epi16(tmp, state1, 0xF0)); /* DCBA */
+    _mm_storeu_si128((__m128i *) &h[4], _mm_alignr_epi8(state1, tmp, 8));    /* HGFE */
+}
+
+sha_256_blocks_fn sha_256_hw_blocks(const char **name)
+{
+    unsigned int eax, ebx, ecx, edx;
+
+    /* SSSE3 and SSE4.1 are needed too, for the shuffles and blends around the SHA instructions. */
+    if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx) || !(ecx & bit_SSSE3) || !(ecx & bit_SSE4_1))
+        return NULL;
+    if (!__get_cpuid_count(7, 0, &eax, &ebx, &ecx, &edx) || !(ebx & bit_SHA))
+        return NULL;
+
+    *name = "shani";
+    return compress_shani;
+}
+
+#elif defined(__aarch64__) && (defined(__ARM_FEATURE_CRYPTO) || defined(__ARM_FEATURE_SHA2))
+
+#include <arm_neon.h>
+#include <sys/auxv.h>
+
+#ifndef HWCAP_SHA2
+#define HWCAP_SHA2 (1 << 6)
+#endif
+
+/* 4 rounds with the message words m */
+#define ARMV8_ROUNDS(m, i) \
+    wk = vaddq_u32(m, vld1q_u32(&sha_256_k[4 * (i)])); \
+    tmp = state0; \
+    state0 = vsha256hq_u32(state0, state1, wk); \
+    state1 = vsha256h2q_u32(state1, tmp, wk)
+
+/* Replace m0 (W[t-16..t-13]) by the next 4 message words W[t..t+3]. */
+#define ARMV8_SCHEDULE(m0, m1, m2, m3) \
+    m0 = vsha256su1q_u32(vsha256su0q_u32(m0, m1), m2, m3)
+
+/* Load 4 big-endian message words. */
+#define ARMV8_LOAD(p) vreinterpretq_u32_u8(vrev32q_u8(vld1q_u8(p)))
+
+static void compress_armv8(uint32_t h[8], const uint8_t *data, size_t chunks)
+{
+    uint32x4_t state0 = vld1q_u32(&h[0]);
+    uint32x4_t state1 = vld1q_u32(&h[4]);
+    uint32x4_t abcd_save, efgh_save, wk, tmp;
+    uint32x4_t m0, m1, m2, m3;
+    int i;
+
+    for (; chunks > 0; chunks--, data += 64) {
+        abcd_save = state0;
+        efgh_save = state1;
+
+        m0 = ARMV8_LOAD(data + 0);
+        m1 = ARMV8_LOAD(data + 16);
+        m2 = ARMV8_LOAD(data + 32);
+        m3 = ARMV8_LOAD(data + 48);
+        ARMV8_ROUNDS(m0, 0);
+        ARMV8_ROUNDS(m1, 1);
+        ARMV8_ROUNDS(m2, 2);
+        ARMV8_ROUNDS(m3, 3);
+
+        for (i = 4; i < 16; i += 4) {
+            ARMV8_SCHEDULE(m0, m1, m2, m3);
+            ARMV8_ROUNDS(m0, i);
+            ARMV8_SCHEDULE(m1, m2, m3, m0);
+            ARMV8_ROUNDS(m1, i + 1);
+            ARMV8_SCHEDULE(m2, m3, m0, m1);
+            ARMV8_ROUNDS(m2, i + 2);
+            ARMV8_SCHEDULE(m3, m0, m1, m2);
+            ARMV8_ROUNDS(m3, i + 3);
+        }
+
+        state0 = vaddq_u32(state0, abcd_save);
+        state1 = vaddq_u32(state1, efgh_save);
+    }
+
+    vst1q_u32(&h[0], state0);
+    vst1q_u32(&h[4], state1);
+}
+
+sha_256_blocks_fn sha_256_hw_blocks(const char **name)
+{
+    if (!(getauxval(AT_HWCAP) & HWCAP_SHA2))
+        return NULL;
+
+    *name = "armv8";
+    return compress_armv8;
+}
+
+#else
+
+sha_256_blocks_fn sha_256_hw_blocks(const char **name)
+{
+    (void) name;
+    return NULL;
+}
+
+#endif
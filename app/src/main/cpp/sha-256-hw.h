@@ -0,0 +1,24 @@
+#ifndef SHA_256_HW_H
+#define SHA_256_HW_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+/**
+ * A SHA256 compression function over whole chunks.
+ * @param h      - the running hash value, updated in place
+ * @param data   - ptr to chunks * 64 input bytes
+ * @param chunks - number of consecutive 64-byte chunks to compress
+ */
+typedef void (*sha_256_blocks_fn)(uint32_t h[8], const uint8_t *data, size_t chunks);
+
+/**
+ * Find the compression function using the dedicated SHA256 instructions of this CPU.
+ * - x86 SHA extensions (SHA-NI), detected through CPUID
+ * - ARMv8 cryptography extensions, detected through getauxval(AT_HWCAP)
+ * @param name - set to the name of the backend found, untouched if none
+ * @return the compression function, NULL if the CPU (or this build) has no such instructions
+ */
+sha_256_blocks_fn sha_256_hw_blocks(const char **name);
+
+#endif
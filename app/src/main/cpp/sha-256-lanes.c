@@ -0,0 +1,347 @@
+#include <stdint.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "sha-256.h"
+#include "sha-256-lanes.h"
+#include "sha-256-hw.h"
+
+/* The initial hash value, where the second hash of SHA256d starts from. */
+static const uint32_t sha_256_iv[8] = {
+    0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19
+};
+
+/*
+ * The padding of a 32-byte message: word 8 is the one bit, words 9..14 are 0 and word 15 is the
+ * length in bits. Their schedule terms are constants.
+ */
+#define SHA_256_PAD32_W8 0x80000000u
+#define SHA_256_PAD32_W15 0x00000100u
+#define SHA_256_ROTR(x, n) (((x) >> (n)) | ((x) << (32 - (n))))
+#define SHA_256_PAD32_SIG0_W8 \
+    (SHA_256_ROTR(SHA_256_PAD32_W8, 7) ^ SHA_256_ROTR(SHA_256_PAD32_W8, 18) ^ (SHA_256_PAD32_W8 >> 3))
+#define SHA_256_PAD32_SIG0_W15 \
+    (SHA_256_ROTR(SHA_256_PAD32_W15, 7) ^ SHA_256_ROTR(SHA_256_PAD32_W15, 18) ^ (SHA_256_PAD32_W15 >> 3))
+#define SHA_256_PAD32_SIG1_W15 \
+    (SHA_256_ROTR(SHA_256_PAD32_W15, 17) ^ SHA_256_ROTR(SHA_256_PAD32_W15, 19) ^ (SHA_256_PAD32_W15 >> 10))
+
+/* K + W of the rounds 8..15 of a 32-byte message, i.e., of its padding words. */
+static const uint32_t sha_256_pad32_kw[8] = {
+    0xd807aa98u + SHA_256_PAD32_W8, 0x12835b01, 0x243185be, 0x550c7dc3,
+    0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174u + SHA_256_PAD32_W15
+};
+
+/*
+ * The kernels are all generated from sha-256-lanes.inc, using the GCC/Clang vector extensions so
+ * that the compiler maps every lane operation onto the instruction set enabled for that kernel.
+ */
+
+/* Portable fallback, one lane in a plain 32-bit word. */
+#define LANES_V uint32_t
+#define LANES_FN compress_x1
+#define LANES_MULTI_FN compress_multi_x1
+#define LANES_DOUBLE_FN compress_double_x1
+#define LANES_TARGET
+#include "sha-256-lanes.inc"
+
+#if defined(__SSE2__) || defined(__ARM_NEON) || defined(__aarch64__)
+#define HAVE_LANES_X4 1
+/* 4 lanes in a 128-bit vector: SSE2 on x86-64, NEON on ARM; both are baseline there. */
+typedef uint32_t v4u32 __attribute__((vector_size(16)));
+#define LANES_V v4u32
+#define LANES_FN compress_x4
+#define LANES_MULTI_FN compress_multi_x4
+#define LANES_DOUBLE_FN compress_double_x4
+#define LANES_TARGET
+#include "sha-256-lanes.inc"
+#endif
+
+#if defined(__x86_64__) || defined(__i386__)
+#define HAVE_LANES_X86 1
+/* 8 lanes in a 256-bit vector, AVX2. */
+typedef uint32_t v8u32 __attribute__((vector_size(32)));
+#define LANES_V v8u32
+#define LANES_FN compress_x8
+#define LANES_MULTI_FN compress_multi_x8
+#define LANES_DOUBLE_FN compress_double_x8
+#define LANES_TARGET __attribute__((target("avx2")))
+#include "sha-256-lanes.inc"
+
+/* 16 lanes in a 512-bit vector, AVX-512F. */
+typedef uint32_t v16u32 __attribute__((vector_size(64)));
+#define LANES_V v16u32
+#define LANES_FN compress_x16
+#define LANES_MULTI_FN compress_multi_x16
+#define LANES_DOUBLE_FN compress_double_x16
+#define LANES_TARGET __attribute__((target("avx512f")))
+#include "sha-256-lanes.inc"
+#endif
+
+/*
+ * The SHA256 instructions hash one message at a time, so the lanes of this kernel are just run one
+ * after the other (the CPU overlaps them well enough, there are no dependencies between them).
+ */
+#define HW_LANES 4
+
+static sha_256_blocks_fn hw_blocks;
+
+static void store_big_endian(uint8_t *p, uint32_t value)
+{
+    p[0] = (uint8_t) (value >> 24);
+    p[1] = (uint8_t) (value >> 16);
+    p[2] = (uint8_t) (value >> 8);
+    p[3] = (uint8_t) value;
+}
+
+static uint32_t compress_hw(uint32_t out[8][SHA_256_MAX_LANES], const uint32_t state[8],
+                            const uint32_t w16[16], int var_word, const uint32_t *var,
+                            uint32_t max_h0)
+{
+    uint8_t chunk[64];
+    uint32_t h[8];
+    uint32_t mask = 0;
+    int i, lane;
+
+    for (i = 0; i < 16; i++)
+        store_big_endian(chunk + 4 * i, w16[i]);
+
+    for (lane = 0; lane < HW_LANES; lane++) {
+        store_big_endian(chunk + 4 * var_word, var[lane]);
+        memcpy(h, state, sizeof h);
+        hw_blocks(h, chunk, 1);
+        if (h[0] > max_h0)
+            continue;
+        mask |= 1u << lane;
+        for (i = 0; i < 8; i++)
+            out[i][lane] = h[i];
+    }
+    return mask;
+}
+
+static uint32_t compress_double_hw(uint32_t out[8][SHA_256_MAX_LANES], const uint32_t state[8],
+                                   const uint32_t w16[16], int var_word, const uint32_t *var,
+                                   uint32_t max_h0)
+{
+    uint8_t chunk[64];
+    uint8_t pad32[64] = { 0 };
+    uint32_t h[8];
+    uint32_t mask = 0;
+    int i, lane;
+
+    for (i = 0; i < 16; i++)
+        store_big_endian(chunk + 4 * i, w16[i]);
+    store_big_endian(pad32 + 32, SHA_256_PAD32_W8);
+    store_big_endian(pad32 + 60, SHA_256_PAD32_W15);
+
+    for (lane = 0; lane < HW_LANES; lane++) {
+        store_big_endian(chunk + 4 * var_word, var[lane]);
+        memcpy(h, state, sizeof h);
+        hw_blocks(h, chunk, 1);
+        for (i = 0; i < 8; i++)
+            store_big_endian(pad32 + 4 * i, h[i]);
+        memcpy(h, sha_256_iv, sizeof h);
+        hw_blocks(h, pad32, 1);
+        if (h[0] > max_h0)
+            continue;
+        mask |= 1u << lane;
+        for (i = 0; i < 8; i++)
+            out[i][lane] = h[i];
+    }
+    return mask;
+}
+
+static void compress_multi_hw(uint32_t state[8][SHA_256_MAX_LANES],
+                              const uint32_t w16[16][SHA_256_MAX_LANES])
+{
+    uint8_t chunk[64];
+    uint32_t h[8];
+    int i, lane;
+
+    for (lane = 0; lane < HW_LANES; lane++) {
+        for (i = 0; i < 16; i++)
+            store_big_endian(chunk + 4 * i, w16[i][lane]);
+        for (i = 0; i < 8; i++)
+            h[i] = state[i][lane];
+        hw_blocks(h, chunk, 1);
+        for (i = 0; i < 8; i++)
+            state[i][lane] = h[i];
+    }
+}
+
+static struct Sha_256_lanes lanes_hw = {
+    NULL, HW_LANES, compress_hw, compress_double_hw, compress_multi_hw
+};
+static const struct Sha_256_lanes lanes_x1 = {
+    "scalar", 1, compress_x1, compress_double_x1, compress_multi_x1
+};
+#ifdef HAVE_LANES_X4
+#if defined(__SSE2__)
+static const struct Sha_256_lanes lanes_x4 = {
+    "sse2", 4, compress_x4, compress_double_x4, compress_multi_x4
+};
+#else
+static const struct Sha_256_lanes lanes_x4 = {
+    "neon", 4, compress_x4, compress_double_x4, compress_multi_x4
+};
+#endif
+#endif
+#ifdef HAVE_LANES_X86
+static const struct Sha_256_lanes lanes_x8 = {
+    "avx2", 8, compress_x8, compress_double_x8, compress_multi_x8
+};
+static const struct Sha_256_lanes lanes_x16 = {
+    "avx512", 16, compress_x16, compress_double_x16, compress_multi_x16
+};
+#endif
+
+static const struct Sha_256_lanes *best_lanes = &lanes_x1;
+static const struct Sha_256_lanes *used_lanes;
+static pthread_once_t best_lanes_once = PTHREAD_ONCE_INIT;
+
+/*
+ * From fastest to slowest, for mining: AVX-512 (16 lanes), AVX2 (8 lanes), the SHA instructions
+ * (one message at a time, but still far ahead of 4 lanes), SSE2/NEON (4 lanes) and plain C.
+ */
+static void detect_lanes(void)
+{
+    hw_blocks = sha_256_hw_blocks(&lanes_hw.name);
+#ifdef HAVE_LANES_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f")) {
+        best_lanes = &lanes_x16;
+        return;
+    }
+    if (__builtin_cpu_supports("avx2")) {
+        best_lanes = &lanes_x8;
+        return;
+    }
+#endif
+    if (hw_blocks) {
+        best_lanes = &lanes_hw;
+        return;
+    }
+#ifdef HAVE_LANES_X4
+    best_lanes = &lanes_x4;
+#endif
+}
+
+const struct Sha_256_lanes *sha_256_lanes(void)
+{
+    pthread_once(&best_lanes_once, detect_lanes);
+    return used_lanes ? used_lanes : best_lanes;
+}
+
+int sha_256_lanes_available(const struct Sha_256_lanes **kernels, int max)
+{
+    const struct Sha_256_lanes *all[5];
+    int count = 0, i;
+
+    pthread_once(&best_lanes_once, detect_lanes);
+#ifdef HAVE_LANES_X86
+    if (__builtin_cpu_supports("avx512f"))
+        all[count++] = &lanes_x16;
+    if (__builtin_cpu_supports("avx2"))
+        all[count++] = &lanes_x8;
+#endif
+    if (hw_blocks)
+        all[count++] = &lanes_hw;
+#ifdef HAVE_LANES_X4
+    all[count++] = &lanes_x4;
+#endif
+    all[count++] = &lanes_x1;
+
+    for (i = 0; i < count && i < max; i++)
+        kernels[i] = all[i];
+    return i;
+}
+
+void sha_256_lanes_use(const struct Sha_256_lanes *kernel)
+{
+    pthread_once(&best_lanes_once, detect_lanes);
+    used_lanes = kernel;
+}
+
+static uint32_t load_big_endian(const uint8_t *p)
+{
+    return (uint32_t) p[0] << 24 | (uint32_t) p[1] << 16 | (uint32_t) p[2] << 8 | (uint32_t) p[3];
+}
+
+/*
+ * Get chunk c of a message padded the SHA256 way (the single one bit, zeroes, the bit length), as
+ * big-endian words.
+ */
+static void padded_chunk(uint32_t w[16], const uint8_t *msg, size_t len, size_t c, size_t chunks)
+{
+    const size_t start = c * SIZE_OF_SHA_256_CHUNK;
+    uint8_t chunk[SIZE_OF_SHA_256_CHUNK];
+    const uint8_t *p = chunk;
+    int i;
+
+    if (start + SIZE_OF_SHA_256_CHUNK <= len) {
+        p = msg + start;
+    } else {
+        memset(chunk, 0, sizeof chunk);
+        if (start <= len) {
+            memcpy(chunk, msg + start, len - start);
+            chunk[len - start] = 0x80;
+        }
+        if (c == chunks - 1) {
+            const uint64_t bit_len = (uint64_t) len * 8;
+            for (i = 0; i < 8; i++)
+                chunk[SIZE_OF_SHA_256_CHUNK - 1 - i] = (uint8_t) (bit_len >> (8 * i));
+        }
+    }
+
+    for (i = 0; i < 16; i++)
+        w[i] = load_big_endian(p + 4 * i);
+}
+
+void sha_256_many(uint8_t *hashes, const uint8_t *msgs, size_t len, size_t stride, size_t count)
+{
+    const struct Sha_256_lanes *kernel = sha_256_lanes();
+    const size_t chunks = (len + 1 + 8 + SIZE_OF_SHA_256_CHUNK - 1) / SIZE_OF_SHA_256_CHUNK;
+    struct Sha_256 initial;
+    size_t first, c;
+    int i, lane;
+
+    /* Nothing to gain from lanes that are run one after the other, the plain API is as fast. */
+    if (kernel->lanes == 1 || kernel == &lanes_hw) {
+        for (first = 0; first < count; first++)
+            calc_sha_256(hashes + first * SIZE_OF_SHA_256_HASH, msgs + first * stride, len);
+        return;
+    }
+
+    sha_256_init(&initial);
+    for (first = 0; first < count; first += kernel->lanes) {
+        uint32_t state[8][SHA_256_MAX_LANES];
+        uint32_t w[16][SHA_256_MAX_LANES];
+        uint32_t lane_w[16];
+        /* the last group may be short, its spare lanes just hash the first message again */
+        const int used = count - first < (size_t) kernel->lanes ? (int) (count - first) : kernel->lanes;
+
+        for (i = 0; i < 8; i++)
+            for (lane = 0; lane < kernel->lanes; lane++)
+                state[i][lane] = initial.h[i];
+
+        for (c = 0; c < chunks; c++) {
+            for (lane = 0; lane < kernel->lanes; lane++) {
+                const size_t msg = first + (lane < used ? (size_t) lane : 0);
+                padded_chunk(lane_w, msgs + msg * stride, len, c, chunks);
+                for (i = 0; i < 16; i++)
+                    w[i][lane] = lane_w[i];
+            }
+            kernel->compress_multi(state, w);
+        }
+
+        /* Produce the final hash values (big-endian): */
+        for (lane = 0; lane < used; lane++) {
+            uint8_t *hash = hashes + (first + lane) * SIZE_OF_SHA_256_HASH;
+            for (i = 0; i < 8; i++) {
+                hash[4 * i] = (uint8_t) (state[i][lane] >> 24);
+                hash[4 * i + 1] = (uint8_t) (state[i][lane] >> 16);
+                hash[4 * i + 2] = (uint8_t) (state[i][lane] >> 8);
+                hash[4 * i + 3] = (uint8_t) state[i][lane];
+            }
+        }
+    }
+}
@@ -0,0 +1,91 @@
+#ifndef SHA_256_LANES_H
+#define SHA_256_LANES_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+/* The widest multi-lane kernel, i.e. the most messages hashed per call. */
+#define SHA_256_MAX_LANES 16
+
+/* The SHA256 round constants, shared by all the kernels. */
+extern const uint32_t sha_256_k[64];
+
+/**
+ * A multi-lane ("multi-buffer") SHA256 compression kernel.
+ * - compresses one 64-byte chunk for several messages at once, one message per SIMD lane
+ * - all the lanes start from the same hash state and share the same chunk, except for one 32-bit
+ *   word of the chunk that is different per lane (e.g. the nonce of a block header)
+ */
+struct Sha_256_lanes {
+    /* Human-readable name of the kernel, e.g. "avx2". */
+    const char *name;
+
+    /* Number of messages hashed per call, at most SHA_256_MAX_LANES. */
+    int lanes;
+
+    /**
+     * @param out      - the resulting hash state of every lane, out[i][lane] is h[i] of that lane
+     * @param state    - the hash state all the lanes start from (e.g. a midstate)
+     * @param w        - the chunk as 16 big-endian 32-bit words
+     * @param var_word - the index (0..15) of the word that is different per lane
+     * @param var      - the value of w[var_word] for each lane, `lanes` entries
+     * @param max_h0   - the highest h[0] of interest, e.g. the first word of a target hash
+     * @return a bitmask with bit `lane` set for every lane whose h[0] is <= max_h0; `out` is only
+     *         written when this is not 0, so rejected batches cost no stores
+     */
+    uint32_t (*compress)(uint32_t out[8][SHA_256_MAX_LANES], const uint32_t state[8],
+                         const uint32_t w[16], int var_word, const uint32_t *var,
+                         uint32_t max_h0);
+
+    /**
+     * Like compress, then hash the resulting 32-byte hash value again (SHA256d, as in Bitcoin).
+     * - the second hash is one chunk of constant padding words, folded into its message schedule
+     * @return a bitmask of the lanes whose second hash has h[0] <= max_h0, `out` is that hash
+     */
+    uint32_t (*compress_double)(uint32_t out[8][SHA_256_MAX_LANES], const uint32_t state[8],
+                                const uint32_t w[16], int var_word, const uint32_t *var,
+                                uint32_t max_h0);
+
+    /**
+     * Compress a different chunk into a different hash state for every lane.
+     * @param state - the hash state of every lane, state[i][lane] is h[i] of that lane, updated in place
+     * @param w     - the chunk of every lane as big-endian words, w[i][lane] is word i of that lane
+     */
+    void (*compress_multi)(uint32_t state[8][SHA_256_MAX_LANES],
+                           const uint32_t w[16][SHA_256_MAX_LANES]);
+};
+
+/**
+ * Get the widest multi-lane kernel the CPU running this supports.
+ * - detected once, on the first call
+ * @return the kernel, never NULL (there is always a portable fallback)
+ */
+const struct Sha_256_lanes *sha_256_lanes(void);
+
+/**
+ * Get all the multi-lane kernels the CPU running this supports, e.g. to benchmark them.
+ * @param kernels - set to the kernels, from the fastest (the one sha_256_lanes picks) to the slowest
+ * @param max     - room in kernels
+ * @return the number of kernels put in kernels
+ */
+int sha_256_lanes_available(const struct Sha_256_lanes **kernels, int max);
+
+/**
+ * Make sha_256_lanes return another kernel, e.g. to benchmark it.
+ * - NOT to be called while anything hashes with the kernels
+ * @param kernel - one of sha_256_lanes_available, or NULL for the fastest again
+ */
+void sha_256_lanes_use(const struct Sha_256_lanes *kernel);
+
+/**
+ * Hash many independent messages of the same length, several at a time on the multi-lane kernel.
+ * - e.g. all the 64-byte (left hash, right hash) nodes of one level of a Merkle tree
+ * @param hashes - the output hashes, 32 bytes each, one after the other
+ * @param msgs   - ptr to the first message
+ * @param len    - number of bytes of every message
+ * @param stride - number of bytes from the start of one message to the start of the next
+ * @param count  - number of messages
+ */
+void sha_256_many(uint8_t *hashes, const uint8_t *msgs, size_t len, size_t stride, size_t count);
+
+#endif
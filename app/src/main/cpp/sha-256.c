@@ -1,9 +1,13 @@
 #include <stdint.h>
 #include <string.h>
+#include <pthread.h>
 
 #include "sha-256.h"
+#include "sha-256-lanes.h"
+#include "sha-256-hw.h"
+#include "metrics.h"
 
-#define CHUNK_SIZE 64
+#define CHUNK_SIZE SIZE_OF_SHA_256_CHUNK
 #define TOTAL_LEN_LEN 8
 
 /*
@@ -19,7 +23,7 @@
  * Initialize array of round constants:
  * (first 32 bits of the fractional parts of the cube roots of the first 64 primes 2..311):
  */
-static const uint32_t k[] = {
+const uint32_t sha_256_k[64] = {
         0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
         0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
         0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
@@ -30,14 +34,6 @@ static const uint32_t k[] = {
         0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
 };
 
-struct buffer_state {
-    const uint8_t * p;
-    size_t len;
-    size_t total_len;
-    int single_one_delivered; /* bool */
-    int total_len_delivered; /* bool */
-};
-
 static inline uint32_t right_rot(uint32_t value, unsigned int count)
 {
 /*
@@ -47,164 +43,214 @@ static inline uint32_t right_rot(uint32_t value, unsigned int count)
 return value >> count | value << (32 - count);
 }
 
-static void init_buf_state(struct buffer_state * state, const void * input, size_t len)
+/*
+ * Process one 512-bit chunk of the message into the running hash value h[0..7], portably.
+ */
+static void compress_chunk(uint32_t h[8], const uint8_t chunk[CHUNK_SIZE])
 {
-    state->p = input;
-    state->len = len;
-    state->total_len = len;
-    state->single_one_delivered = 0;
-    state->total_len_delivered = 0;
-}
+    /*
+     * Note 1: All integers (expect indexes) are 32-bit unsigned integers and addition is calculated modulo 2^32.
+     * Note 2: For each round, there is one round constant k[i] and one entry in the message schedule array w[i], 0 = i = 63
+     * Note 3: The compression function uses 8 working variables, a through h
+     * Note 4: Big-endian convention is used when expressing the constants in this pseudocode,
+     *     and when parsing message block data from bytes to words, for example,
+     *     the first word of the input message "abc" after padding is 0x61626380
+     */
+    uint32_t ah[8];
+    int i;
 
-/* Return value: bool */
-static int calc_chunk(uint8_t chunk[CHUNK_SIZE], struct buffer_state * state)
-{
-    size_t space_in_chunk;
+    /*
+     * create a 64-entry message schedule array w[0..63] of 32-bit words
+     * (The initial values in w[16..63] don't matter, they are all written by the extension below)
+     * copy chunk into first 16 words w[0..15] of the message schedule array
+     */
+    uint32_t w[64];
+    const uint8_t *p = chunk;
 
-    if (state->total_len_delivered) {
-        return 0;
+    for (i = 0; i < 16; i++) {
+        w[i] = (uint32_t) p[0] << 24 | (uint32_t) p[1] << 16 |
+                                                  (uint32_t) p[2] << 8 | (uint32_t) p[3];
+        p += 4;
     }
 
-    if (state->len >= CHUNK_SIZE) {
-        memcpy(chunk, state->p, CHUNK_SIZE);
-        state->p += CHUNK_SIZE;
-        state->len -= CHUNK_SIZE;
-        return 1;
+    /* Extend the first 16 words into the remaining 48 words w[16..63] of the message schedule array: */
+    for (i = 16; i < 64; i++) {
+        const uint32_t s0 = right_rot(w[i - 15], 7) ^ right_rot(w[i - 15], 18) ^ (w[i - 15] >> 3);
+        const uint32_t s1 = right_rot(w[i - 2], 17) ^ right_rot(w[i - 2], 19) ^ (w[i - 2] >> 10);
+        w[i] = w[i - 16] + s0 + w[i - 7] + s1;
     }
 
-    memcpy(chunk, state->p, state->len);
-    chunk += state->len;
-    space_in_chunk = CHUNK_SIZE - state->len;
-    state->p += state->len;
-    state->len = 0;
-
-    /* If we are here, space_in_chunk is one at minimum. */
-    if (!state->single_one_delivered) {
-        *chunk++ = 0x80;
-        space_in_chunk -= 1;
-        state->single_one_delivered = 1;
-    }
+    /* Initialize working variables to current hash value: */
+    for (i = 0; i < 8; i++)
+        ah[i] = h[i];
 
-    /*
-     * Now:
-     * - either there is enough space left for the total length, and we can conclude,
-     * - or there is too little space left, and we have to pad the rest of this chunk with zeroes.
-     * In the latter case, we will conclude at the next invokation of this function.
-     */
-    if (space_in_chunk >= TOTAL_LEN_LEN) {
-        const size_t left = space_in_chunk - TOTAL_LEN_LEN;
-        size_t len = state->total_len;
-        int i;
-        memset(chunk, 0x00, left);
-        chunk += left;
-
-        /* Storing of len * 8 as a big endian 64-bit without overflow. */
-        chunk[7] = (uint8_t) (len << 3);
-        len >>= 5;
-        for (i = 6; i >= 0; i--) {
-            chunk[i] = (uint8_t) len;
-            len >>= 8;
-        }
-        state->total_len_delivered = 1;
-    } else {
-        memset(chunk, 0x00, space_in_chunk);
+    /* Compression function main loop: */
+    for (i = 0; i < 64; i++) {
+        const uint32_t s1 = right_rot(ah[4], 6) ^ right_rot(ah[4], 11) ^ right_rot(ah[4], 25);
+        const uint32_t ch = (ah[4] & ah[5]) ^ (~ah[4] & ah[6]);
+        const uint32_t temp1 = ah[7] + s1 + ch + sha_256_k[i] + w[i];
+        const uint32_t s0 = right_rot(ah[0], 2) ^ right_rot(ah[0], 13) ^ right_rot(ah[0], 22);
+        const uint32_t maj = (ah[0] & ah[1]) ^ (ah[0] & ah[2]) ^ (ah[1] & ah[2]);
+        const uint32_t temp2 = s0 + maj;
+
+        ah[7] = ah[6];
+        ah[6] = ah[5];
+        ah[5] = ah[4];
+        ah[4] = ah[3] + temp1;
+        ah[3] = ah[2];
+        ah[2] = ah[1];
+        ah[1] = ah[0];
+        ah[0] = temp1 + temp2;
     }
 
-    return 1;
+    /* Add the compressed chunk to the current hash value: */
+    for (i = 0; i < 8; i++)
+        h[i] += ah[i];
+}
+
+static void compress_portable(uint32_t h[8], const uint8_t *data, size_t chunks)
+{
+    for (; chunks > 0; chunks--, data += CHUNK_SIZE)
+        compress_chunk(h, data);
 }
 
 /*
- * Limitations:
- * - Since input is a pointer in RAM, the data to hash should be in RAM, which could be a problem
- *   for large data sizes.
- * - SHA algorithms theoretically operate on bit strings. However, this implementation has no support
- *   for bit string lengths that are not multiples of eight, and it really operates on arrays of bytes.
- *   In particular, the len parameter is a number of bytes.
+ * The backend: the portable compression unless the CPU has SHA256 instructions, picked once.
  */
-void calc_sha_256(uint8_t hash[32], const void * input, size_t len)
+static sha_256_blocks_fn compress_blocks = compress_portable;
+static const char *backend_name = "portable";
+static pthread_once_t backend_once = PTHREAD_ONCE_INIT;
+
+static void detect_backend(void)
 {
-    /*
-     * Note 1: All integers (expect indexes) are 32-bit unsigned integers and addition is calculated modulo 2^32.
-     * Note 2: For each round, there is one round constant k[i] and one entry in the message schedule array w[i], 0 = i = 63
-     * Note 3: The compression function uses 8 working variables, a through h
-     * Note 4: Big-endian convention is used when expressing the constants in this pseudocode,
-     *     and when parsing message block data from bytes to words, for example,
-     *     the first word of the input message "abc" after padding is 0x61626380
-     */
+    sha_256_blocks_fn hw = sha_256_hw_blocks(&backend_name);
+    if (hw)
+        compress_blocks = hw;
+}
 
+static sha_256_blocks_fn backend(void)
+{
+    pthread_once(&backend_once, detect_backend);
+    return compress_blocks;
+}
+
+const char *sha_256_backend_name(void)
+{
+    pthread_once(&backend_once, detect_backend);
+    return backend_name;
+}
+
+void sha_256_compress(uint32_t h[8], const uint8_t chunk[CHUNK_SIZE])
+{
+    backend()(h, chunk, 1);
+}
+
+void sha_256_init(struct Sha_256 *sha_256)
+{
     /*
      * Initialize hash values:
      * (first 32 bits of the fractional parts of the square roots of the first 8 primes 2..19):
      */
-    uint32_t h[] = { 0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19 };
+    sha_256->h[0] = 0x6a09e667;
+    sha_256->h[1] = 0xbb67ae85;
+    sha_256->h[2] = 0x3c6ef372;
+    sha_256->h[3] = 0xa54ff53a;
+    sha_256->h[4] = 0x510e527f;
+    sha_256->h[5] = 0x9b05688c;
+    sha_256->h[6] = 0x1f83d9ab;
+    sha_256->h[7] = 0x5be0cd19;
+    sha_256->chunk_used = 0;
+    sha_256->total_len = 0;
+}
+
+void sha_256_write(struct Sha_256 *sha_256, const void *data, size_t len)
+{
+    const uint8_t *p = data;
+
+    sha_256->total_len += len;
+
+    /* Top up a partially filled chunk first. */
+    if (sha_256->chunk_used > 0) {
+        size_t space_in_chunk = CHUNK_SIZE - sha_256->chunk_used;
+        size_t n = len < space_in_chunk ? len : space_in_chunk;
+        memcpy(sha_256->chunk + sha_256->chunk_used, p, n);
+        sha_256->chunk_used += n;
+        p += n;
+        len -= n;
+        if (sha_256->chunk_used < CHUNK_SIZE)
+            return;
+        sha_256_compress(sha_256->h, sha_256->chunk);
+        sha_256->chunk_used = 0;
+    }
+
+    /* Whole chunks are compressed straight from the input, without copying. */
+    if (len >= CHUNK_SIZE) {
+        backend()(sha_256->h, p, len / CHUNK_SIZE);
+        p += len - len % CHUNK_SIZE;
+        len %= CHUNK_SIZE;
+    }
+
+    /* Keep the tail until more data (or the close) arrives. */
+    memcpy(sha_256->chunk, p, len);
+    sha_256->chunk_used = len;
+}
+
+void sha_256_close(struct Sha_256 *sha_256, uint8_t hash[SIZE_OF_SHA_256_HASH])
+{
+    uint8_t *chunk = sha_256->chunk;
+    size_t pos = sha_256->chunk_used;
+    size_t len = sha_256->total_len;
     int i, j;
 
-    /* 512-bit chunks is what we will operate on. */
-    uint8_t chunk[64];
-
-    struct buffer_state state;
-
-    init_buf_state(&state, input, len);
-
-    while (calc_chunk(chunk, &state)) {
-        uint32_t ah[8];
-
-        /*
-         * create a 64-entry message schedule array w[0..63] of 32-bit words
-         * (The initial values in w[0..63] don't matter, so many implementations zero them here)
-         * copy chunk into first 16 words w[0..15] of the message schedule array
-         */
-        uint32_t w[64];
-        const uint8_t *p = chunk;
-
-        memset(w, 0x00, sizeof w);
-        for (i = 0; i < 16; i++) {
-            w[i] = (uint32_t) p[0] << 24 | (uint32_t) p[1] << 16 |
-                                                      (uint32_t) p[2] << 8 | (uint32_t) p[3];
-            p += 4;
-        }
-
-        /* Extend the first 16 words into the remaining 48 words w[16..63] of the message schedule array: */
-        for (i = 16; i < 64; i++) {
-            const uint32_t s0 = right_rot(w[i - 15], 7) ^ right_rot(w[i - 15], 18) ^ (w[i - 15] >> 3);
-            const uint32_t s1 = right_rot(w[i - 2], 17) ^ right_rot(w[i - 2], 19) ^ (w[i - 2] >> 10);
-            w[i] = w[i - 16] + s0 + w[i - 7] + s1;
-        }
-
-        /* Initialize working variables to current hash value: */
-        for (i = 0; i < 8; i++)
-            ah[i] = h[i];
-
-        /* Compression function main loop: */
-        for (i = 0; i < 64; i++) {
-            const uint32_t s1 = right_rot(ah[4], 6) ^ right_rot(ah[4], 11) ^ right_rot(ah[4], 25);
-            const uint32_t ch = (ah[4] & ah[5]) ^ (~ah[4] & ah[6]);
-            const uint32_t temp1 = ah[7] + s1 + ch + k[i] + w[i];
-            const uint32_t s0 = right_rot(ah[0], 2) ^ right_rot(ah[0], 13) ^ right_rot(ah[0], 22);
-            const uint32_t maj = (ah[0] & ah[1]) ^ (ah[0] & ah[2]) ^ (ah[1] & ah[2]);
-            const uint32_t temp2 = s0 + maj;
-
-            ah[7] = ah[6];
-            ah[6] = ah[5];
-            ah[5] = ah[4];
-            ah[4] = ah[3] + temp1;
-            ah[3] = ah[2];
-            ah[2] = ah[1];
-            ah[1] = ah[0];
-            ah[0] = temp1 + temp2;
-        }
-
-        /* Add the compressed chunk to the current hash value: */
-        for (i = 0; i < 8; i++)
-            h[i] += ah[i];
+    /* Append the single one bit. There is always room for it, a full chunk is never kept. */
+    chunk[pos++] = 0x80;
+
+    /*
+     * Now:
+     * - either there is enough space left for the total length, and we can conclude,
+     * - or there is too little space left, and we have to pad the rest of this chunk with zeroes
+     *   and conclude in one more chunk.
+     */
+    if (pos > CHUNK_SIZE - TOTAL_LEN_LEN) {
+        memset(chunk + pos, 0x00, CHUNK_SIZE - pos);
+        sha_256_compress(sha_256->h, chunk);
+        pos = 0;
+    }
+    memset(chunk + pos, 0x00, CHUNK_SIZE - TOTAL_LEN_LEN - pos);
+
+    /* Storing of len * 8 as a big endian 64-bit without overflow. */
+    chunk[CHUNK_SIZE - 1] = (uint8_t) (len << 3);
+    len >>= 5;
+    for (i = CHUNK_SIZE - 2; i >= CHUNK_SIZE - TOTAL_LEN_LEN; i--) {
+        chunk[i] = (uint8_t) len;
+        len >>= 8;
     }
+    sha_256_compress(sha_256->h, chunk);
 
     /* Produce the final hash value (big-endian): */
     for (i = 0, j = 0; i < 8; i++)
     {
-        hash[j++] = (uint8_t) (h[i] >> 24);
-        hash[j++] = (uint8_t) (h[i] >> 16);
-        hash[j++] = (uint8_t) (h[i] >> 8);
-        hash[j++] = (uint8_t) h[i];
+        hash[j++] = (uint8_t) (sha_256->h[i] >> 24);
+        hash[j++] = (uint8_t) (sha_256->h[i] >> 16);
+        hash[j++] = (uint8_t) (sha_256->h[i] >> 8);
+        hash[j++] = (uint8_t) sha_256->h[i];
     }
 }
+
+/*
+ * Limitations:
+ * - Since input is a pointer in RAM, the data to hash should be in RAM, which could be a problem
+ *   for large data sizes. Use sha_256_init/sha_256_write/sha_256_close to hash data in pieces.
+ * - SHA algorithms theoretically operate on bit strings. However, this implementation has no support
+ *   for bit string lengths that are not multiples of eight, and it really operates on arrays of bytes.
+ *   In particular, the len parameter is a number of bytes.
+ */
+void calc_sha_256(uint8_t hash[SIZE_OF_SHA_256_HASH], const void * input, size_t len)
+{
+    struct Sha_256 sha_256;
+
+    sha_256_init(&sha_256);
+    sha_256_write(&sha_256, input, len);
+    sha_256_close(&sha_256, hash);
+    metricsCountSha256(len);
+}
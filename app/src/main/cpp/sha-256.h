@@ -3,6 +3,23 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdint.h>
+
+#define SIZE_OF_SHA_256_HASH 32
+#define SIZE_OF_SHA_256_CHUNK 64
+
+/**
+ * Incremental SHA256 state.
+ * - hash data in pieces with sha_256_init, any number of sha_256_write and then sha_256_close
+ * - this is a plain struct that can be copied: a copy taken after writing the leading chunks of a
+ *   message is a "midstate" that can be reused to hash many messages sharing that same prefix
+ */
+struct Sha_256 {
+    uint32_t h[8];
+    uint8_t chunk[SIZE_OF_SHA_256_CHUNK];
+    size_t chunk_used;
+    size_t total_len;
+};
 
 /**
  * Calculate the SHA256 hash from an arbitrary array of bytes.
@@ -14,6 +31,46 @@
  * @param input - ptr to the input bytes
  * @param len   - number of bytes to read
  */
-void calc_sha_256(uint8_t hash[32], const void *input, size_t len);
+void calc_sha_256(uint8_t hash[SIZE_OF_SHA_256_HASH], const void *input, size_t len);
+
+/**
+ * Start a new incremental hash.
+ * @param sha_256 - ptr to the state to (re)initialize
+ */
+void sha_256_init(struct Sha_256 *sha_256);
+
+/**
+ * Feed more bytes into an incremental hash.
+ * @param sha_256 - ptr to the state started with sha_256_init
+ * @param data    - ptr to the input bytes
+ * @param len     - number of bytes to read
+ */
+void sha_256_write(struct Sha_256 *sha_256, const void *data, size_t len);
+
+/**
+ * Pad the message, finish the hash and write it out.
+ * - the state must be re-initialized with sha_256_init before it is written to again
+ * @param sha_256 - ptr to the state started with sha_256_init
+ * @param hash    - ptr to the output 32-byte array of 8-bit bytes
+ */
+void sha_256_close(struct Sha_256 *sha_256, uint8_t hash[SIZE_OF_SHA_256_HASH]);
+
+/**
+ * Run the SHA256 compression function over one 64-byte chunk.
+ * - this is the building block of everything above, exposed for callers (e.g. the miner) that
+ *   lay out and pad their own chunks
+ * - runs on the fastest backend available, see sha_256_backend_name
+ * @param h     - the running hash value, updated in place
+ * @param chunk - ptr to the 64 input bytes
+ */
+void sha_256_compress(uint32_t h[8], const uint8_t chunk[SIZE_OF_SHA_256_CHUNK]);
+
+/**
+ * Get the name of the compression backend everything above runs on.
+ * - picked once for the CPU running this: "shani" (x86 SHA extensions), "armv8" (ARMv8
+ *   cryptography extensions) or "portable" (plain C)
+ * @return the name of the backend
+ */
+const char *sha_256_backend_name(void);
 
 #endif
\ No newline at end of file
@@ -0,0 +1,367 @@
+/*
+ * The on-disk format of the chain store and its recovery from crashes (see chain-store.h).
+ * usage: chain-store-test [directory]
+ * - the store files are made in the directory (default: the current one), and removed at the end
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "blockchain.h"
+#include "chain-store.h"
+#include "sha-256.h"
+#include "check.h"
+
+// the format, as chain-store.c writes it: these must not change without a new magic
+#define FILE_HEADER_LEN 64
+#define RECORD_LEN 136
+#define RECORD_CRC 132
+#define INDEX_CLEAN 24
+
+#define BLOCKS 40
+#define MAX_PAYLOAD 128
+
+static char storePath[512];
+static BlockHeader headers[BLOCKS];
+static uint8_t hashes[BLOCKS][HASH_LEN];
+static uint8_t payloads[BLOCKS][MAX_PAYLOAD];
+
+/**
+ * Make a chain of blocks, linked but not mined: the store does not check the proof of work.
+ */
+static void makeBlocks(void) {
+    for (int i = 0; i < BLOCKS; ++i) {
+        BlockHeader* header = &headers[i];
+        memset(header, 0, sizeof(*header));
+        header->version = HEADER_VERSION_SHA256;
+        header->timestamp = 1700000000u + (uint32_t)i;
+        header->bits = difficultyBits(1);
+        header->dataLength = (uint32_t)(1 + i * 3 % MAX_PAYLOAD);
+        for (uint32_t j = 0; j < header->dataLength; ++j)
+            payloads[i][j] = (uint8_t)(i * 31 + j);
+        calc_sha_256(header->dataHash, payloads[i], header->dataLength);
+        if (i > 0)
+            memcpy(header->previousHeaderHash, hashes[i - 1], HASH_LEN);
+        header->nonce = (uint32_t)i;
+        hashHeader(header, hashes[i]);
+    }
+}
+
+static const char* sibling(const char* suffix) {
+    static char path[sizeof(storePath) + 8];
+    snprintf(path, sizeof(path), "%s%s", storePath, suffix);
+    return path;
+}
+
+static void removeStore(void) {
+    unlink(sibling(""));
+    unlink(sibling(".dat"));
+    unlink(sibling(".idx"));
+}
+
+static off_t fileSize(const char* path) {
+    struct stat st;
+    return stat(path, &st) == 0 ? st.st_size : -1;
+}
+
+static void patchFile(const char* path, const off_t offset, const void* bytes, const size_t size) {
+    const int fd = open(path, O_WRONLY);
+    CHECK(fd >= 0 && pwrite(fd, bytes, size, offset) == (ssize_t)size);
+    if (fd >= 0)
+        close(fd);
+}
+
+static uint64_t payloadsLength(const int count) {
+    uint64_t length = 0;
+    for (int i = 0; i < count; ++i)
+        length += headers[i].dataLength;
+    return length;
+}
+
+/**
+ * Make a store of the first count blocks, closed cleanly.
+ */
+static void makeStore(const int count) {
+    removeStore();
+    ChainStore* store = chainStoreOpen(storePath, 0);
+    CHECK(store != NULL);
+    if (!store)
+        return;
+    for (int i = 0; i < count; ++i)
+        CHECK(chainStoreAppend(store, &headers[i], payloads[i], headers[i].dataLength,
+                               CHAIN_PAYLOAD_RAW) == 0);
+    CHECK(chainStoreClose(store) == 0);
+}
+
+/**
+ * Check that a store holds exactly the first count blocks, found by height and by hash.
+ */
+static void checkStore(ChainStore* store, const int count) {
+    CHECK(chainStoreCount(store) == (uint64_t)count);
+    for (int i = 0; i < count; ++i) {
+        BlockHeader header;
+        uint8_t hash[HASH_LEN];
+        CHECK(chainStoreGet(store, (uint64_t)i, &header, hash) == 0);
+        CHECK(memcmp(&header, &headers[i], sizeof(header)) == 0);
+        CHECK(memcmp(hash, hashes[i], HASH_LEN) == 0);
+        CHECK(chainStoreFind(store, hashes[i]) == i);
+
+        int fd;
+        uint64_t offset, length;
+        int kind;
+        uint8_t payload[MAX_PAYLOAD];
+        CHECK(chainStorePayload(store, (uint64_t)i, &fd, &offset, &length, &kind) == 0);
+        CHECK(length == headers[i].dataLength && kind == CHAIN_PAYLOAD_RAW);
+        CHECK(pread(fd, payload, (size_t)length, (off_t)offset) == (ssize_t)length);
+        CHECK(memcmp(payload, payloads[i], (size_t)length) == 0);
+    }
+    for (int i = count; i < BLOCKS; ++i)
+        CHECK(chainStoreFind(store, hashes[i]) == -1);
+    errno = 0;
+    CHECK(chainStoreGet(store, (uint64_t)count, NULL, NULL) == -1 && errno == ERANGE);
+}
+
+/**
+ * Reopen a store and check it holds the first count blocks, read-only then writable.
+ */
+static void checkReopened(const int count) {
+    ChainStore* store = chainStoreOpen(storePath, CHAIN_STORE_READONLY);
+    CHECK(store != NULL);
+    if (store) {
+        checkStore(store, count);
+        CHECK(chainStoreClose(store) == 0);
+    }
+    store = chainStoreOpen(storePath, 0);
+    CHECK(store != NULL);
+    if (store) {
+        checkStore(store, count);
+        CHECK(chainStoreClose(store) == 0);
+    }
+    CHECK(fileSize(sibling("")) == FILE_HEADER_LEN + (off_t)count * RECORD_LEN);
+    CHECK(fileSize(sibling(".dat")) == (off_t)payloadsLength(count));
+}
+
+static void testRoundTrip(void) {
+    makeStore(BLOCKS);
+    checkReopened(BLOCKS);
+
+    // appends go on after a reopen
+    makeStore(BLOCKS / 2);
+    ChainStore* store = chainStoreOpen(storePath, 0);
+    CHECK(store != NULL);
+    if (!store)
+        return;
+    for (int i = BLOCKS / 2; i < BLOCKS; ++i)
+        CHECK(chainStoreAppend(store, &headers[i], payloads[i], headers[i].dataLength,
+                               CHAIN_PAYLOAD_RAW) == 0);
+    checkStore(store, BLOCKS);
+    CHECK(chainStoreClose(store) == 0);
+    checkReopened(BLOCKS);
+}
+
+static void testAppendChecks(void) {
+    makeStore(3);
+    ChainStore* store = chainStoreOpen(storePath, 0);
+    CHECK(store != NULL);
+    if (!store)
+        return;
+
+    // a block that does not link to the last one
+    errno = 0;
+    CHECK(chainStoreAppend(store, &headers[4], payloads[4], headers[4].dataLength,
+                           CHAIN_PAYLOAD_RAW) == -1 && errno == EINVAL);
+
+    // a raw payload that is not the one hashed into the header, e.g. a file that changed since
+    errno = 0;
+    CHECK(chainStoreAppend(store, &headers[3], payloads[3], headers[3].dataLength + 1,
+                           CHAIN_PAYLOAD_RAW) == -1 && errno == EINVAL);
+    int pipeFds[2];
+    CHECK(pipe(pipeFds) == 0);
+    CHECK(write(pipeFds[1], payloads[3], headers[3].dataLength - 1) ==
+          (ssize_t)headers[3].dataLength - 1);
+    close(pipeFds[1]);
+    errno = 0;
+    CHECK(chainStoreAppendFd(store, &headers[3], pipeFds[0]) == -1 && errno == EINVAL);
+    close(pipeFds[0]);
+    checkStore(store, 3);
+
+    // and then the right one
+    CHECK(chainStoreAppend(store, &headers[3], payloads[3], headers[3].dataLength,
+                           CHAIN_PAYLOAD_RAW) == 0);
+    CHECK(chainStoreClose(store) == 0);
+    checkReopened(4);
+
+    // nothing is appended to a read-only store
+    store = chainStoreOpen(storePath, CHAIN_STORE_READONLY);
+    CHECK(store != NULL);
+    if (store) {
+        errno = 0;
+        CHECK(chainStoreAppend(store, &headers[4], payloads[4], headers[4].dataLength,
+                               CHAIN_PAYLOAD_RAW) == -1 && errno == EBADF);
+        CHECK(chainStoreClose(store) == 0);
+    }
+}
+
+static void testLocking(void) {
+    makeStore(2);
+    ChainStore* writer = chainStoreOpen(storePath, 0);
+    CHECK(writer != NULL);
+    errno = 0;
+    CHECK(chainStoreOpen(storePath, 0) == NULL && errno == EWOULDBLOCK);
+    errno = 0;
+    CHECK(chainStoreOpen(storePath, CHAIN_STORE_READONLY) == NULL && errno == EWOULDBLOCK);
+    CHECK(chainStoreClose(writer) == 0);
+
+    // readers share the store, but keep writers out
+    ChainStore* reader = chainStoreOpen(storePath, CHAIN_STORE_READONLY);
+    ChainStore* other = chainStoreOpen(storePath, CHAIN_STORE_READONLY);
+    CHECK(reader != NULL && other != NULL);
+    errno = 0;
+    CHECK(chainStoreOpen(storePath, 0) == NULL && errno == EWOULDBLOCK);
+    CHECK(chainStoreClose(reader) == 0);
+    CHECK(chainStoreClose(other) == 0);
+    checkReopened(2);
+}
+
+static void testTornRecord(void) {
+    // the last record cut off halfway
+    makeStore(10);
+    CHECK(truncate(sibling(""), FILE_HEADER_LEN + 9 * RECORD_LEN + RECORD_LEN / 2) == 0);
+    checkReopened(9);
+
+    // the last record written in full but not its checksum
+    makeStore(10);
+    const uint8_t zeros[4] = { 0 };
+    patchFile(sibling(""), FILE_HEADER_LEN + 9 * RECORD_LEN + RECORD_CRC, zeros, sizeof(zeros));
+    checkReopened(9);
+
+    // a record whose payload never made it to disk
+    makeStore(10);
+    CHECK(truncate(sibling(".dat"), (off_t)payloadsLength(10) - 1) == 0);
+    checkReopened(9);
+
+    // the store goes on from the last good block
+    ChainStore* store = chainStoreOpen(storePath, 0);
+    CHECK(store != NULL);
+    if (store) {
+        CHECK(chainStoreAppend(store, &headers[9], payloads[9], headers[9].dataLength,
+                               CHAIN_PAYLOAD_RAW) == 0);
+        CHECK(chainStoreClose(store) == 0);
+    }
+    checkReopened(10);
+}
+
+static void testOrphanPayload(void) {
+    // a payload written by an append that never wrote its record
+    makeStore(10);
+    const int fd = open(sibling(".dat"), O_WRONLY | O_APPEND);
+    CHECK(fd >= 0 && write(fd, "orphan bytes", 12) == 12);
+    if (fd >= 0)
+        close(fd);
+    checkReopened(10);
+
+    // the next payload goes where the orphan was
+    ChainStore* store = chainStoreOpen(storePath, 0);
+    CHECK(store != NULL);
+    if (store) {
+        CHECK(chainStoreAppend(store, &headers[10], payloads[10], headers[10].dataLength,
+                               CHAIN_PAYLOAD_RAW) == 0);
+        CHECK(chainStoreClose(store) == 0);
+    }
+    checkReopened(11);
+}
+
+static void testIndexRebuild(void) {
+    // an index left unclean (the store was not closed), with garbage in its slots
+    makeStore(BLOCKS);
+    const uint8_t unclean[4] = { 0 };
+    patchFile(sibling(".idx"), INDEX_CLEAN, unclean, sizeof(unclean));
+    uint8_t garbage[256];
+    for (size_t i = 0; i < sizeof(garbage); ++i)
+        garbage[i] = (uint8_t)(i * 151 + 7);
+    patchFile(sibling(".idx"), FILE_HEADER_LEN, garbage, sizeof(garbage));
+    checkReopened(BLOCKS);
+
+    // no index at all
+    makeStore(BLOCKS);
+    CHECK(unlink(sibling(".idx")) == 0);
+    checkReopened(BLOCKS);
+
+    // an index of another format
+    makeStore(BLOCKS);
+    patchFile(sibling(".idx"), 0, "BTCOIDX1", 8);
+    checkReopened(BLOCKS);
+
+    // a clean index of fewer blocks than the store, e.g. restored from a backup
+    makeStore(BLOCKS / 2);
+    const int fd = open(sibling(".idx"), O_RDONLY);
+    const off_t size = fileSize(sibling(".idx"));
+    uint8_t* saved = malloc((size_t)size);
+    CHECK(fd >= 0 && saved && pread(fd, saved, (size_t)size, 0) == size);
+    if (fd >= 0)
+        close(fd);
+    ChainStore* store = chainStoreOpen(storePath, 0);
+    CHECK(store != NULL);
+    if (store) {
+        for (int i = BLOCKS / 2; i < BLOCKS; ++i)
+            CHECK(chainStoreAppend(store, &headers[i], payloads[i], headers[i].dataLength,
+                                   CHAIN_PAYLOAD_RAW) == 0);
+        CHECK(chainStoreClose(store) == 0);
+    }
+    if (saved)
+        patchFile(sibling(".idx"), 0, saved, (size_t)size);
+    free(saved);
+    checkReopened(BLOCKS);
+}
+
+static void testBadFileHeader(void) {
+    // another format of the main file
+    makeStore(3);
+    patchFile(sibling(""), 0, "BTCOCHN2", 8);
+    errno = 0;
+    CHECK(chainStoreOpen(storePath, 0) == NULL && errno == EINVAL);
+    errno = 0;
+    CHECK(chainStoreOpen(storePath, CHAIN_STORE_READONLY) == NULL && errno == EINVAL);
+    // and nothing of it was touched
+    CHECK(fileSize(sibling("")) == FILE_HEADER_LEN + 3 * RECORD_LEN);
+
+    // records of another length
+    makeStore(3);
+    const uint8_t recordLen[4] = { RECORD_LEN - 8, 0, 0, 0 };
+    patchFile(sibling(""), 8, recordLen, sizeof(recordLen));
+    errno = 0;
+    CHECK(chainStoreOpen(storePath, 0) == NULL && errno == EINVAL);
+
+    // a main file too short for its header
+    makeStore(3);
+    CHECK(truncate(sibling(""), FILE_HEADER_LEN / 2) == 0);
+    errno = 0;
+    CHECK(chainStoreOpen(storePath, CHAIN_STORE_READONLY) == NULL && errno == EINVAL);
+
+    // a store that is not there is not made by a reader
+    removeStore();
+    CHECK(chainStoreOpen(storePath, CHAIN_STORE_READONLY) == NULL);
+    CHECK(fileSize(sibling("")) == -1);
+}
+
+int main(int argc, char* argv[]) {
+    snprintf(storePath, sizeof(storePath), "%s/chain-store-test.bin", argc > 1 ? argv[1] : ".");
+    makeBlocks();
+
+    testRoundTrip();
+    testAppendChecks();
+    testLocking();
+    testTornRecord();
+    testOrphanPayload();
+    testIndexRebuild();
+    testBadFileHeader();
+
+    removeStore();
+    return CHECK_STATUS();
+}
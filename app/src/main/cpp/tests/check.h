@@ -0,0 +1,28 @@
+#ifndef BTCO_TESTS_CHECK_H
+#define BTCO_TESTS_CHECK_H
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+
+/**
+ * The checks of the host tests (see tests/), one test program per module, run by ctest.
+ * - a failed check prints where it is and goes on, the program then exits with 1
+ */
+
+// failed checks so far
+static int checkFailures;
+
+#define CHECK(condition) \
+    do { \
+        if (!(condition)) { \
+            ++checkFailures; \
+            fprintf(stderr, "%s:%d: CHECK(%s) failed (errno: %s)\n", __FILE__, __LINE__, \
+                    #condition, strerror(errno)); \
+        } \
+    } while (0)
+
+// the exit status of a test program
+#define CHECK_STATUS() (checkFailures ? 1 : 0)
+
+#endif //BTCO_TESTS_CHECK_H
@@ -0,0 +1,121 @@
+/*
+ * Reading the CPU topology from sysfs (see topology.h), on the copies of sysfs trees in sysfs/.
+ * usage: topology-test <the sysfs directory of the tests>
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <errno.h>
+
+#include "topology.h"
+#include "check.h"
+
+/**
+ * A CPU as the topology is expected to have it: cpu, core, sibling, capacity.
+ */
+typedef struct {
+    int cpu;
+    int core;
+    int sibling;
+    uint32_t capacity;
+} ExpectedCpu;
+
+static const char* root;
+
+/**
+ * Read the topology of a tree and check it is the one expected, in order.
+ */
+static void checkTopology(const char* tree, const int cores, const ExpectedCpu* expected,
+                          const int count) {
+    char path[512];
+    snprintf(path, sizeof(path), "%s/%s", root, tree);
+    CpuTopology topology = { 0 };
+    CHECK(topologyRead(path, &topology) == 0);
+    CHECK(topology.cpuCount == count);
+    CHECK(topology.coreCount == cores);
+    for (int i = 0; i < count && i < topology.cpuCount; ++i) {
+        const CpuInfo* cpu = &topology.cpus[i];
+        if (cpu->cpu != expected[i].cpu || cpu->core != expected[i].core ||
+            cpu->sibling != expected[i].sibling || cpu->capacity != expected[i].capacity) {
+            fprintf(stderr, "%s: CPU #%d is %d (core %d, sibling %d, capacity %u), expected %d "
+                    "(core %d, sibling %d, capacity %u)\n", tree, i, cpu->cpu, cpu->core,
+                    cpu->sibling, cpu->capacity, expected[i].cpu, expected[i].core,
+                    expected[i].sibling, expected[i].capacity);
+            CHECK(0);
+        }
+    }
+}
+
+/**
+ * A phone: 4 LITTLE, 3 big and a prime core (cpu_capacity), no SMT; the fastest first.
+ */
+static void testBigLittle(void) {
+    static const ExpectedCpu expected[] = {
+            { 7, 0, 0, 1024 }, { 4, 1, 0, 871 }, { 5, 2, 0, 871 }, { 6, 3, 0, 871 },
+            { 0, 4, 0, 446 }, { 1, 5, 0, 446 }, { 2, 6, 0, 446 }, { 3, 7, 0, 446 }
+    };
+    checkTopology("big-little", 8, expected, 8);
+}
+
+/**
+ * A desktop: 4 cores of 2 hyperthreads each, numbered as x86 does (the siblings last); the
+ * first CPU of every core before any sibling.
+ */
+static void testX86Smt(void) {
+    static const ExpectedCpu expected[] = {
+            { 0, 0, 0, 1024 }, { 1, 1, 0, 1024 }, { 2, 2, 0, 1024 }, { 3, 3, 0, 1024 },
+            { 4, 0, 1, 1024 }, { 5, 1, 1, 1024 }, { 6, 2, 1, 1024 }, { 7, 3, 1, 1024 }
+    };
+    checkTopology("x86-smt", 4, expected, 8);
+}
+
+/**
+ * A hybrid laptop: 4 performance cores with SMT (one with its sibling offline), 4 efficiency
+ * cores without, told apart by their max frequencies.
+ */
+static void testHybrid(void) {
+    static const ExpectedCpu expected[] = {
+            { 0, 0, 0, 1024 }, { 2, 1, 0, 1024 }, { 4, 2, 0, 1024 }, { 6, 3, 0, 1024 },
+            { 8, 4, 0, 778 }, { 9, 5, 0, 778 }, { 10, 6, 0, 778 }, { 11, 7, 0, 778 },
+            { 1, 0, 1, 1024 }, { 3, 1, 1, 1024 }, { 7, 3, 1, 1024 }
+    };
+    checkTopology("hybrid", 8, expected, 11);
+}
+
+/**
+ * A machine that says nothing but which CPUs are online: a core each, all as fast.
+ */
+static void testNoSpeed(void) {
+    static const ExpectedCpu expected[] = {
+            { 0, 0, 0, 1024 }, { 1, 1, 0, 1024 }, { 2, 2, 0, 1024 }
+    };
+    checkTopology("no-speed", 3, expected, 3);
+}
+
+static void testMissing(void) {
+    char path[512];
+    snprintf(path, sizeof(path), "%s/none", root);
+    CpuTopology topology;
+    errno = 0;
+    CHECK(topologyRead(path, &topology) == -1 && errno == ENOENT);
+}
+
+int main(int argc, char* argv[]) {
+    if (argc != 2) {
+        fprintf(stderr, "usage: %s <the sysfs directory of the tests>\n", argv[0]);
+        return 2;
+    }
+    root = argv[1];
+
+    testBigLittle();
+    testX86Smt();
+    testHybrid();
+    testNoSpeed();
+    testMissing();
+
+    // whatever the machine is, it has a CPU to run this on
+    const CpuTopology* machine = cpuTopology();
+    CHECK(!machine || (machine->cpuCount >= 1 && machine->coreCount >= 1 &&
+                       machine->coreCount <= machine->cpuCount));
+    return CHECK_STATUS();
+}
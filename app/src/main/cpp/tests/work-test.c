@@ -0,0 +1,375 @@
+/*
+ * Mining by workers over a Unix socket (see coordinator.h, worker.h): blocks mined, a worker gone
+ * mid-unit, and a coordinator gone mid-job, with real workers and coordinators in threads or with
+ * ones played by hand message by message.
+ * usage: work-test [directory]
+ * - the sockets are made in the directory (default: the current one), and removed at the end
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <poll.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/socket.h>
+
+#include "blockchain.h"
+#include "coordinator.h"
+#include "miner.h"
+#include "work-protocol.h"
+#include "worker.h"
+#include "check.h"
+
+// a block found in a few thousand hashes, and one that is never found in a unit of work
+#define EASY_DIFFICULTY 2
+#define HARD_DIFFICULTY 10
+
+#define BLOCKS 3
+#define WORKERS 2
+
+// how long a message of a peer is waited for before the test gives up on it
+#define RECEIVE_MS 5000
+
+static char address[512];
+
+/**
+ * A worker run on a thread, as if in a process of its own.
+ */
+typedef struct {
+    pthread_t thread;
+    MiningControl control;
+    uint64_t solutions;
+    int rc;
+    int error;
+} WorkerThread;
+
+/**
+ * A block mined by the coordinator on a thread, for the test to play its workers meanwhile.
+ */
+typedef struct {
+    pthread_t thread;
+    Coordinator* coordinator;
+    BlockHeader header;
+    uint8_t targetHash[HASH_LEN];
+    uint8_t hash[HASH_LEN];
+    MiningControl control;
+    int rc;
+    int error;
+} MineThread;
+
+static uint64_t monotonicMs(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + (uint64_t)ts.tv_nsec / 1000000;
+}
+
+static void sleepMs(const long ms) {
+    const struct timespec ts = { ms / 1000, ms % 1000 * 1000000 };
+    nanosleep(&ts, NULL);
+}
+
+/**
+ * Make the header of a block to mine on top of another (all 0s for a genesis block).
+ */
+static void makeJob(BlockHeader* header, const uint8_t previousHash[HASH_LEN], const int difficulty,
+                    uint8_t targetHash[HASH_LEN]) {
+    memset(header, 0, sizeof(*header));
+    header->version = HEADER_VERSION_SHA256;
+    memcpy(header->previousHeaderHash, previousHash, HASH_LEN);
+    for (int i = 0; i < HASH_LEN; ++i)
+        header->dataHash[i] = (uint8_t)(previousHash[i] ^ (i * 7 + 1));
+    header->dataLength = HASH_LEN;
+    header->bits = difficultyBits(difficulty);
+    bitsToTarget(header->bits, targetHash);
+}
+
+static void* runWorker(void* arg) {
+    WorkerThread* worker = arg;
+    worker->rc = workerRun(address, 1, &worker->control, &worker->solutions);
+    worker->error = worker->rc ? errno : 0;
+    return NULL;
+}
+
+static void startWorker(WorkerThread* worker) {
+    memset(worker, 0, sizeof(*worker));
+    miningControlInit(&worker->control, NULL, NULL, 0);
+    CHECK(pthread_create(&worker->thread, NULL, runWorker, worker) == 0);
+}
+
+static void* runMine(void* arg) {
+    MineThread* mine = arg;
+    mine->rc = coordinatorMine(mine->coordinator, &mine->header, mine->targetHash, mine->hash,
+                               &mine->control);
+    mine->error = mine->rc ? errno : 0;
+    return NULL;
+}
+
+static void startMine(MineThread* mine, Coordinator* coordinator,
+                      const uint8_t previousHash[HASH_LEN]) {
+    memset(mine, 0, sizeof(*mine));
+    mine->coordinator = coordinator;
+    makeJob(&mine->header, previousHash, EASY_DIFFICULTY, mine->targetHash);
+    miningControlInit(&mine->control, NULL, NULL, 0);
+    CHECK(pthread_create(&mine->thread, NULL, runMine, mine) == 0);
+}
+
+/**
+ * Receive a message, or give up after RECEIVE_MS.
+ * @return 0 on success, -1 with errno set (ETIMEDOUT if nothing came)
+ */
+static int receiveWithin(const int fd, WorkMessage* message) {
+    struct pollfd pfd = { fd, POLLIN, 0 };
+    const int ready = poll(&pfd, 1, RECEIVE_MS);
+    if (ready <= 0) {
+        if (ready == 0)
+            errno = ETIMEDOUT;
+        return -1;
+    }
+    return workReceive(fd, message);
+}
+
+static int sendMessage(const int fd, const uint32_t type, const uint32_t jobId,
+                       const BlockHeader* header, const uint32_t begin, const uint32_t count) {
+    WorkMessage message;
+    memset(&message, 0, sizeof(message));
+    message.type = type;
+    message.jobId = jobId;
+    if (header)
+        message.header = *header;
+    message.begin = begin;
+    message.count = count;
+    return workSend(fd, &message);
+}
+
+/**
+ * Connect as a worker that asks for work, and get the unit it is given.
+ * @return the socket, -1 if it is not given one
+ */
+static int connectWorker(WorkMessage* work) {
+    const int fd = workOpenSocket(address, WORK_CONNECT);
+    CHECK(fd >= 0);
+    if (fd < 0)
+        return -1;
+    CHECK(sendMessage(fd, WORK_MSG_REQUEST, 0, NULL, 0, 0) == 0);
+    CHECK(receiveWithin(fd, work) == 0 && work->type == WORK_MSG_WORK);
+    return fd;
+}
+
+static void expectMessage(const int fd, const uint32_t type, const uint32_t jobId) {
+    WorkMessage message;
+    CHECK(receiveWithin(fd, &message) == 0);
+    CHECK(message.type == type && message.jobId == jobId);
+}
+
+/**
+ * A few blocks mined by real workers, each on top of the last, then the workers let go.
+ */
+static void testMining(void) {
+    Coordinator* coordinator = coordinatorOpen(address);
+    CHECK(coordinator);
+    if (!coordinator)
+        return;
+    WorkerThread workers[WORKERS];
+    for (int i = 0; i < WORKERS; ++i)
+        startWorker(&workers[i]);
+
+    uint8_t previousHash[HASH_LEN] = { 0 };
+    for (int i = 0; i < BLOCKS; ++i) {
+        BlockHeader header;
+        uint8_t targetHash[HASH_LEN];
+        makeJob(&header, previousHash, EASY_DIFFICULTY, targetHash);
+        uint8_t hash[HASH_LEN];
+        CHECK(coordinatorMine(coordinator, &header, targetHash, hash, NULL) == 0);
+        uint8_t checked[HASH_LEN];
+        hashHeader(&header, checked);
+        CHECK(memcmp(checked, hash, HASH_LEN) == 0 && memcmp(hash, targetHash, HASH_LEN) < 0);
+        CHECK(memcmp(header.previousHeaderHash, previousHash, HASH_LEN) == 0);
+        memcpy(previousHash, hash, HASH_LEN);
+    }
+
+    // every block is a solution of a worker, and a few more may have come too late
+    coordinatorClose(coordinator);
+    uint64_t solutions = 0;
+    for (int i = 0; i < WORKERS; ++i) {
+        pthread_join(workers[i].thread, NULL);
+        CHECK(workers[i].rc == 0);
+        solutions += workers[i].solutions;
+    }
+    CHECK(solutions >= BLOCKS);
+}
+
+/**
+ * A worker gone mid-unit, its unit handed out again to the next one, and a block found: the others
+ * told their job is stale, and what they send about it after ignored.
+ */
+static void testOrphanedUnit(void) {
+    Coordinator* coordinator = coordinatorOpen(address);
+    CHECK(coordinator);
+    if (!coordinator)
+        return;
+    const uint8_t genesis[HASH_LEN] = { 0 };
+    MineThread mine;
+    startMine(&mine, coordinator, genesis);
+
+    // the units in order, in the same round
+    WorkMessage workA, workB, workC;
+    const int a = connectWorker(&workA);
+    const int b = connectWorker(&workB);
+    CHECK(workA.jobId == workB.jobId && workA.header.timestamp == workB.header.timestamp);
+    CHECK(workA.begin == 0 && workA.count == COORDINATOR_UNIT_NONCES);
+    CHECK(workB.begin == workA.begin + workA.count);
+
+    // killed mid-unit: a newcomer gets the unit again
+    close(a);
+    const int c = connectWorker(&workC);
+    CHECK(workC.jobId == workA.jobId && workC.header.timestamp == workA.header.timestamp);
+    CHECK(workC.begin == workA.begin && workC.count == workA.count);
+
+    BlockHeader solution = workC.header;
+    CHECK(mineNonceRange(&solution, mine.targetHash, workC.begin,
+                         (uint64_t)workC.begin + workC.count, 1, NULL, NULL) == 0);
+    CHECK(sendMessage(c, WORK_MSG_SOLUTION, workC.jobId, &solution, workC.begin,
+                      solution.nonce - workC.begin + 1) == 0);
+    pthread_join(mine.thread, NULL);
+    CHECK(mine.rc == 0);
+    CHECK(mine.header.timestamp == solution.timestamp && mine.header.nonce == solution.nonce);
+    expectMessage(b, WORK_MSG_STALE, workB.jobId);
+
+    // too late: the block of the next job is not that one, and the worker just gets a unit of it
+    CHECK(sendMessage(b, WORK_MSG_SOLUTION, workB.jobId, &solution, workB.begin, 1) == 0);
+    MineThread next;
+    startMine(&next, coordinator, mine.hash);
+    expectMessage(c, WORK_MSG_WORK, workC.jobId + 1);
+    expectMessage(b, WORK_MSG_WORK, workB.jobId + 1);
+
+    // given up: the workers told so too, and let go once they stopped
+    miningCancel(&next.control);
+    pthread_join(next.thread, NULL);
+    CHECK(next.rc == -1 && next.error == ECANCELED);
+    expectMessage(b, WORK_MSG_STALE, workB.jobId + 1);
+    expectMessage(c, WORK_MSG_STALE, workC.jobId + 1);
+    CHECK(sendMessage(b, WORK_MSG_REQUEST, workB.jobId + 1, NULL, 0, 0) == 0);
+    CHECK(sendMessage(c, WORK_MSG_REQUEST, workC.jobId + 1, NULL, 0, 0) == 0);
+    coordinatorClose(coordinator);
+    expectMessage(b, WORK_MSG_BYE, 0);
+    expectMessage(c, WORK_MSG_BYE, 0);
+    close(b);
+    close(c);
+}
+
+/**
+ * Gives up mining, once the workers are at it for a while.
+ */
+typedef struct {
+    Coordinator* coordinator;
+    MiningControl control;
+    int calls;
+} CancelLater;
+
+static void onCancelLater(void* ctx, uint64_t noncesTried) {
+    (void)noncesTried;
+    CancelLater* later = ctx;
+    if (coordinatorWorkerCount(later->coordinator) == WORKERS && ++later->calls == 4)
+        miningCancel(&later->control);
+}
+
+/**
+ * The coordinator closed mid-job, with real workers on units of it: they stop and are let go.
+ */
+static void testClosedMidJob(void) {
+    CancelLater later;
+    later.coordinator = coordinatorOpen(address);
+    later.calls = 0;
+    CHECK(later.coordinator);
+    if (!later.coordinator)
+        return;
+    miningControlInit(&later.control, onCancelLater, &later, 50);
+    WorkerThread workers[WORKERS];
+    for (int i = 0; i < WORKERS; ++i)
+        startWorker(&workers[i]);
+
+    const uint8_t genesis[HASH_LEN] = { 0 };
+    BlockHeader header;
+    uint8_t targetHash[HASH_LEN];
+    makeJob(&header, genesis, HARD_DIFFICULTY, targetHash);
+    CHECK(coordinatorMine(later.coordinator, &header, targetHash, NULL, &later.control) == -1 &&
+          errno == ECANCELED);
+
+    // the workers say they stopped well before the coordinator would give up waiting for them
+    const uint64_t startMs = monotonicMs();
+    coordinatorClose(later.coordinator);
+    CHECK(monotonicMs() - startMs < COORDINATOR_CLOSE_MS);
+    for (int i = 0; i < WORKERS; ++i) {
+        pthread_join(workers[i].thread, NULL);
+        CHECK(workers[i].rc == 0 && workers[i].solutions == 0);
+    }
+}
+
+/**
+ * Be the coordinator of a real worker, by hand, up to a unit it is mining.
+ * @return the socket of the worker, -1 if it did not get that far
+ */
+static int acceptWorker(const int listenFd, const uint32_t jobId) {
+    struct pollfd pfd = { listenFd, POLLIN, 0 };
+    CHECK(poll(&pfd, 1, RECEIVE_MS) == 1);
+    const int fd = accept(listenFd, NULL, NULL);
+    CHECK(fd >= 0);
+    if (fd < 0)
+        return -1;
+    expectMessage(fd, WORK_MSG_REQUEST, 0);
+    const uint8_t genesis[HASH_LEN] = { 0 };
+    BlockHeader header;
+    uint8_t targetHash[HASH_LEN];
+    makeJob(&header, genesis, HARD_DIFFICULTY, targetHash);
+    header.timestamp = (uint32_t)time(NULL);
+    CHECK(sendMessage(fd, WORK_MSG_WORK, jobId, &header, 0, COORDINATOR_UNIT_NONCES) == 0);
+    // long enough for it to be mining
+    sleepMs(200);
+    return fd;
+}
+
+/**
+ * A coordinator that ends the job and goes away before the reply of the worker comes (EPIPE): as
+ * good as a BYE; and one that goes away without a word: an error.
+ */
+static void testCoordinatorGone(void) {
+    const int listenFd = workOpenSocket(address, WORK_LISTEN);
+    CHECK(listenFd >= 0);
+    if (listenFd < 0)
+        return;
+
+    WorkerThread worker;
+    startWorker(&worker);
+    int fd = acceptWorker(listenFd, 7);
+    if (fd >= 0) {
+        // not reading any more, so that the reply fails whenever it is sent
+        shutdown(fd, SHUT_RD);
+        CHECK(sendMessage(fd, WORK_MSG_STALE, 7, NULL, 0, 0) == 0);
+        close(fd);
+    }
+    pthread_join(worker.thread, NULL);
+    CHECK(worker.rc == 0);
+
+    startWorker(&worker);
+    fd = acceptWorker(listenFd, 8);
+    if (fd >= 0)
+        close(fd);
+    pthread_join(worker.thread, NULL);
+    CHECK(worker.rc == -1 && worker.error == ECONNRESET);
+
+    close(listenFd);
+    unlink(address + strlen("unix:"));
+}
+
+int main(int argc, char* argv[]) {
+    snprintf(address, sizeof(address), "unix:%s/work-test.sock", argc > 1 ? argv[1] : ".");
+
+    testMining();
+    testOrphanedUnit();
+    testClosedMidJob();
+    testCoordinatorGone();
+    return CHECK_STATUS();
+}
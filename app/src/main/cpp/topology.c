@@ -0,0 +1,200 @@
+/*
+ * The CPU topology, from sysfs, and pinning threads to CPUs (see topology.h).
+ */
+
+#define _GNU_SOURCE // sched_setaffinity, CPU_SET
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <sched.h>
+#include <pthread.h>
+
+#include "topology.h"
+
+/**
+ * A CPU as read, before the topology is put in order.
+ */
+typedef struct {
+    int cpu;
+    int coreKey;     // the lowest CPU of its core, i.e., the same for SMT siblings
+    uint64_t speed;  // cpu_capacity or the max frequency, 0 if neither is known
+} RawCpu;
+
+static CpuTopology machineTopology;
+static int machineTopologyKnown;
+static pthread_once_t machineTopologyOnce = PTHREAD_ONCE_INIT;
+
+/**
+ * Read the first line of a small file.
+ * @return 0 on success, -1 if it can't be read
+ */
+static int readLine(const char* path, char* line, const size_t size) {
+    FILE* f = fopen(path, "re");
+    if (!f)
+        return -1;
+    const int ok = fgets(line, (int)size, f) != NULL;
+    fclose(f);
+    return ok ? 0 : -1;
+}
+
+/**
+ * Parse a list of CPUs as the kernel writes them, e.g. "0-3,6,8-9".
+ * @param in set to 1 for each CPU of the list below TOPOLOGY_MAX_CPUS
+ * @return the lowest CPU of the list, -1 if it is not one
+ */
+static int parseCpuList(const char* list, uint8_t in[TOPOLOGY_MAX_CPUS]) {
+    int lowest = -1;
+    const char* p = list;
+    while (*p >= '0' && *p <= '9') {
+        char* end;
+        const long first = strtol(p, &end, 10);
+        long last = first;
+        if (*end == '-')
+            last = strtol(end + 1, &end, 10);
+        for (long cpu = first; cpu <= last && cpu < TOPOLOGY_MAX_CPUS; ++cpu)
+            if (in)
+                in[cpu] = 1;
+        if (lowest < 0 || first < lowest)
+            lowest = (int)first;
+        p = *end == ',' ? end + 1 : end;
+    }
+    return lowest;
+}
+
+/**
+ * Read the online CPUs, their cores and speeds.
+ * @return the number of CPUs, -1 with errno set if there is no telling
+ */
+static int readCpus(const char* root, RawCpu cpus[TOPOLOGY_MAX_CPUS]) {
+    char path[512];
+    char line[1024];
+    uint8_t online[TOPOLOGY_MAX_CPUS] = { 0 };
+    snprintf(path, sizeof(path), "%s/online", root);
+    if (readLine(path, line, sizeof(line)) != 0)
+        return -1;
+    if (parseCpuList(line, online) < 0) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    int count = 0;
+    for (int cpu = 0; cpu < TOPOLOGY_MAX_CPUS; ++cpu) {
+        if (!online[cpu])
+            continue;
+        RawCpu* raw = &cpus[count++];
+        raw->cpu = cpu;
+
+        // the siblings list is what tells cores apart everywhere, the core ids repeat across
+        // clusters on ARM and across packages on x86
+        raw->coreKey = -1;
+        snprintf(path, sizeof(path), "%s/cpu%d/topology/thread_siblings_list", root, cpu);
+        if (readLine(path, line, sizeof(line)) == 0)
+            raw->coreKey = parseCpuList(line, NULL);
+        if (raw->coreKey < 0 || raw->coreKey > cpu)
+            raw->coreKey = cpu;
+
+        snprintf(path, sizeof(path), "%s/cpu%d/cpu_capacity", root, cpu);
+        if (readLine(path, line, sizeof(line)) != 0) {
+            snprintf(path, sizeof(path), "%s/cpu%d/cpufreq/cpuinfo_max_freq", root, cpu);
+            if (readLine(path, line, sizeof(line)) != 0)
+                line[0] = '\0';
+        }
+        raw->speed = strtoull(line, NULL, 10);
+    }
+    return count;
+}
+
+static int compareCpus(const void* a, const void* b) {
+    const CpuInfo* x = a;
+    const CpuInfo* y = b;
+    if (x->sibling != y->sibling)
+        return x->sibling - y->sibling;
+    if (x->capacity != y->capacity)
+        return x->capacity > y->capacity ? -1 : 1;
+    return x->cpu - y->cpu;
+}
+
+/**
+ * Put CPUs in the order of a topology, and number their cores.
+ * @param cpus the CPUs, in increasing order
+ */
+static void buildTopology(const RawCpu* cpus, const int count, CpuTopology* topology) {
+    uint64_t fastest = 0;
+    for (int i = 0; i < count; ++i)
+        if (cpus[i].speed > fastest)
+            fastest = cpus[i].speed;
+
+    for (int i = 0; i < count; ++i) {
+        CpuInfo* info = &topology->cpus[i];
+        info->cpu = cpus[i].cpu;
+        info->core = cpus[i].coreKey; // numbered below
+        info->sibling = 0;
+        for (int j = 0; j < i; ++j)
+            info->sibling += cpus[j].coreKey == cpus[i].coreKey;
+        // NOTE a CPU whose speed is not known is taken to be as fast as any
+        info->capacity = fastest && cpus[i].speed ?
+                (uint32_t)(cpus[i].speed * TOPOLOGY_FULL_CAPACITY / fastest) : TOPOLOGY_FULL_CAPACITY;
+        if (!info->capacity)
+            info->capacity = 1;
+    }
+    qsort(topology->cpus, (size_t)count, sizeof(CpuInfo), compareCpus);
+
+    // the cores in the order of their first CPUs, which come first
+    int coreOf[TOPOLOGY_MAX_CPUS];
+    int cores = 0;
+    for (int i = 0; i < count; ++i)
+        if (topology->cpus[i].sibling == 0)
+            coreOf[topology->cpus[i].core] = cores++;
+    for (int i = 0; i < count; ++i)
+        topology->cpus[i].core = coreOf[topology->cpus[i].core];
+    topology->cpuCount = count;
+    topology->coreCount = cores;
+}
+
+int topologyRead(const char* root, CpuTopology* topology) {
+    RawCpu cpus[TOPOLOGY_MAX_CPUS];
+    const int count = readCpus(root, cpus);
+    if (count <= 0) {
+        if (count == 0)
+            errno = ENOENT;
+        return -1;
+    }
+    buildTopology(cpus, count, topology);
+    return 0;
+}
+
+static void readMachineTopology(void) {
+    RawCpu cpus[TOPOLOGY_MAX_CPUS];
+    int count = readCpus(TOPOLOGY_SYSFS_ROOT, cpus);
+    if (count <= 0)
+        return;
+
+    // only the CPUs this process may run on, e.g. under taskset or the cpuset of an Android app
+    cpu_set_t allowed;
+    if (sched_getaffinity(0, sizeof(allowed), &allowed) == 0) {
+        int kept = 0;
+        for (int i = 0; i < count; ++i)
+            if (CPU_ISSET(cpus[i].cpu, &allowed))
+                cpus[kept++] = cpus[i];
+        count = kept;
+    }
+    if (count == 0)
+        return;
+    buildTopology(cpus, count, &machineTopology);
+    machineTopologyKnown = 1;
+}
+
+const CpuTopology* cpuTopology(void) {
+    pthread_once(&machineTopologyOnce, readMachineTopology);
+    return machineTopologyKnown ? &machineTopology : NULL;
+}
+
+int topologyPinThread(const int cpu) {
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    return sched_setaffinity(0, sizeof(set), &set);
+}
@@ -0,0 +1,66 @@
+#ifndef BTCO_TOPOLOGY_H
+#define BTCO_TOPOLOGY_H
+
+#include <stdint.h>
+
+// the most CPUs (hardware threads) looked at, any more are left out
+#define TOPOLOGY_MAX_CPUS 256
+
+// the capacity of the fastest CPUs, as the kernel has it in cpu_capacity
+#define TOPOLOGY_FULL_CAPACITY 1024
+
+// where Linux (and Android) describes the CPUs
+#define TOPOLOGY_SYSFS_ROOT "/sys/devices/system/cpu"
+
+/**
+ * A CPU, i.e., a hardware thread, as the kernel numbers them.
+ */
+typedef struct {
+    int cpu;
+
+    // the index of its physical core in the topology, the same for SMT siblings (hyperthreads),
+    // which share the SIMD units the SHA256 kernels keep busy
+    int core;
+
+    // 0 for the first CPU of its core, 1.. for its SMT siblings
+    int sibling;
+
+    // how fast its core is, TOPOLOGY_FULL_CAPACITY for the fastest ones: from cpu_capacity (the
+    // big and LITTLE cores of ARM), or else the max frequency, or else all the same
+    uint32_t capacity;
+} CpuInfo;
+
+/**
+ * The CPUs of a machine, in the order to put mining threads on them: the first CPU of each core,
+ * fastest cores first, then the SMT siblings likewise, so that no 2 threads share a core until
+ * there are more threads than cores.
+ */
+typedef struct {
+    int cpuCount;
+    int coreCount;
+    CpuInfo cpus[TOPOLOGY_MAX_CPUS];
+} CpuTopology;
+
+/**
+ * Read the topology of the online CPUs from a sysfs tree.
+ * @param root the directory of the CPUs, TOPOLOGY_SYSFS_ROOT (or a copy of it, e.g. to test)
+ * @param topology set to the topology
+ * @return 0 on success, -1 with errno set if there is no telling (e.g. ENOENT, not Linux)
+ */
+int topologyRead(const char* root, CpuTopology* topology);
+
+/**
+ * Get the topology of the CPUs this process may run on (see sched_getaffinity).
+ * - read once, the first time
+ * @return the topology, NULL if there is no telling
+ */
+const CpuTopology* cpuTopology(void);
+
+/**
+ * Keep the calling thread on a CPU.
+ * @param cpu the CPU, see CpuInfo.cpu
+ * @return 0 on success, -1 with errno set (e.g. EINVAL if the process may not run on it)
+ */
+int topologyPinThread(const int cpu);
+
+#endif //BTCO_TOPOLOGY_H
@@ -0,0 +1,278 @@
+/*
+ * Verification of a whole stored chain, in parallel (see verify.h).
+ */
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <stdatomic.h>
+
+#include "sha-256.h"
+#include "blockchain.h"
+#include "chain-store.h"
+#include "merkle.h"
+#include "miner.h"
+#include "parallel.h"
+#include "payload.h"
+#include "verify.h"
+
+// blocks a thread takes at a time
+#define VERIFY_CHUNK 256
+
+// data up to this size is read with one pread, bigger data is memory-mapped by hashPayloadRange
+#define SMALL_PAYLOAD (64 << 10)
+
+// no invalid block found (yet)
+#define NO_FAULT UINT64_MAX
+
+typedef struct {
+    const ChainStore* store;
+    // the easiest target a block may have, if checkMinWork
+    uint8_t targetHash[HASH_LEN];
+    int checkMinWork;
+    int flags;
+    uint64_t chunks;
+    _Atomic uint64_t nextChunk;
+
+    // height << 8 | fault of the lowest invalid block found so far
+    _Atomic uint64_t firstFault;
+} VerifyRound;
+
+/**
+ * Report an invalid block, unless a lower one is already known.
+ */
+static void offerFault(VerifyRound* round, const uint64_t height, const ChainFault fault) {
+    const uint64_t found = height << 8 | (uint64_t)fault;
+    uint64_t first = atomic_load(&round->firstFault);
+    while (found < first && !atomic_compare_exchange_weak(&round->firstFault, &first, found))
+        ;
+}
+
+/**
+ * Check the proof of work of a block: its hash is below the target of its bits, which is no
+ * easier than the min one of the round.
+ * @return 1 if it is valid, 0 if not
+ */
+static int checkWork(const VerifyRound* round, const BlockHeader* header,
+                     const uint8_t hash[HASH_LEN]) {
+    uint8_t targetHash[HASH_LEN];
+    if (bitsToTarget(header->bits, targetHash) != 0)
+        return 0;
+    if (round->checkMinWork && memcmp(targetHash, round->targetHash, HASH_LEN) > 0)
+        return 0;
+    return memcmp(hash, targetHash, HASH_LEN) < 0;
+}
+
+/**
+ * Make room for size bytes in a thread's buffer.
+ * @return 0 on success, -1 if out of memory
+ */
+static int reserveBuffer(uint8_t** buf, size_t* capacity, const uint64_t size) {
+    if (size <= *capacity)
+        return 0;
+    if (size > SIZE_MAX) {
+        errno = ENOMEM;
+        return -1;
+    }
+    uint8_t* grown = realloc(*buf, (size_t)size);
+    if (!grown) {
+        errno = ENOMEM;
+        return -1;
+    }
+    *buf = grown;
+    *capacity = (size_t)size;
+    return 0;
+}
+
+static int preadAll(const int fd, uint8_t* buf, size_t size, uint64_t offset) {
+    while (size > 0) {
+        ssize_t n = pread(fd, buf, size, (off_t)offset);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0) {
+            if (n == 0)
+                errno = EIO;
+            return -1;
+        }
+        buf += n;
+        size -= (size_t)n;
+        offset += (uint64_t)n;
+    }
+    return 0;
+}
+
+/**
+ * Compute the Merkle root of framed transactions (see CHAIN_PAYLOAD_MERKLE).
+ * @return 0 on success, CHAIN_BAD_DATA if the frames are broken, CHAIN_IO_ERROR if out of memory
+ */
+static ChainFault merkleRootOfFrames(const uint8_t* frames, const uint64_t length,
+                                     uint8_t root[HASH_LEN], uint64_t* dataLength) {
+    // count the transactions first, to hash them all in one batch
+    size_t count = 0;
+    for (uint64_t pos = 0; pos < length; ++count) {
+        if (length - pos < 4)
+            return CHAIN_BAD_DATA;
+        const uint32_t size = frames[pos] | frames[pos + 1] << 8 | frames[pos + 2] << 16 |
+                (uint32_t)frames[pos + 3] << 24;
+        if (length - pos - 4 < size)
+            return CHAIN_BAD_DATA;
+        pos += 4 + (uint64_t)size;
+    }
+
+    const void** data = malloc(count * sizeof(*data) + 1);
+    size_t* lengths = malloc(count * sizeof(*lengths) + 1);
+    if (!data || !lengths) {
+        free(data);
+        free(lengths);
+        errno = ENOMEM;
+        return CHAIN_IO_ERROR;
+    }
+    uint64_t pos = 0;
+    for (size_t i = 0; i < count; ++i) {
+        lengths[i] = frames[pos] | frames[pos + 1] << 8 | frames[pos + 2] << 16 |
+                (uint32_t)frames[pos + 3] << 24;
+        data[i] = frames + pos + 4;
+        pos += 4 + lengths[i];
+    }
+
+    // the threads already have a chunk of blocks each
+    MerkleTree tree;
+    merkleInit(&tree);
+    ChainFault fault = CHAIN_VALID;
+    if (merkleAppendBatch(&tree, data, lengths, count, 1) != 0)
+        fault = CHAIN_IO_ERROR;
+    merkleRoot(&tree, root);
+    *dataLength = tree.dataLength;
+    merkleFree(&tree);
+    free(data);
+    free(lengths);
+    return fault;
+}
+
+/**
+ * Check the data of a block against its header.
+ * @param buf a buffer of the thread, grown as needed
+ * @return CHAIN_VALID, CHAIN_BAD_DATA or CHAIN_IO_ERROR
+ */
+static ChainFault checkPayload(const ChainStore* store, const uint64_t height,
+                               const BlockHeader* header, uint8_t** buf, size_t* capacity) {
+    int fd, kind;
+    uint64_t offset, length, dataLength;
+    uint8_t dataHash[HASH_LEN];
+    if (chainStorePayload(store, height, &fd, &offset, &length, &kind) != 0)
+        return CHAIN_IO_ERROR;
+
+    if (kind == CHAIN_PAYLOAD_MERKLE) {
+        if (reserveBuffer(buf, capacity, length) != 0 || preadAll(fd, *buf, length, offset) != 0)
+            return CHAIN_IO_ERROR;
+        const ChainFault fault = merkleRootOfFrames(*buf, length, dataHash, &dataLength);
+        if (fault != CHAIN_VALID)
+            return fault;
+    } else if (length <= SMALL_PAYLOAD) {
+        // a mapping per block would cost more than the copy
+        if (reserveBuffer(buf, capacity, SMALL_PAYLOAD) != 0 || preadAll(fd, *buf, length, offset) != 0)
+            return CHAIN_IO_ERROR;
+        calc_sha_256(dataHash, *buf, length);
+        dataLength = length;
+    } else {
+        if (hashPayloadRange(fd, offset, length, dataHash) != 0)
+            return CHAIN_IO_ERROR;
+        dataLength = length;
+    }
+
+    if (dataLength != header->dataLength || memcmp(dataHash, header->dataHash, HASH_LEN) != 0)
+        return CHAIN_BAD_DATA;
+    return CHAIN_VALID;
+}
+
+/**
+ * A verifying thread: take chunks of blocks until there are none left (below the first invalid
+ * block found).
+ */
+static void verifyChunks(void* ctx, size_t begin, size_t end) {
+    (void)begin;
+    (void)end;
+    VerifyRound* round = ctx;
+    const uint64_t count = chainStoreCount(round->store);
+    BlockHeader headers[VERIFY_CHUNK + 1];
+    uint8_t hashes[VERIFY_CHUNK + 1][HASH_LEN];
+    uint8_t storedHash[HASH_LEN];
+    uint8_t* buf = NULL;
+    size_t capacity = 0;
+
+    while (1) {
+        const uint64_t chunk = atomic_fetch_add(&round->nextChunk, 1);
+        const uint64_t first = chunk * VERIFY_CHUNK;
+        if (chunk >= round->chunks || first > atomic_load(&round->firstFault) >> 8)
+            break;
+        const size_t n = count - first < VERIFY_CHUNK ? (size_t)(count - first) : VERIFY_CHUNK;
+
+        // the headers of the chunk and the one before it, to check the first link, hashed together
+        const size_t before = first > 0;
+        for (size_t i = 0; i < n + before; ++i)
+            chainStoreGet(round->store, first - before + i, &headers[i], NULL);
+        hashHeaders(headers, n + before, hashes);
+
+        for (size_t i = before; i < n + before; ++i) {
+            const uint64_t height = first - before + i;
+            if (height > atomic_load(&round->firstFault) >> 8)
+                break;
+
+            static const uint8_t NO_HASH[HASH_LEN];
+            const uint8_t* prevHash = i > 0 ? hashes[i - 1] : NO_HASH;
+            ChainFault fault = CHAIN_VALID;
+            chainStoreGet(round->store, height, NULL, storedHash);
+            if (memcmp(storedHash, hashes[i], HASH_LEN) != 0)
+                fault = CHAIN_BAD_HASH;
+            else if (memcmp(headers[i].previousHeaderHash, prevHash, HASH_LEN) != 0)
+                fault = CHAIN_BAD_LINK;
+            else if (!checkWork(round, &headers[i], hashes[i]))
+                fault = CHAIN_BAD_WORK;
+            else if (round->flags & CHAIN_VERIFY_PAYLOADS)
+                fault = checkPayload(round->store, height, &headers[i], &buf, &capacity);
+
+            if (fault != CHAIN_VALID) {
+                offerFault(round, height, fault);
+                break;
+            }
+        }
+    }
+    free(buf);
+}
+
+int64_t chainVerify(const ChainStore* store, const int difficulty, const int flags,
+                    const int threads, ChainFault* fault) {
+    const uint64_t count = chainStoreCount(store);
+    VerifyRound round;
+    round.store = store;
+    round.checkMinWork = difficulty > 0;
+    makeTargetHash(difficulty, round.targetHash);
+    round.flags = flags;
+    round.chunks = (count + VERIFY_CHUNK - 1) / VERIFY_CHUNK;
+    atomic_init(&round.nextChunk, 0);
+    atomic_init(&round.firstFault, NO_FAULT);
+
+    // one share per thread, the threads then deal the chunks out among themselves
+    const int workers = minerThreadCount(threads);
+    parallelFor(round.chunks < (uint64_t)workers ? (size_t)round.chunks : (size_t)workers, 1,
+                workers, verifyChunks, &round);
+
+    const uint64_t firstFault = atomic_load(&round.firstFault);
+    if (fault)
+        *fault = firstFault == NO_FAULT ? CHAIN_VALID : (ChainFault)(firstFault & 0xff);
+    return firstFault == NO_FAULT ? -1 : (int64_t)(firstFault >> 8);
+}
+
+const char* chainFaultName(const ChainFault fault) {
+    switch (fault) {
+        case CHAIN_VALID: return "valid";
+        case CHAIN_BAD_HASH: return "stored hash does not match the header";
+        case CHAIN_BAD_LINK: return "previous header hash does not match";
+        case CHAIN_BAD_WORK: return "hash not below the target, or target too easy";
+        case CHAIN_BAD_DATA: return "data does not match the header";
+        case CHAIN_IO_ERROR: return "data could not be read";
+    }
+    return "unknown";
+}
@@ -0,0 +1,46 @@
+#ifndef BTCO_VERIFY_H
+#define BTCO_VERIFY_H
+
+#include <stdint.h>
+
+#include "chain-store.h"
+
+// flags of chainVerify
+#define CHAIN_VERIFY_PAYLOADS 1 // also hash the data of every block against its dataHash (slower)
+
+/**
+ * What is wrong with the first invalid block of a chain.
+ */
+typedef enum {
+    CHAIN_VALID = 0,
+    CHAIN_BAD_HASH, // the stored hash is not the hash of the stored header, i.e., corrupt storage
+    CHAIN_BAD_LINK, // previousHeaderHash is not the hash of the previous header
+    CHAIN_BAD_WORK, // the hash is not below the target of the bits, or that is below the difficulty
+    CHAIN_BAD_DATA, // the data does not hash to dataHash, or does not have dataLength bytes
+    CHAIN_IO_ERROR  // the data could not be read (errno set)
+} ChainFault;
+
+/**
+ * Check a whole stored chain: the hash and link of every header, its proof of work and (optionally)
+ * its data.
+ * - the blocks are checked independently in chunks, spread over the threads; the headers of a
+ *   chunk are hashed together on the multi-lane SHA256 kernel
+ * - the threads stop at the first invalid block found, but for the chunks below it, so that the
+ *   reported block is the lowest invalid one whatever the number of threads
+ * @param store the chain
+ * @param difficulty min difficulty 1..10 of every block, 0 for any (every block is checked against
+ *                   the target of its own bits either way, see BlockHeader.bits)
+ * @param flags CHAIN_VERIFY_* flags, or 0 to check the headers only
+ * @param threads number of threads, MINER_AUTO_THREADS for one per core
+ * @param fault set to what is wrong with the first invalid block, may be NULL
+ * @return the height of the first invalid block, -1 if the whole chain is valid
+ */
+int64_t chainVerify(const ChainStore* store, const int difficulty, const int flags,
+                    const int threads, ChainFault* fault);
+
+/**
+ * Describe a fault, e.g. for error messages.
+ */
+const char* chainFaultName(const ChainFault fault);
+
+#endif //BTCO_VERIFY_H
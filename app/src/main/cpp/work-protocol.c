@@ -0,0 +1,203 @@
+/*
+ * The messages between a coordinator and its workers, and their sockets (see work-protocol.h).
+ */
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <netdb.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+
+#include "blockchain.h"
+#include "work-protocol.h"
+
+#define UNIX_PREFIX "unix:"
+
+// the connections a coordinator lets wait to be accepted
+#define LISTEN_BACKLOG 16
+
+// the message: magic, type, jobId, header, begin, count, 4 bytes left 0
+#define MSG_MAGIC 0
+#define MSG_TYPE 4
+#define MSG_JOB_ID 8
+#define MSG_HEADER 12
+#define MSG_BEGIN (MSG_HEADER + HEADER_SIZE)
+#define MSG_COUNT (MSG_BEGIN + 4)
+_Static_assert(MSG_COUNT + 8 == WORK_MESSAGE_SIZE, "the message layout must fill the message");
+
+static void storeLe32(uint8_t* p, uint32_t v) {
+    for (int i = 0; i < 4; ++i)
+        p[i] = (uint8_t)(v >> (8 * i));
+}
+
+static uint32_t loadLe32(const uint8_t* p) {
+    uint32_t v = 0;
+    for (int i = 3; i >= 0; --i)
+        v = v << 8 | p[i];
+    return v;
+}
+
+void workEncode(const WorkMessage* message, uint8_t bytes[WORK_MESSAGE_SIZE]) {
+    memset(bytes, 0, WORK_MESSAGE_SIZE);
+    memcpy(bytes + MSG_MAGIC, WORK_MAGIC, 4);
+    storeLe32(bytes + MSG_TYPE, message->type);
+    storeLe32(bytes + MSG_JOB_ID, message->jobId);
+    serializeHeader(&message->header, bytes + MSG_HEADER);
+    storeLe32(bytes + MSG_BEGIN, message->begin);
+    storeLe32(bytes + MSG_COUNT, message->count);
+}
+
+int workDecode(const uint8_t bytes[WORK_MESSAGE_SIZE], WorkMessage* message) {
+    if (memcmp(bytes + MSG_MAGIC, WORK_MAGIC, 4) != 0) {
+        errno = EPROTO;
+        return -1;
+    }
+    message->type = loadLe32(bytes + MSG_TYPE);
+    message->jobId = loadLe32(bytes + MSG_JOB_ID);
+    deserializeHeader(bytes + MSG_HEADER, &message->header);
+    message->begin = loadLe32(bytes + MSG_BEGIN);
+    message->count = loadLe32(bytes + MSG_COUNT);
+    return 0;
+}
+
+int workSend(const int fd, const WorkMessage* message) {
+    uint8_t bytes[WORK_MESSAGE_SIZE];
+    workEncode(message, bytes);
+    size_t sent = 0;
+    while (sent < WORK_MESSAGE_SIZE) {
+        const ssize_t n = send(fd, bytes + sent, WORK_MESSAGE_SIZE - sent, MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n < 0)
+            return -1;
+        sent += (size_t)n;
+    }
+    return 0;
+}
+
+int workReceive(const int fd, WorkMessage* message) {
+    uint8_t bytes[WORK_MESSAGE_SIZE];
+    size_t got = 0;
+    while (got < WORK_MESSAGE_SIZE) {
+        const ssize_t n = recv(fd, bytes + got, WORK_MESSAGE_SIZE - got, 0);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n < 0)
+            return -1;
+        if (n == 0) {
+            errno = ECONNRESET;
+            return -1;
+        }
+        got += (size_t)n;
+    }
+    return workDecode(bytes, message);
+}
+
+/**
+ * Open a Unix socket at a path.
+ */
+static int openUnixSocket(const char* path, const int mode) {
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (!*path || strlen(path) >= sizeof(addr.sun_path)) {
+        errno = EINVAL;
+        return -1;
+    }
+    strcpy(addr.sun_path, path);
+
+    const int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0)
+        return -1;
+    int rc;
+    if (mode == WORK_LISTEN) {
+        // a socket file left by a coordinator that is gone would be in the way
+        unlink(path);
+        rc = bind(fd, (const struct sockaddr*)&addr, sizeof(addr));
+        if (rc == 0)
+            rc = listen(fd, LISTEN_BACKLOG);
+    } else {
+        rc = connect(fd, (const struct sockaddr*)&addr, sizeof(addr));
+    }
+    if (rc != 0) {
+        const int err = errno;
+        close(fd);
+        errno = err;
+        return -1;
+    }
+    return fd;
+}
+
+/**
+ * Open a TCP socket at a host and port.
+ */
+static int openTcpSocket(const char* address, const int mode) {
+    const char* colon = strrchr(address, ':');
+    if (!colon || !colon[1]) {
+        errno = EINVAL;
+        return -1;
+    }
+    char host[256];
+    const size_t hostLen = (size_t)(colon - address);
+    if (hostLen >= sizeof(host)) {
+        errno = EINVAL;
+        return -1;
+    }
+    memcpy(host, address, hostLen);
+    host[hostLen] = '\0';
+
+    struct addrinfo hints;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_flags = mode == WORK_LISTEN ? AI_PASSIVE : 0;
+    struct addrinfo* infos;
+    if (getaddrinfo(hostLen ? host : NULL, colon + 1, &hints, &infos) != 0) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    // the first address of the host that works
+    int fd = -1;
+    int err = EADDRNOTAVAIL;
+    for (const struct addrinfo* info = infos; info && fd < 0; info = info->ai_next) {
+        fd = socket(info->ai_family, info->ai_socktype | SOCK_CLOEXEC, info->ai_protocol);
+        if (fd < 0) {
+            err = errno;
+            continue;
+        }
+        const int on = 1;
+        int rc;
+        if (mode == WORK_LISTEN) {
+            setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+            rc = bind(fd, info->ai_addr, info->ai_addrlen);
+            if (rc == 0)
+                rc = listen(fd, LISTEN_BACKLOG);
+        } else {
+            rc = connect(fd, info->ai_addr, info->ai_addrlen);
+        }
+        if (rc != 0) {
+            err = errno;
+            close(fd);
+            fd = -1;
+            continue;
+        }
+        // the messages are small and each one waited for, they'd better not wait to be sent
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+    }
+    freeaddrinfo(infos);
+    if (fd < 0)
+        errno = err;
+    return fd;
+}
+
+int workOpenSocket(const char* address, const int mode) {
+    if (strncmp(address, UNIX_PREFIX, strlen(UNIX_PREFIX)) == 0)
+        return openUnixSocket(address + strlen(UNIX_PREFIX), mode);
+    return openTcpSocket(address, mode);
+}
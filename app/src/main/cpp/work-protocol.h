@@ -0,0 +1,78 @@
+#ifndef BTCO_WORK_PROTOCOL_H
+#define BTCO_WORK_PROTOCOL_H
+
+#include <stdint.h>
+
+#include "blockchain.h"
+
+// the first bytes of every message, the version of the protocol in the last one
+#define WORK_MAGIC "BTW1"
+
+// the size of every message on the wire
+#define WORK_MESSAGE_SIZE (16 + HEADER_SIZE + 8)
+
+// what a message is
+#define WORK_MSG_REQUEST 1  // worker: done with its unit (if any), give it another
+#define WORK_MSG_WORK 2     // coordinator: a unit of work, i.e., a header and a range of its nonces
+#define WORK_MSG_SOLUTION 3 // worker: a valid header of the unit, and done with it
+#define WORK_MSG_STALE 4    // coordinator: the block of the job is mined (or given up), drop it
+#define WORK_MSG_BYE 5      // coordinator: there is no more work, disconnect
+
+// how to open the socket of an address
+#define WORK_LISTEN 0  // bind and listen to it, for a coordinator
+#define WORK_CONNECT 1 // connect to it, for a worker
+
+/**
+ * A message between a coordinator and a worker (see coordinator.h, worker.h).
+ * - every message is the same size, little-endian whatever the platform like the header:
+ *   the magic, type, jobId, the serialized header, begin, count, then 4 bytes left 0
+ * - a job is the mining of a block, its id changes with every block so that the messages of a
+ *   block that is mined already are told apart
+ */
+typedef struct {
+    uint32_t type;
+
+    uint32_t jobId;
+
+    // WORK: the header to mine at its timestamp, bits included, SOLUTION: the mined header
+    BlockHeader header;
+
+    // the nonces of the unit, from begin to begin + count (REQUEST, SOLUTION: those searched)
+    uint32_t begin;
+    uint32_t count;
+} WorkMessage;
+
+/**
+ * Open a socket of a coordinator or a worker.
+ * @param address "unix:<path>" for a Unix socket, "<host>:<port>" for TCP, e.g. "127.0.0.1:8333"
+ * @param mode WORK_LISTEN or WORK_CONNECT
+ * @return the socket, -1 on error with errno set (EINVAL if the address is not one)
+ */
+int workOpenSocket(const char* address, const int mode);
+
+/**
+ * Serialize a message for the wire.
+ */
+void workEncode(const WorkMessage* message, uint8_t bytes[WORK_MESSAGE_SIZE]);
+
+/**
+ * Deserialize a message from the wire.
+ * @return 0 on success, -1 with errno EPROTO if it is not a message
+ */
+int workDecode(const uint8_t bytes[WORK_MESSAGE_SIZE], WorkMessage* message);
+
+/**
+ * Send a message whole on a (blocking) socket.
+ * - a peer gone is an error (EPIPE), never a SIGPIPE
+ * @return 0 on success, -1 on error with errno set
+ */
+int workSend(const int fd, const WorkMessage* message);
+
+/**
+ * Receive a whole message from a (blocking) socket.
+ * @return 0 on success, -1 on error with errno set (ECONNRESET if the peer is gone, EPROTO if
+ *         what came is not a message)
+ */
+int workReceive(const int fd, WorkMessage* message);
+
+#endif //BTCO_WORK_PROTOCOL_H
@@ -0,0 +1,162 @@
+/*
+ * Mining the work of a coordinator (see worker.h).
+ */
+
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <poll.h>
+#include <unistd.h>
+
+#include "blockchain.h"
+#include "miner.h"
+#include "work-protocol.h"
+#include "worker.h"
+
+/**
+ * A worker mining a unit, given to the progress callback of the mining.
+ */
+typedef struct {
+    int fd;
+    uint32_t jobId;
+
+    // the control of the unit, and the one of the whole run (may be NULL) to forward a cancel from
+    MiningControl unitControl;
+    MiningControl* control;
+
+    // a message that came in while mining, to act on once the mining is stopped
+    int received;
+    int receiveError; // errno of the connection if it broke, 0 if not
+    WorkMessage message;
+} UnitRun;
+
+/**
+ * Stop mining the unit when the coordinator says to (the unit is stale, or it is done), or the
+ * whole run is cancelled.
+ */
+static void onUnitProgress(void* ctx, uint64_t noncesTried) {
+    (void)noncesTried;
+    UnitRun* run = ctx;
+    if (run->control && atomic_load(&run->control->cancelled)) {
+        miningCancel(&run->unitControl);
+        return;
+    }
+    struct pollfd pfd = { run->fd, POLLIN, 0 };
+    if (run->received || poll(&pfd, 1, 0) <= 0)
+        return;
+    if (workReceive(run->fd, &run->message) != 0)
+        run->receiveError = errno;
+    else if (run->message.type == WORK_MSG_STALE && run->message.jobId != run->jobId)
+        return; // about a unit done with already
+    else
+        run->received = 1;
+    miningCancel(&run->unitControl);
+}
+
+/**
+ * Mine a unit of work and tell the coordinator how it went.
+ * @return 0 to go on with the next message, -1 on error with errno set
+ */
+static int mineUnit(UnitRun* run, const WorkMessage* work, const int threads, uint64_t* solutions) {
+    WorkMessage reply;
+    memset(&reply, 0, sizeof(reply));
+    reply.type = WORK_MSG_REQUEST;
+    reply.jobId = work->jobId;
+    reply.header = work->header;
+    reply.begin = work->begin;
+
+    uint8_t targetHash[HASH_LEN];
+    if (bitsToTarget(work->header.bits, targetHash) == 0) {
+        miningControlInit(&run->unitControl, onUnitProgress, run, WORKER_POLL_MS);
+        if (run->control)
+            run->unitControl.priority = run->control->priority;
+        run->jobId = work->jobId;
+        run->received = 0;
+        run->receiveError = 0;
+        const int rc = mineNonceRange(&reply.header, targetHash, work->begin,
+                                      (uint64_t)work->begin + work->count, threads, NULL,
+                                      &run->unitControl);
+        const uint64_t tried = atomic_load(&run->unitControl.noncesTried);
+        if (run->control)
+            atomic_fetch_add_explicit(&run->control->noncesTried, tried, memory_order_relaxed);
+        if (rc == 0) {
+            reply.type = WORK_MSG_SOLUTION;
+            if (solutions)
+                ++*solutions;
+        }
+        reply.count = tried < work->count ? (uint32_t)tried : work->count;
+    }
+    // NOTE a header the coordinator can't read the target of is just done with, there is no
+    //      error message to send it
+    if (run->receiveError) {
+        errno = run->receiveError;
+        return -1;
+    }
+    if (run->control && atomic_load(&run->control->cancelled)) {
+        errno = ECANCELED;
+        return -1;
+    }
+    // a coordinator that is done is not listening any more
+    if (run->received && run->message.type == WORK_MSG_BYE)
+        return 0;
+    if (workSend(run->fd, &reply) == 0)
+        return 0;
+    // nor may one that ended the job, if it closed before the reply came: as good as a BYE
+    if (run->received && run->message.type == WORK_MSG_STALE &&
+        (errno == EPIPE || errno == ECONNRESET)) {
+        run->message.type = WORK_MSG_BYE;
+        return 0;
+    }
+    return -1;
+}
+
+int workerRun(const char* address, const int threads, MiningControl* control, uint64_t* solutions) {
+    if (solutions)
+        *solutions = 0;
+    UnitRun run;
+    memset(&run, 0, sizeof(run));
+    run.control = control;
+    run.fd = workOpenSocket(address, WORK_CONNECT);
+    if (run.fd < 0)
+        return -1;
+
+    WorkMessage request;
+    memset(&request, 0, sizeof(request));
+    request.type = WORK_MSG_REQUEST;
+    int rc = workSend(run.fd, &request);
+    while (rc == 0) {
+        // what came while mining the last unit first, e.g. the stale unit that stopped it
+        WorkMessage message;
+        if (run.received) {
+            message = run.message;
+            run.received = 0;
+        } else {
+            // waiting for work is cancellable too, the coordinator may have none for a while
+            struct pollfd pfd = { run.fd, POLLIN, 0 };
+            const int ready = poll(&pfd, 1, WORKER_POLL_MS);
+            if (control && atomic_load(&control->cancelled)) {
+                errno = ECANCELED;
+                rc = -1;
+                break;
+            }
+            if (ready < 0 && errno != EINTR) {
+                rc = -1;
+                break;
+            }
+            if (ready <= 0)
+                continue;
+            if (workReceive(run.fd, &message) != 0) {
+                rc = -1;
+                break;
+            }
+        }
+
+        if (message.type == WORK_MSG_BYE)
+            break;
+        if (message.type == WORK_MSG_WORK)
+            rc = mineUnit(&run, &message, threads, solutions);
+        // a stale unit that is not being mined any more, it was done with already
+    }
+    close(run.fd);
+    return rc;
+}
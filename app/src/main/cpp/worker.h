@@ -0,0 +1,26 @@
+#ifndef BTCO_WORKER_H
+#define BTCO_WORKER_H
+
+#include <stdint.h>
+
+#include "miner.h"
+
+// how often a worker looks for a word of its coordinator while mining a unit
+#define WORKER_POLL_MS 50
+
+/**
+ * Mine the units of work of a coordinator (see coordinator.h) until it says there is no more.
+ * - each unit is a range of nonces of a header, searched with mineNonceRange on the calling thread
+ *   or the shared pool, and the lowest valid nonce of it, if any, sent back
+ * - a unit the coordinator says is stale (its block is mined) is dropped at once
+ * @param address of the coordinator, "unix:<path>" or "<host>:<port>", see workOpenSocket
+ * @param threads 1 to mine on the calling thread only, anything else to mine on the shared pool
+ * @param control to stop working and follow the progress (the nonces searched), may be NULL
+ * @param solutions set to the number of valid headers sent, may be NULL; some may have come too
+ *        late, once the block was found by another worker
+ * @return 0 once the coordinator is done, -1 on error with errno set (ECANCELED if cancelled,
+ *         ECONNRESET if the coordinator went away without a word)
+ */
+int workerRun(const char* address, const int threads, MiningControl* control, uint64_t* solutions);
+
+#endif //BTCO_WORKER_H
@@ -4,6 +4,10 @@ import android.os.Bundle
 import androidx.appcompat.app.AppCompatActivity
 import edu.singaporetech.btco.databinding.ActivityLayoutBinding
 import kotlinx.coroutines.*
+import kotlinx.coroutines.sync.Mutex
+import kotlinx.coroutines.sync.withLock
+import java.io.File
+import java.nio.ByteBuffer
 
 class BTCOActivity : AppCompatActivity(), CoroutineScope by MainScope() {
     private lateinit var binding:ActivityLayoutBinding
@@ -11,9 +15,49 @@ class BTCOActivity : AppCompatActivity(), CoroutineScope by MainScope() {
     private lateinit var blocks: String
     private lateinit var message: String
 
+    // the native chain the blocks are mined into, kept across button presses
+    // NOTE it must only be used by one coroutine at a time, hence the mutex
+    private var chain = 0L
+    private val chainMutex = Mutex()
+
+    /**
+     * Progress of a native mining job, called back on the mining thread.
+     */
+    fun interface MiningListener {
+        fun onProgress(noncesTried: Long, hashrate: Double, blocksDone: Int)
+    }
+
+    // shows the progress of mining in the log, the callbacks are already throttled natively
+    private val progressListener = MiningListener { noncesTried, hashrate, blocksDone ->
+        runOnUiThread {
+            binding.logTextView.text = getString(R.string.mining_progress, blocksDone,
+                                                 noncesTried, hashrate / 1e6)
+        }
+    }
+
     private external fun logDifficultyMsgNative(difficulty: Int, message: String)
-    private external fun mineGenesisBlockNative(difficulty: Int): String
-    private external fun mineBlocksNative(blocks: Int, difficulty: Int, message: String): String
+    private external fun chainCreateNative(): Long
+    private external fun chainDestroyNative(chain: Long)
+    private external fun chainRetargetNative(chain: Long, intervalSec: Int)
+    private external fun chainLengthNative(chain: Long): Int
+    private external fun chainBlockHashNative(chain: Long, height: Int): String?
+    private external fun chainExportNative(chain: Long, path: String): Boolean
+    private external fun mineJobCreateNative(listener: MiningListener?, priority: Int): Long
+    private external fun mineJobCancelNative(job: Long)
+    private external fun mineJobDestroyNative(job: Long)
+    private external fun mineJobCheckpointNative(job: Long, path: String?, intervalMs: Int): Boolean
+    private external fun mineGenesisBlockNative(chain: Long, job: Long, difficulty: Int,
+                                                threads: Int): String?
+    private external fun mineBlocksNative(chain: Long, job: Long, blocks: Int, difficulty: Int,
+                                          message: String, threads: Int): String?
+    // binary payloads, hashed in place: direct ByteBuffers, the bytes from position to limit
+    external fun mineBufferNative(chain: Long, job: Long, payload: ByteBuffer,
+                                  difficulty: Int, threads: Int): String?
+    external fun mineBuffersNative(chain: Long, job: Long, payloads: Array<ByteBuffer>,
+                                   difficulty: Int, threads: Int): String?
+    private external fun metricsSnapshotNative(): LongArray?
+    private external fun calibrateNative(threads: Int): Double
+    private external fun estimateNative(difficulty: Int, blocks: Int, threads: Int): DoubleArray?
 
 
     /**
@@ -25,6 +69,13 @@ class BTCOActivity : AppCompatActivity(), CoroutineScope by MainScope() {
         super.onCreate(savedInstanceState)
         binding = ActivityLayoutBinding.inflate(layoutInflater)
         setContentView(binding.root)
+        chain = chainCreateNative()
+        chainRetargetNative(chain, BLOCK_INTERVAL_S)
+
+        // measure the hashrate once, while nothing mines, for the estimates of the jobs
+        launch(Dispatchers.Default) {
+            chainMutex.withLock { calibrateNative(MINING_THREADS) }
+        }
 
         binding.genesisButton.setOnClickListener {
             getInputs()
@@ -37,6 +88,85 @@ class BTCOActivity : AppCompatActivity(), CoroutineScope by MainScope() {
         }
     }
 
+    /**
+     * Free the native chain, once whatever is mining into it is done.
+     */
+    override fun onDestroy() {
+        super.onDestroy()
+        cancel()
+        val oldChain = chain
+        CoroutineScope(Dispatchers.Default).launch {
+            chainMutex.withLock { chainDestroyNative(oldChain) }
+        }
+    }
+
+    /**
+     * Run a native mining function on a background thread, as a job that is cancelled (natively)
+     * when the calling coroutine is, e.g. when leaving the activity.
+     * @param checkpoint where the job checkpoints its mining, null not to
+     * @param mine the native mining call, given the handle of the job
+     * @return whatever mine returns
+     */
+    private suspend fun <T> mineCancellable(checkpoint: File? = null,
+                                            mine: (job: Long) -> T): T = coroutineScope {
+        val job = mineJobCreateNative(progressListener, MINING_PRIORITY)
+        if (checkpoint != null)
+            mineJobCheckpointNative(job, checkpoint.path, CHECKPOINT_INTERVAL_MS)
+
+        // the native code can't see coroutine cancellation, this tells it
+        val canceller = launch {
+            try {
+                awaitCancellation()
+            } finally {
+                mineJobCancelNative(job)
+            }
+        }
+        try {
+            withContext(Dispatchers.Default) {
+                chainMutex.withLock { mine(job) }
+            }
+        } finally {
+            withContext(NonCancellable) { canceller.cancelAndJoin() }
+            mineJobDestroyNative(job)
+        }
+    }
+
+    /**
+     * Describe the mining done between 2 snapshots of the native metrics.
+     * @param before snapshot taken before mining
+     * @param after snapshot taken after mining
+     * @return hashes, hashrate and rollovers, empty if a snapshot is missing
+     */
+    private fun miningStats(before: LongArray?, after: LongArray?): String {
+        if (before == null || after == null) return ""
+        val hashes = after[STAT_HASHES] - before[STAT_HASHES]
+        val miningNs = after[STAT_MINING_NS] - before[STAT_MINING_NS]
+        val hashrate = if (miningNs > 0) hashes * 1e9 / miningNs else 0.0
+        return getString(R.string.mining_stats, hashes, hashrate / 1e6,
+                         after[STAT_ROLLOVERS] - before[STAT_ROLLOVERS])
+    }
+
+    /**
+     * Estimate how long mining some blocks takes, and turn the job down if it is over budget.
+     * @param blocks number of blocks to mine
+     * @return true to mine them (the estimate is shown), false if they would take too long
+     */
+    private suspend fun withinBudget(blocks: Int): Boolean {
+        val estimate = withContext(Dispatchers.Default) {
+            chainMutex.withLock { estimateNative(difficulty.toInt(), blocks, MINING_THREADS) }
+        } ?: return true
+        val p95 = estimate[ESTIMATE_P95_SEC]
+        if (p95 > MINING_BUDGET_S) {
+            binding.logTextView.text = getString(R.string.mining_over_budget, p95,
+                                                 MINING_BUDGET_S)
+            return false
+        }
+        binding.logTextView.text = getString(R.string.mining_estimate,
+                                             estimate[ESTIMATE_EXPECTED_SEC], p95,
+                                             estimate[ESTIMATE_HASHRATE] / 1e6)
+        return true
+    }
+
     /**
      * 1. Check if inputs are valid
      * 2. start timer
@@ -48,17 +178,19 @@ class BTCOActivity : AppCompatActivity(), CoroutineScope by MainScope() {
         if(!isValid(GENESIS)) return
 
         launch {
+            if (!withinBudget(1)) return@launch
+            val stats = metricsSnapshotNative()
             val start = System.currentTimeMillis()
 
-            var hash: String
-            withContext(Dispatchers.Default) {
-                hash = mineGenesisBlockNative(difficulty.toInt())
+            val hash = mineCancellable { job ->
+                mineGenesisBlockNative(chain, job, difficulty.toInt(), MINING_THREADS)
             }
 
             val time = System.currentTimeMillis() - start
 
             binding.dataHashTextView.text = hash
             binding.logTextView.text = getString(R.string.time_taken_to_mine, time.toString())
+            binding.logTextView.append("\n" + miningStats(stats, metricsSnapshotNative()))
         }
     }
 
@@ -75,17 +207,21 @@ class BTCOActivity : AppCompatActivity(), CoroutineScope by MainScope() {
         logDifficultyMsgNative(difficulty.toInt(), message)
 
         launch {
+            if (!withinBudget(blocks.toInt())) return@launch
+            val stats = metricsSnapshotNative()
             val start = System.currentTimeMillis()
 
-            var hash: String
-            withContext(Dispatchers.Default) {
-                hash = mineBlocksNative(blocks.toInt(), difficulty.toInt(), message)
+            // a job left unfinished (app killed, activity left) is gone on with from its checkpoint
+            val hash = mineCancellable(File(filesDir, CHECKPOINT_FILE)) { job ->
+                mineBlocksNative(chain, job, blocks.toInt(), difficulty.toInt(), message,
+                                 MINING_THREADS)
             }
 
             val time = System.currentTimeMillis() - start
 
             binding.dataHashTextView.text = hash
             binding.logTextView.text = getString(R.string.time_taken_to_mine, time.toString())
+            binding.logTextView.append("\n" + miningStats(stats, metricsSnapshotNative()))
         }
     }
 
@@ -168,6 +304,33 @@ class BTCOActivity : AppCompatActivity(), CoroutineScope by MainScope() {
         private const val GENESIS = "Genesis"
         private const val CHAIN = "Chain"
 
+        // number of native mining threads, 0 = the shared pool of one thread per core
+        private const val MINING_THREADS = 0
+
+        // seconds aimed at between 2 blocks of the chain, the difficulty entered being the one of
+        // the genesis block only, 0 = every block at the difficulty entered
+        private const val BLOCK_INTERVAL_S = 0
+
+        // indexes of the counters in metricsSnapshotNative, see STAT_* in btco.c
+        private const val STAT_HASHES = 0
+        private const val STAT_ROLLOVERS = 4
+        private const val STAT_MINING_NS = 8
+
+        // indexes in estimateNative, see ESTIMATE_* in btco.c
+        private const val ESTIMATE_HASHRATE = 1
+        private const val ESTIMATE_EXPECTED_SEC = 2
+        private const val ESTIMATE_P95_SEC = 3
+
+        // the longest a job may take (95% of the time), longer ones are turned down before mining
+        private const val MINING_BUDGET_S = 600
+
+        // priority of mining on the shared native pool, 0 = low, 1 = normal, 2 = high
+        private const val MINING_PRIORITY = 1
+
+        // where mining the chain is checkpointed, and how often, see mineJobCheckpointNative
+        private const val CHECKPOINT_FILE = "mining.ckp"
+        private const val CHECKPOINT_INTERVAL_MS = 10_000
+
         init {
             System.loadLibrary("btco")
         }